@@ -34,7 +34,7 @@ $(HLL_TSTBUILD)/%.o: $(HLL_TSTDIR)/%.cpp
 .PHONY: hll_test hll_clean
 hll_test: $(COM_TSTOBJS) $(HLL_OBJECTS) $(HLL_TSTOBJS)
 	@echo "Linking $(HLL_TARGET)..."
-	@$(CC) $^ -o $(HLL_TARGET) $(LIB)
+	@$(CC) $^ -o $(HLL_TARGET) $(LIB) -pthread
 
 hll_exec: hll_test
 	cd hll; ./$(HLL_TEST_BIN)
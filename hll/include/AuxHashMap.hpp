@@ -7,20 +7,40 @@
 
 #include "IntArrayPairIterator.hpp"
 
+#include <atomic>
 #include <memory>
+#include <memory_resource>
 
 namespace datasketches {
 
 class AuxHashMap {
   public:
-    explicit AuxHashMap(int lgAuxArrInts, int lgConfigK);
-    explicit AuxHashMap(AuxHashMap& that);
+    // Maps are created with new (resource) and freed with a plain delete,
+    // like HllSketchImpl. The table comes from the same resource.
+    explicit AuxHashMap(int lgAuxArrInts, int lgConfigK,
+                        std::pmr::memory_resource* resource = std::pmr::get_default_resource());
+    explicit AuxHashMap(AuxHashMap& that, std::pmr::memory_resource* resource);
     static AuxHashMap* deserialize(std::istream& is, const int lgConfigK,
                                    const int auxCount, const int lgAuxArrInts,
-                                   const bool srcCompact);
+                                   const bool srcCompact, std::pmr::memory_resource* resource);
+    static AuxHashMap* deserialize(const void* bytes, const int lgConfigK,
+                                   const int auxCount, const int lgAuxArrInts,
+                                   const bool srcCompact, std::pmr::memory_resource* resource);
     virtual ~AuxHashMap();
 
+    static void* operator new(size_t size, std::pmr::memory_resource* resource);
+    static void operator delete(void* ptr);
+    static void operator delete(void* ptr, std::pmr::memory_resource* resource);
+
     AuxHashMap* copy();
+
+    // Copy-on-write sharing between Hll4Array copies. share() returns this
+    // map with one more owner, or a private copy if wrapped or the copy
+    // lives in another resource; owners call release() instead of delete
+    // and unshare() before changing the map.
+    AuxHashMap* share(std::pmr::memory_resource* resource);
+    static void release(AuxHashMap* auxHashMap);
+    static AuxHashMap* unshare(AuxHashMap* auxHashMap);
     int getUpdatableSizeBytes();
     int getCompactSizeBytes();
 
@@ -28,14 +48,24 @@ class AuxHashMap {
     int* getAuxIntArr();
     int getLgAuxArrInts();
     std::unique_ptr<PairIterator> getIterator();
+    // the same over the table in place, without allocating
+    IntArrayPairIterator getPairs() const;
+
+    // moves the table to mem, see HllSketchImpl::wrapMemory()
+    void wrapMemory(int* mem);
+    bool isWrapped() const;
 
     void mustAdd(const int slotNo, const int value);
     int mustFindValueFor(const int slotNo);
     void mustReplace(const int slotNo, const int value);
 
   private:
+    // index of slotNo's entry, or -1 if absent; never needs an empty entry
+    int findExisting(const int slotNo) const;
     // static so it can be used when resizing
     static int find(const int* auxArr, const int lgAuxArrInts, const int lgConfigK, const int slotNo);
+    // table size to rebuild a compact image into
+    static int compactLgArrInts(const int lgConfigK, const int auxCount);
 
     void checkGrow();
     void growAuxSpace();
@@ -44,6 +74,9 @@ class AuxHashMap {
     int lgAuxArrInts;
     int auxCount;
     int* auxIntArr;
+    bool ownsArray; // false once wrapped into caller memory
+    std::atomic<int> refCount;
+    std::pmr::memory_resource* resource;
 };
 
 }
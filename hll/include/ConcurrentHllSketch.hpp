@@ -0,0 +1,81 @@
+/*
+ * Copyright 2018, Yahoo! Inc. Licensed under the terms of the
+ * Apache License 2.0. See LICENSE file at the project root for terms.
+ */
+
+#ifndef _CONCURRENTHLLSKETCH_HPP_
+#define _CONCURRENTHLLSKETCH_HPP_
+
+#include "hll.hpp"
+#include "HllUtil.hpp"
+
+#include <atomic>
+
+namespace datasketches {
+
+// Contains the non-public API for ConcurrentHllSketch
+class ConcurrentHllSketchPvt final : public ConcurrentHllSketch {
+  public:
+    explicit ConcurrentHllSketchPvt(const int lgConfigK);
+    virtual ~ConcurrentHllSketchPvt();
+
+    virtual void update(const std::string datum);
+    virtual void update(const uint64_t datum);
+    virtual void update(const uint32_t datum);
+    virtual void update(const uint16_t datum);
+    virtual void update(const uint8_t datum);
+    virtual void update(const int64_t datum);
+    virtual void update(const int32_t datum);
+    virtual void update(const int16_t datum);
+    virtual void update(const int8_t datum);
+    virtual void update(const double datum);
+    virtual void update(const float datum);
+    virtual void update(const void* data, const size_t lengthBytes);
+    virtual void updateBatch(const uint64_t* data, const size_t n);
+    virtual void update(const HashState& hash);
+    virtual void couponUpdate(const int coupon);
+    virtual void couponUpdate(const int* coupons, const size_t n);
+
+    virtual double getEstimate() const;
+    virtual double getLowerBound(const int numStdDev) const;
+    virtual double getUpperBound(const int numStdDev) const;
+
+    virtual int getLgConfigK() const;
+    virtual bool isEmpty() const;
+
+    virtual HllSketch* getResult(const TgtHllType tgtHllType = HLL_8) const;
+
+    virtual void reset();
+
+  private:
+    // raises a register to the coupon value unless it already holds more
+    void internalCouponUpdate(const int coupon);
+    void hashUpdate(const void* data, const size_t lengthBytes);
+    // copies the registers to dst (may be null) and counts each value
+    void snapshot(uint8_t* dst, int* counts) const;
+    double getCompositeEstimate(const int* counts) const;
+
+    const int lgConfigK;
+    std::atomic<uint8_t>* regs;
+};
+
+inline void ConcurrentHllSketchPvt::internalCouponUpdate(const int coupon) {
+  const int slotNo = HllUtil::getLow26(coupon) & ((1 << lgConfigK) - 1);
+  const uint8_t newVal = (uint8_t) HllUtil::getValue(coupon);
+  std::atomic<uint8_t>& reg = regs[slotNo];
+  // relaxed is enough: each register only ever grows, and readers accept
+  // any mix of old and new values
+  uint8_t curVal = reg.load(std::memory_order_relaxed);
+  while (newVal > curVal
+         && !reg.compare_exchange_weak(curVal, newVal, std::memory_order_relaxed)) {}
+}
+
+inline void ConcurrentHllSketchPvt::hashUpdate(const void* data, const size_t lengthBytes) {
+  HashState hashResult;
+  HllUtil::hash(data, lengthBytes, HllUtil::DEFAULT_UPDATE_SEED, hashResult);
+  internalCouponUpdate(HllUtil::coupon(hashResult));
+}
+
+}
+
+#endif // _CONCURRENTHLLSKETCH_HPP_
@@ -19,7 +19,14 @@ public:
   static Hll8Array* convertToHll8(const HllArray& srcHllArr);
 
 private:
-  static int curMinAndNum(const HllArray& hllArr);
+  // Returns the value of every slot of srcHllArr, one byte per slot, with
+  // HLL_4 exceptions resolved. An HLL_8 source is returned as-is when buffer
+  // is null; otherwise the values are written to buffer, allocating it with
+  // new[] if null. The caller must delete[] buffer.
+  static const uint8_t* registerBytes(const HllArray& srcHllArr, uint8_t*& buffer);
+
+  // kxq0 and kxq1 from a register value histogram
+  static void putStats(HllArray& tgtHllArr, const int* counts);
 };
 
 }
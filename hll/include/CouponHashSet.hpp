@@ -9,12 +9,18 @@
 
 namespace datasketches {
 
-class CouponHashSet : public CouponList {
+class CouponHashSet final : public CouponList {
   public:
-    static CouponHashSet* newSet(std::istream& is);
+    static CouponHashSet* newSet(std::istream& is, std::pmr::memory_resource* resource,
+                                 const uint8_t hashTag = 0);
+    static CouponHashSet* newSet(const HllSketchView& view, std::pmr::memory_resource* resource);
+
+    // index of coupon in the table, or ~index of the empty slot where it goes
+    static int find(const int* array, const int lgArrInts, const int coupon);
 
   protected:
-    explicit CouponHashSet(const int lgConfigK, const TgtHllType tgtHllType);
+    explicit CouponHashSet(const int lgConfigK, const TgtHllType tgtHllType,
+                           std::pmr::memory_resource* resource);
     explicit CouponHashSet(const CouponHashSet& that);
     explicit CouponHashSet(const CouponHashSet& that, const TgtHllType tgtHllType);
     
@@ -29,10 +35,14 @@ class CouponHashSet : public CouponList {
     virtual int getPreInts() const;
 
     friend class CouponList; // so it can access fields declared in CouponList
+    friend class CouponSparse;
+    friend class HllDispatch;
 
   private:
     bool checkGrowOrPromote();
     void growHashSet(const int srcLgCoupArrSize, const int tgtLgCoupArrSize);
+    // replaces the contents with numCoupons distinct coupons in a table of the given size
+    void rebuild(const int* coupons, const int numCoupons, const int tgtLgCoupArrSize);
 };
 
 }
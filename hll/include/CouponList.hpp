@@ -7,16 +7,27 @@
 
 #include "HllSketchImpl.hpp"
 
+#include <memory_resource>
+#include <vector>
+
 namespace datasketches {
 
+class HllArray;
+
 class CouponList : public HllSketchImpl {
   public:
-    explicit CouponList(const int lgConfigK, const TgtHllType tgtHllType, const CurMode curMode);
+    explicit CouponList(const int lgConfigK, const TgtHllType tgtHllType, const CurMode curMode,
+                        std::pmr::memory_resource* resource);
     explicit CouponList(const CouponList& that);
     explicit CouponList(const CouponList& that, const TgtHllType tgtHllType);
 
-    static CouponList* newList(std::istream& is);
-    virtual void serialize(std::ostream& os, const bool compact) const;
+    static CouponList* newList(std::istream& is, std::pmr::memory_resource* resource,
+                               const uint8_t hashTag = 0);
+    static CouponList* newList(const HllSketchView& view, std::pmr::memory_resource* resource);
+    virtual void serializeToMem(uint8_t* dst, const bool compact) const;
+    virtual void writeHeader(uint8_t* dst, const bool compact) const;
+    virtual void wrapMemory(uint8_t* mem);
+    virtual bool isWrapped() const;
 
     virtual ~CouponList();
 
@@ -25,15 +36,34 @@ class CouponList : public HllSketchImpl {
 
     virtual HllSketchImpl* couponUpdate(int coupon);
 
+    // Bulk union of src's coupons into this LIST or SET, see
+    // HllUnionPvt::unionImpl(). Sorts and dedupes the coupons of both, then
+    // builds the result once at its final size. Returns this, or a new SET
+    // replacing this LIST, or nullptr with this unchanged if the result
+    // would need an HLL array.
+    HllSketchImpl* unionCoupons(const CouponList& src);
+    // the same for the coupon array of a serialized LIST or SET, EMPTY slots
+    // included
+    HllSketchImpl* unionCoupons(const int* srcCoupons, const int srcLen);
+
     virtual double getEstimate() const;
     virtual double getCompositeEstimate() const;
     virtual double getUpperBound(const int numStdDev) const;
     virtual double getLowerBound(const int numStdDev) const;
 
+    // estimators over a coupon count, shared with HllSketchView
+    static double getEstimate(const int couponCount);
+    static double getLowerBound(const int couponCount, const int numStdDev);
+    static double getUpperBound(const int couponCount, const int numStdDev);
+
     virtual bool isEmpty() const;
     virtual int getCouponCount() const;
 
   protected:
+    // for CouponSparse, which uses the array as its insert buffer
+    explicit CouponList(const int lgConfigK, const TgtHllType tgtHllType, const CurMode curMode,
+                        const int lgCouponArrInts, std::pmr::memory_resource* resource, const bool sparse);
+
     HllSketchImpl* promoteHeapListToSet(CouponList& list);
     HllSketchImpl* promoteHeapListOrSetToHll(CouponList& src);
 
@@ -49,12 +79,23 @@ class CouponList : public HllSketchImpl {
     virtual int getLgCouponArrInts() const;
     virtual int* getCouponIntArr();
 
-    virtual CouponList* reset();
+    // empties a LIST in place, see HllSketchImpl::reset()
+    void clear();
+
+    // the steps of unionCoupons(): the coupons of this onto coupons, then
+    // this rebuilt from all of them
+    void appendCoupons(std::pmr::vector<int>& coupons) const;
+    HllSketchImpl* rebuildFromCoupons(std::pmr::vector<int>& coupons);
 
     int lgCouponArrInts;
     int couponCount;
     bool oooFlag;
     int* couponIntArr;
+    bool ownsArray; // false once wrapped into caller memory
+    HllArray* spareHll; // kept from before a reset for the next promotion, or null
+
+    friend class HllSketchImpl;
+    friend class CouponSparse;
 };
 
 }
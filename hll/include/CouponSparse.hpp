@@ -0,0 +1,88 @@
+/*
+ * Copyright 2018, Yahoo! Inc. Licensed under the terms of the
+ * Apache License 2.0. See LICENSE file at the project root for terms.
+ */
+
+#pragma once
+
+#include "CouponList.hpp"
+
+namespace datasketches {
+
+/**
+ * Compact alternative to CouponList and CouponHashSet for the coupon modes,
+ * see HllSketch::newSparseInstance().
+ *
+ * Coupons are kept as keys (slot << 6 | value) sorted in a byte stream of
+ * varints, each holding the slot delta from the previous key shifted left by
+ * 2 and a value code: values 1 to 3 in the low bits, 3 meaning the value
+ * follows in a byte of its own. New coupons go to a sorted buffer, the
+ * inherited couponIntArr, which is merged into the stream when full. Each
+ * merge re-encodes the whole stream, so the buffer grows with the stream to
+ * some 2 sqrt(streamCount) keys, balancing the cost of the merges against
+ * that of inserting into the buffer. The first key of every INDEX_STRIDE keys
+ * of the stream is indexed ahead of the stream in the same block, so testing
+ * a coupon decodes at most that many. The fixed overhead is somewhat above
+ * that of a LIST, so only sketches of more than a few dozen coupons come out
+ * smaller.
+ *
+ * The impl is in SET mode and always out of order. It is promoted to HLL
+ * where a CouponHashSet would be, or earlier once the stream grows beyond the
+ * size of the HLL array. It serializes to standard LIST and SET images.
+ */
+class CouponSparse final : public CouponList {
+  public:
+    explicit CouponSparse(const int lgConfigK, const TgtHllType tgtHllType,
+                          std::pmr::memory_resource* resource);
+    explicit CouponSparse(const CouponSparse& that, const TgtHllType tgtHllType);
+
+    virtual ~CouponSparse();
+
+    virtual CouponSparse* copy() const;
+    virtual CouponSparse* copyAs(const TgtHllType tgtHllType) const;
+
+    virtual HllSketchImpl* couponUpdate(int coupon);
+
+    virtual void serializeToMem(uint8_t* dst, const bool compact) const;
+    virtual void writeHeader(uint8_t* dst, const bool compact) const;
+    virtual void wrapMemory(uint8_t* mem);
+
+    virtual int getUpdatableSerializationBytes() const;
+    virtual int getCompactSerializationBytes() const;
+    virtual std::unique_ptr<PairIterator> getIterator() const;
+    virtual int getMemDataStart() const;
+    virtual int getPreInts() const;
+
+    // empties the sketch in place, with the initial buffer, see HllSketchImpl::reset()
+    void clear();
+
+    // bytes held by the stream and its index
+    int getStreamBytes() const;
+
+    // of the initial buffer
+    static constexpr int LG_BUFFER_INTS = 3;
+    static constexpr int INDEX_STRIDE = 32;
+
+  private:
+    // the standard LIST or SET holding the same coupons, for serialization
+    CouponList* toCouponList() const;
+    // writes the keys of all coupons in order to dst, which has room for couponCount
+    void decodeAll(uint32_t* dst) const;
+    bool streamContains(const uint32_t key) const;
+    int getIndexInts() const;
+    // first key and byte offset of every INDEX_STRIDE keys
+    const uint32_t* getIndex() const;
+    const uint8_t* getEncodedKeys() const;
+    void mergeBuffer();
+    // grows the empty buffer to the size for streamCount
+    void growBuffer();
+    // coupons allowed before promotion, as for CouponList and CouponHashSet
+    int getMaxCoupons() const;
+
+    uint8_t* stream; // the index, then the encoded keys
+    int streamBytes; // of the encoded keys
+    int streamCount;
+    int bufferCount;
+};
+
+}
@@ -11,14 +11,15 @@
 
 namespace datasketches {
 
-class Hll4Array : public HllArray {
+class Hll4Array final : public HllArray {
   public:
-    explicit Hll4Array(const int lgConfigK);
-    explicit Hll4Array(const Hll4Array& that);
+    explicit Hll4Array(const int lgConfigK, std::pmr::memory_resource* resource);
+    explicit Hll4Array(const Hll4Array& that, std::pmr::memory_resource* resource = nullptr);
 
     virtual ~Hll4Array();
 
     virtual Hll4Array* copy() const;
+    virtual void clear();
 
     virtual std::unique_ptr<PairIterator> getIterator() const;
     virtual std::unique_ptr<PairIterator> getAuxIterator() const;
@@ -27,9 +28,13 @@ class Hll4Array : public HllArray {
     virtual void putSlot(const int slotNo, const int value);
 
     virtual int getUpdatableSerializationBytes() const;
+    virtual void wrapMemory(uint8_t* mem);
+    virtual bool isWrapped() const;
     virtual int getHllByteArrBytes() const;
 
     virtual HllSketchImpl* couponUpdate(const int coupon);
+    // non-virtual update used by HllDispatch
+    void internalCouponUpdate(const int coupon);
 
     virtual AuxHashMap* getAuxHashMap() const;
     // does *not* delete old map if overwriting
@@ -52,7 +57,50 @@ class Hll4Iterator : public HllPairIterator {
     virtual ~Hll4Iterator();
 
   private:
+    // The exceptions are copied into the iterator sorted by slot, so each
+    // AUX_TOKEN slot takes the next one instead of a hash lookup. Up to this
+    // many fit inline, more take one allocation from the array's resource.
+    static const int INLINE_EXCEPTIONS = 32;
+
     const Hll4Array& hllArray;
+    int numExceptions;
+    int nextException;
+    int* exceptions; // inlineExceptions or allocated
+    int inlineExceptions[INLINE_EXCEPTIONS];
 };
 
+inline int Hll4Array::getSlot(const int slotNo) const {
+  int theByte = hllByteArr[slotNo >> 1];
+  if ((slotNo & 1) > 0) { // odd?
+    theByte >>= 4;
+  }
+  return theByte & HllUtil::loNibbleMask;
+}
+
+inline void Hll4Array::putSlot(const int slotNo, const int newValue) {
+  unshareArray();
+  const int byteno = slotNo >> 1;
+  const int oldValue = hllByteArr[byteno];
+  if ((slotNo & 1) == 0) { // set low nibble
+    hllByteArr[byteno]
+      = (uint8_t) ((oldValue & HllUtil::hiNibbleMask) | (newValue & HllUtil::loNibbleMask));
+  } else { // set high nibble
+    hllByteArr[byteno]
+      = (uint8_t) ((oldValue & HllUtil::loNibbleMask) | ((newValue << 4) & HllUtil::hiNibbleMask));
+  }
+}
+
+inline void Hll4Array::internalCouponUpdate(const int coupon) {
+  const int newValue = HllUtil::getValue(coupon);
+  assert(newValue > 0);
+
+  if (newValue <= curMin) {
+    return; // quick rejection, but only works for large N
+  }
+
+  const int configKmask = (1 << lgConfigK) - 1;
+  const int slotNo = HllUtil::getLow26(coupon) & configKmask;
+  internalHll4Update(slotNo, newValue);
+}
+
 }
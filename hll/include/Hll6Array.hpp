@@ -6,14 +6,15 @@
 #pragma once
 
 #include "HllArray.hpp"
+#include "HllKernels.hpp"
 #include "HllPairIterator.hpp"
 
 namespace datasketches {
 
-class Hll6Array : public HllArray {
+class Hll6Array final : public HllArray {
   public:
-    explicit Hll6Array(const int lgConfigK);
-    explicit Hll6Array(const Hll6Array& that);
+    explicit Hll6Array(const int lgConfigK, std::pmr::memory_resource* resource);
+    explicit Hll6Array(const Hll6Array& that, std::pmr::memory_resource* resource = nullptr);
 
     virtual ~Hll6Array();
 
@@ -26,6 +27,10 @@ class Hll6Array : public HllArray {
 
     virtual int getHllByteArrBytes() const;
 
+    virtual HllSketchImpl* couponUpdate(const int coupon);
+    // non-virtual update used by HllDispatch
+    void internalCouponUpdate(const int coupon);
+
   protected:
     friend class Hll6Iterator;
 };
@@ -39,7 +44,33 @@ class Hll6Iterator : public HllPairIterator {
 
   private:
     const Hll6Array& hllArray;
-    int bitOffset;
+    // slots are unpacked a block at a time rather than one 16-bit window each
+    uint8_t block[HllKernels::BLOCK_SLOTS];
 };
 
+inline int Hll6Array::getSlot(const int slotNo) const {
+  const int startBit = slotNo * 6;
+  const int shift = startBit & 0x7;
+  const int byteIdx = startBit >> 3;
+  const uint16_t twoByteVal = (hllByteArr[byteIdx + 1] << 8) | hllByteArr[byteIdx];
+  return (uint8_t) (twoByteVal >> shift) & 0x3F;
+}
+
+inline void Hll6Array::putSlot(const int slotNo, const int value) {
+  unshareArray();
+  const int startBit = slotNo * 6;
+  const int shift = startBit & 0x7;
+  const int byteIdx = startBit >> 3;
+  const uint16_t valShifted = (value & 0x3F) << shift;
+  uint16_t curMasked = (hllByteArr[byteIdx + 1] << 8) | hllByteArr[byteIdx];
+  curMasked &= (~(HllUtil::VAL_MASK_6 << shift));
+  uint16_t insert = curMasked | valShifted;
+  hllByteArr[byteIdx]     = insert & 0xFF;
+  hllByteArr[byteIdx + 1] = (insert & 0xFF00) >> 8;
+}
+
+inline void Hll6Array::internalCouponUpdate(const int coupon) {
+  hllCouponUpdate(*this, coupon);
+}
+
 }
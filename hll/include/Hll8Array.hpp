@@ -10,10 +10,10 @@
 
 namespace datasketches {
 
-class Hll8Array : public HllArray {
+class Hll8Array final : public HllArray {
   public:
-    explicit Hll8Array(const int lgConfigK);
-    explicit Hll8Array(const Hll8Array& that);
+    explicit Hll8Array(const int lgConfigK, std::pmr::memory_resource* resource);
+    explicit Hll8Array(const Hll8Array& that, std::pmr::memory_resource* resource = nullptr);
 
     virtual ~Hll8Array();
 
@@ -26,6 +26,10 @@ class Hll8Array : public HllArray {
 
     virtual int getHllByteArrBytes() const;
 
+    virtual HllSketchImpl* couponUpdate(const int coupon);
+    // non-virtual update used by HllDispatch
+    void internalCouponUpdate(const int coupon);
+
   protected:
     friend class Hll8Iterator;
 };
@@ -41,4 +45,17 @@ class Hll8Iterator : public HllPairIterator {
     const Hll8Array& hllArray;
 };
 
+inline int Hll8Array::getSlot(const int slotNo) const {
+  return (int) hllByteArr[slotNo] & HllUtil::VAL_MASK_6;
+}
+
+inline void Hll8Array::putSlot(const int slotNo, const int value) {
+  unshareArray();
+  hllByteArr[slotNo] = value & HllUtil::VAL_MASK_6;
+}
+
+inline void Hll8Array::internalCouponUpdate(const int coupon) {
+  hllCouponUpdate(*this, coupon);
+}
+
 }
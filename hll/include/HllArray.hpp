@@ -8,39 +8,58 @@
 #include "HllSketchImpl.hpp"
 #include "HllUtil.hpp"
 #include "AuxHashMap.hpp"
+#include "HllCompression.hpp"
+
+#include <atomic>
+#include <cassert>
 
 namespace datasketches {
 
 class HllArray : public HllSketchImpl {
   public:
-    explicit HllArray(const int lgConfigK, const TgtHllType tgtHllType);
-    explicit HllArray(const HllArray& that);
-
-    static HllArray* newHll(const int lgConfigK, const TgtHllType tgtHllType);
-    static HllArray* newHll(std::istream& is);
-
-    virtual void serialize(std::ostream& os, const bool compact) const;
+    explicit HllArray(const int lgConfigK, const TgtHllType tgtHllType,
+                      std::pmr::memory_resource* resource);
+    // shares that's registers if they come from the same resource
+    explicit HllArray(const HllArray& that, std::pmr::memory_resource* resource);
+
+    static HllArray* newHll(const int lgConfigK, const TgtHllType tgtHllType,
+                            std::pmr::memory_resource* resource);
+    static HllArray* newHll(std::istream& is, std::pmr::memory_resource* resource,
+                            const uint8_t hashTag = 0);
+    static HllArray* newHll(const HllSketchView& view, std::pmr::memory_resource* resource);
+
+    virtual void serializeToMem(uint8_t* dst, const bool compact) const;
+    virtual void serializeCompressedToMem(uint8_t* dst) const;
+    virtual void writeHeader(uint8_t* dst, const bool compact) const;
+    virtual void wrapMemory(uint8_t* mem);
+    virtual bool isWrapped() const;
 
     virtual ~HllArray();
 
     virtual HllArray* copy() const = 0;
     virtual HllArray* copyAs(const TgtHllType tgtHllType) const;
 
-    virtual HllSketchImpl* couponUpdate(const int coupon);
-
     virtual double getEstimate() const;
     virtual double getCompositeEstimate() const;
     virtual double getLowerBound(const int numStdDev) const;
     virtual double getUpperBound(const int numStdDev) const;
 
-    virtual HllSketchImpl* reset();
+    // Estimators over explicit state, shared with HllSketchView. estimate is
+    // the HIP accumulator when in order, otherwise the composite estimate.
+    static double getCompositeEstimate(const int lgConfigK, const int curMin, const int numAtCurMin,
+                                       const double kxq0, const double kxq1);
+    static double getLowerBound(const int lgConfigK, const int curMin, const int numAtCurMin,
+                                const bool oooFlag, const double estimate, const int numStdDev);
+    static double getUpperBound(const int lgConfigK, const bool oooFlag, const double estimate,
+                                const int numStdDev);
+
+    // back to the state of a new array, reusing the registers unless shared
+    virtual void clear();
 
     void addToHipAccum(double delta);
 
     void decNumAtCurMin();
 
-    virtual CurMode getCurMode() const;
-
     int getCurMin() const;
     int getNumAtCurMin() const;
     double getHipAccum() const;
@@ -52,6 +71,7 @@ class HllArray : public HllSketchImpl {
 
     virtual int getUpdatableSerializationBytes() const;
     virtual int getCompactSerializationBytes() const;
+    virtual int getCompressedSerializationBytes() const;
 
     virtual bool isOutOfOrderFlag() const;
     virtual bool isEmpty() const;
@@ -80,11 +100,38 @@ class HllArray : public HllSketchImpl {
 
     virtual AuxHashMap* getAuxHashMap() const;
 
+    // Register arrays at least this large rarely stay in L2 cache, so batch
+    // updates prefetch them, see prefetchSlots().
+    static const int PREFETCH_MIN_BYTES = 1 << 18;
+
+    // Hints the register bytes the given coupons will update into cache, so a
+    // batch can issue all its misses before applying the updates in order.
+    void prefetchSlots(const int* coupons, const int n) const;
+
   protected:
+    // the aux pairs of a compact image, if HLL_4, written at dst
+    void writeCompactAux(uint8_t* dst) const;
+    // coded bytes of a compressed image, or 0 if the compact one is no larger
+    int getCodedBytes(const HllRegisterEncoder& encoder) const;
+
+    // Copies share hllByteArr until one of them writes, see unshareArray().
+    // Every write to the array must be preceded by unshareArray().
+    void unshareArray();
+    void cloneArray();
+    void releaseArray();
+    // zeroed registers owned by this array alone, called by the derived constructors
+    void allocateArray(const int numBytes);
+    static std::atomic<int>* newRefCount(std::pmr::memory_resource* resource);
+
+    // Coupon update shared by HLL_6 and HLL_8. Instantiated with the concrete
+    // (final) array type so getSlot() and putSlot() bind statically and inline.
+    template<typename HllArr>
+    static void hllCouponUpdate(HllArr& host, const int coupon);
+
     // TODO: does this need to be static?
     static void hipAndKxQIncrementalUpdate(HllArray& host, const int oldValue, const int newValue);
-    double getHllBitMapEstimate(const int lgConfigK, const int curMin, const int numAtCurMin) const;
-    double getHllRawEstimate(const int lgConfigK, const double kxqSum) const;
+    static double getHllBitMapEstimate(const int lgConfigK, const int curMin, const int numAtCurMin);
+    static double getHllRawEstimate(const int lgConfigK, const double kxqSum);
 
     double hipAccum;
     double kxq0;
@@ -93,9 +140,67 @@ class HllArray : public HllSketchImpl {
     int curMin; //always zero for Hll6 and Hll8, only used / tracked by Hll4Array
     int numAtCurMin; //interpreted as num zeros when curMin == 0
     bool oooFlag; //Out-Of-Order Flag
+    bool ownsArray; // false once wrapped into caller memory
+    std::atomic<int>* arrRefs; // owners of hllByteArr, null when wrapped
 
     friend class Conversions;
+    friend class HllUnionPvt;
+    friend class ConcurrentHllSketchPvt;
 };
 
+inline void HllArray::prefetchSlots(const int* coupons, const int n) const {
+  const int slotMask = (1 << lgConfigK) - 1;
+  for (int i = 0; i < n; ++i) {
+    const int slotNo = coupons[i] & slotMask;
+    int byteIdx;
+    switch (tgtHllType) {
+      case HLL_4: byteIdx = slotNo >> 1; break;
+      case HLL_6: byteIdx = (slotNo * 3) >> 2; break;
+      case HLL_8:
+      default: byteIdx = slotNo; break;
+    }
+    __builtin_prefetch(hllByteArr + byteIdx);
+  }
+}
+
+inline void HllArray::unshareArray() {
+  // acquire pairs with the release in releaseArray(), so reads made through
+  // copies that are gone happen before our writes
+  if ((arrRefs != nullptr) && (arrRefs->load(std::memory_order_acquire) > 1)) {
+    cloneArray();
+  }
+}
+
+template<typename HllArr>
+inline void HllArray::hllCouponUpdate(HllArr& host, const int coupon) {
+  const int configKmask = (1 << host.lgConfigK) - 1;
+  const int slotNo = HllUtil::getLow26(coupon) & configKmask;
+  const int newVal = HllUtil::getValue(coupon);
+  assert(newVal > 0);
+
+  const int curVal = host.getSlot(slotNo);
+  if (newVal > curVal) {
+    host.putSlot(slotNo, newVal);
+    hipAndKxQIncrementalUpdate(host, curVal, newVal);
+    if (curVal == 0) {
+      --host.numAtCurMin; // interpret numAtCurMin as num zeros
+      assert(host.numAtCurMin >= 0);
+    }
+  }
+}
+
+inline void HllArray::hipAndKxQIncrementalUpdate(HllArray& host, const int oldValue, const int newValue) {
+  assert(newValue > oldValue);
+
+  const int configK = 1 << host.lgConfigK;
+  // update hipAccum BEFORE updating kxq0 and kxq1
+  host.hipAccum += configK / (host.kxq0 + host.kxq1);
+  // update kxq0 and kxq1; subtract first, then add
+  if (oldValue < 32) { host.kxq0 -= HllUtil::invPow2(oldValue); }
+  else               { host.kxq1 -= HllUtil::invPow2(oldValue); }
+  if (newValue < 32) { host.kxq0 += HllUtil::invPow2(newValue); }
+  else               { host.kxq1 += HllUtil::invPow2(newValue); }
+}
+
 
 }
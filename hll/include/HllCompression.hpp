@@ -0,0 +1,128 @@
+/*
+ * Copyright 2018, Yahoo! Inc. Licensed under the terms of the
+ * Apache License 2.0. See LICENSE file at the project root for terms.
+ */
+
+#ifndef _HLLCOMPRESSION_HPP_
+#define _HLLCOMPRESSION_HPP_
+
+#include "hll.hpp"
+#include "HllUtil.hpp"
+
+#include <cstdint>
+#include <stdexcept>
+
+namespace datasketches {
+
+/**
+ * Entropy coding of HLL register arrays, for the compressed images written by
+ * HllSketch::serializeCompressed().
+ *
+ * The symbols are the stored register values in slot order: the nibbles of
+ * HLL_4, relative to curMin and including AUX_TOKEN, or the values of HLL_6
+ * and HLL_8. Past the first few thousand uniques these crowd into a handful of
+ * values around log2(n/k), so each array gets its own canonical Huffman code,
+ * limited to MAX_CODE_BITS so that decoding is one table lookup per register.
+ *
+ * The coded registers are a byte holding the first symbol, a byte holding the
+ * number of symbols, the code length of each as a nibble (0 for absent), then
+ * the codes packed from the least significant bit up, zero padded to a
+ * multiple of 4 bytes.
+ */
+class HllCompression {
+  public:
+    static const int MAX_CODE_BITS = 12;
+    static const int MAX_SYMBOLS = 64;
+
+    // The compressed image is the compact one with the registers replaced by
+    // an int holding the number of coded bytes followed by the coded bytes.
+    static const int CODED_START = HllUtil::HLL_BYTE_ARR_START + 4;
+
+    // Decodes the registers of a compressed image into arr, the register
+    // array of an HLL of the given type and lgConfigK. Throws
+    // std::invalid_argument if the coded bytes are malformed.
+    static void decode(const uint8_t* coded, const int codedBytes,
+                       const TgtHllType tgtHllType, const int lgConfigK, uint8_t* arr);
+
+    // number of possible stored values: 16 for HLL_4, 64 otherwise
+    static int getMaxSymbols(const TgtHllType tgtHllType);
+
+    // Unpack and pack the stored values of len slots from start. Both must be
+    // multiples of 4, which blocks of HllKernels::BLOCK_SLOTS are.
+    static void getStoredValues(const TgtHllType tgtHllType, const uint8_t* arr,
+                                const int start, const int len, uint8_t* dst);
+    static void putStoredValues(const TgtHllType tgtHllType, uint8_t* arr,
+                                const int start, const int len, const uint8_t* src);
+};
+
+// Builds the code for a register array and writes the coded registers.
+class HllRegisterEncoder {
+  public:
+    explicit HllRegisterEncoder(const TgtHllType tgtHllType, const int lgConfigK, const uint8_t* arr);
+
+    // a multiple of 4
+    int getCodedBytes() const;
+    // writes getCodedBytes() bytes to dst
+    void write(uint8_t* dst) const;
+
+  private:
+    const TgtHllType tgtHllType;
+    const int lgConfigK;
+    const uint8_t* arr;
+    int firstSymbol;
+    int numSymbols;
+    uint8_t lengths[HllCompression::MAX_SYMBOLS];
+    uint32_t codes[HllCompression::MAX_SYMBOLS]; // bit reversed, ready to pack
+    int codedBytes;
+};
+
+// Reads back the stored register values of coded registers in slot order.
+class HllRegisterDecoder {
+  public:
+    // throws std::invalid_argument if the code is malformed or holds symbols
+    // beyond maxSymbols
+    explicit HllRegisterDecoder(const uint8_t* coded, const int codedBytes, const int maxSymbols);
+
+    // throws std::invalid_argument on a code not in the table or past the end
+    int next();
+    void next(uint8_t* dst, const int n);
+
+  private:
+    static const int TABLE_MASK = (1 << HllCompression::MAX_CODE_BITS) - 1;
+
+    void refill();
+
+    const uint8_t* ptr;
+    const uint8_t* end;
+    uint64_t bitBuf;
+    int bitCount;
+    // symbol << 4 | code length for every MAX_CODE_BITS bit pattern
+    uint16_t table[1 << HllCompression::MAX_CODE_BITS];
+};
+
+inline void HllRegisterDecoder::refill() {
+  while ((bitCount <= 56) && (ptr < end)) {
+    bitBuf |= ((uint64_t) *ptr++) << bitCount;
+    bitCount += 8;
+  }
+}
+
+inline int HllRegisterDecoder::next() {
+  if (bitCount < HllCompression::MAX_CODE_BITS) { refill(); }
+  const int entry = table[bitBuf & TABLE_MASK];
+  const int len = entry & 0xF;
+  if ((len == 0) || (len > bitCount)) {
+    throw std::invalid_argument("Corrupt compressed HLL registers");
+  }
+  bitBuf >>= len;
+  bitCount -= len;
+  return entry >> 4;
+}
+
+inline void HllRegisterDecoder::next(uint8_t* dst, const int n) {
+  for (int i = 0; i < n; ++i) { dst[i] = (uint8_t) next(); }
+}
+
+}
+
+#endif // _HLLCOMPRESSION_HPP_
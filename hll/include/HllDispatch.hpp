@@ -0,0 +1,59 @@
+/*
+ * Copyright 2018, Yahoo! Inc. Licensed under the terms of the
+ * Apache License 2.0. See LICENSE file at the project root for terms.
+ */
+
+#pragma once
+
+#include "HllSketchImpl.hpp"
+#include "CouponList.hpp"
+#include "CouponHashSet.hpp"
+#include "CouponSparse.hpp"
+#include "Hll4Array.hpp"
+#include "Hll6Array.hpp"
+#include "Hll8Array.hpp"
+
+namespace datasketches {
+
+/**
+ * Static dispatch of coupon updates onto the concrete HllSketchImpl.
+ *
+ * The set of implementations is closed: the current mode and the target type
+ * identify the concrete class exactly, so a switch on the two replaces the
+ * virtual call and lets the array register updates inline into the caller.
+ */
+class HllDispatch {
+  public:
+    // Returns the impl to use after the update, which differs from impl
+    // when the update promoted the sketch to a new mode. The caller owns
+    // (and must delete) the old impl in that case.
+    static HllSketchImpl* couponUpdate(HllSketchImpl* impl, const int coupon);
+};
+
+inline HllSketchImpl* HllDispatch::couponUpdate(HllSketchImpl* impl, const int coupon) {
+  switch (impl->getCurMode()) {
+    case HLL:
+      switch (impl->getTgtHllType()) {
+        case HLL_8:
+          static_cast<Hll8Array*>(impl)->internalCouponUpdate(coupon);
+          break;
+        case HLL_6:
+          static_cast<Hll6Array*>(impl)->internalCouponUpdate(coupon);
+          break;
+        case HLL_4:
+          static_cast<Hll4Array*>(impl)->internalCouponUpdate(coupon);
+          break;
+      }
+      return impl;
+    case SET:
+      if (impl->isSparse()) {
+        return static_cast<CouponSparse*>(impl)->couponUpdate(coupon);
+      }
+      return static_cast<CouponHashSet*>(impl)->couponUpdate(coupon);
+    case LIST:
+    default:
+      return static_cast<CouponList*>(impl)->CouponList::couponUpdate(coupon);
+  }
+}
+
+}
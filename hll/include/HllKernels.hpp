@@ -0,0 +1,70 @@
+/*
+ * Copyright 2018, Yahoo! Inc. Licensed under the terms of the
+ * Apache License 2.0. See LICENSE file at the project root for terms.
+ */
+
+#ifndef _HLLKERNELS_HPP_
+#define _HLLKERNELS_HPP_
+
+#include <cstdint>
+
+namespace datasketches {
+
+/**
+ * Bulk register kernels over raw HLL byte arrays.
+ *
+ * These work on whole arrays rather than slot by slot, so callers avoid the
+ * PairIterator and per-coupon update overhead. Each kernel uses SSE2, SSSE3
+ * or AVX2 when the build enables them and has a scalar fallback.
+ */
+class HllKernels {
+public:
+  // number of slots unpacked at a time by callers that go through a byte buffer
+  static constexpr int BLOCK_SLOTS = 256;
+
+  // dst[i] = max(dst[i], src[i]) over numSlots HLL_8 registers
+  static void maxMerge8(uint8_t* dst, const uint8_t* src, const int numSlots);
+
+  // Folds numSlots HLL_8 registers onto dstSlots of them, a power of 2:
+  // dst[i & (dstSlots - 1)] = max(dst[i & (dstSlots - 1)], src[i]), the slot
+  // a coupon lands in when downsampled. Unless counts is null, adds the counts
+  // of each register value of the folded dst to counts[64], in the same pass.
+  static void foldMax8(uint8_t* dst, const int dstSlots, const uint8_t* src, const int numSlots,
+                       int* counts = nullptr);
+
+  // Unpacks numSlots HLL_4 nibbles into one byte per slot, adding curMin.
+  // Slots holding AUX_TOKEN are written as 0, since their true value lives in
+  // the aux map and must be applied by the caller.
+  static void unpack4(uint8_t* dst, const uint8_t* src, const int numSlots, const int curMin);
+
+  // Unpacks numSlots HLL_6 registers into one byte per slot. src must point
+  // at the start of a 4-slot (3-byte) group.
+  static void unpack6(uint8_t* dst, const uint8_t* src, const int numSlots);
+
+  // Packs numSlots register bytes into HLL_4 nibbles, storing value - curMin.
+  // Values at or above curMin + AUX_TOKEN are stored as AUX_TOKEN; the caller
+  // must record them in an aux map. numSlots must be even.
+  static void pack4(uint8_t* dst, const uint8_t* src, const int numSlots, const int curMin);
+
+  // Decrements every HLL_4 nibble below AUX_TOKEN in place, as needed when
+  // curMin goes up by one. Adds the number of slots that become 0 to numZeros
+  // and the number of AUX_TOKEN slots to numTokens. Returns false if any slot
+  // held 0 before the shift, in which case the array contents are undefined.
+  // numSlots must be even.
+  static bool shift4(uint8_t* arr, const int numSlots, int& numZeros, int& numTokens);
+
+  // Packs numSlots register bytes (each < 64) into HLL_6 format. numSlots
+  // must be a multiple of 4.
+  static void pack6(uint8_t* dst, const uint8_t* src, const int numSlots);
+
+  // Adds the counts of each register value (0-63) in regs to counts[64].
+  static void histogram8(const uint8_t* regs, const int numSlots, int* counts);
+
+  // kxq0 and kxq1 from a register value histogram, as maintained by
+  // HllArray::hipAndKxQIncrementalUpdate()
+  static void kxqFromHistogram(const int* counts, double& kxq0, double& kxq1);
+};
+
+}
+
+#endif // _HLLKERNELS_HPP_
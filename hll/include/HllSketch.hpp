@@ -21,14 +21,20 @@ class HllSketchImpl;
 // Contains the non-public API for HllSketch
 class HllSketchPvt : public HllSketch {
   public:
-    explicit HllSketchPvt(const int lgConfigK, const TgtHllType tgtHllType = HLL_4);
-    static HllSketchPvt* deserialize(std::istream& is);
+    explicit HllSketchPvt(const int lgConfigK, const TgtHllType tgtHllType = HLL_4,
+                          std::pmr::memory_resource* resource = nullptr,
+                          const HashPolicy& hashPolicy = HashPolicy(), const bool sparse = false);
+    static HllSketchPvt* deserialize(std::istream& is, std::pmr::memory_resource* resource,
+                                     const HashPolicy& hashPolicy = HashPolicy());
+    static HllSketchPvt* deserialize(const void* bytes, const size_t sizeBytes,
+                                     std::pmr::memory_resource* resource,
+                                     const HashPolicy& hashPolicy = HashPolicy());
 
     virtual ~HllSketchPvt();
 
     // copy constructors
     HllSketchPvt(const HllSketch& that);
-    HllSketchPvt(HllSketchImpl* that);
+    HllSketchPvt(HllSketchImpl* that, const HashPolicy& hashPolicy = HashPolicy(), const bool sparse = false);
 
     HllSketch* copy() const;
     HllSketch* copyAs(const TgtHllType tgtHllType) const;
@@ -47,9 +53,22 @@ class HllSketchPvt : public HllSketch {
     virtual void update(const double datum);
     virtual void update(const float datum);
     virtual void update(const void* data, const size_t lengthBytes);
+    virtual void updateBatch(const uint64_t* data, const size_t n);
+    virtual void updateBatch(const int32_t* data, const size_t n);
+    virtual void updateBatch(const double* data, const size_t n);
+    virtual void updateBatch(const std::string_view* data, const size_t n);
+    virtual void update(const HashState& hash);
+    virtual void updateBatch(const HashState* hashes, const size_t n);
     
     virtual void serializeCompact(std::ostream& os) const;
     virtual void serializeUpdatable(std::ostream& os) const;
+    virtual std::pair<ptr_with_deleter, const size_t> serializeCompact(unsigned header_size_bytes = 0) const;
+    virtual std::pair<ptr_with_deleter, const size_t> serializeUpdatable(unsigned header_size_bytes = 0) const;
+    virtual size_t serializeCompact(void* dst, const size_t capacityBytes) const;
+    virtual size_t serializeUpdatable(void* dst, const size_t capacityBytes) const;
+    virtual void serializeCompressed(std::ostream& os) const;
+    virtual std::pair<ptr_with_deleter, const size_t> serializeCompressed(unsigned header_size_bytes = 0) const;
+    virtual size_t serializeCompressed(void* dst, const size_t capacityBytes) const;
 
     virtual std::ostream& to_string(std::ostream& os,
                                     const bool summary = true,
@@ -64,16 +83,21 @@ class HllSketchPvt : public HllSketch {
 
     virtual int getLgConfigK() const;
     virtual TgtHllType getTgtHllType() const;
+    virtual const HashPolicy& getHashPolicy() const;
     
     virtual bool isCompact() const;
     virtual bool isEmpty() const;
 
     virtual int getUpdatableSerializationBytes() const;
     virtual int getCompactSerializationBytes() const;
+    virtual int getCompressedSerializationBytes() const;
+
+    virtual void* getMemory() const;
 
     virtual std::unique_ptr<PairIterator> getIterator() const;
 
-    virtual void couponUpdate(int coupon);
+    virtual void couponUpdate(const int coupon);
+    virtual void couponUpdate(const int* coupons, const size_t n);
 
     virtual std::string typeAsString() const;
     virtual std::string modeAsString() const;
@@ -84,6 +108,8 @@ class HllSketchPvt : public HllSketch {
     bool isEstimationMode() const;
 
     HllSketchImpl* hllSketchImpl;
+    const HashPolicy hashPolicy;
+    const bool sparse; // see HllSketch::newSparseInstance()
 };
 
 }
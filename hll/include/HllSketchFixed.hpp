@@ -0,0 +1,438 @@
+/*
+ * Copyright 2018, Yahoo! Inc. Licensed under the terms of the
+ * Apache License 2.0. See LICENSE file at the project root for terms.
+ */
+
+#ifndef _HLLSKETCHFIXED_HPP_
+#define _HLLSKETCHFIXED_HPP_
+
+#include "hll.hpp"
+#include "HllUtil.hpp"
+#include "HllArray.hpp"
+#include "HllSketchView.hpp"
+#include "CompositeInterpolationXTable.hpp"
+#include "CubicInterpolation.hpp"
+#include "HarmonicNumbers.hpp"
+
+#include <algorithm>
+#include <cmath>
+#include <cstddef>
+#include <cstring>
+#include <memory>
+#include <stdexcept>
+#include <vector>
+
+namespace datasketches {
+
+/**
+ * An HLL sketch whose lgConfigK and target type are fixed at compile time,
+ * for applications that only ever use one configuration.
+ *
+ * The sketch is in HLL mode from the start, with one byte per register held
+ * inline, so an update is a hash, a constant mask and a byte compare, with no
+ * mode or type to dispatch on. The estimator constants of LgK are constexpr.
+ * Registers are bytes whatever the Type, as in the gadget of an HllUnion:
+ * Type is the type of the images and results the sketch produces.
+ *
+ * The sketch's storage is itself an updatable HLL_8 image, so getView() hands
+ * it to HllUnion::update() without a copy. Being held inline, the registers
+ * make the object 2^LgK bytes large; large LgK belong on the heap.
+ */
+template<int LgK, TgtHllType Type = HLL_4>
+class HllSketchFixed final {
+  static_assert((LgK >= HllUtil::MIN_LOG_K) && (LgK <= HllUtil::MAX_LOG_K), "LgK out of range");
+
+  public:
+    static constexpr int K = 1 << LgK;
+
+    explicit HllSketchFixed(const HashPolicy& hashPolicy = HashPolicy());
+
+    // Reads an image of any type, mode and format with lgConfigK LgK. A sketch
+    // in LIST or SET mode has its coupons replayed. Throws
+    // std::invalid_argument if the image is of another lgConfigK or policy.
+    static HllSketchFixed* deserialize(const void* bytes, const size_t sizeBytes,
+                                       const HashPolicy& hashPolicy = HashPolicy());
+    static HllSketchFixed* deserialize(std::istream& is, const HashPolicy& hashPolicy = HashPolicy());
+
+    void reset();
+
+    void update(const std::string& datum);
+    void update(const uint64_t datum);
+    void update(const uint32_t datum);
+    void update(const uint16_t datum);
+    void update(const uint8_t datum);
+    void update(const int64_t datum);
+    void update(const int32_t datum);
+    void update(const int16_t datum);
+    void update(const int8_t datum);
+    void update(const double datum);
+    void update(const float datum);
+    void update(const void* data, const size_t lengthBytes);
+    void updateBatch(const uint64_t* data, const size_t n);
+    void update(const HashState& hash);
+    void couponUpdate(const int coupon);
+    void couponUpdate(const int* coupons, const size_t n);
+
+    double getEstimate() const;
+    double getCompositeEstimate() const;
+    double getLowerBound(const int numStdDev) const;
+    double getUpperBound(const int numStdDev) const;
+
+    static constexpr int getLgConfigK() { return LgK; }
+    static constexpr TgtHllType getTgtHllType() { return Type; }
+    const HashPolicy& getHashPolicy() const;
+
+    bool isEmpty() const;
+    bool isOutOfOrderFlag() const;
+
+    // the registers as an updatable HLL_8 image, valid until the next update
+    HllSketchView getView() const;
+
+    // a copy as an ordinary sketch of type Type
+    HllSketch* getResult() const;
+
+    // images of type Type, as HllSketch writes them
+    void serializeCompact(std::ostream& os) const;
+    void serializeUpdatable(std::ostream& os) const;
+
+  private:
+    // The layout of an updatable HLL_8 image, see HllArray::writeHeader().
+    // Images are little endian, as is everything the library writes.
+    struct Image {
+      uint8_t preamble[8];
+      double hipAccum;
+      double kxq[2]; // sums of 2^-v over the registers of values v < 32, v >= 32
+      int32_t numAtCurMin; // number of zero registers
+      int32_t auxCount;
+      uint8_t regs[K];
+      uint8_t seedHash[HashPolicy::SEED_HASH_BYTES]; // only part of the image if non-default
+    };
+    static_assert(offsetof(Image, regs) == HllUtil::HLL_BYTE_ARR_START, "HLL_8 image layout");
+    static_assert(offsetof(Image, seedHash) == HllUtil::HLL_BYTE_ARR_START + K, "HLL_8 image layout");
+
+    static constexpr int SLOT_MASK = K - 1;
+    // getHllRawEstimate()
+    static constexpr double RAW_CORRECTION =
+        (LgK == 4) ? 0.673 : (LgK == 5) ? 0.697 : (LgK == 6) ? 0.709 : 0.7213 / (1.0 + (1.079 / K));
+    static constexpr double RAW_NUMERATOR = RAW_CORRECTION * K * K;
+    // getCompositeEstimate(): past this the linear counting estimate is unsafe
+    static constexpr double MAX_LINEAR_ADJ_EST = 3.0 * K;
+    // and the crossover of the two estimators' errors
+    static constexpr double CROSSOVER = ((LgK == 4) ? 0.718 : (LgK == 5) ? 0.672 : 0.64) * K;
+
+    static constexpr int PREAMBLE_MODE = HLL | (HLL_8 << 2);
+
+    // bytes of the image in use
+    size_t getImageBytes() const;
+    void hashUpdate(const void* data, const size_t lengthBytes);
+    void internalCouponUpdate(const int coupon);
+
+    const HashPolicy hashPolicy;
+    alignas(8) Image image;
+};
+
+template<int LgK, TgtHllType Type>
+HllSketchFixed<LgK, Type>::HllSketchFixed(const HashPolicy& hashPolicy) : hashPolicy(hashPolicy) {
+  image.preamble[0] = (uint8_t) HllUtil::HLL_PREINTS;
+  image.preamble[1] = (uint8_t) HllUtil::SER_VER;
+  image.preamble[2] = (uint8_t) HllUtil::FAMILY_ID;
+  image.preamble[3] = (uint8_t) LgK;
+  image.preamble[4] = 0; // no aux table
+  image.preamble[6] = 0; // curMin
+  image.preamble[7] = (uint8_t) (PREAMBLE_MODE | (hashPolicy.getSerialTag() << 4));
+  image.auxCount = 0;
+  HllUtil::writeSeedHash(image.seedHash, hashPolicy);
+  reset();
+}
+
+template<int LgK, TgtHllType Type>
+HllSketchFixed<LgK, Type>* HllSketchFixed<LgK, Type>::deserialize(const void* bytes, const size_t sizeBytes,
+                                                                  const HashPolicy& hashPolicy) {
+  std::vector<uint8_t> buffer;
+  bytes = HllSketchView::aligned(bytes, sizeBytes, buffer);
+  const HllSketchView view(bytes, sizeBytes);
+  if (view.getLgConfigK() != LgK) {
+    throw std::invalid_argument("Sketch lgConfigK does not match that of the HllSketchFixed");
+  }
+  if (!view.hasHashPolicy(hashPolicy)) {
+    throw std::invalid_argument("Sketch was serialized with a different hash policy");
+  }
+  std::unique_ptr<HllSketchFixed> sketch(new HllSketchFixed(hashPolicy));
+  if (view.getCurMode() != HLL) {
+    std::unique_ptr<PairIterator> itr = view.getIterator();
+    while (itr->nextValid()) {
+      sketch->internalCouponUpdate(itr->getPair());
+    }
+    return sketch.release();
+  }
+
+  // any HLL image converts to the HLL_8 updatable image that is the sketch
+  std::unique_ptr<HllSketch> hll(HllSketch::deserialize(bytes, sizeBytes, nullptr, hashPolicy));
+  if (hll->getTgtHllType() != HLL_8) {
+    hll.reset(hll->copyAs(HLL_8));
+  }
+  hll->serializeUpdatable(&sketch->image, sizeof(Image));
+  return sketch.release();
+}
+
+template<int LgK, TgtHllType Type>
+HllSketchFixed<LgK, Type>* HllSketchFixed<LgK, Type>::deserialize(std::istream& is,
+                                                                  const HashPolicy& hashPolicy) {
+  std::vector<uint8_t> buffer;
+  const int sizeBytes = HllSketchView::read(is, buffer);
+  return deserialize(buffer.data(), sizeBytes, hashPolicy);
+}
+
+template<int LgK, TgtHllType Type>
+void HllSketchFixed<LgK, Type>::reset() {
+  image.preamble[5] = (uint8_t) HllUtil::EMPTY_FLAG_MASK;
+  image.hipAccum = 0.0;
+  image.kxq[0] = K;
+  image.kxq[1] = 0.0;
+  image.numAtCurMin = K;
+  std::fill(image.regs, image.regs + K, 0);
+}
+
+template<int LgK, TgtHllType Type>
+void HllSketchFixed<LgK, Type>::update(const std::string& datum) {
+  if (datum.empty()) { return; }
+  hashUpdate(datum.c_str(), datum.length());
+}
+
+template<int LgK, TgtHllType Type>
+void HllSketchFixed<LgK, Type>::update(const uint64_t datum) {
+  hashUpdate(&datum, sizeof(datum));
+}
+
+template<int LgK, TgtHllType Type>
+void HllSketchFixed<LgK, Type>::update(const uint32_t datum) {
+  update(static_cast<uint64_t>(datum));
+}
+
+template<int LgK, TgtHllType Type>
+void HllSketchFixed<LgK, Type>::update(const uint16_t datum) {
+  update(static_cast<uint64_t>(datum));
+}
+
+template<int LgK, TgtHllType Type>
+void HllSketchFixed<LgK, Type>::update(const uint8_t datum) {
+  update(static_cast<uint64_t>(datum));
+}
+
+template<int LgK, TgtHllType Type>
+void HllSketchFixed<LgK, Type>::update(const int64_t datum) {
+  hashUpdate(&datum, sizeof(datum));
+}
+
+template<int LgK, TgtHllType Type>
+void HllSketchFixed<LgK, Type>::update(const int32_t datum) {
+  update(static_cast<int64_t>(datum));
+}
+
+template<int LgK, TgtHllType Type>
+void HllSketchFixed<LgK, Type>::update(const int16_t datum) {
+  update(static_cast<int64_t>(datum));
+}
+
+template<int LgK, TgtHllType Type>
+void HllSketchFixed<LgK, Type>::update(const int8_t datum) {
+  update(static_cast<int64_t>(datum));
+}
+
+template<int LgK, TgtHllType Type>
+void HllSketchFixed<LgK, Type>::update(const double datum) {
+  // the canonicalization of HllSketch::update(const double)
+  int64_t bits;
+  if (datum == 0.0) {
+    bits = 0; // -0.0 as 0.0
+  } else if (std::isnan(datum)) {
+    bits = 0x7ff8000000000000L; // Java's Double.doubleToLongBits() NaN
+  } else {
+    std::memcpy(&bits, &datum, sizeof(bits));
+  }
+  hashUpdate(&bits, sizeof(bits));
+}
+
+template<int LgK, TgtHllType Type>
+void HllSketchFixed<LgK, Type>::update(const float datum) {
+  update(static_cast<double>(datum));
+}
+
+template<int LgK, TgtHllType Type>
+void HllSketchFixed<LgK, Type>::update(const void* data, const size_t lengthBytes) {
+  if (data == nullptr) { return; }
+  hashUpdate(data, lengthBytes);
+}
+
+template<int LgK, TgtHllType Type>
+void HllSketchFixed<LgK, Type>::updateBatch(const uint64_t* data, const size_t n) {
+  if (data == nullptr) { return; }
+  int coupons[HllUtil::BATCH_SIZE];
+  for (size_t i = 0; i < n; i += HllUtil::BATCH_SIZE) {
+    const int len = (int) std::min<size_t>(HllUtil::BATCH_SIZE, n - i);
+    HllUtil::couponsFromLongs(data + i, len, hashPolicy, coupons);
+    couponUpdate(coupons, len);
+  }
+}
+
+template<int LgK, TgtHllType Type>
+void HllSketchFixed<LgK, Type>::update(const HashState& hash) {
+  internalCouponUpdate(HllUtil::coupon(hash));
+}
+
+template<int LgK, TgtHllType Type>
+void HllSketchFixed<LgK, Type>::couponUpdate(const int coupon) {
+  if (HllUtil::getValue(coupon) == 0) {
+    if (coupon == HllUtil::EMPTY) { return; }
+    throw std::invalid_argument("Invalid coupon: zero value");
+  }
+  internalCouponUpdate(coupon);
+}
+
+template<int LgK, TgtHllType Type>
+void HllSketchFixed<LgK, Type>::couponUpdate(const int* coupons, const size_t n) {
+  if (coupons == nullptr) { return; }
+  for (size_t i = 0; i < n; i += HllUtil::BATCH_SIZE) {
+    const size_t end = std::min<size_t>(n, i + HllUtil::BATCH_SIZE);
+    if constexpr (K >= HllArray::PREFETCH_MIN_BYTES) {
+      for (size_t j = i; j < end; ++j) {
+        __builtin_prefetch(image.regs + (coupons[j] & SLOT_MASK), 1);
+      }
+    }
+    for (size_t j = i; j < end; ++j) {
+      couponUpdate(coupons[j]);
+    }
+  }
+}
+
+template<int LgK, TgtHllType Type>
+double HllSketchFixed<LgK, Type>::getEstimate() const {
+  return isOutOfOrderFlag() ? getCompositeEstimate() : image.hipAccum;
+}
+
+// HllArray::getCompositeEstimate() with the constants of LgK folded in
+template<int LgK, TgtHllType Type>
+double HllSketchFixed<LgK, Type>::getCompositeEstimate() const {
+  const double rawEst = RAW_NUMERATOR / (image.kxq[0] + image.kxq[1]);
+
+  const double* xArr = CompositeInterpolationXTable::get_x_arr(LgK);
+  const int xArrLen = CompositeInterpolationXTable::get_x_arr_length(LgK);
+  const double yStride = CompositeInterpolationXTable::get_y_stride(LgK);
+
+  if (rawEst < xArr[0]) {
+    return 0;
+  }
+  const int xArrLenM1 = xArrLen - 1;
+  if (rawEst > xArr[xArrLenM1]) {
+    const double finalY = yStride * xArrLenM1;
+    return rawEst * (finalY / xArr[xArrLenM1]);
+  }
+
+  const double adjEst = CubicInterpolation::usingXArrAndYStride(xArr, xArrLen, yStride, rawEst);
+  if (adjEst > MAX_LINEAR_ADJ_EST) { return adjEst; }
+
+  const double linEst = (image.numAtCurMin == 0)
+      ? K * std::log(K / 0.5)
+      : HarmonicNumbers::getBitMapEstimate(K, K - image.numAtCurMin);
+  const double avgEst = (adjEst + linEst) / 2.0;
+  return (avgEst > CROSSOVER) ? adjEst : linEst;
+}
+
+template<int LgK, TgtHllType Type>
+double HllSketchFixed<LgK, Type>::getLowerBound(const int numStdDev) const {
+  return HllArray::getLowerBound(LgK, 0, image.numAtCurMin, isOutOfOrderFlag(), getEstimate(), numStdDev);
+}
+
+template<int LgK, TgtHllType Type>
+double HllSketchFixed<LgK, Type>::getUpperBound(const int numStdDev) const {
+  return HllArray::getUpperBound(LgK, isOutOfOrderFlag(), getEstimate(), numStdDev);
+}
+
+template<int LgK, TgtHllType Type>
+const HashPolicy& HllSketchFixed<LgK, Type>::getHashPolicy() const {
+  return hashPolicy;
+}
+
+template<int LgK, TgtHllType Type>
+bool HllSketchFixed<LgK, Type>::isEmpty() const {
+  return image.numAtCurMin == K;
+}
+
+template<int LgK, TgtHllType Type>
+bool HllSketchFixed<LgK, Type>::isOutOfOrderFlag() const {
+  return (image.preamble[5] & HllUtil::OUT_OF_ORDER_FLAG_MASK) != 0;
+}
+
+template<int LgK, TgtHllType Type>
+HllSketchView HllSketchFixed<LgK, Type>::getView() const {
+  return HllSketchView(&image, getImageBytes());
+}
+
+template<int LgK, TgtHllType Type>
+HllSketch* HllSketchFixed<LgK, Type>::getResult() const {
+  HllSketch* result = HllSketch::deserialize(&image, getImageBytes(), nullptr, hashPolicy);
+  if (Type != HLL_8) {
+    HllSketch* converted = result->copyAs(Type);
+    delete result;
+    result = converted;
+  }
+  return result;
+}
+
+template<int LgK, TgtHllType Type>
+size_t HllSketchFixed<LgK, Type>::getImageBytes() const {
+  return HllUtil::HLL_BYTE_ARR_START + K + hashPolicy.getSeedHashBytes();
+}
+
+template<int LgK, TgtHllType Type>
+void HllSketchFixed<LgK, Type>::serializeCompact(std::ostream& os) const {
+  if constexpr (Type == HLL_8) {
+    // an HLL_8 image has no aux pairs, so the compact one only differs in a flag
+    const uint8_t flags = image.preamble[5] | HllUtil::COMPACT_FLAG_MASK;
+    os.write((const char*) image.preamble, 5);
+    os.write((const char*) &flags, 1);
+    os.write((const char*) image.preamble + 6, getImageBytes() - 6);
+  } else {
+    std::unique_ptr<HllSketch> result(getResult());
+    result->serializeCompact(os);
+  }
+}
+
+template<int LgK, TgtHllType Type>
+void HllSketchFixed<LgK, Type>::serializeUpdatable(std::ostream& os) const {
+  if constexpr (Type == HLL_8) {
+    os.write((const char*) &image, getImageBytes());
+  } else {
+    std::unique_ptr<HllSketch> result(getResult());
+    result->serializeUpdatable(os);
+  }
+}
+
+template<int LgK, TgtHllType Type>
+inline void HllSketchFixed<LgK, Type>::hashUpdate(const void* data, const size_t lengthBytes) {
+  HashState hashResult;
+  hashPolicy.hash(data, lengthBytes, hashResult);
+  internalCouponUpdate(HllUtil::coupon(hashResult));
+}
+
+// HllArray::hllCouponUpdate() on the image
+template<int LgK, TgtHllType Type>
+inline void HllSketchFixed<LgK, Type>::internalCouponUpdate(const int coupon) {
+  const int slotNo = coupon & SLOT_MASK; // K <= 2^26, so within the low 26 bits
+  const int newVal = HllUtil::getValue(coupon);
+  const int curVal = image.regs[slotNo];
+  if (newVal <= curVal) { return; }
+  image.regs[slotNo] = (uint8_t) newVal;
+  // HIP before kxq, subtract before add
+  image.hipAccum += K / (image.kxq[0] + image.kxq[1]);
+  image.kxq[curVal >> 5] -= HllUtil::invPow2(curVal);
+  image.kxq[newVal >> 5] += HllUtil::invPow2(newVal);
+  if (curVal == 0) {
+    --image.numAtCurMin;
+    image.preamble[5] &= ~HllUtil::EMPTY_FLAG_MASK;
+  }
+}
+
+}
+
+#endif // _HLLSKETCHFIXED_HPP_
@@ -10,24 +10,72 @@
 #include "HllSketch.hpp"
 
 #include <memory>
+#include <memory_resource>
 
 namespace datasketches {
 
 class HllSketchImpl {
   public:
-    HllSketchImpl(const int lgConfigK, const TgtHllType tgtHllType, const CurMode curMode);
+    HllSketchImpl(const int lgConfigK, const TgtHllType tgtHllType, const CurMode curMode,
+                  std::pmr::memory_resource* resource, const bool sparse = false);
     virtual ~HllSketchImpl();
 
-    virtual void serialize(std::ostream& os, const bool compact) const = 0;
-    static HllSketchImpl* deserialize(std::istream& os);
+    // Impls are created with new (resource) and freed with a plain delete.
+    // Every impl and array a sketch creates comes from the same resource.
+    static void* operator new(size_t size, std::pmr::memory_resource* resource);
+    static void operator delete(void* ptr);
+    static void operator delete(void* ptr, std::pmr::memory_resource* resource);
+    std::pmr::memory_resource* getResource() const;
+
+    enum SerialFormat { UPDATABLE, COMPACT, COMPRESSED };
+
+    // The HashPolicy::getSerialTag() of hashPolicy goes in the high nibble of
+    // the mode byte, and a non-default policy adds its seed hash after the image.
+    void serialize(std::ostream& os, const SerialFormat format,
+                   const HashPolicy& hashPolicy = HashPolicy()) const;
+    std::pair<ptr_with_deleter, const size_t> serialize(const SerialFormat format,
+                                                        const unsigned header_size_bytes,
+                                                        const HashPolicy& hashPolicy = HashPolicy()) const;
+    size_t serialize(void* dst, const size_t capacityBytes, const SerialFormat format,
+                     const HashPolicy& hashPolicy = HashPolicy()) const;
+    // without the seed hash of a non-default policy
+    int getSerializationBytes(const SerialFormat format) const;
+    // writes exactly getCompactSerializationBytes() or
+    // getUpdatableSerializationBytes() bytes to dst
+    virtual void serializeToMem(uint8_t* dst, const bool compact) const = 0;
+    // The compact image with entropy coded registers, see HllCompression. Only
+    // HLL arrays code theirs, the other impls write their compact image.
+    virtual void serializeCompressedToMem(uint8_t* dst) const;
+    // writes the preamble, everything ahead of the coupon or register data
+    virtual void writeHeader(uint8_t* dst, const bool compact) const = 0;
+
+    // Moves the arrays into the updatable image at mem and writes the header.
+    // Arrays already living in memory are re-pointed at the same offsets, so
+    // mem may be the old buffer or a moved copy of it. isWrapped() then holds
+    // until a mode change or a grown table allocates from the heap again.
+    virtual void wrapMemory(uint8_t* mem) = 0;
+    virtual bool isWrapped() const = 0;
+    // throw std::invalid_argument unless the image was written under hashPolicy
+    static HllSketchImpl* deserialize(std::istream& os, std::pmr::memory_resource* resource,
+                                      const HashPolicy& hashPolicy = HashPolicy());
+    static HllSketchImpl* deserialize(const void* bytes, const size_t sizeBytes,
+                                      std::pmr::memory_resource* resource,
+                                      const HashPolicy& hashPolicy = HashPolicy());
 
     virtual HllSketchImpl* copy() const = 0;
     virtual HllSketchImpl* copyAs(TgtHllType tgtHllType) const = 0;
-    virtual HllSketchImpl* reset() = 0;
+
+    // Returns an empty LIST mode impl, or an empty CouponSparse if sparse,
+    // reusing what it can of impl, which is consumed. A LIST or CouponSparse
+    // is cleared in place and an HLL array is kept as the spare the next
+    // promotion to HLL fills instead of allocating.
+    static HllSketchImpl* reset(HllSketchImpl* impl, const bool sparse = false);
 
     virtual HllSketchImpl* couponUpdate(int coupon) = 0;
 
-    virtual CurMode getCurMode() const;
+    CurMode getCurMode() const;
+    // true for a CouponSparse, which is in SET mode
+    bool isSparse() const;
 
     virtual double getEstimate() const = 0;
     virtual double getCompositeEstimate() const = 0;
@@ -46,6 +94,7 @@ class HllSketchImpl {
 
     virtual int getUpdatableSerializationBytes() const = 0;
     virtual int getCompactSerializationBytes() const = 0;
+    virtual int getCompressedSerializationBytes() const;
 
     virtual bool isCompact() const = 0;
     virtual bool isEmpty() const = 0;
@@ -55,14 +104,37 @@ class HllSketchImpl {
   protected:
     static TgtHllType extractTgtHllType(const uint8_t modeByte);
     static CurMode extractCurMode(const uint8_t modeByte);
+    static void checkHashTag(const uint8_t modeByte, const uint8_t hashTag);
     uint8_t makeFlagsByte(const bool compact) const;
     uint8_t makeModeByte() const;
 
     const int lgConfigK;
     const TgtHllType tgtHllType;
     const CurMode curMode;
+    std::pmr::memory_resource* const resource;
+    const bool sparse;
 };
 
+inline CurMode HllSketchImpl::getCurMode() const {
+  return curMode;
+}
+
+inline bool HllSketchImpl::isSparse() const {
+  return sparse;
+}
+
+inline TgtHllType HllSketchImpl::getTgtHllType() const {
+  return tgtHllType;
+}
+
+inline int HllSketchImpl::getLgConfigK() const {
+  return lgConfigK;
+}
+
+inline std::pmr::memory_resource* HllSketchImpl::getResource() const {
+  return resource;
+}
+
 }
 
 #endif // _HLLSKETCHIMPL_H_
\ No newline at end of file
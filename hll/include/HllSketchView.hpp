@@ -0,0 +1,138 @@
+/*
+ * Copyright 2018, Yahoo! Inc. Licensed under the terms of the
+ * Apache License 2.0. See LICENSE file at the project root for terms.
+ */
+
+#ifndef _HLLSKETCHVIEW_HPP_
+#define _HLLSKETCHVIEW_HPP_
+
+#include "hll.hpp"
+#include "HllUtil.hpp"
+#include "HllPairIterator.hpp"
+#include "HllCompression.hpp"
+
+#include <istream>
+#include <memory>
+#include <vector>
+
+namespace datasketches {
+
+/**
+ * Read-only view of a serialized HllSketch, in either the compact or the
+ * updatable format.
+ *
+ * Nothing is copied or allocated on construction: the estimates come from the
+ * header fields and iteration reads the coupons or registers in place, so the
+ * bytes must outlive the view. Coupons and HLL_4 exceptions are read as ints,
+ * so the bytes must also be 4-byte aligned. A view can be passed directly to
+ * HllUnion::update().
+ */
+class HllSketchView {
+  public:
+    // throws std::invalid_argument if the bytes do not hold a valid sketch or
+    // are not 4-byte aligned
+    explicit HllSketchView(const void* bytes, const size_t sizeBytes);
+
+    double getEstimate() const;
+    double getCompositeEstimate() const;
+    double getLowerBound(const int numStdDev) const;
+    double getUpperBound(const int numStdDev) const;
+
+    int getLgConfigK() const;
+    TgtHllType getTgtHllType() const;
+    CurMode getCurMode() const;
+    bool isCompact() const;
+    bool isEmpty() const;
+    bool isOutOfOrderFlag() const;
+    // HLL registers entropy coded, see HllSketch::serializeCompressed()
+    bool isCompressed() const;
+    // HashPolicy::getSerialTag() of the policy the sketch was written under
+    uint8_t getHashTag() const;
+    // HashPolicy::getSeedHash() of that policy, 0 for the default one
+    uint16_t getSeedHash() const;
+    // true if the sketch was written under hashPolicy
+    bool hasHashPolicy(const HashPolicy& hashPolicy) const;
+
+    // number of bytes of the input occupied by the sketch
+    int getSerializationBytes() const;
+
+    // coupons in LIST or SET mode, registers in HLL mode
+    std::unique_ptr<PairIterator> getIterator() const;
+    // HLL_4 exceptions, or null if there are none
+    std::unique_ptr<PairIterator> getAuxIterator() const;
+
+    // Reads exactly one image from is into buffer, resized to hold it, and
+    // returns its size. Throws std::invalid_argument if the stream ends inside
+    // the image or does not start one.
+    static int read(std::istream& is, std::vector<uint8_t>& buffer);
+
+    // bytes if a view can be made of them, otherwise an aligned copy of them
+    // in buffer, for callers taking bytes from anywhere
+    static const void* aligned(const void* bytes, const size_t sizeBytes, std::vector<uint8_t>& buffer);
+
+  private:
+    // With checkSize false only the preamble need be there, enough to tell
+    // getSerializationBytes(). Nothing else may be used.
+    HllSketchView(const void* bytes, const size_t sizeBytes, const bool checkSize);
+
+    // Bytes of preamble of the image starting with these 8 bytes, throws
+    // std::invalid_argument if they do not start an HLL sketch.
+    static int getPreambleBytes(const uint8_t* header);
+
+    const uint8_t* bytes;
+    int lgConfigK;
+    TgtHllType tgtHllType;
+    CurMode curMode;
+    bool compact;
+    bool empty;
+    bool oooFlag;
+    bool compressed;
+    uint8_t hashTag;
+
+    // LIST and SET
+    int couponCount;
+
+    // HLL
+    int curMin;
+    int numAtCurMin;
+    double hipAccum;
+    double kxq0;
+    double kxq1;
+    int auxCount;
+
+    const uint8_t* data; // coupons, registers or coded registers
+    int dataInts;        // number of coupon ints, LIST and SET
+    int codedBytes;      // length of the coded registers, if compressed
+    const int* auxInts;  // HLL_4 exceptions, compact pairs or updatable hash table
+    int auxLen;
+    int lgAuxArrInts;    // size of the updatable hash table
+    uint16_t seedHash;
+    size_t serBytes;
+
+    friend class HllUnionPvt;
+    friend class HllViewIterator;
+    friend class CouponList;
+    friend class CouponHashSet;
+    friend class HllArray;
+};
+
+// iterates over the registers of an HLL mode view
+class HllViewIterator : public HllPairIterator {
+  public:
+    HllViewIterator(const HllSketchView& view, const int lengthPairs);
+    virtual int value();
+
+    virtual ~HllViewIterator();
+
+  private:
+    // the value of an AUX_TOKEN slot
+    int auxValue() const;
+
+    const HllSketchView& view;
+    // reads the registers of a compressed view, in slot order
+    std::unique_ptr<HllRegisterDecoder> decoder;
+};
+
+}
+
+#endif // _HLLSKETCHVIEW_HPP_
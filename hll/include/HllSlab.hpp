@@ -0,0 +1,60 @@
+/*
+ * Copyright 2018, Yahoo! Inc. Licensed under the terms of the
+ * Apache License 2.0. See LICENSE file at the project root for terms.
+ */
+
+#ifndef _HLLSLAB_HPP_
+#define _HLLSLAB_HPP_
+
+#include <cstdint>
+#include <memory_resource>
+#include <vector>
+
+namespace datasketches {
+
+/**
+ * Fixed-size blocks carved out of large chunks of a memory_resource, for
+ * containers of many small sketches. Blocks are named by index rather than
+ * by pointer, so an index stays valid as the slab grows, and are not moved.
+ * Released blocks are handed out again before new ones.
+ */
+class HllSlab {
+  public:
+    explicit HllSlab(const size_t blockBytes, std::pmr::memory_resource* resource);
+    ~HllSlab();
+
+    HllSlab(const HllSlab&) = delete;
+    HllSlab& operator=(const HllSlab&) = delete;
+
+    // index of a block of uninitialized bytes
+    uint32_t allocate();
+    void release(const uint32_t block);
+    uint8_t* get(const uint32_t block) const;
+
+    // releases every block, keeping the chunks for reuse
+    void clear();
+
+    size_t getBlockBytes() const;
+    // bytes of the chunks held
+    size_t getMemoryBytes() const;
+
+  private:
+    // about a megabyte per chunk, or one block if that is larger
+    static const int LG_CHUNK_BYTES = 20;
+
+    const size_t blockBytes;
+    const int lgBlocksPerChunk;
+    std::pmr::memory_resource* resource;
+    std::pmr::vector<uint8_t*> chunks;
+    std::pmr::vector<uint32_t> freeBlocks;
+    uint32_t numBlocks; // handed out from the chunks, released or not
+};
+
+inline uint8_t* HllSlab::get(const uint32_t block) const {
+  const uint32_t blockMask = (1u << lgBlocksPerChunk) - 1;
+  return chunks[block >> lgBlocksPerChunk] + ((block & blockMask) * blockBytes);
+}
+
+}
+
+#endif // _HLLSLAB_HPP_
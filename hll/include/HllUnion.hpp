@@ -10,8 +10,15 @@
 #include "HllUtil.hpp"
 #include "HllSketch.hpp"
 
+#include <atomic>
+#include <memory>
+#include <vector>
+
 namespace datasketches {
 
+class HllArray;
+class Hll8Array;
+
 /**
  * This performs union operations for HLL sketches. This union operator is configured with a
  * <i>lgMaxK</i> instead of the normal <i>lgConfigK</i>.
@@ -38,9 +45,14 @@ namespace datasketches {
  */
 class HllUnionPvt : public HllUnion {
   public:
-    explicit HllUnionPvt(const int lgMaxK);
+    explicit HllUnionPvt(const int lgMaxK, std::pmr::memory_resource* resource = nullptr,
+                         const HashPolicy& hashPolicy = HashPolicy());
     explicit HllUnionPvt(HllSketch& sketch);
-    static HllUnionPvt* deserialize(std::istream& is);
+    static HllUnionPvt* deserialize(std::istream& is, std::pmr::memory_resource* resource,
+                                    const HashPolicy& hashPolicy = HashPolicy());
+    static HllUnionPvt* deserialize(const void* bytes, const size_t sizeBytes,
+                                    std::pmr::memory_resource* resource,
+                                    const HashPolicy& hashPolicy = HashPolicy());
 
     virtual ~HllUnionPvt();
 
@@ -51,9 +63,11 @@ class HllUnionPvt : public HllUnion {
 
     virtual int getCompactSerializationBytes() const;
     virtual int getUpdatableSerializationBytes() const;
+    virtual int getCompressedSerializationBytes() const;
     virtual int getLgConfigK() const;
 
     virtual TgtHllType getTgtHllType() const;
+    virtual const HashPolicy& getHashPolicy() const;
     virtual bool isCompact() const;
     virtual bool isEmpty() const;
 
@@ -61,9 +75,17 @@ class HllUnionPvt : public HllUnion {
 
     virtual HllSketch* getResult() const;
     virtual HllSketch* getResult(TgtHllType tgtHllType) const;
+    virtual std::shared_ptr<const HllSketch> getSharedResult(TgtHllType tgtHllType = HLL_4) const;
 
     virtual void serializeCompact(std::ostream& os) const;
     virtual void serializeUpdatable(std::ostream& os) const;
+    virtual std::pair<ptr_with_deleter, const size_t> serializeCompact(unsigned header_size_bytes = 0) const;
+    virtual std::pair<ptr_with_deleter, const size_t> serializeUpdatable(unsigned header_size_bytes = 0) const;
+    virtual size_t serializeCompact(void* dst, const size_t capacityBytes) const;
+    virtual size_t serializeUpdatable(void* dst, const size_t capacityBytes) const;
+    virtual void serializeCompressed(std::ostream& os) const;
+    virtual std::pair<ptr_with_deleter, const size_t> serializeCompressed(unsigned header_size_bytes = 0) const;
+    virtual size_t serializeCompressed(void* dst, const size_t capacityBytes) const;
 
     virtual std::ostream& to_string(std::ostream& os,
                                     const bool summary = true,
@@ -73,6 +95,11 @@ class HllUnionPvt : public HllUnion {
 
     virtual void update(const HllSketch& sketch);
     virtual void update(const HllSketch* sketch);
+    virtual void update(const HllSketchView& sketch);
+    virtual void updateSerialized(const void* bytes, const size_t sizeBytes);
+    virtual void updateSerialized(std::istream& is);
+    virtual void updateAll(const HllSketch* const* sketches, const size_t n, const int numThreads = 0);
+    virtual void updateAll(const HllSketchView* sketches, const size_t n, const int numThreads = 0);
     virtual void update(const std::string datum);
     virtual void update(const uint64_t datum);
     virtual void update(const uint32_t datum);
@@ -85,8 +112,15 @@ class HllUnionPvt : public HllUnion {
     virtual void update(const double datum);
     virtual void update(const float datum);
     virtual void update(const void* data, const size_t lengthBytes);
+    virtual void updateBatch(const uint64_t* data, const size_t n);
+    virtual void updateBatch(const int32_t* data, const size_t n);
+    virtual void updateBatch(const double* data, const size_t n);
+    virtual void updateBatch(const std::string_view* data, const size_t n);
+    virtual void update(const HashState& hash);
+    virtual void updateBatch(const HashState* hashes, const size_t n);
 
-    void couponUpdate(const int coupon);
+    virtual void couponUpdate(const int coupon);
+    virtual void couponUpdate(const int* coupons, const size_t n);
 
     CurMode getCurrentMode() const;
     int getSerializationVersion() const;
@@ -109,15 +143,75 @@ class HllUnionPvt : public HllUnion {
     */
     void unionImpl(HllSketchImpl* incomingImpl, const int lgMaxK);
 
-    static HllSketchImpl* copyOrDownsampleHll(HllSketchImpl* srcImpl, const int tgtLgK);
+    // the result is allocated from resource
+    static HllSketchImpl* copyOrDownsampleHll(HllSketchImpl* srcImpl, const int tgtLgK,
+                                              std::pmr::memory_resource* resource);
+
+    // Register-wise max of a source register array of the given type and
+    // lgConfigK into dst, of the same or a smaller lgConfigK, onto which a
+    // larger source is folded as coupons are downsampled. auxItr holds the
+    // HLL_4 exceptions and may be null. Rebuilds kxq0, kxq1 and numAtCurMin
+    // from the merged registers; hipAccum is left alone since the result is
+    // always out of order or gets the hipAccum of the source.
+    static void mergeHllRegisters(Hll8Array& dst, const TgtHllType srcType, const uint8_t* srcArr,
+                                  const int srcLgK, const int srcCurMin, PairIterator* auxItr);
+    // the same for an HLL mode array, its exceptions read in place
+    static void mergeHllRegisters(Hll8Array& dst, const HllArray& src);
+    // the same for an HLL mode view, compressed or not
+    static void mergeHllRegisters(Hll8Array& dst, const HllSketchView& src);
+    static void mergeAuxPairs(Hll8Array& dst, PairIterator* auxItr);
+    // folds len unpacked register values of the slots from start into dst
+    static void foldBlock(Hll8Array& dst, const int start, const uint8_t* values, const int len);
+    // kxq0, kxq1 and numAtCurMin from the registers of dst, or their counts
+    static void refreshEstimators(Hll8Array& dst);
+    static void putEstimators(Hll8Array& dst, const int* counts);
+
+    // Calls fn(firstSlot, values, len) over the register values of an HLL
+    // mode view in slot order, a block of HllKernels::BLOCK_SLOTS at a time,
+    // with HLL_4 exceptions resolved and coded registers decoded on the way.
+    template<typename Fn>
+    static void forEachRegisterBlock(const HllSketchView& src, Fn fn);
+    // copyOrDownsampleHll() of an HLL mode view
+    static Hll8Array* copyOrDownsampleHll(const HllSketchView& src, const int tgtLgK,
+                                          std::pmr::memory_resource* resource);
+
+    // updateAll() for either kind of input
+    template<typename Source>
+    void parallelUpdate(const Source* sources, const size_t n, int numThreads);
 
     // calls couponUpdate on sketch, freeing the old sketch upon changes in CurMode
     static HllSketchImpl* leakFreeCouponUpdate(HllSketchImpl* impl, const int coupon);
 
+    // unions a LIST or SET src into an empty, LIST or SET dst, in bulk unless
+    // the result is an HLL; frees dst if it is replaced
+    static HllSketchImpl* unionCoupons(HllSketchImpl* dstImpl, const HllSketchImpl* srcImpl);
+    // the same for the coupon array of a serialized LIST or SET, EMPTY slots included
+    static HllSketchImpl* unionCoupons(HllSketchImpl* dstImpl, const int* srcCoupons, const int srcLen);
+
+    // drops the cached results, called before anything that modifies the gadget
+    void invalidateResults();
+
     const int lgMaxK;
     HllSketchPvt* gadget;
+    // holds the image read by updateSerialized(std::istream&), or an aligned
+    // copy of unaligned bytes given to it, kept to be reused
+    std::vector<uint8_t> streamBuffer;
+
+    // getSharedResult() per TgtHllType, built on demand
+    mutable std::shared_ptr<const HllSketch> results[3];
+    mutable std::atomic<bool> hasResults{false};
 };
 
+inline void HllUnionPvt::invalidateResults() {
+  // only the relaxed flag check is paid on the update path
+  if (hasResults.load(std::memory_order_relaxed)) {
+    for (std::shared_ptr<const HllSketch>& result : results) {
+      std::atomic_store(&result, std::shared_ptr<const HllSketch>());
+    }
+    hasResults.store(false, std::memory_order_relaxed);
+  }
+}
+
 }
 
 #endif // _HLLUNION_H_
\ No newline at end of file
@@ -11,11 +11,14 @@
 #include <cassert>
 #include <cmath>
 #include <exception>
+#include <memory_resource>
 #include <string>
 #include <sstream>
 
 namespace datasketches {
 
+class HashPolicy;
+
 enum CurMode { LIST = 0, SET, HLL };
 
 class HllUtil {
@@ -27,6 +30,8 @@ public:
   static const int EMPTY_FLAG_MASK          = 4;
   static const int COMPACT_FLAG_MASK        = 8;
   static const int OUT_OF_ORDER_FLAG_MASK   = 16;
+  // compact HLL image with entropy coded registers, see HllCompression
+  static const int COMPRESSED_FLAG_MASK     = 64;
 
   // Coupon List
   static const int LIST_INT_ARR_START = 8;
@@ -50,6 +55,9 @@ public:
 
   static const uint64_t DEFAULT_UPDATE_SEED = 9001L;
 
+  // number of keys hashed together by the batch update paths
+  static const int BATCH_SIZE = 64;
+
   static const double HLL_HIP_RSE_FACTOR; // sqrt(log(2.0)) = 0.8325546
   static const double HLL_NON_HIP_RSE_FACTOR; // sqrt((3.0 * log(2.0)) - 1.0) = 1.03896
   static const double COUPON_RSE_FACTOR; // 0.409 at transition point not the asymptote
@@ -73,6 +81,26 @@ public:
   static int coupon(const uint64_t hash[]);
   static int coupon(const HashState& hashState);
   static void hash(const void* key, const int keyLen, const uint64_t seed, HashState& result);
+  // bit-identical to hash() followed by coupon() on each 8-byte key
+  static void couponsFromLongs(const uint64_t* keys, const int numKeys, const uint64_t seed, int* coupons);
+  // the same as HashPolicy::hash() followed by coupon() on each 8-byte key
+  static void couponsFromLongs(const uint64_t* keys, const int numKeys, const HashPolicy& hashPolicy,
+                               int* coupons);
+  // HashPolicy::FAST_MIX of a key of up to 8 bytes: two independent splitmix64
+  // finalizer chains over the seeded key, the length folded into the second
+  static void fastMix(const uint64_t key, const size_t keyLen, const uint64_t seed, HashState& result);
+
+  // the HashPolicy::SEED_HASH_BYTES ending an image of a non-default policy
+  static void writeSeedHash(uint8_t* dst, const HashPolicy& hashPolicy);
+
+  // Sketch internals allocate from a std::pmr::memory_resource. A header in
+  // front of each block records the resource and size, so deallocate()
+  // needs neither. resourceOrDefault() maps nullptr to the default resource.
+  static void* allocate(std::pmr::memory_resource* resource, const size_t bytes);
+  static void deallocate(void* ptr);
+  template<typename T>
+  static T* newArray(std::pmr::memory_resource* resource, const size_t n);
+  static std::pmr::memory_resource* resourceOrDefault(std::pmr::memory_resource* resource);
 
   static int checkLgK(const int lgK);
   static void checkMemSize(const uint64_t minBytes, const uint64_t capBytes);
@@ -104,7 +132,20 @@ inline int HllUtil::coupon(const HashState& hashState) {
 }
 
 inline void HllUtil::hash(const void* key, const int keyLen, const uint64_t seed, HashState& result) {
-  MurmurHash3_x64_128(key, keyLen, DEFAULT_UPDATE_SEED, result);
+  MurmurHash3_x64_128(key, keyLen, seed, result);
+}
+
+static inline uint64_t splitmix64Finalize(uint64_t z) {
+  z = (z ^ (z >> 30)) * BIG_CONSTANT(0xbf58476d1ce4e5b9);
+  z = (z ^ (z >> 27)) * BIG_CONSTANT(0x94d049bb133111eb);
+  return z ^ (z >> 31);
+}
+
+inline void HllUtil::fastMix(const uint64_t key, const size_t keyLen, const uint64_t seed, HashState& result) {
+  static const uint64_t golden = BIG_CONSTANT(0x9e3779b97f4a7c15);
+  const uint64_t x = key ^ seed;
+  result.h1 = splitmix64Finalize(x + golden);
+  result.h2 = splitmix64Finalize((x ^ (keyLen << 56)) + 2 * golden);
 }
 
 inline double HllUtil::getRelErr(const bool upperBound, const bool unioned,
@@ -112,6 +153,15 @@ inline double HllUtil::getRelErr(const bool upperBound, const bool unioned,
   return RelativeErrorTables::getRelErr(upperBound, unioned, lgConfigK, numStdDev);
 }
 
+template<typename T>
+inline T* HllUtil::newArray(std::pmr::memory_resource* resource, const size_t n) {
+  return static_cast<T*>(allocate(resource, n * sizeof(T)));
+}
+
+inline std::pmr::memory_resource* HllUtil::resourceOrDefault(std::pmr::memory_resource* resource) {
+  return (resource == nullptr) ? std::pmr::get_default_resource() : resource;
+}
+
 inline int HllUtil::checkLgK(const int lgK) {
   if ((lgK >= HllUtil::MIN_LOG_K) && (lgK <= HllUtil::MAX_LOG_K)) { return lgK; }
   std::stringstream ss;
@@ -208,6 +258,9 @@ inline unsigned int HllUtil::getNumberOfLeadingZeros(const uint64_t x) {
   if (x == 0)
     return 64;
 
+#if defined(__GNUC__)
+  return __builtin_clzll(x);
+#else
   // we know at least some 1 bit, so iterate until it's in leftmost position
   // -- making endian assumptions here
   unsigned int n = 0;
@@ -217,6 +270,7 @@ inline unsigned int HllUtil::getNumberOfLeadingZeros(const uint64_t x) {
     val <<= 1;
   }
   return n;
+#endif
 }
 
 }
@@ -0,0 +1,161 @@
+/*
+ * Copyright 2018, Yahoo! Inc. Licensed under the terms of the
+ * Apache License 2.0. See LICENSE file at the project root for terms.
+ */
+
+#ifndef _KEYEDHLLSKETCH_HPP_
+#define _KEYEDHLLSKETCH_HPP_
+
+#include "hll.hpp"
+#include "HllUtil.hpp"
+#include "HllSlab.hpp"
+
+#include <cstring>
+#include <memory>
+#include <vector>
+
+namespace datasketches {
+
+// Contains the non-public API for KeyedHllSketch
+class KeyedHllSketchPvt final : public KeyedHllSketch {
+  public:
+    explicit KeyedHllSketchPvt(const int lgConfigK, std::pmr::memory_resource* resource,
+                               const HashPolicy& hashPolicy);
+    virtual ~KeyedHllSketchPvt();
+
+    virtual void update(const uint64_t key, const uint64_t value);
+    virtual void update(const uint64_t key, const std::string& value);
+    virtual void update(const uint64_t* keys, const uint64_t* values, const size_t n);
+    virtual void couponUpdate(const uint64_t key, const int coupon);
+
+    virtual double getEstimate(const uint64_t key) const;
+    virtual double getLowerBound(const uint64_t key, const int numStdDev) const;
+    virtual double getUpperBound(const uint64_t key, const int numStdDev) const;
+    virtual HllSketch* getResult(const uint64_t key, const TgtHllType tgtHllType = HLL_8) const;
+
+    virtual void forEach(const std::function<void(const uint64_t, const double)>& fn) const;
+
+    virtual size_t getNumKeys() const;
+    virtual int getLgConfigK() const;
+    virtual const HashPolicy& getHashPolicy() const;
+    virtual size_t getMemoryBytes() const;
+
+    virtual void serialize(std::ostream& os) const;
+
+    virtual void reset();
+
+    // coupons a sketch holds before it moves to a set slab, a cache line of
+    // them, or as many as an HllSketch holds in LIST mode below lgConfigK 8,
+    // where it goes straight to the register slab
+    static const int LIST_COUPONS = 16;
+    static int getListCapacity(const int lgConfigK);
+
+    // adds the sketch of a new key from its image, for deserialize()
+    void add(const uint64_t key, const uint8_t* bytes, const int sizeBytes);
+
+  private:
+    // An index slot. count is the number of coupons while the sketch is in the
+    // coupon slab or a set slab, HLL_COUNT once it is in the register slab. A
+    // free slot has block FREE_BLOCK.
+    struct Entry {
+      uint64_t key;
+      uint32_t block;
+      uint32_t count;
+    };
+    static const uint32_t HLL_COUNT = 0xFFFFFFFF;
+    static const uint32_t FREE_BLOCK = 0xFFFFFFFF;
+    static const int LG_INIT_ENTRIES = 4;
+
+    // the index slot of key, or of the free slot where it would go
+    size_t findSlot(const uint64_t key) const;
+    // the entry of key, created with an empty coupon block if new; the
+    // index must have room for it, see reserve()
+    Entry& getOrAddEntry(const uint64_t key);
+    const Entry* findEntry(const uint64_t key) const;
+    // grows the index so that n more keys fit under the load factor
+    void reserve(const size_t n);
+    void resize(const int newLgEntries);
+
+    void couponUpdate(Entry& entry, const int coupon);
+    void setUpdate(Entry& entry, const int coupon);
+    // moves the coupons of a block and coupon into a new set block of lgArrInts
+    void moveToSet(Entry& entry, const int lgArrInts, const int coupon);
+    // moves the coupons of a full block and coupon into a new register block
+    void promote(Entry& entry, const int coupon);
+    // raises a register of a block and its HIP and kxq estimators, as
+    // HllArray::hipAndKxQIncrementalUpdate() does
+    void registerUpdate(uint8_t* mem, const int coupon) const;
+    void prefetch(const Entry& entry, const int coupon) const;
+
+    double getEstimate(const Entry& entry) const;
+    double getLowerBound(const Entry& entry, const int numStdDev) const;
+    double getUpperBound(const Entry& entry, const int numStdDev) const;
+    // the coupon block of a LIST or SET sketch, EMPTY where unused, and its
+    // length in ints
+    const int* getCoupons(const Entry& entry) const;
+    int getCouponsLength(const Entry& entry) const;
+    const uint8_t* getImage(const Entry& entry) const;
+    // the slab holding the block of entry
+    HllSlab& getSlab(const Entry& entry);
+    bool isSet(const Entry& entry) const;
+    // size of the set block of count coupons, as CouponHashSet grows its table
+    static int getLgSetInts(const uint32_t count);
+
+    const int lgConfigK;
+    const uint32_t listCapacity;
+    std::pmr::memory_resource* resource;
+    const HashPolicy hashPolicy;
+
+    Entry* entries;
+    int lgEntries;
+    size_t numKeys;
+
+    HllSlab couponSlab;
+    // Hash tables of coupons, as in a CouponHashSet, one slab per size from
+    // 2^LG_INIT_SET_SIZE to 2^(lgConfigK - 3) ints. A sketch moves to the
+    // register slab where an HllSketch would go to HLL mode. None below
+    // lgConfigK 8.
+    std::vector<std::unique_ptr<HllSlab>> setSlabs;
+    HllSlab registerSlab;
+    // preamble of a new register block, an updatable HLL_8 image
+    uint8_t header[HllUtil::HLL_BYTE_ARR_START];
+};
+
+inline size_t KeyedHllSketchPvt::findSlot(const uint64_t key) const {
+  const size_t mask = ((size_t) 1 << lgEntries) - 1;
+  size_t slot = splitmix64Finalize(key) & mask;
+  while ((entries[slot].block != FREE_BLOCK) && (entries[slot].key != key)) {
+    slot = (slot + 1) & mask;
+  }
+  return slot;
+}
+
+inline void KeyedHllSketchPvt::registerUpdate(uint8_t* mem, const int coupon) const {
+  const int slotNo = HllUtil::getLow26(coupon) & ((1 << lgConfigK) - 1);
+  const int newVal = HllUtil::getValue(coupon);
+  uint8_t* reg = mem + HllUtil::HLL_BYTE_ARR_START + slotNo;
+  const int curVal = *reg;
+  if (newVal <= curVal) { return; }
+  *reg = (uint8_t) newVal;
+
+  // the estimators where writeHeader() puts them
+  double hipAccum;
+  double kxq[2];
+  std::memcpy(&hipAccum, mem + 8, sizeof(hipAccum));
+  std::memcpy(kxq, mem + 16, sizeof(kxq));
+  hipAccum += (1 << lgConfigK) / (kxq[0] + kxq[1]);
+  kxq[curVal >> 5] -= HllUtil::invPow2(curVal);
+  kxq[newVal >> 5] += HllUtil::invPow2(newVal);
+  std::memcpy(mem + 8, &hipAccum, sizeof(hipAccum));
+  std::memcpy(mem + 16, kxq, sizeof(kxq));
+  if (curVal == 0) {
+    int numAtCurMin;
+    std::memcpy(&numAtCurMin, mem + 32, sizeof(numAtCurMin));
+    --numAtCurMin; // num zeros for HLL_8
+    std::memcpy(mem + 32, &numAtCurMin, sizeof(numAtCurMin));
+  }
+}
+
+}
+
+#endif // _KEYEDHLLSKETCH_HPP_
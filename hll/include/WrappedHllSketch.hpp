@@ -0,0 +1,53 @@
+/*
+ * Copyright 2018, Yahoo! Inc. Licensed under the terms of the
+ * Apache License 2.0. See LICENSE file at the project root for terms.
+ */
+
+#ifndef _WRAPPEDHLLSKETCH_HPP_
+#define _WRAPPEDHLLSKETCH_HPP_
+
+#include "HllSketch.hpp"
+
+namespace datasketches {
+
+/**
+ * HllSketch updated in place in caller-owned memory, see HllSketch::writableWrap().
+ *
+ * The coupon, register and aux arrays of the implementation point into the
+ * image, so an update only touches the slots it changes plus the preamble.
+ * A mode change or a grown table allocates on the heap as usual; the next
+ * sync moves the new layout into the buffer, growing it first if needed.
+ */
+class WrappedHllSketch final : public HllSketchPvt {
+  public:
+    explicit WrappedHllSketch(void* mem, const size_t capBytes,
+                              void* (*reallocate)(void* mem, size_t sizeBytes));
+    virtual ~WrappedHllSketch();
+
+    virtual void reset();
+    virtual void couponUpdate(const int coupon);
+    virtual void couponUpdate(const int* coupons, const size_t n);
+
+    virtual void* getMemory() const;
+
+  private:
+    // writes the preamble, or rebinds the whole image if the layout changed
+    void syncMemory();
+    void bindMemory();
+
+    uint8_t* mem;
+    size_t capBytes;
+    void* (*reallocate)(void* mem, size_t sizeBytes);
+};
+
+inline void WrappedHllSketch::syncMemory() {
+  if (hllSketchImpl->isWrapped()) {
+    hllSketchImpl->writeHeader(mem, false);
+  } else {
+    bindMemory();
+  }
+}
+
+}
+
+#endif // _WRAPPEDHLLSKETCH_HPP_
@@ -6,7 +6,15 @@
 #ifndef _HLL_H_
 #define _HLL_H_
 
+#include "MurmurHash3.h"
+
+#include <functional>
 #include <iostream>
+#include <memory>
+#include <memory_resource>
+#include <string>
+#include <string_view>
+#include <utility>
 
 namespace datasketches {
 
@@ -17,13 +25,114 @@ enum TgtHllType {
     HLL_8
 };
 
+class HllSketchView;
+
+/**
+ * How a sketch hashes keys into coupons.
+ *
+ * The default, MurmurHash3 x64_128 with DEFAULT_SEED, is what the Java library
+ * uses, so only default-policy sketches are interchangeable with it. FAST_MIX
+ * is an opt-in 128-bit mixer for keys of 8 bytes or fewer (all integer and
+ * floating point updates); longer keys are still hashed with MurmurHash3 and
+ * the policy's seed. Different policies give different coupons for the same
+ * key, so sketches may only be merged with and deserialized as sketches of the
+ * same policy. Images of a non-default policy carry a 4-bit tag of it in the
+ * mode byte and its 16-bit seed hash after the sketch data, both of which
+ * deserialize() and HllUnion check.
+ */
+class HashPolicy {
+  public:
+    enum Function { MURMUR3, FAST_MIX };
+
+    static const uint64_t DEFAULT_SEED = 9001;
+
+    explicit HashPolicy(const Function function = MURMUR3, const uint64_t seed = DEFAULT_SEED);
+
+    Function getFunction() const;
+    uint64_t getSeed() const;
+
+    void hash(const void* data, const size_t lengthBytes, HashState& result) const;
+
+    // 0 for the default policy, otherwise 1-15 derived from the function and seed
+    uint8_t getSerialTag() const;
+    // 0 for the default policy, otherwise a nonzero 16-bit hash of the function
+    // and seed, like the seed hash of CPC sketches
+    uint16_t getSeedHash() const;
+    // Images of a non-default policy are this much longer, the seed hash and
+    // padding to a whole int. getSeedHashBytes() is 0 or SEED_HASH_BYTES.
+    static const int SEED_HASH_BYTES = 4;
+    int getSeedHashBytes() const;
+
+    bool operator==(const HashPolicy& that) const;
+    bool operator!=(const HashPolicy& that) const;
+
+  private:
+    Function function;
+    uint64_t seed;
+};
+
+// owns a serialized image together with the means to free it
+typedef std::unique_ptr<void, void(*)(void*)> ptr_with_deleter;
+
 class HllSketch {
   public:
-    static HllSketch* newInstance(const int lgConfigK, const TgtHllType tgtHllType = HLL_4);
-    static HllSketch* deserialize(std::istream& is);
+    /**
+     * The coupon, register and aux arrays and the objects holding them come
+     * from resource, or from the default memory resource if null. Copies,
+     * results and later modes of the sketch use the same resource, which must
+     * outlive them all. reset() keeps the HLL registers for the next time the
+     * sketch reaches HLL mode, so a sketch reset and refilled every period
+     * does not reallocate them.
+     * A copy shares the registers (see copy()), and whichever of the sketch
+     * and its copies goes last frees them. So when copies live on other
+     * threads, the resource must be safe to use from several threads, as
+     * the default one is.
+     */
+    static HllSketch* newInstance(const int lgConfigK, const TgtHllType tgtHllType = HLL_4,
+                                  std::pmr::memory_resource* resource = nullptr,
+                                  const HashPolicy& hashPolicy = HashPolicy());
+    /**
+     * Like newInstance(), but for many small sketches: until promoted to HLL
+     * the coupons are kept sorted and delta-encoded, in about half the memory
+     * of the LIST and SET modes once past a hundred or so coupons. Updates get
+     * slower as the sketch grows, and the sketch is promoted to HLL no later
+     * than a SET would be, or earlier once the coupons would take more memory
+     * than the registers.
+     * Serialized images are the usual LIST and SET ones. Copies and resets
+     * stay sparse, deserialized sketches do not.
+     */
+    static HllSketch* newSparseInstance(const int lgConfigK, const TgtHllType tgtHllType = HLL_4,
+                                        std::pmr::memory_resource* resource = nullptr,
+                                        const HashPolicy& hashPolicy = HashPolicy());
+    // throws std::invalid_argument if the image was written under another hash policy
+    static HllSketch* deserialize(std::istream& is, std::pmr::memory_resource* resource = nullptr,
+                                  const HashPolicy& hashPolicy = HashPolicy());
+    static HllSketch* deserialize(const void* bytes, const size_t sizeBytes,
+                                  std::pmr::memory_resource* resource = nullptr,
+                                  const HashPolicy& hashPolicy = HashPolicy());
+
+    /**
+     * Updates the updatable image in mem (see serializeUpdatable()) in place,
+     * always with the default HashPolicy:
+     * registers, estimator fields and the aux table all live in mem, which must
+     * be 4-byte aligned and outlive the sketch. Deleting the sketch leaves a
+     * valid image behind.
+     *
+     * When a mode change or a grown table needs more than capBytes, reallocate
+     * is called with the buffer and the size required. It must return a buffer
+     * of at least that size holding the current contents, as std::realloc does,
+     * or nullptr to refuse, in which case the update throws
+     * std::invalid_argument. getMemory() tells where the image lives now.
+     */
+    static HllSketch* writableWrap(void* mem, const size_t capBytes,
+                                   void* (*reallocate)(void* mem, size_t sizeBytes) = nullptr);
 
     virtual ~HllSketch();
 
+    // In HLL mode the copy shares the registers with this sketch until either
+    // side writes to them, so copy() and copyAs() to the same type are O(1).
+    // A copy may be read by other threads while the original keeps updating,
+    // provided the sketch's memory resource is thread safe, see newInstance().
     virtual HllSketch* copy() const = 0;
     virtual HllSketch* copyAs(const TgtHllType tgtHllType) const = 0;
 
@@ -32,6 +141,27 @@ class HllSketch {
     virtual void serializeCompact(std::ostream& os) const = 0;
     virtual void serializeUpdatable(std::ostream& os) const = 0;
 
+    // serializes into a newly allocated buffer, leaving the first
+    // header_size_bytes free for the caller
+    virtual std::pair<ptr_with_deleter, const size_t> serializeCompact(unsigned header_size_bytes = 0) const = 0;
+    virtual std::pair<ptr_with_deleter, const size_t> serializeUpdatable(unsigned header_size_bytes = 0) const = 0;
+
+    // serializes into dst and returns the number of bytes written,
+    // throws std::invalid_argument if capacityBytes is too small
+    virtual size_t serializeCompact(void* dst, const size_t capacityBytes) const = 0;
+    virtual size_t serializeUpdatable(void* dst, const size_t capacityBytes) const = 0;
+
+    /**
+     * The compact image with the HLL registers entropy coded at about 3 bits
+     * each: some 30% smaller than the compact image of HLL_4, 50% of HLL_6 and
+     * 65% of HLL_8. deserialize(), HllSketchView and HllUnion read it like any
+     * other image, the Java library does not. In LIST and SET mode, and where
+     * coding would not save space, this is the plain compact image.
+     */
+    virtual void serializeCompressed(std::ostream& os) const = 0;
+    virtual std::pair<ptr_with_deleter, const size_t> serializeCompressed(unsigned header_size_bytes = 0) const = 0;
+    virtual size_t serializeCompressed(void* dst, const size_t capacityBytes) const = 0;
+
     virtual std::ostream& to_string(std::ostream& os,
                                     const bool summary = true,
                                     const bool detail = false,
@@ -51,6 +181,27 @@ class HllSketch {
     virtual void update(const float datum) = 0;
     virtual void update(const void* data, const size_t lengthBytes) = 0;
 
+    /**
+     * Batch updates: each of the n elements is treated as a separate datum, with
+     * the same result as n calls to the corresponding single-value update().
+     * They are not overloads of update(), where update(&x, sizeof(x)) has to
+     * keep hashing the bytes of x.
+     */
+    virtual void updateBatch(const uint64_t* data, const size_t n) = 0;
+    virtual void updateBatch(const int32_t* data, const size_t n) = 0;
+    virtual void updateBatch(const double* data, const size_t n) = 0;
+    virtual void updateBatch(const std::string_view* data, const size_t n) = 0;
+
+    /**
+     * Pre-hashed updates, for callers that already hash their keys. To match the
+     * sketch updated by value, the hash must be what getHashPolicy().hash() returns
+     * for the same bytes, and coupons must come from HllSketch::coupon().
+     */
+    virtual void update(const HashState& hash) = 0;
+    virtual void updateBatch(const HashState* hashes, const size_t n) = 0;
+    virtual void couponUpdate(const int coupon) = 0;
+    virtual void couponUpdate(const int* coupons, const size_t n) = 0;
+
     virtual double getEstimate() const = 0;
     virtual double getCompositeEstimate() const = 0;
     virtual double getLowerBound(int numStdDev) const = 0;
@@ -58,17 +209,23 @@ class HllSketch {
 
     virtual int getLgConfigK() const = 0;
     virtual TgtHllType getTgtHllType() const = 0;
+    virtual const HashPolicy& getHashPolicy() const = 0;
 
     virtual bool isCompact() const = 0;
     virtual bool isEmpty() const = 0;
 
     virtual int getUpdatableSerializationBytes() const = 0;
     virtual int getCompactSerializationBytes() const = 0;
+    virtual int getCompressedSerializationBytes() const = 0;
+
+    // the buffer of a writableWrap() sketch, nullptr for a heap sketch
+    virtual void* getMemory() const = 0;
 
     /**
      * Returns the maximum size in bytes that this sketch can grow to given lgConfigK.
      * However, for the HLL_4 sketch type, this value can be exceeded in extremely rare cases.
-     * If exceeded, it will be larger by only a few percent.
+     * If exceeded, it will be larger by only a few percent. Sketches of a
+     * non-default HashPolicy add HashPolicy::SEED_HASH_BYTES.
      *
      * @param lgConfigK The Log2 of K for the target HLL sketch. This value must be
      * between 4 and 21 inclusively.
@@ -79,12 +236,24 @@ class HllSketch {
     static double getRelErr(const bool upperBound, const bool unioned,
                             const int lgConfigK, const int numStdDev);
 
+    // the hash (under the default policy) and coupon used by update(), exposed
+    // for the pre-hashed updates
+    static void hash(const void* data, const size_t lengthBytes, HashState& result);
+    static int coupon(const HashState& hash);
+
 };
 
 class HllUnion {
   public:
-    static HllUnion* newInstance(const int lgMaxK);
-    static HllUnion* deserialize(std::istream& is);
+    // resource and hashPolicy as for HllSketch::newInstance(), results use
+    // them as well. Only sketches of the same hash policy can be merged.
+    static HllUnion* newInstance(const int lgMaxK, std::pmr::memory_resource* resource = nullptr,
+                                 const HashPolicy& hashPolicy = HashPolicy());
+    static HllUnion* deserialize(std::istream& is, std::pmr::memory_resource* resource = nullptr,
+                                 const HashPolicy& hashPolicy = HashPolicy());
+    static HllUnion* deserialize(const void* bytes, const size_t sizeBytes,
+                                 std::pmr::memory_resource* resource = nullptr,
+                                 const HashPolicy& hashPolicy = HashPolicy());
 
     virtual ~HllUnion();
 
@@ -95,9 +264,11 @@ class HllUnion {
 
     virtual int getCompactSerializationBytes() const = 0;
     virtual int getUpdatableSerializationBytes() const = 0;
+    virtual int getCompressedSerializationBytes() const = 0;
     virtual int getLgConfigK() const = 0;
 
     virtual TgtHllType getTgtHllType() const = 0;
+    virtual const HashPolicy& getHashPolicy() const = 0;
     virtual bool isCompact() const = 0;
     virtual bool isEmpty() const = 0;
 
@@ -106,9 +277,34 @@ class HllUnion {
     virtual HllSketch* getResult() const = 0;
     virtual HllSketch* getResult(TgtHllType tgtHllType) const = 0;
 
+    /**
+     * Returns the result of the union as a shared, read-only sketch. The
+     * result for each TgtHllType is built once and handed out again until
+     * the union next changes, so repeated calls between updates cost no
+     * conversion or copy. Handles already returned stay valid after the
+     * union changes; they keep the result they were given. getResult()
+     * copies from the same cache.
+     */
+    virtual std::shared_ptr<const HllSketch> getSharedResult(TgtHllType tgtHllType = HLL_4) const = 0;
+
     virtual void serializeCompact(std::ostream& os) const = 0;
     virtual void serializeUpdatable(std::ostream& os) const = 0;
 
+    // serializes into a newly allocated buffer, leaving the first
+    // header_size_bytes free for the caller
+    virtual std::pair<ptr_with_deleter, const size_t> serializeCompact(unsigned header_size_bytes = 0) const = 0;
+    virtual std::pair<ptr_with_deleter, const size_t> serializeUpdatable(unsigned header_size_bytes = 0) const = 0;
+
+    // serializes into dst and returns the number of bytes written,
+    // throws std::invalid_argument if capacityBytes is too small
+    virtual size_t serializeCompact(void* dst, const size_t capacityBytes) const = 0;
+    virtual size_t serializeUpdatable(void* dst, const size_t capacityBytes) const = 0;
+
+    // the compact image with entropy coded registers, see HllSketch::serializeCompressed()
+    virtual void serializeCompressed(std::ostream& os) const = 0;
+    virtual std::pair<ptr_with_deleter, const size_t> serializeCompressed(unsigned header_size_bytes = 0) const = 0;
+    virtual size_t serializeCompressed(void* dst, const size_t capacityBytes) const = 0;
+
     virtual std::ostream& to_string(std::ostream& os,
                                     const bool summary = true,
                                     const bool detail = false,
@@ -117,6 +313,31 @@ class HllUnion {
 
     virtual void update(const HllSketch& sketch) = 0;
     virtual void update(const HllSketch* sketch) = 0;
+    // unions a serialized sketch in place, see HllSketchView
+    virtual void update(const HllSketchView& sketch) = 0;
+
+    /**
+     * Unions a serialized sketch straight from its image, in any of the
+     * formats: the coupons or registers are read in place and folded into the
+     * union, downsampled as needed, without building a sketch of the input.
+     * The union ends up exactly as deserializing and updating would leave it.
+     * Throws std::invalid_argument as HllSketch::deserialize() would. The
+     * stream variant reads exactly one image, through a buffer the union keeps
+     * for the next call.
+     */
+    virtual void updateSerialized(const void* bytes, const size_t sizeBytes) = 0;
+    virtual void updateSerialized(std::istream& is) = 0;
+
+    /**
+     * Unions n sketches using up to numThreads threads, or one per core if 0.
+     * Each thread merges its share of the inputs into a separate HLL_8 union
+     * and the partial unions are then combined pairwise. The inputs must not
+     * change during the call. The result is the one update() would give
+     * sketch by sketch, except that a SET mode result may hold its coupons
+     * in a different order.
+     */
+    virtual void updateAll(const HllSketch* const* sketches, const size_t n, const int numThreads = 0) = 0;
+    virtual void updateAll(const HllSketchView* sketches, const size_t n, const int numThreads = 0) = 0;
     virtual void update(const std::string datum) = 0;
     virtual void update(const uint64_t datum) = 0;
     virtual void update(const uint32_t datum) = 0;
@@ -129,13 +350,123 @@ class HllUnion {
     virtual void update(const double datum) = 0;
     virtual void update(const float datum) = 0;
     virtual void update(const void* data, const size_t lengthBytes) = 0;
+    virtual void updateBatch(const uint64_t* data, const size_t n) = 0;
+    virtual void updateBatch(const int32_t* data, const size_t n) = 0;
+    virtual void updateBatch(const double* data, const size_t n) = 0;
+    virtual void updateBatch(const std::string_view* data, const size_t n) = 0;
+    virtual void update(const HashState& hash) = 0;
+    virtual void updateBatch(const HashState* hashes, const size_t n) = 0;
+    virtual void couponUpdate(const int coupon) = 0;
+    virtual void couponUpdate(const int* coupons, const size_t n) = 0;
 
+    // as HllSketch::getMaxUpdatableSerializationBytes() for HLL_8
     static int getMaxSerializationBytes(const int lgK);
     static double getRelErr(const bool upperBound, const bool unioned,
                             const int lgConfigK, const int numStdDev);
 
 };
 
+/**
+ * HLL_8 sketch that many threads may update at once without locking.
+ *
+ * Registers are raised with an atomic compare-and-swap max, so concurrent
+ * updates never lose a larger value. The sketch starts in HLL mode and keeps
+ * no HIP accumulator: estimates come from the composite estimator, as for a
+ * sketch produced by a union, and are computed from the registers on each
+ * read. Reads may run alongside updates.
+ */
+class ConcurrentHllSketch {
+  public:
+    static ConcurrentHllSketch* newInstance(const int lgConfigK);
+
+    virtual ~ConcurrentHllSketch();
+
+    virtual void update(const std::string datum) = 0;
+    virtual void update(const uint64_t datum) = 0;
+    virtual void update(const uint32_t datum) = 0;
+    virtual void update(const uint16_t datum) = 0;
+    virtual void update(const uint8_t datum) = 0;
+    virtual void update(const int64_t datum) = 0;
+    virtual void update(const int32_t datum) = 0;
+    virtual void update(const int16_t datum) = 0;
+    virtual void update(const int8_t datum) = 0;
+    virtual void update(const double datum) = 0;
+    virtual void update(const float datum) = 0;
+    virtual void update(const void* data, const size_t lengthBytes) = 0;
+    virtual void updateBatch(const uint64_t* data, const size_t n) = 0;
+    virtual void update(const HashState& hash) = 0;
+    virtual void couponUpdate(const int coupon) = 0;
+    virtual void couponUpdate(const int* coupons, const size_t n) = 0;
+
+    virtual double getEstimate() const = 0;
+    virtual double getLowerBound(const int numStdDev) const = 0;
+    virtual double getUpperBound(const int numStdDev) const = 0;
+
+    virtual int getLgConfigK() const = 0;
+    virtual bool isEmpty() const = 0;
+
+    // copies the registers into an ordinary sketch, e.g. to serialize or union it
+    virtual HllSketch* getResult(const TgtHllType tgtHllType = HLL_8) const = 0;
+
+    // not safe to call while other threads update
+    virtual void reset() = 0;
+};
+
+/**
+ * HLL sketches of one lgConfigK keyed by a 64-bit key, such as a hash of a
+ * dimension tuple, for counting distinct values per key over many keys.
+ *
+ * Rather than one heap object per key, sketches live in slabs: a sketch
+ * holds up to 16 coupons in a 64-byte block of the coupon slab, then a hash
+ * table of coupons the size of HllSketch's in SET mode in a set slab, and
+ * where an HllSketch goes to HLL mode moves into an HLL_8 register block of
+ * the register slab, laid out as an updatable image. Keys find their sketch
+ * through an open addressing index, so an update touches the index entry and
+ * one block. The estimates are those of an HLL_8 HllSketch.
+ */
+class KeyedHllSketch {
+  public:
+    static KeyedHllSketch* newInstance(const int lgConfigK, std::pmr::memory_resource* resource = nullptr,
+                                       const HashPolicy& hashPolicy = HashPolicy());
+    // reads what serialize() wrote; throws std::invalid_argument on a bad image
+    static KeyedHllSketch* deserialize(std::istream& is, std::pmr::memory_resource* resource = nullptr,
+                                       const HashPolicy& hashPolicy = HashPolicy());
+
+    virtual ~KeyedHllSketch();
+
+    // counts value, hashed as HllSketch::update() would, under key
+    virtual void update(const uint64_t key, const uint64_t value) = 0;
+    virtual void update(const uint64_t key, const std::string& value) = 0;
+    // update(keys[i], values[i]) for each i, with the index and block lookups
+    // of a batch overlapped
+    virtual void update(const uint64_t* keys, const uint64_t* values, const size_t n) = 0;
+    virtual void couponUpdate(const uint64_t key, const int coupon) = 0;
+
+    // 0 for a key never updated
+    virtual double getEstimate(const uint64_t key) const = 0;
+    virtual double getLowerBound(const uint64_t key, const int numStdDev) const = 0;
+    virtual double getUpperBound(const uint64_t key, const int numStdDev) const = 0;
+    // a copy of the sketch of key, empty for a key never updated
+    virtual HllSketch* getResult(const uint64_t key, const TgtHllType tgtHllType = HLL_8) const = 0;
+
+    // calls fn(key, estimate) for every key, in no particular order
+    virtual void forEach(const std::function<void(const uint64_t, const double)>& fn) const = 0;
+
+    virtual size_t getNumKeys() const = 0;
+    virtual int getLgConfigK() const = 0;
+    virtual const HashPolicy& getHashPolicy() const = 0;
+    // bytes of the index and slabs
+    virtual size_t getMemoryBytes() const = 0;
+
+    // Writes the lgConfigK, the policy tag and the number of keys, then each
+    // key followed by the image of its sketch, which HllSketchView,
+    // HllSketch::deserialize() and HllUnion::updateSerialized() read.
+    virtual void serialize(std::ostream& os) const = 0;
+
+    // drops every key, keeping the memory for reuse
+    virtual void reset() = 0;
+};
+
 std::ostream& operator<<(std::ostream& os, HllSketch& sketch);
 
 } // namespace datasketches
@@ -10,47 +10,80 @@
 #include <sstream>
 #include <memory>
 
+#if defined(__SSE2__)
+#include <immintrin.h>
+#endif
+
 namespace datasketches {
 
-AuxHashMap::AuxHashMap(int lgAuxArrInts,int lgConfigK)
+AuxHashMap::AuxHashMap(int lgAuxArrInts,int lgConfigK, std::pmr::memory_resource* resource)
   : lgConfigK(lgConfigK),
     lgAuxArrInts(lgAuxArrInts),
-    auxCount(0) {
+    auxCount(0),
+    ownsArray(true),
+    refCount(1),
+    resource(resource) {
   const int numItems = 1 << lgAuxArrInts;
-  auxIntArr = new int[numItems];
+  auxIntArr = HllUtil::newArray<int>(resource, numItems);
   std::fill(auxIntArr, auxIntArr + numItems, 0);
 }
 
-AuxHashMap::AuxHashMap(AuxHashMap& that)
+AuxHashMap::AuxHashMap(AuxHashMap& that, std::pmr::memory_resource* resource)
   : lgConfigK(that.lgConfigK),
     lgAuxArrInts(that.lgAuxArrInts),
-    auxCount(that.auxCount) {
+    auxCount(that.auxCount),
+    ownsArray(true),
+    refCount(1),
+    resource(resource) {
   const int numItems = 1 << lgAuxArrInts;
-  auxIntArr = new int[numItems];
+  auxIntArr = HllUtil::newArray<int>(resource, numItems);
   std::copy(that.auxIntArr, that.auxIntArr + numItems, auxIntArr);
 }
 
+int AuxHashMap::compactLgArrInts(const int lgConfigK, const int auxCount) {
+  int ceilInts = HllUtil::ceilingPowerOf2(auxCount);
+  if ((HllUtil::RESIZE_DENOM * auxCount) > (HllUtil::RESIZE_NUMER * ceilInts)) {
+    ceilInts <<= 1;
+  }
+  int maxVal = (ceilInts > (1 << HllUtil::LG_AUX_ARR_INTS[lgConfigK])
+                ? ceilInts : (1 << HllUtil::LG_AUX_ARR_INTS[lgConfigK]));
+  return HllUtil::simpleIntLog2(maxVal);
+}
+
 AuxHashMap* AuxHashMap::deserialize(std::istream& is, const int lgConfigK,
                                     const int auxCount, const int lgAuxArrInts,
-                                    const bool srcCompact) {
-  int lgArrInts = lgAuxArrInts;
-  if (srcCompact) { // early compact versions didn't use LgArr byte field so ignore input
-    int ceilInts = HllUtil::ceilingPowerOf2(auxCount);
-    if ((HllUtil::RESIZE_DENOM * auxCount) > (HllUtil::RESIZE_NUMER * ceilInts)) {
-      ceilInts <<= 1;
-    }
-    int maxVal = (ceilInts > (1 << HllUtil::LG_AUX_ARR_INTS[lgConfigK])
-                  ? ceilInts : (1 << HllUtil::LG_AUX_ARR_INTS[lgConfigK]));
-    lgArrInts = HllUtil::simpleIntLog2(maxVal);
-  }
-  
-  AuxHashMap* auxHashMap = new AuxHashMap(lgArrInts, lgConfigK);
+                                    const bool srcCompact, std::pmr::memory_resource* resource) {
+  // early compact versions didn't use LgArr byte field so ignore input
+  const int lgArrInts = (srcCompact ? compactLgArrInts(lgConfigK, auxCount) : lgAuxArrInts);
+  AuxHashMap* auxHashMap = new (resource) AuxHashMap(lgArrInts, lgConfigK, resource);
   int configKmask = (1 << lgConfigK) - 1;
 
   int itemsToRead = (srcCompact ? auxCount : (1 << lgAuxArrInts));
   for (int i = 0; i < itemsToRead; ++i) {
     int pair;
     is.read((char*)&pair, sizeof(pair));
+    if (pair == HllUtil::EMPTY) { continue; } // unused slot of an updatable table
+    int slotNo = HllUtil::getLow26(pair) & configKmask;
+    int value = HllUtil::getValue(pair);
+    auxHashMap->mustAdd(slotNo, value);
+  }
+
+  return auxHashMap;
+}
+
+AuxHashMap* AuxHashMap::deserialize(const void* bytes, const int lgConfigK,
+                                    const int auxCount, const int lgAuxArrInts,
+                                    const bool srcCompact, std::pmr::memory_resource* resource) {
+  const int lgArrInts = (srcCompact ? compactLgArrInts(lgConfigK, auxCount) : lgAuxArrInts);
+  AuxHashMap* auxHashMap = new (resource) AuxHashMap(lgArrInts, lgConfigK, resource);
+  int configKmask = (1 << lgConfigK) - 1;
+
+  const uint8_t* ptr = static_cast<const uint8_t*>(bytes);
+  int itemsToRead = (srcCompact ? auxCount : (1 << lgAuxArrInts));
+  for (int i = 0; i < itemsToRead; ++i) {
+    int pair;
+    std::memcpy(&pair, ptr + (i << 2), sizeof(pair));
+    if (pair == HllUtil::EMPTY) { continue; }
     int slotNo = HllUtil::getLow26(pair) & configKmask;
     int value = HllUtil::getValue(pair);
     auxHashMap->mustAdd(slotNo, value);
@@ -61,11 +94,47 @@ AuxHashMap* AuxHashMap::deserialize(std::istream& is, const int lgConfigK,
 
 AuxHashMap::~AuxHashMap() {
   // should be no way to have an object without a valid array
-  delete auxIntArr;
+  if (ownsArray) {
+    HllUtil::deallocate(auxIntArr);
+  }
+}
+
+void* AuxHashMap::operator new(size_t size, std::pmr::memory_resource* resource) {
+  return HllUtil::allocate(resource, size);
+}
+
+void AuxHashMap::operator delete(void* ptr) {
+  HllUtil::deallocate(ptr);
+}
+
+// matches the placement new if a constructor throws
+void AuxHashMap::operator delete(void* ptr, std::pmr::memory_resource* /* resource */) {
+  HllUtil::deallocate(ptr);
 }
 
 AuxHashMap* AuxHashMap::copy() {
-  return new AuxHashMap(*this);
+  return new (resource) AuxHashMap(*this, resource);
+}
+
+AuxHashMap* AuxHashMap::share(std::pmr::memory_resource* resource) {
+  if (!ownsArray || (resource != this->resource)) { return new (resource) AuxHashMap(*this, resource); }
+  refCount.fetch_add(1, std::memory_order_relaxed);
+  return this;
+}
+
+void AuxHashMap::release(AuxHashMap* auxHashMap) {
+  if (auxHashMap->refCount.fetch_sub(1, std::memory_order_acq_rel) == 1) {
+    delete auxHashMap;
+  }
+}
+
+AuxHashMap* AuxHashMap::unshare(AuxHashMap* auxHashMap) {
+  if (auxHashMap->refCount.load(std::memory_order_acquire) == 1) {
+    return auxHashMap;
+  }
+  AuxHashMap* result = auxHashMap->copy();
+  release(auxHashMap);
+  return result;
 }
 
 int AuxHashMap::getAuxCount() {
@@ -88,11 +157,28 @@ int AuxHashMap::getUpdatableSizeBytes() {
   return 4 << lgAuxArrInts;
 }
 
+void AuxHashMap::wrapMemory(int* mem) {
+  if (ownsArray) {
+    std::copy(auxIntArr, auxIntArr + (1 << lgAuxArrInts), mem);
+    HllUtil::deallocate(auxIntArr);
+    ownsArray = false;
+  }
+  auxIntArr = mem;
+}
+
+bool AuxHashMap::isWrapped() const {
+  return !ownsArray;
+}
+
 std::unique_ptr<PairIterator> AuxHashMap::getIterator() {
   PairIterator* itr = new IntArrayPairIterator(auxIntArr, 1 << lgAuxArrInts, lgConfigK);
   return std::unique_ptr<PairIterator>(itr);
 }
 
+IntArrayPairIterator AuxHashMap::getPairs() const {
+  return IntArrayPairIterator(auxIntArr, 1 << lgAuxArrInts, lgConfigK);
+}
+
 void AuxHashMap::mustAdd(const int slotNo, const int value) {
   const int index = find(auxIntArr, lgAuxArrInts, lgConfigK, slotNo);
   const int entry_pair = HllUtil::pair(slotNo, value);
@@ -111,7 +197,7 @@ void AuxHashMap::mustAdd(const int slotNo, const int value) {
 }
 
 int AuxHashMap::mustFindValueFor(const int slotNo) {
-  const int index = find(auxIntArr, lgAuxArrInts, lgConfigK, slotNo);
+  const int index = findExisting(slotNo);
   if (index >= 0) {
     return HllUtil::getValue(auxIntArr[index]);
   }
@@ -122,7 +208,7 @@ int AuxHashMap::mustFindValueFor(const int slotNo) {
 }
 
 void AuxHashMap::mustReplace(const int slotNo, const int value) {
-  const int idx = find(auxIntArr, lgAuxArrInts, lgConfigK, slotNo);
+  const int idx = findExisting(slotNo);
   if (idx >= 0) {
     auxIntArr[idx] = HllUtil::pair(slotNo, value);
     return;
@@ -145,7 +231,7 @@ void AuxHashMap::growAuxSpace() {
   const int oldArrLen = 1 << lgAuxArrInts;
   const int configKmask = (1 << lgConfigK) - 1;
   const int newArrLen = 1 << ++lgAuxArrInts;
-  auxIntArr = new int[newArrLen];
+  auxIntArr = HllUtil::newArray<int>(resource, newArrLen);
   std::fill(auxIntArr, auxIntArr + newArrLen, 0);
   for (int i = 0; i < oldArrLen; ++i) {
     const int fetched = oldArray[i];
@@ -156,7 +242,36 @@ void AuxHashMap::growAuxSpace() {
     }
   }
 
-  delete oldArray;
+  if (ownsArray) {
+    HllUtil::deallocate(oldArray);
+  }
+  ownsArray = true;
+}
+
+// Tables up to this size are small enough that comparing every entry costs
+// less than following a probe sequence through them.
+static const int SCAN_MAX_INTS = 32;
+
+int AuxHashMap::findExisting(const int slotNo) const {
+  const int numItems = 1 << lgAuxArrInts;
+#if defined(__SSE2__)
+  if (numItems >= 4 && numItems <= SCAN_MAX_INTS) {
+    const __m128i key = _mm_set1_epi32(slotNo);
+    const __m128i keyMask = _mm_set1_epi32((1 << lgConfigK) - 1);
+    const __m128i empty = _mm_setzero_si128();
+    for (int i = 0; i < numItems; i += 4) {
+      const __m128i entries = _mm_loadu_si128((const __m128i*) (auxIntArr + i));
+      // an EMPTY entry would otherwise match slotNo 0
+      const __m128i hits = _mm_andnot_si128(_mm_cmpeq_epi32(entries, empty),
+                                            _mm_cmpeq_epi32(_mm_and_si128(entries, keyMask), key));
+      const int mask = _mm_movemask_ps(_mm_castsi128_ps(hits));
+      if (mask != 0) { return i + __builtin_ctz(mask); }
+    }
+    return -1;
+  }
+#endif
+  const int index = find(auxIntArr, lgAuxArrInts, lgConfigK, slotNo);
+  return (index >= 0) ? index : -1;
 }
 
 //Searches the Aux arr hash table for an empty or a matching slotNo depending on the context.
@@ -0,0 +1,221 @@
+/*
+ * Copyright 2018, Yahoo! Inc. Licensed under the terms of the
+ * Apache License 2.0. See LICENSE file at the project root for terms.
+ */
+
+#include "ConcurrentHllSketch.hpp"
+#include "HllSketch.hpp"
+#include "Hll8Array.hpp"
+#include "HllKernels.hpp"
+
+#include <algorithm>
+#include <cmath>
+
+namespace datasketches {
+
+typedef union {
+  int64_t longBytes;
+  double doubleBytes;
+} longDoubleUnion;
+
+ConcurrentHllSketch* ConcurrentHllSketch::newInstance(const int lgConfigK) {
+  return new ConcurrentHllSketchPvt(lgConfigK);
+}
+
+ConcurrentHllSketch::~ConcurrentHllSketch() {}
+
+ConcurrentHllSketchPvt::ConcurrentHllSketchPvt(const int lgConfigK)
+  : lgConfigK(HllUtil::checkLgK(lgConfigK)) {
+  const int numSlots = 1 << lgConfigK;
+  regs = new std::atomic<uint8_t>[numSlots];
+  for (int i = 0; i < numSlots; ++i) {
+    regs[i].store(0, std::memory_order_relaxed);
+  }
+}
+
+ConcurrentHllSketchPvt::~ConcurrentHllSketchPvt() {
+  delete [] regs;
+}
+
+void ConcurrentHllSketchPvt::update(const std::string datum) {
+  if (datum.empty()) { return; }
+  hashUpdate(datum.c_str(), datum.length());
+}
+
+void ConcurrentHllSketchPvt::update(const uint64_t datum) {
+  hashUpdate(&datum, sizeof(uint64_t));
+}
+
+void ConcurrentHllSketchPvt::update(const uint32_t datum) {
+  update(static_cast<uint64_t>(datum));
+}
+
+void ConcurrentHllSketchPvt::update(const uint16_t datum) {
+  update(static_cast<uint64_t>(datum));
+}
+
+void ConcurrentHllSketchPvt::update(const uint8_t datum) {
+  update(static_cast<uint64_t>(datum));
+}
+
+void ConcurrentHllSketchPvt::update(const int64_t datum) {
+  hashUpdate(&datum, sizeof(int64_t));
+}
+
+void ConcurrentHllSketchPvt::update(const int32_t datum) {
+  update(static_cast<int64_t>(datum));
+}
+
+void ConcurrentHllSketchPvt::update(const int16_t datum) {
+  update(static_cast<int64_t>(datum));
+}
+
+void ConcurrentHllSketchPvt::update(const int8_t datum) {
+  update(static_cast<int64_t>(datum));
+}
+
+void ConcurrentHllSketchPvt::update(const double datum) {
+  longDoubleUnion d;
+  d.doubleBytes = static_cast<double>(datum);
+  if (datum == 0.0) {
+    d.doubleBytes = 0.0; // canonicalize -0.0 to 0.0
+  } else if (std::isnan(d.doubleBytes)) {
+    d.longBytes = 0x7ff8000000000000L; // canonicalize NaN using value from Java's Double.doubleToLongBits()
+  }
+  hashUpdate(&d, sizeof(double));
+}
+
+void ConcurrentHllSketchPvt::update(const float datum) {
+  update(static_cast<double>(datum));
+}
+
+void ConcurrentHllSketchPvt::update(const void* data, const size_t lengthBytes) {
+  if (data == nullptr) { return; }
+  hashUpdate(data, lengthBytes);
+}
+
+void ConcurrentHllSketchPvt::updateBatch(const uint64_t* data, const size_t n) {
+  if (data == nullptr) { return; }
+  int coupons[HllUtil::BATCH_SIZE];
+  for (size_t i = 0; i < n; i += HllUtil::BATCH_SIZE) {
+    const int len = (int) std::min<size_t>(HllUtil::BATCH_SIZE, n - i);
+    HllUtil::couponsFromLongs(data + i, len, HllUtil::DEFAULT_UPDATE_SEED, coupons);
+    for (int j = 0; j < len; ++j) {
+      internalCouponUpdate(coupons[j]);
+    }
+  }
+}
+
+void ConcurrentHllSketchPvt::update(const HashState& hash) {
+  internalCouponUpdate(HllUtil::coupon(hash));
+}
+
+void ConcurrentHllSketchPvt::couponUpdate(const int coupon) {
+  if (HllUtil::getValue(coupon) == 0) {
+    if (coupon == HllUtil::EMPTY) { return; }
+    throw std::invalid_argument("Invalid coupon: zero value");
+  }
+  internalCouponUpdate(coupon);
+}
+
+void ConcurrentHllSketchPvt::couponUpdate(const int* coupons, const size_t n) {
+  if (coupons == nullptr) { return; }
+  if ((1 << lgConfigK) < HllArray::PREFETCH_MIN_BYTES) {
+    for (size_t i = 0; i < n; ++i) {
+      couponUpdate(coupons[i]);
+    }
+    return;
+  }
+  // prefetch the registers of a block before updating them, as in HllSketchPvt
+  const int slotMask = (1 << lgConfigK) - 1;
+  for (size_t i = 0; i < n; i += HllUtil::BATCH_SIZE) {
+    const size_t end = std::min(n, i + HllUtil::BATCH_SIZE);
+    for (size_t j = i; j < end; ++j) {
+      __builtin_prefetch(regs + (coupons[j] & slotMask));
+    }
+    for (size_t j = i; j < end; ++j) {
+      couponUpdate(coupons[j]);
+    }
+  }
+}
+
+void ConcurrentHllSketchPvt::snapshot(uint8_t* dst, int* counts) const {
+  std::fill_n(counts, 64, 0);
+  uint8_t block[HllKernels::BLOCK_SLOTS];
+  const int numSlots = 1 << lgConfigK;
+  for (int i = 0; i < numSlots; i += HllKernels::BLOCK_SLOTS) {
+    const int len = std::min(HllKernels::BLOCK_SLOTS, numSlots - i);
+    uint8_t* out = (dst == nullptr) ? block : dst + i;
+    for (int j = 0; j < len; ++j) {
+      out[j] = regs[i + j].load(std::memory_order_relaxed);
+    }
+    HllKernels::histogram8(out, len, counts);
+  }
+}
+
+double ConcurrentHllSketchPvt::getCompositeEstimate(const int* counts) const {
+  double kxq0, kxq1;
+  HllKernels::kxqFromHistogram(counts, kxq0, kxq1);
+  return HllArray::getCompositeEstimate(lgConfigK, 0, counts[0], kxq0, kxq1);
+}
+
+double ConcurrentHllSketchPvt::getEstimate() const {
+  int counts[64];
+  snapshot(nullptr, counts);
+  return getCompositeEstimate(counts);
+}
+
+double ConcurrentHllSketchPvt::getLowerBound(const int numStdDev) const {
+  int counts[64];
+  snapshot(nullptr, counts);
+  return HllArray::getLowerBound(lgConfigK, 0, counts[0], true, getCompositeEstimate(counts), numStdDev);
+}
+
+double ConcurrentHllSketchPvt::getUpperBound(const int numStdDev) const {
+  int counts[64];
+  snapshot(nullptr, counts);
+  return HllArray::getUpperBound(lgConfigK, true, getCompositeEstimate(counts), numStdDev);
+}
+
+int ConcurrentHllSketchPvt::getLgConfigK() const {
+  return lgConfigK;
+}
+
+bool ConcurrentHllSketchPvt::isEmpty() const {
+  const int numSlots = 1 << lgConfigK;
+  for (int i = 0; i < numSlots; ++i) {
+    if (regs[i].load(std::memory_order_relaxed) != 0) { return false; }
+  }
+  return true;
+}
+
+HllSketch* ConcurrentHllSketchPvt::getResult(const TgtHllType tgtHllType) const {
+  std::pmr::memory_resource* resource = std::pmr::get_default_resource();
+  Hll8Array* hll8Array = new (resource) Hll8Array(lgConfigK, resource);
+  int counts[64];
+  snapshot(hll8Array->hllByteArr, counts);
+  double kxq0, kxq1;
+  HllKernels::kxqFromHistogram(counts, kxq0, kxq1);
+  hll8Array->putKxQ0(kxq0);
+  hll8Array->putKxQ1(kxq1);
+  hll8Array->putNumAtCurMin(counts[0]);
+  hll8Array->putHipAccum(HllArray::getCompositeEstimate(lgConfigK, 0, counts[0], kxq0, kxq1));
+  hll8Array->putOutOfOrderFlag(true);
+
+  HllSketchPvt* result = new HllSketchPvt(hll8Array);
+  if (tgtHllType == HLL_8) {
+    return result;
+  }
+  HllSketch* converted = result->copyAs(tgtHllType);
+  delete result;
+  return converted;
+}
+
+void ConcurrentHllSketchPvt::reset() {
+  const int numSlots = 1 << lgConfigK;
+  for (int i = 0; i < numSlots; ++i) {
+    regs[i].store(0, std::memory_order_relaxed);
+  }
+}
+
+}
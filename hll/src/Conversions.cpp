@@ -6,6 +6,7 @@
 #include "Conversions.hpp"
 #include "HllUtil.hpp"
 #include "HllArray.hpp"
+#include "HllKernels.hpp"
 
 #include <memory>
 
@@ -13,96 +14,121 @@ namespace datasketches {
 
 Hll4Array* Conversions::convertToHll4(const HllArray& srcHllArr) {
   const int lgConfigK = srcHllArr.getLgConfigK();
-  Hll4Array* hll4Array = new Hll4Array(lgConfigK);
+  const int numSlots = 1 << lgConfigK;
+  std::pmr::memory_resource* resource = srcHllArr.getResource();
+  Hll4Array* hll4Array = new (resource) Hll4Array(lgConfigK, resource);
   hll4Array->putOutOfOrderFlag(srcHllArr.isOutOfOrderFlag());
 
-  // 1st pass: compute starting curMin and numAtCurMin
-  int pairVals = curMinAndNum(srcHllArr);
-  int curMin = HllUtil::getValue(pairVals);
-  int numAtCurMin = HllUtil::getLow26(pairVals);
-
-  // 2nd pass: must know curMin.
-  // Populate KxQ registers, build AuxHashMap if needed
-  std::unique_ptr<PairIterator> itr = srcHllArr.getIterator();
-  // nothing allocated, may be null
-  AuxHashMap* auxHashMap = srcHllArr.getAuxHashMap();
-
-  while (itr->nextValid()) {
-    const int slotNo = itr->getIndex();
-    const int actualValue = itr->getValue();
-    HllArray::hipAndKxQIncrementalUpdate(*hll4Array, 0, actualValue);
-    if (actualValue >= (curMin + 15)) {
-      hll4Array->putSlot(slotNo, HllUtil::AUX_TOKEN);
-      if (auxHashMap == nullptr) {
-        auxHashMap = new AuxHashMap(HllUtil::LG_AUX_ARR_INTS[lgConfigK], lgConfigK);
-        hll4Array->putAuxHashMap(auxHashMap);
+  uint8_t* tmp = nullptr;
+  const uint8_t* values = registerBytes(srcHllArr, tmp);
+
+  // 1st pass: curMin, numAtCurMin and KxQ registers from the value histogram
+  int counts[64] = {0};
+  HllKernels::histogram8(values, numSlots, counts);
+  int curMin = 0;
+  while (counts[curMin] == 0) { ++curMin; }
+  putStats(*hll4Array, counts);
+
+  // 2nd pass: must know curMin. Pack the nibbles, then build the AuxHashMap
+  // for the exceptions, if any
+  HllKernels::pack4(hll4Array->hllByteArr, values, numSlots, curMin);
+  int numExceptions = 0;
+  for (int v = curMin + HllUtil::AUX_TOKEN; v < 64; ++v) { numExceptions += counts[v]; }
+  if (numExceptions > 0) {
+    AuxHashMap* auxHashMap = new (resource) AuxHashMap(HllUtil::LG_AUX_ARR_INTS[lgConfigK],
+                                                       lgConfigK, resource);
+    hll4Array->putAuxHashMap(auxHashMap);
+    const int auxMin = curMin + HllUtil::AUX_TOKEN;
+    for (int slotNo = 0; numExceptions > 0; ++slotNo) {
+      if (values[slotNo] >= auxMin) {
+        auxHashMap->mustAdd(slotNo, values[slotNo]);
+        --numExceptions;
       }
-      auxHashMap->mustAdd(slotNo, actualValue);
-    } else {
-      hll4Array->putSlot(slotNo, actualValue - curMin);
     }
   }
+  delete[] tmp;
 
   hll4Array->putCurMin(curMin);
-  hll4Array->putNumAtCurMin(numAtCurMin);
+  hll4Array->putNumAtCurMin(counts[curMin]);
   hll4Array->putHipAccum(srcHllArr.getHipAccum());
 
   return hll4Array;
 }
 
-int Conversions::curMinAndNum(const HllArray& hllArr) {
-  int curMin = 64;
-  int numAtCurMin = 0;
-  std::unique_ptr<PairIterator> itr = hllArr.getIterator();
-  while (itr->nextAll()) {
-    int v = itr->getValue();
-    if (v < curMin) {
-      curMin = v;
-      numAtCurMin = 1;
-    } else if (v == curMin) {
-      ++numAtCurMin;
-    }
-  }
-
-  return HllUtil::pair(numAtCurMin, curMin);
-}
-
 Hll6Array* Conversions::convertToHll6(const HllArray& srcHllArr) {
   const int lgConfigK = srcHllArr.getLgConfigK();
-  Hll6Array* hll6Array = new Hll6Array(lgConfigK);
+  const int numSlots = 1 << lgConfigK;
+  std::pmr::memory_resource* resource = srcHllArr.getResource();
+  Hll6Array* hll6Array = new (resource) Hll6Array(lgConfigK, resource);
   hll6Array->putOutOfOrderFlag(srcHllArr.isOutOfOrderFlag());
 
-  int numZeros = 1 << lgConfigK;
-  std::unique_ptr<PairIterator> itr = srcHllArr.getIterator();
-  while (itr->nextAll()) {
-    if (itr->getValue() != HllUtil::EMPTY) {
-      --numZeros;
-      hll6Array->couponUpdate(itr->getPair());
-    }
-  }
+  uint8_t* tmp = nullptr;
+  const uint8_t* values = registerBytes(srcHllArr, tmp);
+  HllKernels::pack6(hll6Array->hllByteArr, values, numSlots);
+
+  int counts[64] = {0};
+  HllKernels::histogram8(values, numSlots, counts);
+  putStats(*hll6Array, counts);
+  delete[] tmp;
 
-  hll6Array->putNumAtCurMin(numZeros);
+  hll6Array->putNumAtCurMin(counts[0]);
   hll6Array->putHipAccum(srcHllArr.getHipAccum());
   return hll6Array;
 }
 
 Hll8Array* Conversions::convertToHll8(const HllArray& srcHllArr) {
   const int lgConfigK = srcHllArr.getLgConfigK();
-  Hll8Array* hll8Array = new Hll8Array(lgConfigK);
+  const int numSlots = 1 << lgConfigK;
+  std::pmr::memory_resource* resource = srcHllArr.getResource();
+  Hll8Array* hll8Array = new (resource) Hll8Array(lgConfigK, resource);
   hll8Array->putOutOfOrderFlag(srcHllArr.isOutOfOrderFlag());
 
-  int numZeros = 1 << lgConfigK;
-  std::unique_ptr<PairIterator> itr = srcHllArr.getIterator();
-  while (itr->nextAll()) {
-    if (itr->getValue() != HllUtil::EMPTY) {
-      --numZeros;
-      hll8Array->couponUpdate(itr->getPair());
-    }
-  }
+  // decode straight into the target array
+  uint8_t* dst = hll8Array->hllByteArr;
+  registerBytes(srcHllArr, dst);
 
-  hll8Array->putNumAtCurMin(numZeros);
+  int counts[64] = {0};
+  HllKernels::histogram8(dst, numSlots, counts);
+  putStats(*hll8Array, counts);
+
+  hll8Array->putNumAtCurMin(counts[0]);
   hll8Array->putHipAccum(srcHllArr.getHipAccum());
   return hll8Array;
 }
 
+const uint8_t* Conversions::registerBytes(const HllArray& srcHllArr, uint8_t*& buffer) {
+  const int numSlots = 1 << srcHllArr.getLgConfigK();
+  const uint8_t* srcArr = srcHllArr.hllByteArr;
+  if (srcHllArr.getTgtHllType() == HLL_8) {
+    if (buffer == nullptr) { return srcArr; }
+    std::copy(srcArr, srcArr + numSlots, buffer);
+    return buffer;
+  }
+
+  if (buffer == nullptr) { buffer = new uint8_t[numSlots]; }
+  if (srcHllArr.getTgtHllType() == HLL_6) {
+    HllKernels::unpack6(buffer, srcArr, numSlots);
+  } else {
+    HllKernels::unpack4(buffer, srcArr, numSlots, srcHllArr.getCurMin());
+    // unpack4() leaves AUX_TOKEN slots at 0; fill in their true values
+    const AuxHashMap* auxHashMap = srcHllArr.getAuxHashMap();
+    if (auxHashMap != nullptr) {
+      IntArrayPairIterator auxItr = auxHashMap->getPairs();
+      while (auxItr.nextValid()) {
+        const int pair = auxItr.getPair();
+        buffer[HllUtil::getLow26(pair) & (numSlots - 1)] = (uint8_t) HllUtil::getValue(pair);
+      }
+    }
+  }
+  return buffer;
+}
+
+void Conversions::putStats(HllArray& tgtHllArr, const int* counts) {
+  double kxq0;
+  double kxq1;
+  HllKernels::kxqFromHistogram(counts, kxq0, kxq1);
+  tgtHllArr.putKxQ0(kxq0);
+  tgtHllArr.putKxQ1(kxq1);
+}
+
 }
@@ -4,15 +4,16 @@
  */
 
 #include "CouponHashSet.hpp"
+#include "HllSketchView.hpp"
 
 #include <cassert>
+#include <cstring>
 
 namespace datasketches {
 
-static int find(const int* array, const int lgArrInts, const int coupon);
-
-CouponHashSet::CouponHashSet(const int lgConfigK, const TgtHllType tgtHllType)
-  : CouponList(lgConfigK, tgtHllType, CurMode::SET)
+CouponHashSet::CouponHashSet(const int lgConfigK, const TgtHllType tgtHllType,
+                             std::pmr::memory_resource* resource)
+  : CouponList(lgConfigK, tgtHllType, CurMode::SET, resource)
 {
   assert(lgConfigK > 7);
 }
@@ -23,7 +24,8 @@ CouponHashSet::CouponHashSet(const CouponHashSet& that)
 CouponHashSet::CouponHashSet(const CouponHashSet& that, const TgtHllType tgtHllType)
   : CouponList(that, tgtHllType) {}
 
-CouponHashSet* CouponHashSet::newSet(std::istream& is) {
+CouponHashSet* CouponHashSet::newSet(std::istream& is, std::pmr::memory_resource* resource,
+                                     const uint8_t hashTag) {
   uint8_t listHeader[8];
   is.read((char*)listHeader, 8 * sizeof(uint8_t));
 
@@ -43,6 +45,7 @@ CouponHashSet* CouponHashSet::newSet(std::istream& is) {
   }
 
   TgtHllType tgtHllType = extractTgtHllType(listHeader[7]);
+  checkHashTag(listHeader[7], hashTag);
 
   const int lgK = (int) listHeader[3];
   const int lgArrInts = (int) listHeader[4];
@@ -50,7 +53,7 @@ CouponHashSet* CouponHashSet::newSet(std::istream& is) {
   //bool oooFlag = ((listHeader[5] & HllUtil::OUT_OF_ORDER_FLAG_MASK) ? true : false);
   //bool emptyFlag = ((listHeader[5] & HllUtil::EMPTY_FLAG_MASK) ? true : false);
 
-  CouponHashSet* sketch = new CouponHashSet(lgK, tgtHllType);
+  CouponHashSet* sketch = new (resource) CouponHashSet(lgK, tgtHllType, resource);
   sketch->putOutOfOrderFlag(true);
 
   int couponCount;
@@ -69,23 +72,55 @@ CouponHashSet* CouponHashSet::newSet(std::istream& is) {
   } else {
     int* tmp = sketch->couponIntArr;
     sketch->lgCouponArrInts = lgArrInts;
-    sketch->couponIntArr = new int[1 << lgArrInts];
+    sketch->couponIntArr = HllUtil::newArray<int>(resource, 1 << lgArrInts);
     sketch->couponCount = couponCount;
     // for stream processing, read entire list so read pointer ends up set correctly
     //is.read((char*)sketch->couponIntArr, couponCount * sizeof(int));
     is.read((char*)sketch->couponIntArr, (1 << sketch->lgCouponArrInts) * sizeof(int));
-    delete tmp;
+    HllUtil::deallocate(tmp);
   } 
 
   return sketch;
 }
 
+CouponHashSet* CouponHashSet::newSet(const HllSketchView& view, std::pmr::memory_resource* resource) {
+  if (view.curMode != SET) {
+    throw std::invalid_argument("Calling set construtor with non-set mode data");
+  }
+
+  CouponHashSet* sketch = new (resource) CouponHashSet(view.lgConfigK, view.tgtHllType, resource);
+  sketch->putOutOfOrderFlag(true);
+
+  if (view.compact) {
+    for (int i = 0; i < view.couponCount; ++i) {
+      int coupon;
+      std::memcpy(&coupon, view.data + (i << 2), sizeof(coupon));
+      if (coupon == HllUtil::EMPTY) { continue; }
+      sketch->couponUpdate(coupon);
+    }
+  } else {
+    const int lgArrInts = HllUtil::simpleIntLog2(view.dataInts);
+    if (view.couponCount >= view.dataInts) {
+      delete sketch;
+      throw std::invalid_argument("Coupon count exceeds hash set capacity");
+    }
+    int* tmp = sketch->couponIntArr;
+    sketch->lgCouponArrInts = lgArrInts;
+    sketch->couponIntArr = HllUtil::newArray<int>(resource, view.dataInts);
+    sketch->couponCount = view.couponCount;
+    std::memcpy(sketch->couponIntArr, view.data, view.dataInts * sizeof(int));
+    HllUtil::deallocate(tmp);
+  }
+
+  return sketch;
+}
+
 CouponHashSet* CouponHashSet::copy() const {
-  return new CouponHashSet(*this);
+  return new (resource) CouponHashSet(*this);
 }
 
 CouponHashSet* CouponHashSet::copyAs(const TgtHllType tgtHllType) const {
-  return new CouponHashSet(*this, tgtHllType);
+  return new (resource) CouponHashSet(*this, tgtHllType);
 }
 
 CouponHashSet::~CouponHashSet() {}
@@ -124,7 +159,7 @@ bool CouponHashSet::checkGrowOrPromote() {
 
 void CouponHashSet::growHashSet(const int srcLgCoupArrSize, const int tgtLgCoupArrSize) {
   const int tgtLen = 1 << tgtLgCoupArrSize;
-  int* tgtCouponIntArr = new int[tgtLen];
+  int* tgtCouponIntArr = HllUtil::newArray<int>(resource, tgtLen);
   std::fill(tgtCouponIntArr, tgtCouponIntArr + tgtLen, 0);
 
   const int srcLen = 1 << srcLgCoupArrSize;
@@ -140,12 +175,32 @@ void CouponHashSet::growHashSet(const int srcLgCoupArrSize, const int tgtLgCoupA
     }
   }
 
-  delete couponIntArr;
+  if (ownsArray) {
+    HllUtil::deallocate(couponIntArr);
+  }
   couponIntArr = tgtCouponIntArr;
+  ownsArray = true;
   lgCouponArrInts = tgtLgCoupArrSize;
 }
 
-static int find(const int* array, const int lgArrInts, const int coupon) {
+void CouponHashSet::rebuild(const int* coupons, const int numCoupons, const int tgtLgCoupArrSize) {
+  const int tgtLen = 1 << tgtLgCoupArrSize;
+  if (!ownsArray || (tgtLgCoupArrSize != lgCouponArrInts)) {
+    if (ownsArray) {
+      HllUtil::deallocate(couponIntArr);
+    }
+    couponIntArr = HllUtil::newArray<int>(resource, tgtLen);
+    ownsArray = true;
+    lgCouponArrInts = tgtLgCoupArrSize;
+  }
+  std::fill(couponIntArr, couponIntArr + tgtLen, 0);
+  for (int i = 0; i < numCoupons; ++i) {
+    couponIntArr[~find(couponIntArr, tgtLgCoupArrSize, coupons[i])] = coupons[i];
+  }
+  couponCount = numCoupons;
+}
+
+int CouponHashSet::find(const int* array, const int lgArrInts, const int coupon) {
   const int arrMask = (1 << lgArrInts) - 1;
   int probe = coupon & arrMask;
   const int loopIndex = probe;
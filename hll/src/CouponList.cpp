@@ -9,16 +9,21 @@
 #include "HllUtil.hpp"
 #include "IntArrayPairIterator.hpp"
 #include "HllArray.hpp"
+#include "HllSketchView.hpp"
 
 #include <iostream>
 #include <cstring>
 #include <cmath>
 #include <algorithm>
+#include <memory_resource>
+#include <utility>
+#include <vector>
 
 namespace datasketches {
 
-CouponList::CouponList(const int lgConfigK, const TgtHllType tgtHllType, const CurMode curMode)
-  : HllSketchImpl(lgConfigK, tgtHllType, curMode) {
+CouponList::CouponList(const int lgConfigK, const TgtHllType tgtHllType, const CurMode curMode,
+                       std::pmr::memory_resource* resource)
+  : HllSketchImpl(lgConfigK, tgtHllType, curMode, resource) {
     if (curMode == CurMode::LIST) {
       lgCouponArrInts = HllUtil::LG_INIT_LIST_SIZE;
       oooFlag = false;
@@ -27,46 +32,72 @@ CouponList::CouponList(const int lgConfigK, const TgtHllType tgtHllType, const C
       oooFlag = true;
     }
     const int arrayLen = 1 << lgCouponArrInts;
-    couponIntArr = new int[arrayLen];
+    couponIntArr = HllUtil::newArray<int>(resource, arrayLen);
     std::fill(couponIntArr, couponIntArr + arrayLen, 0);
     couponCount = 0;
+    ownsArray = true;
+    spareHll = nullptr;
+}
+
+CouponList::CouponList(const int lgConfigK, const TgtHllType tgtHllType, const CurMode curMode,
+                       const int lgCouponArrInts, std::pmr::memory_resource* resource, const bool sparse)
+  : HllSketchImpl(lgConfigK, tgtHllType, curMode, resource, sparse),
+    lgCouponArrInts(lgCouponArrInts),
+    couponCount(0),
+    oooFlag(curMode == CurMode::SET),
+    ownsArray(true),
+    spareHll(nullptr) {
+
+  const int arrayLen = 1 << lgCouponArrInts;
+  couponIntArr = HllUtil::newArray<int>(resource, arrayLen);
+  std::fill(couponIntArr, couponIntArr + arrayLen, 0);
 }
 
 CouponList::CouponList(const CouponList& that)
-  : HllSketchImpl(that.lgConfigK, that.tgtHllType, that.curMode),
+  : HllSketchImpl(that.lgConfigK, that.tgtHllType, that.curMode, that.resource),
     lgCouponArrInts(that.lgCouponArrInts),
     couponCount(that.couponCount),
-    oooFlag(that.oooFlag) {
+    oooFlag(that.oooFlag),
+    ownsArray(true),
+    spareHll(nullptr) {
 
   const int numItems = 1 << lgCouponArrInts;
-  couponIntArr = new int[numItems];
+  couponIntArr = HllUtil::newArray<int>(resource, numItems);
   std::copy(that.couponIntArr, that.couponIntArr + numItems, couponIntArr);
 }
 
 CouponList::CouponList(const CouponList& that, const TgtHllType tgtHllType)
-  : HllSketchImpl(that.lgConfigK, tgtHllType, that.curMode),
+  : HllSketchImpl(that.lgConfigK, tgtHllType, that.curMode, that.resource),
     lgCouponArrInts(that.lgCouponArrInts),
     couponCount(that.couponCount),
-    oooFlag(that.oooFlag) {
+    oooFlag(that.oooFlag),
+    ownsArray(true),
+    spareHll(nullptr) {
 
   const int numItems = 1 << lgCouponArrInts;
-  couponIntArr = new int[numItems];
+  couponIntArr = HllUtil::newArray<int>(resource, numItems);
   std::copy(that.couponIntArr, that.couponIntArr + numItems, couponIntArr);
 }
 
 CouponList::~CouponList() {
-  delete couponIntArr;
+  if (ownsArray) {
+    HllUtil::deallocate(couponIntArr);
+  }
+  if (spareHll != nullptr) {
+    delete spareHll;
+  }
 }
 
 CouponList* CouponList::copy() const {
-  return new CouponList(*this);
+  return new (resource) CouponList(*this);
 }
 
 CouponList* CouponList::copyAs(const TgtHllType tgtHllType) const {
-  return new CouponList(*this, tgtHllType);
+  return new (resource) CouponList(*this, tgtHllType);
 }
 
-CouponList* CouponList::newList(std::istream& is) {
+CouponList* CouponList::newList(std::istream& is, std::pmr::memory_resource* resource,
+                                const uint8_t hashTag) {
   uint8_t listHeader[8];
   is.read((char*)listHeader, 8 * sizeof(uint8_t));
 
@@ -86,6 +117,7 @@ CouponList* CouponList::newList(std::istream& is) {
   }
 
   TgtHllType tgtHllType = extractTgtHllType(listHeader[7]);
+  checkHashTag(listHeader[7], hashTag);
 
   const int lgK = (int) listHeader[3];
   //const int lgArrInts = (int) listHeader[4];
@@ -93,7 +125,7 @@ CouponList* CouponList::newList(std::istream& is) {
   bool oooFlag = ((listHeader[5] & HllUtil::OUT_OF_ORDER_FLAG_MASK) ? true : false);
   bool emptyFlag = ((listHeader[5] & HllUtil::EMPTY_FLAG_MASK) ? true : false);
 
-  CouponList* sketch = new CouponList(lgK, tgtHllType, curMode);
+  CouponList* sketch = new (resource) CouponList(lgK, tgtHllType, curMode, resource);
   const int couponCount = (int) listHeader[6];
   sketch->couponCount = couponCount;
   sketch->putOutOfOrderFlag(oooFlag); // should always be false for LIST
@@ -109,50 +141,47 @@ CouponList* CouponList::newList(std::istream& is) {
   return sketch;
 }
 
-void CouponList::serialize(std::ostream& os, const bool compact) const {
-  // header
-  const uint8_t preInts(getPreInts());
-  os.write((char*)&preInts, sizeof(preInts));
-  const uint8_t serialVersion(HllUtil::SER_VER);
-  os.write((char*)&serialVersion, sizeof(serialVersion));
-  const uint8_t familyId(HllUtil::FAMILY_ID);
-  os.write((char*)&familyId, sizeof(familyId));
-  const uint8_t lgKByte((uint8_t) lgConfigK);
-  os.write((char*)&lgKByte, sizeof(lgKByte));
-  const uint8_t lgArrIntsByte((uint8_t) lgCouponArrInts);
-  os.write((char*)&lgArrIntsByte, sizeof(lgArrIntsByte));
-  const uint8_t flagsByte(makeFlagsByte(compact));
-  os.write((char*)&flagsByte, sizeof(flagsByte));
-
-  if (curMode == LIST) {
-    const uint8_t listCount((uint8_t) couponCount);
-    os.write((char*)&listCount, sizeof(listCount));
-  } else { // curMode == SET
-    const uint8_t unused(0);
-    os.write((char*)&unused, sizeof(unused));
+CouponList* CouponList::newList(const HllSketchView& view, std::pmr::memory_resource* resource) {
+  if (view.curMode != LIST) {
+    throw std::invalid_argument("Calling list construtor with non-list mode data");
   }
 
-  const uint8_t modeByte(makeModeByte());
-  os.write((char*)&modeByte, sizeof(modeByte));
+  CouponList* sketch = new (resource) CouponList(view.lgConfigK, view.tgtHllType, view.curMode, resource);
+  sketch->putOutOfOrderFlag(view.oooFlag);
 
-  if (curMode == SET) {
-    // writing as int, already stored as int
-    os.write((char*)&couponCount, sizeof(couponCount));
+  if (!view.empty) {
+    if (view.couponCount > (1 << sketch->lgCouponArrInts)) {
+      delete sketch;
+      throw std::invalid_argument("Coupon count exceeds list capacity");
+    }
+    sketch->couponCount = view.couponCount;
+    // the updatable image may hold more slots than we need, but all coupons
+    // sit at the front of a list
+    const int numToRead = std::min(view.dataInts, 1 << sketch->lgCouponArrInts);
+    std::memcpy(sketch->couponIntArr, view.data, numToRead * sizeof(int));
   }
 
+  return sketch;
+}
+
+void CouponList::serializeToMem(uint8_t* dst, const bool compact) const {
+  writeHeader(dst, compact);
+
   // coupons
+  uint8_t* ptr = dst + getMemDataStart();
   // isCompact() is always false for now
   const int sw = (isCompact() ? 2 : 0) | (compact ? 1 : 0);
   switch (sw) {
     case 0: { // src updatable, dst updatable
-      os.write((char*)couponIntArr, (1 << lgCouponArrInts) * sizeof(int));
+      std::memcpy(ptr, couponIntArr, (1 << lgCouponArrInts) * sizeof(int));
       break;
     }
     case 1: { // src updatable, dst compact
       std::unique_ptr<PairIterator> itr = getIterator();
       while (itr->nextValid()) {
         const int pairValue = itr->getPair();
-        os.write((char*)&pairValue, sizeof(pairValue));
+        std::memcpy(ptr, &pairValue, sizeof(pairValue));
+        ptr += sizeof(pairValue);
       }
       break;
     }
@@ -160,8 +189,38 @@ void CouponList::serialize(std::ostream& os, const bool compact) const {
     default:
       throw std::runtime_error("Impossible condition when serializing");
   }
-  
-  return;
+}
+
+void CouponList::writeHeader(uint8_t* dst, const bool compact) const {
+  dst[0] = (uint8_t) getPreInts();
+  dst[1] = (uint8_t) HllUtil::SER_VER;
+  dst[2] = (uint8_t) HllUtil::FAMILY_ID;
+  dst[3] = (uint8_t) lgConfigK;
+  dst[4] = (uint8_t) lgCouponArrInts;
+  dst[5] = makeFlagsByte(compact);
+  // list count if LIST, unused if SET
+  dst[6] = (curMode == LIST ? (uint8_t) couponCount : 0);
+  dst[7] = makeModeByte();
+
+  if (curMode == SET) {
+    // writing as int, already stored as int
+    std::memcpy(dst + HllUtil::HASH_SET_COUNT_INT, &couponCount, sizeof(couponCount));
+  }
+}
+
+void CouponList::wrapMemory(uint8_t* mem) {
+  int* memArr = reinterpret_cast<int*>(mem + getMemDataStart());
+  if (ownsArray) {
+    std::copy(couponIntArr, couponIntArr + (1 << lgCouponArrInts), memArr);
+    HllUtil::deallocate(couponIntArr);
+    ownsArray = false;
+  }
+  couponIntArr = memArr;
+  writeHeader(mem, false);
+}
+
+bool CouponList::isWrapped() const {
+  return !ownsArray;
 }
 
 HllSketchImpl* CouponList::couponUpdate(int coupon) {
@@ -188,25 +247,94 @@ HllSketchImpl* CouponList::couponUpdate(int coupon) {
   throw std::runtime_error("Array invalid: no empties and no duplicates");
 }
 
+HllSketchImpl* CouponList::unionCoupons(const CouponList& src) {
+  if (!src.isSparse()) { return unionCoupons(src.couponIntArr, 1 << src.lgCouponArrInts); }
+  if (!ownsArray) { return nullptr; }
+  std::pmr::vector<int> coupons(resource);
+  coupons.reserve(couponCount + src.couponCount);
+  appendCoupons(coupons);
+  std::unique_ptr<PairIterator> srcItr = src.getIterator();
+  while (srcItr->nextValid()) { coupons.push_back(srcItr->getPair()); }
+  return rebuildFromCoupons(coupons);
+}
+
+HllSketchImpl* CouponList::unionCoupons(const int* srcCoupons, const int srcLen) {
+  if (!ownsArray) { return nullptr; }
+  std::pmr::vector<int> coupons(resource);
+  coupons.reserve(couponCount + srcLen);
+  appendCoupons(coupons);
+  for (int i = 0; i < srcLen; ++i) {
+    if (srcCoupons[i] != HllUtil::EMPTY) { coupons.push_back(srcCoupons[i]); }
+  }
+  return rebuildFromCoupons(coupons);
+}
+
+void CouponList::appendCoupons(std::pmr::vector<int>& coupons) const {
+  const int len = 1 << lgCouponArrInts;
+  for (int i = 0; i < len; ++i) {
+    if (couponIntArr[i] != HllUtil::EMPTY) { coupons.push_back(couponIntArr[i]); }
+  }
+}
+
+HllSketchImpl* CouponList::rebuildFromCoupons(std::pmr::vector<int>& coupons) {
+  const int len = 1 << lgCouponArrInts;
+  std::sort(coupons.begin(), coupons.end());
+  const int numCoupons = std::unique(coupons.begin(), coupons.end()) - coupons.begin();
+
+  // a LIST that would not have filled up stays a LIST
+  if ((curMode == CurMode::LIST) && (numCoupons < (1 << HllUtil::LG_INIT_LIST_SIZE))) {
+    std::copy(coupons.begin(), coupons.begin() + numCoupons, couponIntArr);
+    std::fill(couponIntArr + numCoupons, couponIntArr + len, 0);
+    couponCount = numCoupons;
+    return this;
+  }
+
+  // otherwise the same growth and promotion rules as one couponUpdate() at a time
+  if (lgConfigK < 8) { return nullptr; }
+  int tgtLgArrInts = (curMode == CurMode::SET) ? lgCouponArrInts : HllUtil::LG_INIT_SET_SIZE;
+  while ((HllUtil::RESIZE_DENOM * numCoupons) > (HllUtil::RESIZE_NUMER * (1 << tgtLgArrInts))) {
+    if (tgtLgArrInts == (lgConfigK - 3)) { return nullptr; }
+    ++tgtLgArrInts;
+  }
+  CouponHashSet* chSet;
+  if (curMode == CurMode::SET) {
+    chSet = static_cast<CouponHashSet*>(this);
+  } else {
+    chSet = new (resource) CouponHashSet(lgConfigK, tgtHllType, resource);
+    std::swap(chSet->spareHll, spareHll);
+  }
+  chSet->rebuild(coupons.data(), numCoupons, tgtLgArrInts);
+  return chSet;
+}
+
 double CouponList::getCompositeEstimate() const { return getEstimate(); }
 
 double CouponList::getEstimate() const {
-  const int couponCount = getCouponCount();
+  return getEstimate(getCouponCount());
+}
+
+double CouponList::getEstimate(const int couponCount) {
   const double est = CubicInterpolation::usingXAndYTables(couponCount);
   return fmax(est, couponCount);
 }
 
 double CouponList::getLowerBound(const int numStdDev) const {
+  return getLowerBound(getCouponCount(), numStdDev);
+}
+
+double CouponList::getLowerBound(const int couponCount, const int numStdDev) {
   HllUtil::checkNumStdDev(numStdDev);
-  const int couponCount = getCouponCount();
   const double est = CubicInterpolation::usingXAndYTables(couponCount);
   const double tmp = est / (1.0 + (numStdDev * HllUtil::COUPON_RSE));
   return fmax(tmp, couponCount);
 }
 
 double CouponList::getUpperBound(const int numStdDev) const {
+  return getUpperBound(getCouponCount(), numStdDev);
+}
+
+double CouponList::getUpperBound(const int couponCount, const int numStdDev) {
   HllUtil::checkNumStdDev(numStdDev);
-  const int couponCount = getCouponCount();
   const double est = CubicInterpolation::usingXAndYTables(couponCount);
   const double tmp = est / (1.0 - (numStdDev * HllUtil::COUPON_RSE));
   return fmax(tmp, couponCount);
@@ -242,8 +370,10 @@ void CouponList::putOutOfOrderFlag(bool oooFlag) {
   this->oooFlag = oooFlag;
 }
 
-CouponList* CouponList::reset() {
-  return new CouponList(lgConfigK, tgtHllType, CurMode::LIST);
+void CouponList::clear() {
+  std::fill(couponIntArr, couponIntArr + (1 << lgCouponArrInts), 0);
+  couponCount = 0;
+  oooFlag = false;
 }
 
 int CouponList::getLgCouponArrInts() const {
@@ -262,7 +392,8 @@ std::unique_ptr<PairIterator> CouponList::getIterator() const {
 HllSketchImpl* CouponList::promoteHeapListToSet(CouponList& list) {
   const int couponCount = list.couponCount;
   const int* arr = list.couponIntArr;
-  CouponHashSet* chSet = new CouponHashSet(list.lgConfigK, list.tgtHllType);
+  CouponHashSet* chSet = new (list.resource) CouponHashSet(list.lgConfigK, list.tgtHllType, list.resource);
+  std::swap(chSet->spareHll, list.spareHll);
   for (int i = 0; i < couponCount; ++i) {
     chSet->couponUpdate(arr[i]);
   }
@@ -272,7 +403,14 @@ HllSketchImpl* CouponList::promoteHeapListToSet(CouponList& list) {
 }
 
 HllSketchImpl* CouponList::promoteHeapListOrSetToHll(CouponList& src) {
-  HllArray* tgtHllArr = HllArray::newHll(src.lgConfigK, src.tgtHllType);
+  HllArray* tgtHllArr;
+  if (src.spareHll != nullptr) {
+    tgtHllArr = src.spareHll;
+    src.spareHll = nullptr;
+    tgtHllArr->clear();
+  } else {
+    tgtHllArr = HllArray::newHll(src.lgConfigK, src.tgtHllType, src.resource);
+  }
   std::unique_ptr<PairIterator> srcItr = src.getIterator();
   tgtHllArr->putKxQ0(1 << src.lgConfigK);
   while (srcItr->nextValid()) {
@@ -0,0 +1,328 @@
+/*
+ * Copyright 2018, Yahoo! Inc. Licensed under the terms of the
+ * Apache License 2.0. See LICENSE file at the project root for terms.
+ */
+
+#include "CouponSparse.hpp"
+#include "CouponHashSet.hpp"
+#include "HllArray.hpp"
+#include "HllUtil.hpp"
+#include "IntArrayPairIterator.hpp"
+
+#include <algorithm>
+#include <cassert>
+#include <cstring>
+#include <stdexcept>
+
+namespace datasketches {
+
+// keys sort by slot, then value
+static inline uint32_t toKey(const int coupon) {
+  return (static_cast<uint32_t>(HllUtil::getLow26(coupon)) << HllUtil::VAL_BITS_6)
+      | HllUtil::getValue(coupon);
+}
+
+static inline int toCoupon(const uint32_t key) {
+  return HllUtil::pair(key >> HllUtil::VAL_BITS_6, key & HllUtil::VAL_MASK_6);
+}
+
+// a varint token and an optional value byte, at most 6 bytes
+static const int MAX_KEY_BYTES = 6;
+
+static inline uint8_t* encodeKey(uint8_t* ptr, const uint32_t key, const uint32_t prevKey) {
+  const uint32_t value = key & HllUtil::VAL_MASK_6;
+  const uint32_t code = (value < 4) ? (value - 1) : 3;
+  uint32_t token = (((key >> HllUtil::VAL_BITS_6) - (prevKey >> HllUtil::VAL_BITS_6)) << 2) | code;
+  while (token >= 0x80) {
+    *ptr++ = (uint8_t) (token | 0x80);
+    token >>= 7;
+  }
+  *ptr++ = (uint8_t) token;
+  if (code == 3) { *ptr++ = (uint8_t) value; }
+  return ptr;
+}
+
+// key holds the previous key on entry and the decoded one on return
+static inline const uint8_t* decodeKey(const uint8_t* ptr, uint32_t& key) {
+  uint32_t token = 0;
+  int shift = 0;
+  uint8_t byte;
+  do {
+    byte = *ptr++;
+    token |= (uint32_t) (byte & 0x7f) << shift;
+    shift += 7;
+  } while (byte & 0x80);
+  const uint32_t code = token & 3;
+  const uint32_t value = (code == 3) ? *ptr++ : (code + 1);
+  key = (((key >> HllUtil::VAL_BITS_6) + (token >> 2)) << HllUtil::VAL_BITS_6) | value;
+  return ptr;
+}
+
+// iterates over decoded coupons it owns
+class DecodedPairIterator final : public IntArrayPairIterator {
+  public:
+    DecodedPairIterator(const int* coupons, const int len, const int lgConfigK)
+      : IntArrayPairIterator(coupons, len, lgConfigK) {}
+    virtual ~DecodedPairIterator() { delete [] array; }
+};
+
+CouponSparse::CouponSparse(const int lgConfigK, const TgtHllType tgtHllType,
+                           std::pmr::memory_resource* resource)
+  : CouponList(lgConfigK, tgtHllType, CurMode::SET, LG_BUFFER_INTS, resource, true),
+    stream(nullptr),
+    streamBytes(0),
+    streamCount(0),
+    bufferCount(0) {}
+
+CouponSparse::CouponSparse(const CouponSparse& that, const TgtHllType tgtHllType)
+  : CouponList(that.lgConfigK, tgtHllType, CurMode::SET, that.lgCouponArrInts, that.resource, true),
+    stream(nullptr),
+    streamBytes(that.streamBytes),
+    streamCount(that.streamCount),
+    bufferCount(that.bufferCount) {
+  couponCount = that.couponCount;
+  oooFlag = that.oooFlag;
+  std::copy(that.couponIntArr, that.couponIntArr + bufferCount, couponIntArr);
+  if (streamCount > 0) {
+    stream = HllUtil::newArray<uint8_t>(resource, getStreamBytes());
+    std::memcpy(stream, that.stream, getStreamBytes());
+  }
+}
+
+CouponSparse::~CouponSparse() {
+  HllUtil::deallocate(stream);
+}
+
+CouponSparse* CouponSparse::copy() const {
+  return new (resource) CouponSparse(*this, tgtHllType);
+}
+
+CouponSparse* CouponSparse::copyAs(const TgtHllType tgtHllType) const {
+  return new (resource) CouponSparse(*this, tgtHllType);
+}
+
+HllSketchImpl* CouponSparse::couponUpdate(int coupon) {
+  const uint32_t key = toKey(coupon);
+  uint32_t* buffer = reinterpret_cast<uint32_t*>(couponIntArr);
+  uint32_t* pos = std::lower_bound(buffer, buffer + bufferCount, key);
+  if (((pos != buffer + bufferCount) && (*pos == key)) || streamContains(key)) {
+    return this; // duplicate
+  }
+  std::copy_backward(pos, buffer + bufferCount, buffer + bufferCount + 1);
+  *pos = key;
+  ++bufferCount;
+  ++couponCount;
+  if (couponCount > getMaxCoupons()) {
+    return promoteHeapListOrSetToHll(*this);
+  }
+  if (bufferCount == (1 << lgCouponArrInts)) {
+    mergeBuffer();
+    const int hllBytes = (tgtHllType == HLL_4) ? HllArray::hll4ArrBytes(lgConfigK)
+        : (tgtHllType == HLL_6) ? HllArray::hll6ArrBytes(lgConfigK) : HllArray::hll8ArrBytes(lgConfigK);
+    if (getStreamBytes() >= hllBytes) {
+      return promoteHeapListOrSetToHll(*this);
+    }
+  }
+  return this;
+}
+
+int CouponSparse::getIndexInts() const {
+  return 2 * ((streamCount + INDEX_STRIDE - 1) / INDEX_STRIDE);
+}
+
+const uint32_t* CouponSparse::getIndex() const {
+  return reinterpret_cast<const uint32_t*>(stream);
+}
+
+const uint8_t* CouponSparse::getEncodedKeys() const {
+  return stream + getIndexInts() * sizeof(uint32_t);
+}
+
+bool CouponSparse::streamContains(const uint32_t key) const {
+  const uint32_t* index = getIndex();
+  if ((streamCount == 0) || (key < index[0])) { return false; }
+  // last block starting at or before key
+  int lo = 0;
+  int hi = getIndexInts() / 2;
+  while (hi - lo > 1) {
+    const int mid = (lo + hi) >> 1;
+    if (index[2 * mid] <= key) { lo = mid; } else { hi = mid; }
+  }
+  uint32_t cur = 0;
+  const uint8_t* ptr = decodeKey(getEncodedKeys() + index[2 * lo + 1], cur);
+  cur = index[2 * lo];
+  const int numKeys = std::min(INDEX_STRIDE, streamCount - lo * INDEX_STRIDE);
+  for (int i = 1; (i < numKeys) && (cur < key); ++i) {
+    ptr = decodeKey(ptr, cur);
+  }
+  return cur == key;
+}
+
+void CouponSparse::decodeAll(uint32_t* dst) const {
+  const uint32_t* buffer = reinterpret_cast<const uint32_t*>(couponIntArr);
+  const uint8_t* ptr = getEncodedKeys();
+  uint32_t streamKey = 0;
+  int streamPos = 0;
+  int bufferPos = 0;
+  if (streamCount > 0) { ptr = decodeKey(ptr, streamKey); }
+  const int total = streamCount + bufferCount;
+  for (int i = 0; i < total; ++i) {
+    if ((bufferPos < bufferCount) && ((streamPos == streamCount) || (buffer[bufferPos] < streamKey))) {
+      dst[i] = buffer[bufferPos++];
+    } else {
+      dst[i] = streamKey;
+      if (++streamPos < streamCount) { ptr = decodeKey(ptr, streamKey); }
+    }
+  }
+}
+
+void CouponSparse::mergeBuffer() {
+  const int total = streamCount + bufferCount;
+  uint32_t* keys = HllUtil::newArray<uint32_t>(resource, total);
+  decodeAll(keys);
+  const int numBlocks = (total + INDEX_STRIDE - 1) / INDEX_STRIDE;
+  const size_t indexBytes = 2 * numBlocks * sizeof(uint32_t);
+  uint8_t* merged = HllUtil::newArray<uint8_t>(resource,
+                                               indexBytes + streamBytes + bufferCount * MAX_KEY_BYTES);
+  uint32_t* index = reinterpret_cast<uint32_t*>(merged);
+  uint8_t* const encoded = merged + indexBytes;
+  uint8_t* ptr = encoded;
+  uint32_t prevKey = 0;
+  for (int i = 0; i < total; ++i) {
+    if ((i % INDEX_STRIDE) == 0) {
+      index[2 * (i / INDEX_STRIDE)] = keys[i];
+      index[2 * (i / INDEX_STRIDE) + 1] = (uint32_t) (ptr - encoded);
+    }
+    ptr = encodeKey(ptr, keys[i], prevKey);
+    prevKey = keys[i];
+  }
+  HllUtil::deallocate(keys);
+
+  // keep only what the stream needs
+  const size_t mergedBytes = ptr - merged;
+  HllUtil::deallocate(stream);
+  stream = HllUtil::newArray<uint8_t>(resource, mergedBytes);
+  std::memcpy(stream, merged, mergedBytes);
+  HllUtil::deallocate(merged);
+  streamBytes = (int) (ptr - encoded);
+  streamCount = total;
+  bufferCount = 0;
+  growBuffer();
+}
+
+void CouponSparse::growBuffer() {
+  int lgBufferInts = lgCouponArrInts;
+  while ((1 << (2 * lgBufferInts)) < 4 * streamCount) { ++lgBufferInts; }
+  if (lgBufferInts == lgCouponArrInts) { return; }
+  HllUtil::deallocate(couponIntArr);
+  couponIntArr = HllUtil::newArray<int>(resource, 1 << lgBufferInts);
+  lgCouponArrInts = lgBufferInts;
+}
+
+int CouponSparse::getMaxCoupons() const {
+  if (lgConfigK < 8) { return (1 << HllUtil::LG_INIT_LIST_SIZE) - 1; }
+  return (HllUtil::RESIZE_NUMER << (lgConfigK - 3)) / HllUtil::RESIZE_DENOM;
+}
+
+// size of the table a CouponHashSet would use for count coupons
+static int lgSetArrInts(const int count) {
+  int lgArrInts = HllUtil::LG_INIT_SET_SIZE;
+  while ((HllUtil::RESIZE_DENOM * count) > (HllUtil::RESIZE_NUMER * (1 << lgArrInts))) {
+    ++lgArrInts;
+  }
+  return lgArrInts;
+}
+
+// fewer coupons than a LIST holds serialize as a LIST, the others as a SET
+static bool isListImage(const int count) {
+  return count < (1 << HllUtil::LG_INIT_LIST_SIZE);
+}
+
+CouponList* CouponSparse::toCouponList() const {
+  int* coupons = HllUtil::newArray<int>(resource, couponCount);
+  decodeAll(reinterpret_cast<uint32_t*>(coupons));
+  for (int i = 0; i < couponCount; ++i) {
+    coupons[i] = toCoupon(static_cast<uint32_t>(coupons[i]));
+  }
+  CouponList* list;
+  if (isListImage(couponCount)) {
+    list = new (resource) CouponList(lgConfigK, tgtHllType, CurMode::LIST, resource);
+    std::copy(coupons, coupons + couponCount, list->couponIntArr);
+    list->couponCount = couponCount;
+  } else {
+    CouponHashSet* chSet = new (resource) CouponHashSet(lgConfigK, tgtHllType, resource);
+    chSet->rebuild(coupons, couponCount, lgSetArrInts(couponCount));
+    list = chSet;
+  }
+  list->putOutOfOrderFlag(oooFlag);
+  HllUtil::deallocate(coupons);
+  return list;
+}
+
+void CouponSparse::serializeToMem(uint8_t* dst, const bool compact) const {
+  CouponList* list = toCouponList();
+  list->serializeToMem(dst, compact);
+  delete list;
+}
+
+void CouponSparse::writeHeader(uint8_t* dst, const bool compact) const {
+  CouponList* list = toCouponList();
+  list->writeHeader(dst, compact);
+  delete list;
+}
+
+// Unreachable: wrapped sketches deserialize to the regular modes and reset
+// with sparse false, so no sparse impl is ever wrapped.
+void CouponSparse::wrapMemory(uint8_t* /* mem */) {
+  assert(false);
+  throw std::logic_error("Sparse sketches cannot be wrapped");
+}
+
+int CouponSparse::getUpdatableSerializationBytes() const {
+  if (isListImage(couponCount)) {
+    return HllUtil::LIST_INT_ARR_START + (4 << HllUtil::LG_INIT_LIST_SIZE);
+  }
+  return HllUtil::HASH_SET_INT_ARR_START + (4 << lgSetArrInts(couponCount));
+}
+
+int CouponSparse::getCompactSerializationBytes() const {
+  return getMemDataStart() + (couponCount << 2);
+}
+
+int CouponSparse::getMemDataStart() const {
+  return isListImage(couponCount) ? HllUtil::LIST_INT_ARR_START : HllUtil::HASH_SET_INT_ARR_START;
+}
+
+int CouponSparse::getPreInts() const {
+  return isListImage(couponCount) ? HllUtil::LIST_PREINTS : HllUtil::HASH_SET_PREINTS;
+}
+
+std::unique_ptr<PairIterator> CouponSparse::getIterator() const {
+  int* coupons = new int[couponCount];
+  decodeAll(reinterpret_cast<uint32_t*>(coupons));
+  for (int i = 0; i < couponCount; ++i) {
+    coupons[i] = toCoupon(static_cast<uint32_t>(coupons[i]));
+  }
+  return std::unique_ptr<PairIterator>(new DecodedPairIterator(coupons, couponCount, lgConfigK));
+}
+
+void CouponSparse::clear() {
+  HllUtil::deallocate(stream);
+  stream = nullptr;
+  if (lgCouponArrInts > LG_BUFFER_INTS) {
+    HllUtil::deallocate(couponIntArr);
+    couponIntArr = HllUtil::newArray<int>(resource, 1 << LG_BUFFER_INTS);
+    lgCouponArrInts = LG_BUFFER_INTS;
+  }
+  streamBytes = 0;
+  streamCount = 0;
+  bufferCount = 0;
+  couponCount = 0;
+  oooFlag = true;
+}
+
+int CouponSparse::getStreamBytes() const {
+  return getIndexInts() * (int) sizeof(uint32_t) + streamBytes;
+}
+
+}
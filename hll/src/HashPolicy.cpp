@@ -0,0 +1,62 @@
+/*
+ * Copyright 2018, Yahoo! Inc. Licensed under the terms of the
+ * Apache License 2.0. See LICENSE file at the project root for terms.
+ */
+
+#include "hll.hpp"
+#include "HllUtil.hpp"
+
+#include <cstring>
+
+namespace datasketches {
+
+HashPolicy::HashPolicy(const Function function, const uint64_t seed)
+  : function(function), seed(seed) {}
+
+HashPolicy::Function HashPolicy::getFunction() const {
+  return function;
+}
+
+uint64_t HashPolicy::getSeed() const {
+  return seed;
+}
+
+void HashPolicy::hash(const void* data, const size_t lengthBytes, HashState& result) const {
+  if ((function == FAST_MIX) && (lengthBytes <= sizeof(uint64_t))) {
+    uint64_t key = 0;
+    std::memcpy(&key, data, lengthBytes);
+    HllUtil::fastMix(key, lengthBytes, seed, result);
+  } else {
+    MurmurHash3_x64_128(data, lengthBytes, seed, result);
+  }
+}
+
+uint8_t HashPolicy::getSerialTag() const {
+  // the seed hash folded into the 4 spare bits of the mode byte; 0 stays
+  // reserved for the default
+  const uint16_t seedHash = getSeedHash();
+  return (seedHash == 0) ? 0 : (uint8_t) (1 + (seedHash % 15));
+}
+
+uint16_t HashPolicy::getSeedHash() const {
+  if ((function == MURMUR3) && (seed == DEFAULT_SEED)) { return 0; }
+  const uint64_t key[2] = { seed, static_cast<uint64_t>(function) };
+  HashState seedHash;
+  MurmurHash3_x64_128(key, sizeof(key), 0, seedHash);
+  const uint16_t result = (uint16_t) seedHash.h1;
+  return (result == 0) ? 1 : result;
+}
+
+int HashPolicy::getSeedHashBytes() const {
+  return ((function == MURMUR3) && (seed == DEFAULT_SEED)) ? 0 : SEED_HASH_BYTES;
+}
+
+bool HashPolicy::operator==(const HashPolicy& that) const {
+  return (function == that.function) && (seed == that.seed);
+}
+
+bool HashPolicy::operator!=(const HashPolicy& that) const {
+  return !(*this == that);
+}
+
+}
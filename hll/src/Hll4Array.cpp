@@ -4,7 +4,9 @@
  */
 
 #include "Hll4Array.hpp"
+#include "HllKernels.hpp"
 
+#include <algorithm>
 #include <cstring>
 #include <memory>
 
@@ -12,50 +14,76 @@ namespace datasketches {
 
 Hll4Iterator::Hll4Iterator(const Hll4Array& hllArray, const int lengthPairs)
   : HllPairIterator(lengthPairs),
-    hllArray(hllArray)
-{}
+    hllArray(hllArray),
+    numExceptions(0),
+    nextException(0),
+    exceptions(inlineExceptions)
+{
+  AuxHashMap* auxHashMap = hllArray.getAuxHashMap();
+  if (auxHashMap == nullptr) { return; }
+  const int auxCount = auxHashMap->getAuxCount();
+  if (auxCount > INLINE_EXCEPTIONS) {
+    exceptions = HllUtil::newArray<int>(hllArray.getResource(), auxCount);
+  }
+  IntArrayPairIterator auxItr = auxHashMap->getPairs();
+  while (auxItr.nextValid()) { exceptions[numExceptions++] = auxItr.getPair(); }
+  const int configKmask = (1 << hllArray.getLgConfigK()) - 1;
+  std::sort(exceptions, exceptions + numExceptions, [configKmask](const int a, const int b) {
+    return (a & configKmask) < (b & configKmask);
+  });
+}
 
-Hll4Iterator::~Hll4Iterator() { }
+Hll4Iterator::~Hll4Iterator() {
+  if (exceptions != inlineExceptions) { HllUtil::deallocate(exceptions); }
+}
 
 int Hll4Iterator::value() {
   const int nib = hllArray.getSlot(index);
   if (nib == HllUtil::AUX_TOKEN) {
-    // auxHashMap cannot be null here
-    return hllArray.getAuxHashMap()->mustFindValueFor(index);
+    // slots are visited in order, so this token's exception is the next one
+    assert((nextException < numExceptions)
+           && ((exceptions[nextException] & ((1 << hllArray.getLgConfigK()) - 1)) == index));
+    return HllUtil::getValue(exceptions[nextException++]);
   } else {
     return nib + hllArray.getCurMin();
   }
 }
 
-Hll4Array::Hll4Array(const int lgConfigK) :
-    HllArray(lgConfigK, TgtHllType::HLL_4) {
-  const int numBytes = hll4ArrBytes(lgConfigK);
-  hllByteArr = new uint8_t[numBytes];
-  std::fill(hllByteArr, hllByteArr + numBytes, 0);
+Hll4Array::Hll4Array(const int lgConfigK, std::pmr::memory_resource* resource) :
+    HllArray(lgConfigK, TgtHllType::HLL_4, resource) {
+  allocateArray(hll4ArrBytes(lgConfigK));
   auxHashMap = nullptr;
 }
 
-Hll4Array::Hll4Array(const Hll4Array& that) :
-  HllArray(that)
+Hll4Array::Hll4Array(const Hll4Array& that, std::pmr::memory_resource* resource) :
+  HllArray(that, (resource == nullptr) ? that.resource : resource)
 {
   // can determine hllByteArr size in parent class, no need to allocate here
   // but parent class doesn't handle the auxHashMap
   if (that.auxHashMap != nullptr) {
-    auxHashMap = that.auxHashMap->copy();
+    auxHashMap = that.auxHashMap->share(this->resource);
   } else {
     auxHashMap = nullptr;
   }
 }
 
 Hll4Array::~Hll4Array() {
-  // hllByteArr deleted in parent
+  // hllByteArr released in parent
   if (auxHashMap != nullptr) {
-    delete auxHashMap;
+    AuxHashMap::release(auxHashMap);
   }
 }
 
 Hll4Array* Hll4Array::copy() const {
-  return new Hll4Array(*this);
+  return new (resource) Hll4Array(*this);
+}
+
+void Hll4Array::clear() {
+  HllArray::clear();
+  if (auxHashMap != nullptr) {
+    AuxHashMap::release(auxHashMap);
+    auxHashMap = nullptr;
+  }
 }
 
 std::unique_ptr<PairIterator> Hll4Array::getIterator() const {
@@ -81,6 +109,22 @@ int Hll4Array::getUpdatableSerializationBytes() const {
   return HllUtil::HLL_BYTE_ARR_START + getHllByteArrBytes() + auxBytes;
 }
 
+void Hll4Array::wrapMemory(uint8_t* mem) {
+  HllArray::wrapMemory(mem);
+  int* auxMem = reinterpret_cast<int*>(hllByteArr + getHllByteArrBytes());
+  if (auxHashMap != nullptr) {
+    auxHashMap = AuxHashMap::unshare(auxHashMap);
+    auxHashMap->wrapMemory(auxMem);
+  } else {
+    // the updatable image keeps the default aux space even when unused
+    std::fill_n(auxMem, 1 << HllUtil::LG_AUX_ARR_INTS[lgConfigK], 0);
+  }
+}
+
+bool Hll4Array::isWrapped() const {
+  return HllArray::isWrapped() && (auxHashMap == nullptr || auxHashMap->isWrapped());
+}
+
 int Hll4Array::getHllByteArrBytes() const {
   return hll4ArrBytes(lgConfigK);
 }
@@ -93,40 +137,11 @@ void Hll4Array::putAuxHashMap(AuxHashMap* auxHashMap) {
   this->auxHashMap = auxHashMap;
 }
 
-int Hll4Array::getSlot(const int slotNo) const {
-  int theByte = hllByteArr[slotNo >> 1];
-  if ((slotNo & 1) > 0) { // odd?
-    theByte >>= 4;
-  }
-  return theByte & HllUtil::loNibbleMask;
-}
-
 HllSketchImpl* Hll4Array::couponUpdate(const int coupon) {
-  const int newValue = HllUtil::getValue(coupon);
-  assert(newValue > 0);
-
-  if (newValue <= curMin) {
-    return this; // quick rejection, but only works for large N
-  }
-
-  const int configKmask = (1 << lgConfigK) - 1;
-  const int slotNo = HllUtil::getLow26(coupon) & configKmask;
-  internalHll4Update(slotNo, newValue);
+  internalCouponUpdate(coupon);
   return this;
 }
 
-void Hll4Array::putSlot(const int slotNo, const int newValue) {
-  const int byteno = slotNo >> 1;
-  const int oldValue = hllByteArr[byteno];
-  if ((slotNo & 1) == 0) { // set low nibble
-    hllByteArr[byteno]
-      = (uint8_t) ((oldValue & HllUtil::hiNibbleMask) | (newValue & HllUtil::loNibbleMask));
-  } else { // set high nibble
-    hllByteArr[byteno]
-      = (uint8_t) ((oldValue & HllUtil::loNibbleMask) | ((newValue << 4) & HllUtil::hiNibbleMask));
-  }
-}
-
 //In C: two-registers.c Line 836 in "hhb_abstract_set_slot_if_new_value_bigger" non-sparse
 void Hll4Array::internalHll4Update(const int slotNo, const int newVal) {
   assert((0 <= slotNo) && (slotNo < (1 << lgConfigK)));
@@ -161,6 +176,7 @@ void Hll4Array::internalHll4Update(const int slotNo, const int newVal) {
           // the byte array already contains aux token
           // This is the case where old and new values are both exceptions.
           // The 4-bit array already is AUX_TOKEN, only need to update auxHashMap
+          auxHashMap = AuxHashMap::unshare(auxHashMap);
           auxHashMap->mustReplace(slotNo, newVal);
         }
         else { // case 2: 885
@@ -176,7 +192,10 @@ void Hll4Array::internalHll4Update(const int slotNo, const int newVal) {
           // added to the exception table
           putSlot(slotNo, HllUtil::AUX_TOKEN);
           if (auxHashMap == nullptr) {
-            auxHashMap = new AuxHashMap(HllUtil::LG_AUX_ARR_INTS[lgConfigK], lgConfigK);
+            auxHashMap = new (resource) AuxHashMap(HllUtil::LG_AUX_ARR_INTS[lgConfigK],
+                                                   lgConfigK, resource);
+          } else {
+            auxHashMap = AuxHashMap::unshare(auxHashMap);
           }
           auxHashMap->mustAdd(slotNo, newVal);
         }
@@ -214,38 +233,27 @@ void Hll4Array::shiftToBiggerCurMin() {
   int numAtNewCurMin = 0;
   int numAuxTokens = 0;
 
-  // Walk through the slots of 4-bit array decrementing stored values by one unless it
-  // equals AUX_TOKEN, where it is left alone but counted to be checked later.
-  // If oldStoredValue is 0 it is an error.
-  // If the decremented value is 0, we increment numAtNewCurMin.
-  // Because getNibble is masked to 4 bits oldStoredValue can never be > 15 or negative
-  for (int i = 0; i < configK; i++) { //724
-    int oldStoredValue = getSlot(i);
-    if (oldStoredValue == 0) {
-      throw std::runtime_error("Array slots cannot be 0 at this point.");
-    }
-    if (oldStoredValue < HllUtil::AUX_TOKEN) {
-      putSlot(i, --oldStoredValue);
-      if (oldStoredValue == 0) { numAtNewCurMin++; }
-    } else { //oldStoredValue == AUX_TOKEN
-      numAuxTokens++;
-      assert(auxHashMap != nullptr); // auxHashMap cannot be null at this point
-    }
+  // Decrement every stored value by one unless it equals AUX_TOKEN, where it is
+  // left alone but counted to be checked later. If an old stored value is 0 it
+  // is an error. Slots whose decremented value is 0 are counted in numAtNewCurMin.
+  unshareArray();
+  if (!HllKernels::shift4(hllByteArr, configK, numAtNewCurMin, numAuxTokens)) {
+    throw std::runtime_error("Array slots cannot be 0 at this point.");
   }
+  assert(numAuxTokens == 0 || auxHashMap != nullptr); // auxHashMap cannot be null if tokens exist
 
-  // If old AuxHashMap exists, walk through it updating some slots and build a new AuxHashMap
+  // If old AuxHashMap exists, walk its table updating some slots and build a new AuxHashMap
   // if needed.
   AuxHashMap* newAuxMap = nullptr;
   if (auxHashMap != nullptr) {
-    int slotNum;
-    int oldActualVal;
-    int newShiftedVal;
-
-    std::unique_ptr<PairIterator> itr = auxHashMap->getIterator();
-    while (itr->nextValid()) {
-      slotNum = itr->getKey() & configKmask;
-      oldActualVal = itr->getValue();
-      newShiftedVal = oldActualVal - newCurMin;
+    const int* auxArr = auxHashMap->getAuxIntArr();
+    const int auxArrInts = 1 << auxHashMap->getLgAuxArrInts();
+    for (int i = 0; i < auxArrInts; ++i) {
+      const int pair = auxArr[i];
+      if (pair == HllUtil::EMPTY) { continue; }
+      const int slotNum = HllUtil::getLow26(pair) & configKmask;
+      const int oldActualVal = HllUtil::getValue(pair);
+      const int newShiftedVal = oldActualVal - newCurMin;
       assert(newShiftedVal >= 0);
 
       assert(getSlot(slotNum) == HllUtil::AUX_TOKEN);
@@ -260,7 +268,8 @@ void Hll4Array::shiftToBiggerCurMin() {
       else { //newShiftedVal >= AUX_TOKEN
         // the former exception remains an exception, so must be added to the newAuxMap
         if (newAuxMap == nullptr) {
-          newAuxMap = new AuxHashMap(HllUtil::LG_AUX_ARR_INTS[lgConfigK], lgConfigK);
+          newAuxMap = new (resource) AuxHashMap(HllUtil::LG_AUX_ARR_INTS[lgConfigK],
+                                                lgConfigK, resource);
         }
         newAuxMap->mustAdd(slotNum, oldActualVal);
       }
@@ -280,7 +289,11 @@ void Hll4Array::shiftToBiggerCurMin() {
   }
 
   if (auxHashMap != nullptr) {
-    delete auxHashMap;
+    if (newAuxMap == nullptr && auxHashMap->isWrapped()) {
+      // nothing will be rebound into the wrapped aux space, so clear it here
+      std::fill_n(auxHashMap->getAuxIntArr(), 1 << auxHashMap->getLgAuxArrInts(), 0);
+    }
+    AuxHashMap::release(auxHashMap);
   }
   auxHashMap = newAuxMap;
 
@@ -3,6 +3,7 @@
  * Apache License 2.0. See LICENSE file at the project root for terms.
  */
 
+#include <algorithm>
 #include <cstring>
 
 #include "Hll6Array.hpp"
@@ -11,40 +12,38 @@ namespace datasketches {
 
 Hll6Iterator::Hll6Iterator(const Hll6Array& hllArray, const int lengthPairs)
   : HllPairIterator(lengthPairs),
-    hllArray(hllArray),
-    bitOffset(-6)
+    hllArray(hllArray)
 {}
 
 Hll6Iterator::~Hll6Iterator() { }
 
 int Hll6Iterator::value() {
-  bitOffset += 6;
-  const int shift = bitOffset & 0x7;
-  const int byteIdx = bitOffset >> 3;
-  const uint16_t twoByteVal = (hllArray.hllByteArr[byteIdx + 1] << 8)
-                              | hllArray.hllByteArr[byteIdx];
-  return (uint8_t) (twoByteVal >> shift) & 0x3F;
+  // index only ever advances by one, so refill at each block boundary
+  const int offset = index & (HllKernels::BLOCK_SLOTS - 1);
+  if (offset == 0) {
+    HllKernels::unpack6(block, hllArray.hllByteArr + ((index * 3) >> 2),
+                        std::min(HllKernels::BLOCK_SLOTS, lengthPairs - index));
+  }
+  return block[offset];
 }
 
-Hll6Array::Hll6Array(const int lgConfigK) :
-    HllArray(lgConfigK, TgtHllType::HLL_6) {
-  const int numBytes = hll6ArrBytes(lgConfigK);
-  hllByteArr = new uint8_t[numBytes];
-  std::fill(hllByteArr, hllByteArr + numBytes, 0);
+Hll6Array::Hll6Array(const int lgConfigK, std::pmr::memory_resource* resource) :
+    HllArray(lgConfigK, TgtHllType::HLL_6, resource) {
+  allocateArray(hll6ArrBytes(lgConfigK));
 }
 
-Hll6Array::Hll6Array(const Hll6Array& that) :
-  HllArray(that)
+Hll6Array::Hll6Array(const Hll6Array& that, std::pmr::memory_resource* resource) :
+  HllArray(that, (resource == nullptr) ? that.resource : resource)
 {
   // can determine hllByteArr size in parent class, no need to allocate here
 }
 
 Hll6Array::~Hll6Array() {
-  // hllByteArr deleted in parent
+  // hllByteArr released in parent
 }
 
 Hll6Array* Hll6Array::copy() const {
-  return new Hll6Array(*this);
+  return new (resource) Hll6Array(*this);
 }
 
 std::unique_ptr<PairIterator> Hll6Array::getIterator() const {
@@ -52,24 +51,9 @@ std::unique_ptr<PairIterator> Hll6Array::getIterator() const {
   return std::unique_ptr<PairIterator>(itr);
 }
 
-int Hll6Array::getSlot(const int slotNo) const {
-  const int startBit = slotNo * 6;
-  const int shift = startBit & 0x7;
-  const int byteIdx = startBit >> 3;  
-  const uint16_t twoByteVal = (hllByteArr[byteIdx + 1] << 8) | hllByteArr[byteIdx];
-  return (uint8_t) (twoByteVal >> shift) & 0x3F;
-}
-
-void Hll6Array::putSlot(const int slotNo, const int value) {
-  const int startBit = slotNo * 6;
-  const int shift = startBit & 0x7;
-  const int byteIdx = startBit >> 3;
-  const uint16_t valShifted = (value & 0x3F) << shift;
-  uint16_t curMasked = (hllByteArr[byteIdx + 1] << 8) | hllByteArr[byteIdx];
-  curMasked &= (~(HllUtil::VAL_MASK_6 << shift));
-  uint16_t insert = curMasked | valShifted;
-  hllByteArr[byteIdx]     = insert & 0xFF;
-  hllByteArr[byteIdx + 1] = (insert & 0xFF00) >> 8;
+HllSketchImpl* Hll6Array::couponUpdate(const int coupon) {
+  internalCouponUpdate(coupon);
+  return this;
 }
 
 int Hll6Array::getHllByteArrBytes() const {
@@ -20,25 +20,23 @@ int Hll8Iterator::value() {
   return hllArray.hllByteArr[index] & HllUtil::VAL_MASK_6;
 }
 
-Hll8Array::Hll8Array(const int lgConfigK) :
-    HllArray(lgConfigK, TgtHllType::HLL_8) {
-  const int numBytes = hll8ArrBytes(lgConfigK);
-  hllByteArr = new uint8_t[numBytes];
-  std::fill(hllByteArr, hllByteArr + numBytes, 0);
+Hll8Array::Hll8Array(const int lgConfigK, std::pmr::memory_resource* resource) :
+    HllArray(lgConfigK, TgtHllType::HLL_8, resource) {
+  allocateArray(hll8ArrBytes(lgConfigK));
 }
 
-Hll8Array::Hll8Array(const Hll8Array& that) :
-  HllArray(that)
+Hll8Array::Hll8Array(const Hll8Array& that, std::pmr::memory_resource* resource) :
+  HllArray(that, (resource == nullptr) ? that.resource : resource)
 {
   // can determine hllByteArr size in parent class, no need to allocate here
 }
 
 Hll8Array::~Hll8Array() {
-  // hllByteArr deleted in parent
+  // hllByteArr released in parent
 }
 
 Hll8Array* Hll8Array::copy() const {
-  return new Hll8Array(*this);
+  return new (resource) Hll8Array(*this);
 }
 
 std::unique_ptr<PairIterator> Hll8Array::getIterator() const {
@@ -46,12 +44,9 @@ std::unique_ptr<PairIterator> Hll8Array::getIterator() const {
   return std::unique_ptr<PairIterator>(itr);
 }
 
-int Hll8Array::getSlot(const int slotNo) const {
-  return (int) hllByteArr[slotNo] & HllUtil::VAL_MASK_6;
-}
-
-void Hll8Array::putSlot(const int slotNo, const int value) {
-  hllByteArr[slotNo] = value & HllUtil::VAL_MASK_6;
+HllSketchImpl* Hll8Array::couponUpdate(const int coupon) {
+  internalCouponUpdate(coupon);
+  return this;
 }
 
 int Hll8Array::getHllByteArrBytes() const {
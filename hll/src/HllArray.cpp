@@ -14,14 +14,17 @@
 #include "Hll6Array.hpp"
 #include "Hll4Array.hpp"
 #include "Conversions.hpp"
+#include "HllSketchView.hpp"
 
+#include <algorithm>
 #include <cstring>
 #include <cmath>
 
 namespace datasketches {
 
-HllArray::HllArray(const int lgConfigK, const TgtHllType tgtHllType)
-  : HllSketchImpl(lgConfigK, tgtHllType, CurMode::HLL) {
+HllArray::HllArray(const int lgConfigK, const TgtHllType tgtHllType,
+                   std::pmr::memory_resource* resource)
+  : HllSketchImpl(lgConfigK, tgtHllType, CurMode::HLL, resource) {
   hipAccum = 0.0;
   kxq0 = 1 << lgConfigK;
   kxq1 = 0.0;
@@ -29,10 +32,12 @@ HllArray::HllArray(const int lgConfigK, const TgtHllType tgtHllType)
   numAtCurMin = 1 << lgConfigK;
   oooFlag = false;
   hllByteArr = nullptr; // allocated in derived class
+  ownsArray = true;
+  arrRefs = nullptr;
 }
 
-HllArray::HllArray(const HllArray& that)
-  : HllSketchImpl(that.lgConfigK, that.tgtHllType, CurMode::HLL) {
+HllArray::HllArray(const HllArray& that, std::pmr::memory_resource* resource)
+  : HllSketchImpl(that.lgConfigK, that.tgtHllType, CurMode::HLL, resource) {
   hipAccum = that.getHipAccum();
   kxq0 = that.getKxQ0();
   kxq1 = that.getKxQ1();
@@ -40,14 +45,68 @@ HllArray::HllArray(const HllArray& that)
   numAtCurMin = that.getNumAtCurMin();
   oooFlag = that.isOutOfOrderFlag();
 
-  // can determine length, so allocate here
-  int arrayLen = that.getHllByteArrBytes();
-  hllByteArr = new uint8_t[arrayLen];
-  std::copy(that.hllByteArr, that.hllByteArr + arrayLen, hllByteArr);
+  if (that.ownsArray && (that.resource == resource)) {
+    // share the registers, the first write to either array clones them
+    hllByteArr = that.hllByteArr;
+    arrRefs = that.arrRefs;
+    arrRefs->fetch_add(1, std::memory_order_relaxed);
+  } else {
+    // wrapped memory belongs to the caller and another resource may be
+    // released before that's, so take a private copy
+    const int arrayLen = that.getHllByteArrBytes();
+    hllByteArr = HllUtil::newArray<uint8_t>(resource, arrayLen);
+    std::copy(that.hllByteArr, that.hllByteArr + arrayLen, hllByteArr);
+    arrRefs = newRefCount(resource);
+  }
+  ownsArray = true;
 }
 
 HllArray::~HllArray() {
-  delete hllByteArr;
+  releaseArray();
+}
+
+std::atomic<int>* HllArray::newRefCount(std::pmr::memory_resource* resource) {
+  return new (HllUtil::allocate(resource, sizeof(std::atomic<int>))) std::atomic<int>(1);
+}
+
+void HllArray::allocateArray(const int numBytes) {
+  hllByteArr = HllUtil::newArray<uint8_t>(resource, numBytes);
+  std::fill(hllByteArr, hllByteArr + numBytes, 0);
+  arrRefs = newRefCount(resource);
+}
+
+void HllArray::cloneArray() {
+  const int arrayLen = getHllByteArrBytes();
+  uint8_t* arr = HllUtil::newArray<uint8_t>(resource, arrayLen);
+  std::copy(hllByteArr, hllByteArr + arrayLen, arr);
+  releaseArray();
+  hllByteArr = arr;
+  arrRefs = newRefCount(resource);
+  ownsArray = true;
+}
+
+void HllArray::releaseArray() {
+  if (ownsArray && (arrRefs->fetch_sub(1, std::memory_order_acq_rel) == 1)) {
+    HllUtil::deallocate(hllByteArr);
+    HllUtil::deallocate(arrRefs);
+  }
+  arrRefs = nullptr;
+}
+
+void HllArray::clear() {
+  hipAccum = 0.0;
+  kxq0 = 1 << lgConfigK;
+  kxq1 = 0.0;
+  curMin = 0;
+  numAtCurMin = 1 << lgConfigK;
+  oooFlag = false;
+  if ((arrRefs != nullptr) && (arrRefs->load(std::memory_order_acquire) > 1)) {
+    // a copy still reads the old registers
+    releaseArray();
+    allocateArray(getHllByteArrBytes());
+  } else {
+    std::fill(hllByteArr, hllByteArr + getHllByteArrBytes(), 0);
+  }
 }
 
 HllArray* HllArray::copyAs(const TgtHllType tgtHllType) const {
@@ -63,20 +122,22 @@ HllArray* HllArray::copyAs(const TgtHllType tgtHllType) const {
   }
 }
 
-HllArray* HllArray::newHll(const int lgConfigK, const TgtHllType tgtHllType) {
+HllArray* HllArray::newHll(const int lgConfigK, const TgtHllType tgtHllType,
+                           std::pmr::memory_resource* resource) {
   switch (tgtHllType) {
     case HLL_8:
-      return (HllArray*) new Hll8Array(lgConfigK);
+      return (HllArray*) new (resource) Hll8Array(lgConfigK, resource);
     case HLL_6:
-      return (HllArray*) new Hll6Array(lgConfigK);
+      return (HllArray*) new (resource) Hll6Array(lgConfigK, resource);
     case HLL_4:
-      return (HllArray*) new Hll4Array(lgConfigK);
+      return (HllArray*) new (resource) Hll4Array(lgConfigK, resource);
     default:
       throw std::invalid_argument("Impossible HLL type");
   }
 }
 
-HllArray* HllArray::newHll(std::istream& is) {
+HllArray* HllArray::newHll(std::istream& is, std::pmr::memory_resource* resource,
+                           const uint8_t hashTag) {
   uint8_t listHeader[8];
   is.read((char*)listHeader, 8 * sizeof(uint8_t));
 
@@ -96,13 +157,14 @@ HllArray* HllArray::newHll(std::istream& is) {
   }
 
   TgtHllType tgtHllType = extractTgtHllType(listHeader[7]);
+  checkHashTag(listHeader[7], hashTag);
   bool oooFlag = ((listHeader[5] & HllUtil::OUT_OF_ORDER_FLAG_MASK) ? true : false);
   bool comapctFlag = ((listHeader[5] & HllUtil::COMPACT_FLAG_MASK) ? true : false);
 
   const int lgK = (int) listHeader[3];
   const int curMin = (int) listHeader[6];
 
-  HllArray* sketch = newHll(lgK, tgtHllType);
+  HllArray* sketch = newHll(lgK, tgtHllType, resource);
   sketch->putCurMin(curMin);
   sketch->putOutOfOrderFlag(oooFlag);
 
@@ -118,95 +180,170 @@ HllArray* HllArray::newHll(std::istream& is) {
   is.read((char*)&numAtCurMin, sizeof(numAtCurMin));
   is.read((char*)&auxCount, sizeof(auxCount));
   sketch->putNumAtCurMin(numAtCurMin);
-  
-  is.read((char*)sketch->hllByteArr, sketch->getHllByteArrBytes());
+
+  if (listHeader[5] & HllUtil::COMPRESSED_FLAG_MASK) {
+    int codedBytes;
+    is.read((char*)&codedBytes, sizeof(codedBytes));
+    // registers are only coded when that makes them smaller
+    if ((codedBytes <= 0) || (codedBytes > sketch->getHllByteArrBytes())) {
+      delete sketch;
+      throw std::invalid_argument("Corrupt compressed HLL registers");
+    }
+    std::unique_ptr<uint8_t[]> coded(new uint8_t[codedBytes]);
+    is.read((char*)coded.get(), codedBytes);
+    try {
+      HllCompression::decode(coded.get(), codedBytes, tgtHllType, lgK, sketch->hllByteArr);
+    } catch (...) {
+      delete sketch;
+      throw;
+    }
+  } else {
+    is.read((char*)sketch->hllByteArr, sketch->getHllByteArrBytes());
+  }
   
   if (auxCount > 0) { // necessarily TgtHllType == HLL_4
     int auxLgIntArrSize = (int) listHeader[4];
-    AuxHashMap* auxHashMap = AuxHashMap::deserialize(is, lgK, auxCount, auxLgIntArrSize, comapctFlag);
+    AuxHashMap* auxHashMap = AuxHashMap::deserialize(is, lgK, auxCount, auxLgIntArrSize, comapctFlag,
+                                                     resource);
     ((Hll4Array*)sketch)->putAuxHashMap(auxHashMap);
+  } else if ((tgtHllType == HLL_4) && !comapctFlag) {
+    // updatable images carry the aux table even when it is unused
+    const int lgAuxArrInts = (listHeader[4] > 0) ? listHeader[4] : HllUtil::LG_AUX_ARR_INTS[lgK];
+    is.ignore((std::streamsize) sizeof(int) << lgAuxArrInts);
   }
 
   return sketch;
 }
 
-void HllArray::serialize(std::ostream& os, const bool compact) const {
-  // header
-  const uint8_t preInts(getPreInts());
-  os.write((char*)&preInts, sizeof(preInts));
-  const uint8_t serialVersion(HllUtil::SER_VER);
-  os.write((char*)&serialVersion, sizeof(serialVersion));
-  const uint8_t familyId(HllUtil::FAMILY_ID);
-  os.write((char*)&familyId, sizeof(familyId));
-  const uint8_t lgKByte((uint8_t) lgConfigK);
-  os.write((char*)&lgKByte, sizeof(lgKByte));
+HllArray* HllArray::newHll(const HllSketchView& view, std::pmr::memory_resource* resource) {
+  if (view.curMode != HLL) {
+    throw std::invalid_argument("Calling HLL construtor with non-HLL mode data");
+  }
 
-  AuxHashMap* auxHashMap = getAuxHashMap();
-  uint8_t lgArrByte(0);
-  if (auxHashMap != nullptr) {
-    lgArrByte = auxHashMap->getLgAuxArrInts();
+  HllArray* sketch = newHll(view.lgConfigK, view.tgtHllType, resource);
+  sketch->putCurMin(view.curMin);
+  sketch->putOutOfOrderFlag(view.oooFlag);
+  sketch->putHipAccum(view.hipAccum);
+  sketch->putKxQ0(view.kxq0);
+  sketch->putKxQ1(view.kxq1);
+  sketch->putNumAtCurMin(view.numAtCurMin);
+
+  if (view.compressed) {
+    try {
+      HllCompression::decode(view.data, view.codedBytes, view.tgtHllType, view.lgConfigK,
+                             sketch->hllByteArr);
+    } catch (...) {
+      delete sketch;
+      throw;
+    }
+  } else {
+    std::memcpy(sketch->hllByteArr, view.data, sketch->getHllByteArrBytes());
   }
-  os.write((char*)&lgArrByte, sizeof(lgArrByte));
 
-  const uint8_t flagsByte(makeFlagsByte(compact));
-  os.write((char*)&flagsByte, sizeof(flagsByte));
-  const uint8_t curMinByte((uint8_t) curMin);
-  os.write((char*)&curMinByte, sizeof(curMinByte));
-  const uint8_t modeByte(makeModeByte());
-  os.write((char*)&modeByte, sizeof(modeByte));
+  if (view.auxCount > 0) { // necessarily TgtHllType == HLL_4
+    AuxHashMap* auxHashMap = AuxHashMap::deserialize(view.auxInts, view.lgConfigK, view.auxCount,
+                                                     view.lgAuxArrInts, view.compact, resource);
+    ((Hll4Array*)sketch)->putAuxHashMap(auxHashMap);
+  }
 
-  // estimator data
-  os.write((char*)&hipAccum, sizeof(hipAccum));
-  os.write((char*)&kxq0, sizeof(kxq0));
-  os.write((char*)&kxq1, sizeof(kxq1));
+  return sketch;
+}
 
-  // array data
-  os.write((char*)&numAtCurMin, sizeof(numAtCurMin));
+void HllArray::serializeToMem(uint8_t* dst, const bool compact) const {
+  AuxHashMap* auxHashMap = getAuxHashMap();
+  writeHeader(dst, compact);
 
-  const int auxCount = (auxHashMap == nullptr ? 0 : auxHashMap->getAuxCount());
-  os.write((char*)&auxCount, sizeof(auxCount));
-  os.write((char*)hllByteArr, getHllByteArrBytes());
+  const int arrBytes = getHllByteArrBytes();
+  std::memcpy(dst + HllUtil::HLL_BYTE_ARR_START, hllByteArr, arrBytes);
 
   // aux map if HLL_4
+  uint8_t* ptr = dst + HllUtil::HLL_BYTE_ARR_START + arrBytes;
   if (tgtHllType == HLL_4) {
-    if (auxHashMap != nullptr) {
-      if (compact) {
-        std::unique_ptr<PairIterator> itr = auxHashMap->getIterator();
-        while (itr->nextValid()) {
-          const int pairValue = itr->getPair();
-          os.write((char*)&pairValue, sizeof(pairValue));
-        }
-      } else {
-        os.write((char*)auxHashMap->getAuxIntArr(), auxHashMap->getUpdatableSizeBytes());
-      }
-    } else if (!compact) {
-      // if updatable, we write even if currently unused so the binary can be wrapped      
-      int auxBytes = 4 << HllUtil::LG_AUX_ARR_INTS[lgConfigK];
-      std::fill_n(std::ostreambuf_iterator<char>(os), auxBytes, 0);
+    if (compact) {
+      writeCompactAux(ptr);
+    } else if (auxHashMap != nullptr) {
+      std::memcpy(ptr, auxHashMap->getAuxIntArr(), auxHashMap->getUpdatableSizeBytes());
+    } else {
+      // if updatable, we write even if currently unused so the binary can be wrapped
+      std::fill_n(ptr, 4 << HllUtil::LG_AUX_ARR_INTS[lgConfigK], 0);
     }
   }
 }
 
-HllSketchImpl* HllArray::couponUpdate(const int coupon) { // used by HLL_8 and HLL_6
-  const int configKmask = (1 << getLgConfigK()) - 1;
-  const int slotNo = HllUtil::getLow26(coupon) & configKmask;
-  const int newVal = HllUtil::getValue(coupon);
-  assert(newVal > 0);
+void HllArray::writeCompactAux(uint8_t* dst) const {
+  AuxHashMap* auxHashMap = getAuxHashMap();
+  if (auxHashMap == nullptr) { return; }
+  IntArrayPairIterator itr = auxHashMap->getPairs();
+  while (itr.nextValid()) {
+    const int pairValue = itr.getPair();
+    std::memcpy(dst, &pairValue, sizeof(pairValue));
+    dst += sizeof(pairValue);
+  }
+}
 
-  const int curVal = getSlot(slotNo);
-  if (newVal > curVal) {
-    putSlot(slotNo, newVal);
-    hipAndKxQIncrementalUpdate(*this, curVal, newVal);
-    if (curVal == 0) {
-      decNumAtCurMin(); // interpret numAtCurMin as num zeros
-      assert(getNumAtCurMin() >= 0);
-    }
+int HllArray::getCodedBytes(const HllRegisterEncoder& encoder) const {
+  const int codedBytes = encoder.getCodedBytes();
+  return (HllCompression::CODED_START + codedBytes < HllUtil::HLL_BYTE_ARR_START + getHllByteArrBytes())
+      ? codedBytes : 0;
+}
+
+int HllArray::getCompressedSerializationBytes() const {
+  const int codedBytes = getCodedBytes(HllRegisterEncoder(tgtHllType, lgConfigK, hllByteArr));
+  if (codedBytes == 0) { return getCompactSerializationBytes(); }
+  AuxHashMap* auxHashMap = getAuxHashMap();
+  const int auxCountBytes = ((auxHashMap == nullptr) ? 0 : auxHashMap->getCompactSizeBytes());
+  return HllCompression::CODED_START + codedBytes + auxCountBytes;
+}
+
+void HllArray::serializeCompressedToMem(uint8_t* dst) const {
+  const HllRegisterEncoder encoder(tgtHllType, lgConfigK, hllByteArr);
+  const int codedBytes = getCodedBytes(encoder);
+  if (codedBytes == 0) {
+    serializeToMem(dst, true);
+    return;
   }
-  return this;
+  writeHeader(dst, true);
+  dst[5] |= HllUtil::COMPRESSED_FLAG_MASK;
+  std::memcpy(dst + HllUtil::HLL_BYTE_ARR_START, &codedBytes, sizeof(codedBytes));
+  encoder.write(dst + HllCompression::CODED_START);
+  writeCompactAux(dst + HllCompression::CODED_START + codedBytes);
+}
+
+void HllArray::writeHeader(uint8_t* dst, const bool compact) const {
+  AuxHashMap* auxHashMap = getAuxHashMap();
+  dst[0] = (uint8_t) getPreInts();
+  dst[1] = (uint8_t) HllUtil::SER_VER;
+  dst[2] = (uint8_t) HllUtil::FAMILY_ID;
+  dst[3] = (uint8_t) lgConfigK;
+  dst[4] = (auxHashMap == nullptr ? 0 : (uint8_t) auxHashMap->getLgAuxArrInts());
+  dst[5] = makeFlagsByte(compact);
+  dst[6] = (uint8_t) curMin;
+  dst[7] = makeModeByte();
+
+  // estimator data
+  std::memcpy(dst + 8, &hipAccum, sizeof(hipAccum));
+  std::memcpy(dst + 16, &kxq0, sizeof(kxq0));
+  std::memcpy(dst + 24, &kxq1, sizeof(kxq1));
+
+  // array data
+  std::memcpy(dst + 32, &numAtCurMin, sizeof(numAtCurMin));
+  const int auxCount = (auxHashMap == nullptr ? 0 : auxHashMap->getAuxCount());
+  std::memcpy(dst + 36, &auxCount, sizeof(auxCount));
 }
 
-HllSketchImpl* HllArray::reset() {
-  return new CouponList(lgConfigK, tgtHllType, CurMode::LIST);
+void HllArray::wrapMemory(uint8_t* mem) {
+  uint8_t* memArr = mem + HllUtil::HLL_BYTE_ARR_START;
+  if (ownsArray) {
+    std::copy(hllByteArr, hllByteArr + getHllByteArrBytes(), memArr);
+    releaseArray();
+    ownsArray = false;
+  }
+  hllByteArr = memArr;
+  writeHeader(mem, false);
+}
+
+bool HllArray::isWrapped() const {
+  return !ownsArray;
 }
 
 double HllArray::getEstimate() const {
@@ -232,19 +369,16 @@ double HllArray::getEstimate() const {
  * the very small values <= k where curMin = 0 still apply.
  */
 double HllArray::getLowerBound(const int numStdDev) const {
+  return getLowerBound(lgConfigK, curMin, numAtCurMin, oooFlag, getEstimate(), numStdDev);
+}
+
+double HllArray::getLowerBound(const int lgConfigK, const int curMin, const int numAtCurMin,
+                               const bool oooFlag, const double estimate, const int numStdDev) {
   HllUtil::checkNumStdDev(numStdDev);
   const int configK = 1 << lgConfigK;
   const double numNonZeros = ((curMin == 0) ? (configK - numAtCurMin) : configK);
 
-  double estimate;
-  double rseFactor;
-  if (oooFlag) {
-    estimate = getCompositeEstimate();
-    rseFactor = HllUtil::HLL_NON_HIP_RSE_FACTOR;
-  } else {
-    estimate = hipAccum;
-    rseFactor = HllUtil::HLL_HIP_RSE_FACTOR;
-  }
+  const double rseFactor = (oooFlag ? HllUtil::HLL_NON_HIP_RSE_FACTOR : HllUtil::HLL_HIP_RSE_FACTOR);
 
   double relErr;
   if (lgConfigK > 12) {
@@ -256,18 +390,15 @@ double HllArray::getLowerBound(const int numStdDev) const {
 }
 
 double HllArray::getUpperBound(const int numStdDev) const {
+  return getUpperBound(lgConfigK, oooFlag, getEstimate(), numStdDev);
+}
+
+double HllArray::getUpperBound(const int lgConfigK, const bool oooFlag, const double estimate,
+                               const int numStdDev) {
   HllUtil::checkNumStdDev(numStdDev);
   const int configK = 1 << lgConfigK;
 
-  double estimate;
-  double rseFactor;
-  if (oooFlag) {
-    estimate = getCompositeEstimate();
-    rseFactor = HllUtil::HLL_NON_HIP_RSE_FACTOR;
-  } else {
-    estimate = hipAccum;
-    rseFactor = HllUtil::HLL_HIP_RSE_FACTOR;
-  }
+  const double rseFactor = (oooFlag ? HllUtil::HLL_NON_HIP_RSE_FACTOR : HllUtil::HLL_HIP_RSE_FACTOR);
 
   double relErr;
   if (lgConfigK > 12) {
@@ -286,6 +417,11 @@ double HllArray::getUpperBound(const int numStdDev) const {
  */
 // Original C: again-two-registers.c hhb_get_composite_estimate L1489
 double HllArray::getCompositeEstimate() const {
+  return getCompositeEstimate(lgConfigK, curMin, numAtCurMin, kxq0, kxq1);
+}
+
+double HllArray::getCompositeEstimate(const int lgConfigK, const int curMin, const int numAtCurMin,
+                                      const double kxq0, const double kxq1) {
   const double rawEst = getHllRawEstimate(lgConfigK, kxq0 + kxq1);
 
   const double* xArr = CompositeInterpolationXTable::get_x_arr(lgConfigK);
@@ -352,10 +488,6 @@ int HllArray::getNumAtCurMin() const {
   return numAtCurMin;
 }
 
-CurMode HllArray::getCurMode() const {
-  return curMode;
-}
-
 void HllArray::putKxQ0(const double kxq0) {
   this->kxq0 = kxq0;
 }
@@ -440,28 +572,13 @@ AuxHashMap* HllArray::getAuxHashMap() const {
   return nullptr;
 }
 
-void HllArray::hipAndKxQIncrementalUpdate(HllArray& host, const int oldValue, const int newValue) {
-  assert(newValue > oldValue);
-
-  const int configK = 1 << host.getLgConfigK();
-  // update hipAccum BEFORE updating kxq0 and kxq1
-  double kxq0 = host.getKxQ0();
-  double kxq1 = host.getKxQ1();
-  host.addToHipAccum(configK / (kxq0 + kxq1));
-  // update kxq0 and kxq1; subtract first, then add
-  if (oldValue < 32) { host.putKxQ0(kxq0 -= HllUtil::invPow2(oldValue)); }
-  else               { host.putKxQ1(kxq1 -= HllUtil::invPow2(oldValue)); }
-  if (newValue < 32) { host.putKxQ0(kxq0 += HllUtil::invPow2(newValue)); }
-  else               { host.putKxQ1(kxq1 += HllUtil::invPow2(newValue)); }
-}
-
 /**
  * Estimator when N is small, roughly less than k log(k).
  * Refer to Wikipedia: Coupon Collector Problem
  * @return the very low range estimate
  */
 //In C: again-two-registers.c hhb_get_improved_linear_counting_estimate L1274
-double HllArray::getHllBitMapEstimate(const int lgConfigK, const int curMin, const int numAtCurMin) const {
+double HllArray::getHllBitMapEstimate(const int lgConfigK, const int curMin, const int numAtCurMin) {
   const  int configK = 1 << lgConfigK;
   const  int numUnhitBuckets =  ((curMin == 0) ? numAtCurMin : 0);
 
@@ -475,7 +592,7 @@ double HllArray::getHllBitMapEstimate(const int lgConfigK, const int curMin, con
 }
 
 //In C: again-two-registers.c hhb_get_raw_estimate L1167
-double HllArray::getHllRawEstimate(const int lgConfigK, const double kxqSum) const {
+double HllArray::getHllRawEstimate(const int lgConfigK, const double kxqSum) {
   const int configK = 1 << lgConfigK;
   double correctionFactor;
   if (lgConfigK == 4) { correctionFactor = 0.673; }
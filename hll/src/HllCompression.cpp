@@ -0,0 +1,255 @@
+/*
+ * Copyright 2018, Yahoo! Inc. Licensed under the terms of the
+ * Apache License 2.0. See LICENSE file at the project root for terms.
+ */
+
+#include "HllCompression.hpp"
+#include "HllKernels.hpp"
+
+#include <algorithm>
+#include <cstring>
+
+namespace datasketches {
+
+static const int MAX_SYMBOLS = HllCompression::MAX_SYMBOLS;
+static const int MAX_CODE_BITS = HllCompression::MAX_CODE_BITS;
+
+// Huffman code lengths of the symbols with nonzero counts. With at most 64
+// symbols a quadratic search for the two lightest roots is cheap enough.
+static void huffmanLengths(const uint64_t* counts, uint8_t* lengths) {
+  uint64_t weight[2 * MAX_SYMBOLS];
+  int parent[2 * MAX_SYMBOLS];
+  int leaf[MAX_SYMBOLS];
+  int numNodes = 0;
+  for (int s = 0; s < MAX_SYMBOLS; ++s) {
+    lengths[s] = 0;
+    leaf[s] = -1;
+    if (counts[s] > 0) {
+      leaf[s] = numNodes;
+      weight[numNodes] = counts[s];
+      parent[numNodes++] = -1;
+    }
+  }
+  if (numNodes == 1) {
+    // a lone symbol still needs a bit, so the decoder can count registers
+    for (int s = 0; s < MAX_SYMBOLS; ++s) {
+      if (leaf[s] == 0) { lengths[s] = 1; }
+    }
+    return;
+  }
+
+  for (int numRoots = numNodes; numRoots > 1; --numRoots) {
+    int a = -1;
+    int b = -1;
+    for (int n = 0; n < numNodes; ++n) {
+      if (parent[n] != -1) { continue; }
+      if ((a < 0) || (weight[n] < weight[a])) {
+        b = a;
+        a = n;
+      } else if ((b < 0) || (weight[n] < weight[b])) {
+        b = n;
+      }
+    }
+    weight[numNodes] = weight[a] + weight[b];
+    parent[numNodes] = -1;
+    parent[a] = numNodes;
+    parent[b] = numNodes;
+    ++numNodes;
+  }
+
+  for (int s = 0; s < MAX_SYMBOLS; ++s) {
+    if (leaf[s] < 0) { continue; }
+    int depth = 0;
+    for (int n = leaf[s]; parent[n] != -1; n = parent[n]) { ++depth; }
+    lengths[s] = (uint8_t) depth;
+  }
+}
+
+// Huffman code lengths, halving the counts until no code is longer than
+// MAX_CODE_BITS. Counts of one stay one, so this ends with at most the
+// 6 bits of a balanced code for 64 symbols.
+static void limitedCodeLengths(uint64_t* counts, uint8_t* lengths) {
+  while (true) {
+    huffmanLengths(counts, lengths);
+    if (*std::max_element(lengths, lengths + MAX_SYMBOLS) <= MAX_CODE_BITS) { return; }
+    for (int s = 0; s < MAX_SYMBOLS; ++s) {
+      if (counts[s] > 0) { counts[s] = (counts[s] + 1) >> 1; }
+    }
+  }
+}
+
+// Canonical codes for the lengths, bit reversed since codes are packed from
+// the least significant bit up. The lengths must satisfy the Kraft inequality.
+static void canonicalCodes(const uint8_t* lengths, uint32_t* codes) {
+  uint32_t code = 0;
+  for (int len = 1; len <= MAX_CODE_BITS; ++len) {
+    for (int s = 0; s < MAX_SYMBOLS; ++s) {
+      if (lengths[s] != len) { continue; }
+      uint32_t reversed = 0;
+      for (int i = 0; i < len; ++i) { reversed |= ((code >> i) & 1) << (len - 1 - i); }
+      codes[s] = reversed;
+      ++code;
+    }
+    code <<= 1;
+  }
+}
+
+int HllCompression::getMaxSymbols(const TgtHllType tgtHllType) {
+  return (tgtHllType == HLL_4) ? (HllUtil::AUX_TOKEN + 1) : MAX_SYMBOLS;
+}
+
+void HllCompression::getStoredValues(const TgtHllType tgtHllType, const uint8_t* arr,
+                                     const int start, const int len, uint8_t* dst) {
+  switch (tgtHllType) {
+    case HLL_4: {
+      const uint8_t* src = arr + (start >> 1);
+      for (int i = 0; i < len; i += 2) {
+        dst[i] = src[i >> 1] & HllUtil::loNibbleMask;
+        dst[i + 1] = src[i >> 1] >> 4;
+      }
+      break;
+    }
+    case HLL_6:
+      HllKernels::unpack6(dst, arr + ((start * 3) >> 2), len);
+      break;
+    case HLL_8:
+    default:
+      for (int i = 0; i < len; ++i) { dst[i] = arr[start + i] & HllUtil::VAL_MASK_6; }
+      break;
+  }
+}
+
+void HllCompression::putStoredValues(const TgtHllType tgtHllType, uint8_t* arr,
+                                     const int start, const int len, const uint8_t* src) {
+  switch (tgtHllType) {
+    case HLL_4:
+      // with curMin 0 the nibbles go in as they are, AUX_TOKEN included
+      HllKernels::pack4(arr + (start >> 1), src, len, 0);
+      break;
+    case HLL_6:
+      HllKernels::pack6(arr + ((start * 3) >> 2), src, len);
+      break;
+    case HLL_8:
+    default:
+      std::memcpy(arr + start, src, len);
+      break;
+  }
+}
+
+void HllCompression::decode(const uint8_t* coded, const int codedBytes,
+                            const TgtHllType tgtHllType, const int lgConfigK, uint8_t* arr) {
+  HllRegisterDecoder decoder(coded, codedBytes, getMaxSymbols(tgtHllType));
+  const int numSlots = 1 << lgConfigK;
+  uint8_t block[HllKernels::BLOCK_SLOTS];
+  for (int i = 0; i < numSlots; i += HllKernels::BLOCK_SLOTS) {
+    const int len = std::min(HllKernels::BLOCK_SLOTS, numSlots - i);
+    decoder.next(block, len);
+    putStoredValues(tgtHllType, arr, i, len, block);
+  }
+}
+
+HllRegisterEncoder::HllRegisterEncoder(const TgtHllType tgtHllType, const int lgConfigK,
+                                       const uint8_t* arr)
+  : tgtHllType(tgtHllType), lgConfigK(lgConfigK), arr(arr) {
+  const int numSlots = 1 << lgConfigK;
+  uint64_t counts[MAX_SYMBOLS] = {0};
+  uint8_t block[HllKernels::BLOCK_SLOTS];
+  for (int i = 0; i < numSlots; i += HllKernels::BLOCK_SLOTS) {
+    const int len = std::min(HllKernels::BLOCK_SLOTS, numSlots - i);
+    HllCompression::getStoredValues(tgtHllType, arr, i, len, block);
+    for (int j = 0; j < len; ++j) { ++counts[block[j]]; }
+  }
+
+  firstSymbol = 0;
+  while (counts[firstSymbol] == 0) { ++firstSymbol; }
+  int lastSymbol = MAX_SYMBOLS - 1;
+  while (counts[lastSymbol] == 0) { --lastSymbol; }
+  numSymbols = lastSymbol - firstSymbol + 1;
+
+  // bits are counted before the lengths are limited, which halves the counts
+  uint64_t bitCounts[MAX_SYMBOLS];
+  std::copy(counts, counts + MAX_SYMBOLS, bitCounts);
+  limitedCodeLengths(counts, lengths);
+  canonicalCodes(lengths, codes);
+
+  uint64_t numBits = 0;
+  for (int s = firstSymbol; s <= lastSymbol; ++s) { numBits += bitCounts[s] * lengths[s]; }
+  const int tableBytes = 2 + ((numSymbols + 1) >> 1);
+  codedBytes = (tableBytes + (int) ((numBits + 7) >> 3) + 3) & ~3;
+}
+
+int HllRegisterEncoder::getCodedBytes() const {
+  return codedBytes;
+}
+
+void HllRegisterEncoder::write(uint8_t* dst) const {
+  uint8_t* ptr = dst;
+  *ptr++ = (uint8_t) firstSymbol;
+  *ptr++ = (uint8_t) numSymbols;
+  for (int s = 0; s < numSymbols; s += 2) {
+    const int hi = (s + 1 < numSymbols) ? lengths[firstSymbol + s + 1] : 0;
+    *ptr++ = (uint8_t) (lengths[firstSymbol + s] | (hi << 4));
+  }
+
+  const int numSlots = 1 << lgConfigK;
+  uint8_t block[HllKernels::BLOCK_SLOTS];
+  uint64_t bitBuf = 0;
+  int bitCount = 0;
+  for (int i = 0; i < numSlots; i += HllKernels::BLOCK_SLOTS) {
+    const int len = std::min(HllKernels::BLOCK_SLOTS, numSlots - i);
+    HllCompression::getStoredValues(tgtHllType, arr, i, len, block);
+    for (int j = 0; j < len; ++j) {
+      bitBuf |= ((uint64_t) codes[block[j]]) << bitCount;
+      bitCount += lengths[block[j]];
+      if (bitCount >= 32) {
+        for (int b = 0; b < 4; ++b, bitBuf >>= 8) { *ptr++ = (uint8_t) bitBuf; }
+        bitCount -= 32;
+      }
+    }
+  }
+  for (; bitCount > 0; bitCount -= 8, bitBuf >>= 8) { *ptr++ = (uint8_t) bitBuf; }
+  std::fill(ptr, dst + codedBytes, 0);
+}
+
+HllRegisterDecoder::HllRegisterDecoder(const uint8_t* coded, const int codedBytes, const int maxSymbols)
+  : bitBuf(0), bitCount(0) {
+  if (codedBytes < 3) {
+    throw std::invalid_argument("Corrupt compressed HLL registers");
+  }
+  const int firstSymbol = coded[0];
+  const int numSymbols = coded[1];
+  const int tableBytes = 2 + ((numSymbols + 1) >> 1);
+  if ((numSymbols == 0) || (firstSymbol + numSymbols > maxSymbols) || (tableBytes > codedBytes)) {
+    throw std::invalid_argument("Corrupt compressed HLL registers");
+  }
+
+  uint8_t lengths[MAX_SYMBOLS] = {0};
+  int kraftSum = 0;
+  for (int s = 0; s < numSymbols; ++s) {
+    const int len = (coded[2 + (s >> 1)] >> ((s & 1) << 2)) & HllUtil::loNibbleMask;
+    if (len > MAX_CODE_BITS) {
+      throw std::invalid_argument("Corrupt compressed HLL registers");
+    }
+    lengths[firstSymbol + s] = (uint8_t) len;
+    if (len > 0) { kraftSum += 1 << (MAX_CODE_BITS - len); }
+  }
+  if (kraftSum > (1 << MAX_CODE_BITS)) {
+    throw std::invalid_argument("Corrupt compressed HLL registers");
+  }
+
+  uint32_t codes[MAX_SYMBOLS];
+  canonicalCodes(lengths, codes);
+  std::fill(table, table + TABLE_MASK + 1, 0);
+  for (int s = 0; s < MAX_SYMBOLS; ++s) {
+    const int len = lengths[s];
+    if (len == 0) { continue; }
+    for (uint32_t j = codes[s]; j <= TABLE_MASK; j += 1 << len) {
+      table[j] = (uint16_t) ((s << 4) | len);
+    }
+  }
+
+  ptr = coded + tableBytes;
+  end = coded + codedBytes;
+}
+
+}
@@ -0,0 +1,242 @@
+/*
+ * Copyright 2018, Yahoo! Inc. Licensed under the terms of the
+ * Apache License 2.0. See LICENSE file at the project root for terms.
+ */
+
+#include "HllKernels.hpp"
+#include "HllUtil.hpp"
+
+#include <algorithm>
+#include <cstring>
+
+#if defined(__AVX2__) || defined(__SSSE3__) || defined(__SSE2__)
+#include <immintrin.h>
+#endif
+
+namespace datasketches {
+
+void HllKernels::maxMerge8(uint8_t* dst, const uint8_t* src, const int numSlots) {
+  int i = 0;
+#if defined(__AVX2__)
+  for (; i + 32 <= numSlots; i += 32) {
+    const __m256i a = _mm256_loadu_si256((const __m256i*) (dst + i));
+    const __m256i b = _mm256_loadu_si256((const __m256i*) (src + i));
+    _mm256_storeu_si256((__m256i*) (dst + i), _mm256_max_epu8(a, b));
+  }
+#endif
+#if defined(__SSE2__)
+  for (; i + 16 <= numSlots; i += 16) {
+    const __m128i a = _mm_loadu_si128((const __m128i*) (dst + i));
+    const __m128i b = _mm_loadu_si128((const __m128i*) (src + i));
+    _mm_storeu_si128((__m128i*) (dst + i), _mm_max_epu8(a, b));
+  }
+#endif
+  for (; i < numSlots; ++i) {
+    if (src[i] > dst[i]) { dst[i] = src[i]; }
+  }
+}
+
+void HllKernels::foldMax8(uint8_t* dst, const int dstSlots, const uint8_t* src, const int numSlots,
+                          int* counts) {
+  // a chunk of dst at a time, which stays in cache while every source slot
+  // aliased to it is merged and then while it is counted
+  const int chunkSlots = 4096;
+  for (int i = 0; i < dstSlots; i += chunkSlots) {
+    const int len = std::min(chunkSlots, dstSlots - i);
+    for (int j = i; j < numSlots; j += dstSlots) {
+      maxMerge8(dst + i, src + j, std::min(len, numSlots - j));
+    }
+    if (counts != nullptr) { histogram8(dst + i, len, counts); }
+  }
+}
+
+void HllKernels::unpack4(uint8_t* dst, const uint8_t* src, const int numSlots, const int curMin) {
+  int i = 0;
+#if defined(__SSE2__)
+  const __m128i loMask = _mm_set1_epi8(HllUtil::loNibbleMask);
+  const __m128i token = _mm_set1_epi8(HllUtil::AUX_TOKEN);
+  const __m128i offset = _mm_set1_epi8((char) curMin);
+  for (; i + 32 <= numSlots; i += 32) {
+    const __m128i bytes = _mm_loadu_si128((const __m128i*) (src + (i >> 1)));
+    const __m128i lo = _mm_and_si128(bytes, loMask);
+    const __m128i hi = _mm_and_si128(_mm_srli_epi16(bytes, 4), loMask);
+    // slot 2j is the low nibble of byte j, slot 2j+1 the high nibble
+    const __m128i n0 = _mm_unpacklo_epi8(lo, hi);
+    const __m128i n1 = _mm_unpackhi_epi8(lo, hi);
+    const __m128i v0 = _mm_andnot_si128(_mm_cmpeq_epi8(n0, token), _mm_add_epi8(n0, offset));
+    const __m128i v1 = _mm_andnot_si128(_mm_cmpeq_epi8(n1, token), _mm_add_epi8(n1, offset));
+    _mm_storeu_si128((__m128i*) (dst + i), v0);
+    _mm_storeu_si128((__m128i*) (dst + i + 16), v1);
+  }
+#endif
+  for (; i < numSlots; ++i) {
+    int nibble = src[i >> 1];
+    if ((i & 1) > 0) { nibble >>= 4; }
+    nibble &= HllUtil::loNibbleMask;
+    dst[i] = (nibble == HllUtil::AUX_TOKEN) ? 0 : (uint8_t) (nibble + curMin);
+  }
+}
+
+void HllKernels::unpack6(uint8_t* dst, const uint8_t* src, const int numSlots) {
+  int i = 0;
+#if defined(__SSSE3__)
+  // spread each 3-byte group into its own 32-bit lane, then move slots 1-3
+  // up to the next byte boundary
+  const __m128i spread = _mm_setr_epi8(0, 1, 2, -1, 3, 4, 5, -1, 6, 7, 8, -1, 9, 10, 11, -1);
+  const __m128i mask0 = _mm_set1_epi32(0x0000003F);
+  const __m128i mask1 = _mm_set1_epi32(0x00003F00);
+  const __m128i mask2 = _mm_set1_epi32(0x003F0000);
+  const __m128i mask3 = _mm_set1_epi32(0x3F000000);
+  // each step reads 16 bytes but consumes 12, so stay clear of the end
+  for (; i + 24 <= numSlots; i += 16, src += 12) {
+    const __m128i words = _mm_shuffle_epi8(_mm_loadu_si128((const __m128i*) src), spread);
+    const __m128i v = _mm_or_si128(
+        _mm_or_si128(_mm_and_si128(words, mask0), _mm_and_si128(_mm_slli_epi32(words, 2), mask1)),
+        _mm_or_si128(_mm_and_si128(_mm_slli_epi32(words, 4), mask2), _mm_and_si128(_mm_slli_epi32(words, 6), mask3)));
+    _mm_storeu_si128((__m128i*) (dst + i), v);
+  }
+#endif
+  // four 6-bit slots per three bytes, least significant bits first
+  for (; i + 4 <= numSlots; i += 4, src += 3) {
+    const uint32_t word = src[0] | (src[1] << 8) | (src[2] << 16);
+    dst[i]     = word & 0x3F;
+    dst[i + 1] = (word >> 6) & 0x3F;
+    dst[i + 2] = (word >> 12) & 0x3F;
+    dst[i + 3] = (word >> 18) & 0x3F;
+  }
+  for (int j = 0; i < numSlots; ++i, ++j) {
+    const int startBit = j * 6;
+    const uint16_t twoByteVal = (src[(startBit >> 3) + 1] << 8) | src[startBit >> 3];
+    dst[i] = (twoByteVal >> (startBit & 0x7)) & 0x3F;
+  }
+}
+
+void HllKernels::pack4(uint8_t* dst, const uint8_t* src, const int numSlots, const int curMin) {
+  int i = 0;
+#if defined(__SSE2__)
+  const __m128i offset = _mm_set1_epi8((char) curMin);
+  const __m128i token = _mm_set1_epi8(HllUtil::AUX_TOKEN);
+  const __m128i evenMask = _mm_set1_epi16(0x00FF);
+  for (; i + 32 <= numSlots; i += 32) {
+    // saturating subtract, then clamp anything at or above the token to it
+    const __m128i v0 = _mm_min_epu8(_mm_subs_epu8(_mm_loadu_si128((const __m128i*) (src + i)), offset), token);
+    const __m128i v1 = _mm_min_epu8(_mm_subs_epu8(_mm_loadu_si128((const __m128i*) (src + i + 16)), offset), token);
+    // each 16-bit lane holds slots 2j (low byte) and 2j+1 (high byte)
+    const __m128i p0 = _mm_or_si128(_mm_and_si128(v0, evenMask), _mm_srli_epi16(v0, 4));
+    const __m128i p1 = _mm_or_si128(_mm_and_si128(v1, evenMask), _mm_srli_epi16(v1, 4));
+    const __m128i packed = _mm_packus_epi16(p0, p1);
+    _mm_storeu_si128((__m128i*) (dst + (i >> 1)), packed);
+  }
+#endif
+  for (; i < numSlots; i += 2) {
+    const int lo = std::min(std::max(src[i] - curMin, 0), (int) HllUtil::AUX_TOKEN);
+    const int hi = std::min(std::max(src[i + 1] - curMin, 0), (int) HllUtil::AUX_TOKEN);
+    dst[i >> 1] = (uint8_t) (lo | (hi << 4));
+  }
+}
+
+bool HllKernels::shift4(uint8_t* arr, const int numSlots, int& numZeros, int& numTokens) {
+  int i = 0;
+  bool valid = true;
+#if defined(__SSE2__)
+  const __m128i loMask = _mm_set1_epi8(HllUtil::loNibbleMask);
+  const __m128i hiMask = _mm_set1_epi8((char) HllUtil::hiNibbleMask);
+  const __m128i token = _mm_set1_epi8(HllUtil::AUX_TOKEN);
+  const __m128i zero = _mm_setzero_si128();
+  const __m128i ones = _mm_set1_epi8((char) 0xFF);
+  __m128i invalid = zero;
+  for (; i + 32 <= numSlots; i += 32) {
+    const __m128i bytes = _mm_loadu_si128((const __m128i*) (arr + (i >> 1)));
+    const __m128i lo = _mm_and_si128(bytes, loMask);
+    const __m128i hi = _mm_and_si128(_mm_srli_epi16(bytes, 4), loMask);
+    const __m128i loTok = _mm_cmpeq_epi8(lo, token);
+    const __m128i hiTok = _mm_cmpeq_epi8(hi, token);
+    invalid = _mm_or_si128(invalid, _mm_or_si128(_mm_cmpeq_epi8(lo, zero), _mm_cmpeq_epi8(hi, zero)));
+    // adding 0xFF subtracts one from every lane that is not a token
+    const __m128i newLo = _mm_add_epi8(lo, _mm_andnot_si128(loTok, ones));
+    const __m128i newHi = _mm_add_epi8(hi, _mm_andnot_si128(hiTok, ones));
+    numZeros += __builtin_popcount(_mm_movemask_epi8(_mm_cmpeq_epi8(newLo, zero)))
+                + __builtin_popcount(_mm_movemask_epi8(_mm_cmpeq_epi8(newHi, zero)));
+    numTokens += __builtin_popcount(_mm_movemask_epi8(loTok))
+                 + __builtin_popcount(_mm_movemask_epi8(hiTok));
+    const __m128i packed = _mm_or_si128(_mm_and_si128(newLo, loMask),
+                                        _mm_and_si128(_mm_slli_epi16(newHi, 4), hiMask));
+    _mm_storeu_si128((__m128i*) (arr + (i >> 1)), packed);
+  }
+  valid = _mm_movemask_epi8(invalid) == 0;
+#endif
+  for (; i < numSlots; i += 2) {
+    int lo = arr[i >> 1] & HllUtil::loNibbleMask;
+    int hi = arr[i >> 1] >> 4;
+    if (lo == 0 || hi == 0) { valid = false; }
+    if (lo == HllUtil::AUX_TOKEN) { ++numTokens; } else if (--lo == 0) { ++numZeros; }
+    if (hi == HllUtil::AUX_TOKEN) { ++numTokens; } else if (--hi == 0) { ++numZeros; }
+    arr[i >> 1] = (uint8_t) ((lo & HllUtil::loNibbleMask) | ((hi << 4) & HllUtil::hiNibbleMask));
+  }
+  return valid;
+}
+
+void HllKernels::pack6(uint8_t* dst, const uint8_t* src, const int numSlots) {
+  int i = 0;
+#if defined(__SSSE3__)
+  // gather the four slots of each 32-bit lane into its low 24 bits, then
+  // squeeze out the high byte of every lane
+  const __m128i valMask = _mm_set1_epi8(HllUtil::VAL_MASK_6);
+  const __m128i mask0 = _mm_set1_epi32(0x0000003F);
+  const __m128i mask1 = _mm_set1_epi32(0x00000FC0);
+  const __m128i mask2 = _mm_set1_epi32(0x0003F000);
+  const __m128i mask3 = _mm_set1_epi32(0x00FC0000);
+  const __m128i squeeze = _mm_setr_epi8(0, 1, 2, 4, 5, 6, 8, 9, 10, 12, 13, 14, -1, -1, -1, -1);
+  for (; i + 16 <= numSlots; i += 16, dst += 12) {
+    const __m128i v = _mm_and_si128(_mm_loadu_si128((const __m128i*) (src + i)), valMask);
+    const __m128i words = _mm_or_si128(
+        _mm_or_si128(_mm_and_si128(v, mask0), _mm_and_si128(_mm_srli_epi32(v, 2), mask1)),
+        _mm_or_si128(_mm_and_si128(_mm_srli_epi32(v, 4), mask2), _mm_and_si128(_mm_srli_epi32(v, 6), mask3)));
+    const __m128i packed = _mm_shuffle_epi8(words, squeeze);
+    // store exactly 12 bytes
+    _mm_storel_epi64((__m128i*) dst, packed);
+    const uint32_t tail = (uint32_t) _mm_cvtsi128_si32(_mm_srli_si128(packed, 8));
+    std::memcpy(dst + 8, &tail, sizeof(tail));
+  }
+#endif
+  for (; i < numSlots; i += 4, dst += 3) {
+    const uint32_t word = (src[i] & 0x3F) | ((src[i + 1] & 0x3F) << 6)
+                          | ((src[i + 2] & 0x3F) << 12) | ((src[i + 3] & 0x3F) << 18);
+    dst[0] = word & 0xFF;
+    dst[1] = (word >> 8) & 0xFF;
+    dst[2] = (word >> 16) & 0xFF;
+  }
+}
+
+void HllKernels::histogram8(const uint8_t* regs, const int numSlots, int* counts) {
+  // four interleaved tables so consecutive equal values do not serialize on
+  // a single counter
+  int tables[4][64];
+  std::memset(tables, 0, sizeof(tables));
+  int i = 0;
+  for (; i + 4 <= numSlots; i += 4) {
+    ++tables[0][regs[i]     & HllUtil::VAL_MASK_6];
+    ++tables[1][regs[i + 1] & HllUtil::VAL_MASK_6];
+    ++tables[2][regs[i + 2] & HllUtil::VAL_MASK_6];
+    ++tables[3][regs[i + 3] & HllUtil::VAL_MASK_6];
+  }
+  for (; i < numSlots; ++i) {
+    ++tables[0][regs[i] & HllUtil::VAL_MASK_6];
+  }
+  for (int v = 0; v < 64; ++v) {
+    counts[v] += tables[0][v] + tables[1][v] + tables[2][v] + tables[3][v];
+  }
+}
+
+void HllKernels::kxqFromHistogram(const int* counts, double& kxq0, double& kxq1) {
+  kxq0 = 0;
+  kxq1 = 0;
+  for (int v = 0; v < 32; ++v) {
+    kxq0 += counts[v] * HllUtil::invPow2(v);
+  }
+  for (int v = 32; v < 64; ++v) {
+    kxq1 += counts[v] * HllUtil::invPow2(v);
+  }
+}
+
+}
@@ -6,8 +6,12 @@
 #include "HllSketch.hpp"
 #include "HllUtil.hpp"
 #include "CouponList.hpp"
+#include "CouponSparse.hpp"
 #include "HllArray.hpp"
+#include "HllDispatch.hpp"
+#include "WrappedHllSketch.hpp"
 
+#include <algorithm>
 #include <cstdio>
 #include <cstdlib>
 #include <string>
@@ -20,23 +24,73 @@ typedef union {
   double doubleBytes;
 } longDoubleUnion;
 
-HllSketch* HllSketch::newInstance(const int lgConfigK, const TgtHllType tgtHllType) {
-  return new HllSketchPvt(lgConfigK, tgtHllType);
+// same canonicalization as update(const double)
+static inline uint64_t canonicalDoubleBits(const double datum) {
+  longDoubleUnion d;
+  d.doubleBytes = datum;
+  if (datum == 0.0) {
+    d.doubleBytes = 0.0; // canonicalize -0.0 to 0.0
+  } else if (std::isnan(d.doubleBytes)) {
+    d.longBytes = 0x7ff8000000000000L; // canonicalize NaN using value from Java's Double.doubleToLongBits()
+  }
+  return static_cast<uint64_t>(d.longBytes);
+}
+
+HllSketch* HllSketch::newInstance(const int lgConfigK, const TgtHllType tgtHllType,
+                                  std::pmr::memory_resource* resource,
+                                  const HashPolicy& hashPolicy) {
+  return new HllSketchPvt(lgConfigK, tgtHllType, resource, hashPolicy);
+}
+
+HllSketch* HllSketch::newSparseInstance(const int lgConfigK, const TgtHllType tgtHllType,
+                                        std::pmr::memory_resource* resource,
+                                        const HashPolicy& hashPolicy) {
+  return new HllSketchPvt(lgConfigK, tgtHllType, resource, hashPolicy, true);
 }
 
-HllSketch* HllSketch::deserialize(std::istream& is) {
-  return HllSketchPvt::deserialize(is);
+HllSketch* HllSketch::deserialize(std::istream& is, std::pmr::memory_resource* resource,
+                                  const HashPolicy& hashPolicy) {
+  return HllSketchPvt::deserialize(is, resource, hashPolicy);
+}
+
+HllSketch* HllSketch::deserialize(const void* bytes, const size_t sizeBytes,
+                                  std::pmr::memory_resource* resource,
+                                  const HashPolicy& hashPolicy) {
+  return HllSketchPvt::deserialize(bytes, sizeBytes, resource, hashPolicy);
+}
+
+HllSketch* HllSketch::writableWrap(void* mem, const size_t capBytes,
+                                   void* (*reallocate)(void* mem, size_t sizeBytes)) {
+  return new WrappedHllSketch(mem, capBytes, reallocate);
 }
 
 HllSketch::~HllSketch() {}
 
-HllSketchPvt::HllSketchPvt(const int lgConfigK, const TgtHllType tgtHllType) {
-  hllSketchImpl = new CouponList(HllUtil::checkLgK(lgConfigK), tgtHllType, CurMode::LIST); 
+HllSketchPvt::HllSketchPvt(const int lgConfigK, const TgtHllType tgtHllType,
+                           std::pmr::memory_resource* resource, const HashPolicy& hashPolicy,
+                           const bool sparse)
+  : hashPolicy(hashPolicy), sparse(sparse) {
+  resource = HllUtil::resourceOrDefault(resource);
+  if (sparse) {
+    hllSketchImpl = new (resource) CouponSparse(HllUtil::checkLgK(lgConfigK), tgtHllType, resource);
+  } else {
+    hllSketchImpl = new (resource) CouponList(HllUtil::checkLgK(lgConfigK), tgtHllType, CurMode::LIST,
+                                              resource);
+  }
 }
 
-HllSketchPvt* HllSketchPvt::deserialize(std::istream& is) {
-  HllSketchImpl* impl = HllSketchImpl::deserialize(is);
-  return new HllSketchPvt(impl);
+HllSketchPvt* HllSketchPvt::deserialize(std::istream& is, std::pmr::memory_resource* resource,
+                                        const HashPolicy& hashPolicy) {
+  HllSketchImpl* impl = HllSketchImpl::deserialize(is, HllUtil::resourceOrDefault(resource), hashPolicy);
+  return new HllSketchPvt(impl, hashPolicy);
+}
+
+HllSketchPvt* HllSketchPvt::deserialize(const void* bytes, const size_t sizeBytes,
+                                        std::pmr::memory_resource* resource,
+                                        const HashPolicy& hashPolicy) {
+  HllSketchImpl* impl = HllSketchImpl::deserialize(bytes, sizeBytes, HllUtil::resourceOrDefault(resource),
+                                                   hashPolicy);
+  return new HllSketchPvt(impl, hashPolicy);
 }
 
 HllSketchPvt::~HllSketchPvt() {
@@ -47,86 +101,86 @@ std::ostream& operator<<(std::ostream& os, HllSketch& sketch) {
   return sketch.to_string(os, true, true, false, false);
 }
 
-HllSketchPvt::HllSketchPvt(const HllSketch& that) {
+HllSketchPvt::HllSketchPvt(const HllSketch& that)
+  : hashPolicy(that.getHashPolicy()), sparse(static_cast<const HllSketchPvt&>(that).sparse) {
   hllSketchImpl = static_cast<HllSketchPvt>(that).hllSketchImpl->copy();
 }
 
-HllSketchPvt::HllSketchPvt(HllSketchImpl* that) {
+HllSketchPvt::HllSketchPvt(HllSketchImpl* that, const HashPolicy& hashPolicy, const bool sparse)
+  : hashPolicy(hashPolicy), sparse(sparse) {
   hllSketchImpl = that;
 }
 
 HllSketch* HllSketchPvt::copy() const {
-  return new HllSketchPvt(this->hllSketchImpl->copy());
+  return new HllSketchPvt(this->hllSketchImpl->copy(), hashPolicy, sparse);
 }
 
 HllSketch* HllSketchPvt::copyAs(const TgtHllType tgtHllType) const {
-  return new HllSketchPvt(hllSketchImpl->copyAs(tgtHllType));
+  return new HllSketchPvt(hllSketchImpl->copyAs(tgtHllType), hashPolicy, sparse);
 }
 
 void HllSketchPvt::reset() {
-  HllSketchImpl* newImpl = hllSketchImpl->reset();
-  delete hllSketchImpl;
-  hllSketchImpl = newImpl;
+  hllSketchImpl = HllSketchImpl::reset(hllSketchImpl, sparse);
 }
 
 void HllSketchPvt::update(const std::string datum) {
   if (datum.empty()) { return; }
   HashState hashResult;
-  HllUtil::hash(datum.c_str(), datum.length(), HllUtil::DEFAULT_UPDATE_SEED, hashResult);
+  hashPolicy.hash(datum.c_str(), datum.length(), hashResult);
   couponUpdate(HllUtil::coupon(hashResult));
 }
 
 void HllSketchPvt::update(const uint64_t datum) {
   HashState hashResult;
-  HllUtil::hash(&datum, sizeof(uint64_t), HllUtil::DEFAULT_UPDATE_SEED, hashResult);
+  hashPolicy.hash(&datum, sizeof(uint64_t), hashResult);
   couponUpdate(HllUtil::coupon(hashResult));
 }
 
 void HllSketchPvt::update(const uint32_t datum) {
   uint64_t val = static_cast<uint64_t>(datum);
   HashState hashResult;
-  HllUtil::hash(&val, sizeof(uint64_t), HllUtil::DEFAULT_UPDATE_SEED, hashResult);
+  hashPolicy.hash(&val, sizeof(uint64_t), hashResult);
   couponUpdate(HllUtil::coupon(hashResult));
 }
 
 void HllSketchPvt::update(const uint16_t datum) {
   uint64_t val = static_cast<uint64_t>(datum);
   HashState hashResult;
-  HllUtil::hash(&val, sizeof(uint64_t), HllUtil::DEFAULT_UPDATE_SEED, hashResult);
+  hashPolicy.hash(&val, sizeof(uint64_t), hashResult);
   couponUpdate(HllUtil::coupon(hashResult));
 }
 
 void HllSketchPvt::update(const uint8_t datum) {
   uint64_t val = static_cast<uint64_t>(datum);
   HashState hashResult;
-  HllUtil::hash(&val, sizeof(uint64_t), HllUtil::DEFAULT_UPDATE_SEED, hashResult);
+  hashPolicy.hash(&val, sizeof(uint64_t), hashResult);
   couponUpdate(HllUtil::coupon(hashResult));
 }
 
 void HllSketchPvt::update(const int64_t datum) {
   HashState hashResult;
-  HllUtil::hash(&datum, sizeof(int64_t), HllUtil::DEFAULT_UPDATE_SEED, hashResult);
+  hashPolicy.hash(&datum, sizeof(int64_t), hashResult);
   couponUpdate(HllUtil::coupon(hashResult));
 }
 
 void HllSketchPvt::update(const int32_t datum) {
   int64_t val = static_cast<int64_t>(datum);
   HashState hashResult;
-  HllUtil::hash(&val, sizeof(int64_t), HllUtil::DEFAULT_UPDATE_SEED, hashResult);
+  hashPolicy.hash(&val, sizeof(int64_t), hashResult);
   couponUpdate(HllUtil::coupon(hashResult));
 }
 
 void HllSketchPvt::update(const int16_t datum) {
   int64_t val = static_cast<int64_t>(datum);
   HashState hashResult;
-  HllUtil::hash(&val, sizeof(int64_t), HllUtil::DEFAULT_UPDATE_SEED, hashResult);
+  hashPolicy.hash(&val, sizeof(int64_t), hashResult);
   couponUpdate(HllUtil::coupon(hashResult));
 }
 
 void HllSketchPvt::update(const int8_t datum) {
   int64_t val = static_cast<int64_t>(datum);
   HashState hashResult;
-  HllUtil::hash(&val, sizeof(int64_t), HllUtil::DEFAULT_UPDATE_SEED, hashResult);
+  hashPolicy.hash(&val, sizeof(int64_t), hashResult);
   couponUpdate(HllUtil::coupon(hashResult));
 }
 
@@ -139,7 +193,7 @@ void HllSketchPvt::update(const double datum) {
     d.longBytes = 0x7ff8000000000000L; // canonicalize NaN using value from Java's Double.doubleToLongBits()
   }
   HashState hashResult;
-  HllUtil::hash(&d, sizeof(double), HllUtil::DEFAULT_UPDATE_SEED, hashResult);
+  hashPolicy.hash(&d, sizeof(double), hashResult);
   couponUpdate(HllUtil::coupon(hashResult));
 }
 
@@ -152,20 +206,127 @@ void HllSketchPvt::update(const float datum) {
     d.longBytes = 0x7ff8000000000000L; // canonicalize NaN using value from Java's Double.doubleToLongBits()
   }
   HashState hashResult;
-  HllUtil::hash(&d, sizeof(double), HllUtil::DEFAULT_UPDATE_SEED, hashResult);
+  hashPolicy.hash(&d, sizeof(double), hashResult);
   couponUpdate(HllUtil::coupon(hashResult));
 }
 
 void HllSketchPvt::update(const void* data, const size_t lengthBytes) {
   if (data == nullptr) { return; }
   HashState hashResult;
-  HllUtil::hash(data, lengthBytes, HllUtil::DEFAULT_UPDATE_SEED, hashResult);
+  hashPolicy.hash(data, lengthBytes, hashResult);
   couponUpdate(HllUtil::coupon(hashResult));
 }
 
-void HllSketchPvt::couponUpdate(int coupon) {
-  if (coupon == HllUtil::EMPTY) { return; }
-  HllSketchImpl* result = this->hllSketchImpl->couponUpdate(coupon);
+// Batch updates hash a block of keys at a time into a coupon buffer and then
+// apply the whole block, so the per-key virtual dispatch is paid once per block.
+void HllSketchPvt::updateBatch(const uint64_t* data, const size_t n) {
+  if (data == nullptr) { return; }
+  int coupons[HllUtil::BATCH_SIZE];
+  for (size_t i = 0; i < n; i += HllUtil::BATCH_SIZE) {
+    const int len = (int) std::min<size_t>(HllUtil::BATCH_SIZE, n - i);
+    HllUtil::couponsFromLongs(data + i, len, hashPolicy, coupons);
+    couponUpdate(coupons, len);
+  }
+}
+
+void HllSketchPvt::updateBatch(const int32_t* data, const size_t n) {
+  if (data == nullptr) { return; }
+  uint64_t keys[HllUtil::BATCH_SIZE];
+  int coupons[HllUtil::BATCH_SIZE];
+  for (size_t i = 0; i < n; i += HllUtil::BATCH_SIZE) {
+    const int len = (int) std::min<size_t>(HllUtil::BATCH_SIZE, n - i);
+    for (int j = 0; j < len; ++j) {
+      keys[j] = static_cast<uint64_t>(static_cast<int64_t>(data[i + j]));
+    }
+    HllUtil::couponsFromLongs(keys, len, hashPolicy, coupons);
+    couponUpdate(coupons, len);
+  }
+}
+
+void HllSketchPvt::updateBatch(const double* data, const size_t n) {
+  if (data == nullptr) { return; }
+  uint64_t keys[HllUtil::BATCH_SIZE];
+  int coupons[HllUtil::BATCH_SIZE];
+  for (size_t i = 0; i < n; i += HllUtil::BATCH_SIZE) {
+    const int len = (int) std::min<size_t>(HllUtil::BATCH_SIZE, n - i);
+    for (int j = 0; j < len; ++j) {
+      keys[j] = canonicalDoubleBits(data[i + j]);
+    }
+    HllUtil::couponsFromLongs(keys, len, hashPolicy, coupons);
+    couponUpdate(coupons, len);
+  }
+}
+
+void HllSketchPvt::updateBatch(const std::string_view* data, const size_t n) {
+  if (data == nullptr) { return; }
+  int coupons[HllUtil::BATCH_SIZE];
+  for (size_t i = 0; i < n; i += HllUtil::BATCH_SIZE) {
+    const int len = (int) std::min<size_t>(HllUtil::BATCH_SIZE, n - i);
+    int numCoupons = 0;
+    for (int j = 0; j < len; ++j) {
+      const std::string_view& datum = data[i + j];
+      if (datum.empty()) { continue; }
+      HashState hashResult;
+      hashPolicy.hash(datum.data(), datum.length(), hashResult);
+      coupons[numCoupons++] = HllUtil::coupon(hashResult);
+    }
+    couponUpdate(coupons, numCoupons);
+  }
+}
+
+void HllSketchPvt::update(const HashState& hash) {
+  couponUpdate(HllUtil::coupon(hash));
+}
+
+void HllSketchPvt::updateBatch(const HashState* hashes, const size_t n) {
+  if (hashes == nullptr) { return; }
+  int coupons[HllUtil::BATCH_SIZE];
+  for (size_t i = 0; i < n; i += HllUtil::BATCH_SIZE) {
+    const int len = (int) std::min<size_t>(HllUtil::BATCH_SIZE, n - i);
+    for (int j = 0; j < len; ++j) {
+      coupons[j] = HllUtil::coupon(hashes[i + j]);
+    }
+    couponUpdate(coupons, len);
+  }
+}
+
+void HllSketchPvt::couponUpdate(const int* coupons, const size_t n) {
+  if (coupons == nullptr) { return; }
+  size_t i = 0;
+  while (i < n) {
+    // Once in HLL mode the impl no longer changes, so for large arrays all the
+    // register lines of a block are prefetched first. The updates themselves
+    // still go in input order, as the HIP accumulator requires.
+    size_t end = n;
+    if (hllSketchImpl->getCurMode() == CurMode::HLL) {
+      const HllArray* hllArray = static_cast<HllArray*>(hllSketchImpl);
+      if (hllArray->getHllByteArrBytes() >= HllArray::PREFETCH_MIN_BYTES) {
+        end = std::min(n, i + HllUtil::BATCH_SIZE);
+        hllArray->prefetchSlots(coupons + i, (int) (end - i));
+      }
+    }
+    while (i < end) {
+      const int coupon = coupons[i++];
+      if (HllUtil::getValue(coupon) == 0) {
+        if (coupon == HllUtil::EMPTY) { continue; }
+        throw std::invalid_argument("Invalid coupon: zero value");
+      }
+      HllSketchImpl* result = HllDispatch::couponUpdate(hllSketchImpl, coupon);
+      if (result != hllSketchImpl) {
+        delete hllSketchImpl;
+        hllSketchImpl = result;
+        break; // new mode, may now prefetch
+      }
+    }
+  }
+}
+
+void HllSketchPvt::couponUpdate(const int coupon) {
+  if (HllUtil::getValue(coupon) == 0) {
+    if (coupon == HllUtil::EMPTY) { return; }
+    throw std::invalid_argument("Invalid coupon: zero value");
+  }
+  HllSketchImpl* result = HllDispatch::couponUpdate(this->hllSketchImpl, coupon);
   if (result != this->hllSketchImpl) {
     delete this->hllSketchImpl;
     this->hllSketchImpl = result;
@@ -173,11 +334,39 @@ void HllSketchPvt::couponUpdate(int coupon) {
 }
 
 void HllSketchPvt::serializeCompact(std::ostream& os) const {
-  return hllSketchImpl->serialize(os, true);
+  return hllSketchImpl->serialize(os, HllSketchImpl::COMPACT, hashPolicy);
 }
 
 void HllSketchPvt::serializeUpdatable(std::ostream& os) const {
-  return hllSketchImpl->serialize(os, false);
+  return hllSketchImpl->serialize(os, HllSketchImpl::UPDATABLE, hashPolicy);
+}
+
+std::pair<ptr_with_deleter, const size_t> HllSketchPvt::serializeCompact(unsigned header_size_bytes) const {
+  return hllSketchImpl->serialize(HllSketchImpl::COMPACT, header_size_bytes, hashPolicy);
+}
+
+std::pair<ptr_with_deleter, const size_t> HllSketchPvt::serializeUpdatable(unsigned header_size_bytes) const {
+  return hllSketchImpl->serialize(HllSketchImpl::UPDATABLE, header_size_bytes, hashPolicy);
+}
+
+size_t HllSketchPvt::serializeCompact(void* dst, const size_t capacityBytes) const {
+  return hllSketchImpl->serialize(dst, capacityBytes, HllSketchImpl::COMPACT, hashPolicy);
+}
+
+size_t HllSketchPvt::serializeUpdatable(void* dst, const size_t capacityBytes) const {
+  return hllSketchImpl->serialize(dst, capacityBytes, HllSketchImpl::UPDATABLE, hashPolicy);
+}
+
+void HllSketchPvt::serializeCompressed(std::ostream& os) const {
+  return hllSketchImpl->serialize(os, HllSketchImpl::COMPRESSED, hashPolicy);
+}
+
+std::pair<ptr_with_deleter, const size_t> HllSketchPvt::serializeCompressed(unsigned header_size_bytes) const {
+  return hllSketchImpl->serialize(HllSketchImpl::COMPRESSED, header_size_bytes, hashPolicy);
+}
+
+size_t HllSketchPvt::serializeCompressed(void* dst, const size_t capacityBytes) const {
+  return hllSketchImpl->serialize(dst, capacityBytes, HllSketchImpl::COMPRESSED, hashPolicy);
 }
 
 std::ostream& HllSketchPvt::to_string(std::ostream& os,
@@ -272,6 +461,10 @@ TgtHllType HllSketchPvt::getTgtHllType() const {
   return hllSketchImpl->getTgtHllType();
 }
 
+const HashPolicy& HllSketchPvt::getHashPolicy() const {
+  return hashPolicy;
+}
+
 bool HllSketchPvt::isOutOfOrderFlag() const {
   return hllSketchImpl->isOutOfOrderFlag();
 }
@@ -281,11 +474,19 @@ bool HllSketchPvt::isEstimationMode() const {
 }
 
 int HllSketchPvt::getUpdatableSerializationBytes() const {
-  return hllSketchImpl->getUpdatableSerializationBytes();
+  return hllSketchImpl->getUpdatableSerializationBytes() + hashPolicy.getSeedHashBytes();
 }
 
 int HllSketchPvt::getCompactSerializationBytes() const {
-  return hllSketchImpl->getCompactSerializationBytes();
+  return hllSketchImpl->getCompactSerializationBytes() + hashPolicy.getSeedHashBytes();
+}
+
+int HllSketchPvt::getCompressedSerializationBytes() const {
+  return hllSketchImpl->getCompressedSerializationBytes() + hashPolicy.getSeedHashBytes();
+}
+
+void* HllSketchPvt::getMemory() const {
+  return nullptr;
 }
 
 bool HllSketchPvt::isCompact() const {
@@ -340,6 +541,14 @@ int HllSketch::getMaxUpdatableSerializationBytes(const int lgConfigK,
   return HllUtil::HLL_BYTE_ARR_START + arrBytes;
 }
 
+void HllSketch::hash(const void* data, const size_t lengthBytes, HashState& result) {
+  HllUtil::hash(data, lengthBytes, HllUtil::DEFAULT_UPDATE_SEED, result);
+}
+
+int HllSketch::coupon(const HashState& hash) {
+  return HllUtil::coupon(hash);
+}
+
 double HllSketch::getRelErr(const bool upperBound, const bool unioned,
                            const int lgConfigK, const int numStdDev) {
   return HllUtil::getRelErr(upperBound, unioned, lgConfigK, numStdDev);
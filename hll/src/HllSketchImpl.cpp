@@ -7,6 +7,11 @@
 #include "HllArray.hpp"
 #include "CouponList.hpp"
 #include "CouponHashSet.hpp"
+#include "CouponSparse.hpp"
+#include "HllSketchView.hpp"
+
+#include <utility>
+#include <vector>
 
 namespace datasketches {
 
@@ -14,10 +19,13 @@ namespace datasketches {
 static int numImpls = 0;
 #endif 
 
-HllSketchImpl::HllSketchImpl(const int lgConfigK, const TgtHllType tgtHllType, const CurMode curMode)
+HllSketchImpl::HllSketchImpl(const int lgConfigK, const TgtHllType tgtHllType, const CurMode curMode,
+                             std::pmr::memory_resource* resource, const bool sparse)
   : lgConfigK(lgConfigK),
     tgtHllType(tgtHllType),
-    curMode(curMode)
+    curMode(curMode),
+    resource(resource),
+    sparse(sparse)
 {
 #ifdef DEBUG
   std::cerr << "Num impls: " << ++numImpls << "\n";
@@ -30,19 +38,160 @@ HllSketchImpl::~HllSketchImpl() {
 #endif
 }
 
-HllSketchImpl* HllSketchImpl::deserialize(std::istream& is) {
+void* HllSketchImpl::operator new(size_t size, std::pmr::memory_resource* resource) {
+  return HllUtil::allocate(resource, size);
+}
+
+void HllSketchImpl::operator delete(void* ptr) {
+  HllUtil::deallocate(ptr);
+}
+
+// matches the placement new if a constructor throws; the block header
+// already records the resource
+void HllSketchImpl::operator delete(void* ptr, std::pmr::memory_resource* /* resource */) {
+  HllUtil::deallocate(ptr);
+}
+
+HllSketchImpl* HllSketchImpl::reset(HllSketchImpl* impl, const bool sparse) {
+  if (impl->isSparse()) {
+    static_cast<CouponSparse*>(impl)->clear();
+    return impl;
+  }
+  switch (impl->getCurMode()) {
+    case LIST:
+      static_cast<CouponList*>(impl)->clear();
+      return impl;
+    case SET: {
+      CouponList* list = new (impl->resource) CouponList(impl->lgConfigK, impl->tgtHllType,
+                                                         CurMode::LIST, impl->resource);
+      std::swap(list->spareHll, static_cast<CouponList*>(impl)->spareHll);
+      delete impl;
+      return list;
+    }
+    default: {
+      CouponList* list = sparse
+          ? new (impl->resource) CouponSparse(impl->lgConfigK, impl->tgtHllType, impl->resource)
+          : new (impl->resource) CouponList(impl->lgConfigK, impl->tgtHllType,
+                                            CurMode::LIST, impl->resource);
+      // registers in wrapped memory get overwritten by the new image
+      if (impl->isWrapped()) {
+        delete impl;
+      } else {
+        list->spareHll = static_cast<HllArray*>(impl);
+      }
+      return list;
+    }
+  }
+}
+
+HllSketchImpl* HllSketchImpl::deserialize(std::istream& is, std::pmr::memory_resource* resource,
+                                          const HashPolicy& hashPolicy) {
   // we'll hand off the sketch based on PreInts so we don't need
   // to move the stream pointer back and forth -- perhaps somewhat fragile?
+  const uint8_t hashTag = hashPolicy.getSerialTag();
   const int preInts = is.peek();
+  HllSketchImpl* impl;
   if (preInts == HllUtil::HLL_PREINTS) {
-    return HllArray::newHll(is);
+    impl = HllArray::newHll(is, resource, hashTag);
   } else if (preInts == HllUtil::HASH_SET_PREINTS) {
-    return CouponHashSet::newSet(is);
+    impl = CouponHashSet::newSet(is, resource, hashTag);
   } else if (preInts == HllUtil::LIST_PREINTS) {
-    return CouponList::newList(is);
+    impl = CouponList::newList(is, resource, hashTag);
   } else {
     throw std::invalid_argument("Attempt to deserialize Unknown object type");
   }
+  if (hashTag != 0) {
+    uint16_t seedHash[2] = { 0, 0 };
+    is.read((char*) seedHash, HashPolicy::SEED_HASH_BYTES);
+    if (!is || (seedHash[0] != hashPolicy.getSeedHash())) {
+      delete impl;
+      throw std::invalid_argument("Sketch was serialized with a different hash policy");
+    }
+  }
+  return impl;
+}
+
+HllSketchImpl* HllSketchImpl::deserialize(const void* bytes, const size_t sizeBytes,
+                                          std::pmr::memory_resource* resource,
+                                          const HashPolicy& hashPolicy) {
+  std::vector<uint8_t> buffer;
+  const HllSketchView view(HllSketchView::aligned(bytes, sizeBytes, buffer), sizeBytes);
+  if (!view.hasHashPolicy(hashPolicy)) {
+    throw std::invalid_argument("Sketch was serialized with a different hash policy");
+  }
+  switch (view.getCurMode()) {
+    case LIST:
+      return CouponList::newList(view, resource);
+    case SET:
+      return CouponHashSet::newSet(view, resource);
+    default:
+      return HllArray::newHll(view, resource);
+  }
+}
+
+int HllSketchImpl::getSerializationBytes(const SerialFormat format) const {
+  switch (format) {
+    case UPDATABLE: return getUpdatableSerializationBytes();
+    case COMPACT: return getCompactSerializationBytes();
+    default: return getCompressedSerializationBytes();
+  }
+}
+
+int HllSketchImpl::getCompressedSerializationBytes() const {
+  return getCompactSerializationBytes();
+}
+
+void HllSketchImpl::serializeCompressedToMem(uint8_t* dst) const {
+  serializeToMem(dst, true);
+}
+
+// writes imageBytes() bytes to dst
+static void writeImage(const HllSketchImpl& impl, uint8_t* dst, const HllSketchImpl::SerialFormat format,
+                       const HashPolicy& hashPolicy) {
+  if (format == HllSketchImpl::COMPRESSED) {
+    impl.serializeCompressedToMem(dst);
+  } else {
+    impl.serializeToMem(dst, format == HllSketchImpl::COMPACT);
+  }
+  dst[7] |= hashPolicy.getSerialTag() << 4;
+  if (hashPolicy.getSeedHashBytes() > 0) {
+    HllUtil::writeSeedHash(dst + impl.getSerializationBytes(format), hashPolicy);
+  }
+}
+
+static size_t imageBytes(const HllSketchImpl& impl, const HllSketchImpl::SerialFormat format,
+                         const HashPolicy& hashPolicy) {
+  return impl.getSerializationBytes(format) + hashPolicy.getSeedHashBytes();
+}
+
+void HllSketchImpl::serialize(std::ostream& os, const SerialFormat format, const HashPolicy& hashPolicy) const {
+  // build the image in memory so the stream sees a single write
+  const size_t sizeBytes = imageBytes(*this, format, hashPolicy);
+  uint8_t* buffer = new uint8_t[sizeBytes];
+  writeImage(*this, buffer, format, hashPolicy);
+  os.write((char*)buffer, sizeBytes);
+  delete [] buffer;
+}
+
+std::pair<ptr_with_deleter, const size_t> HllSketchImpl::serialize(const SerialFormat format,
+                                                                  const unsigned header_size_bytes,
+                                                                  const HashPolicy& hashPolicy) const {
+  const size_t sketchBytes = imageBytes(*this, format, hashPolicy);
+  const size_t size = header_size_bytes + sketchBytes;
+  ptr_with_deleter data_ptr(
+      new uint8_t[size],
+      [](void* ptr) { delete [] static_cast<uint8_t*>(ptr); }
+  );
+  writeImage(*this, static_cast<uint8_t*>(data_ptr.get()) + header_size_bytes, format, hashPolicy);
+  return std::make_pair(std::move(data_ptr), size);
+}
+
+size_t HllSketchImpl::serialize(void* dst, const size_t capacityBytes, const SerialFormat format,
+                                const HashPolicy& hashPolicy) const {
+  const size_t sketchBytes = imageBytes(*this, format, hashPolicy);
+  HllUtil::checkMemSize(sketchBytes, capacityBytes);
+  writeImage(*this, static_cast<uint8_t*>(dst), format, hashPolicy);
+  return sketchBytes;
 }
 
 TgtHllType HllSketchImpl::extractTgtHllType(const uint8_t modeByte) {
@@ -71,6 +220,12 @@ CurMode HllSketchImpl::extractCurMode(const uint8_t modeByte) {
   }
 }
 
+void HllSketchImpl::checkHashTag(const uint8_t modeByte, const uint8_t hashTag) {
+  if ((modeByte >> 4) != hashTag) {
+    throw std::invalid_argument("Sketch was serialized with a different hash policy");
+  }
+}
+
 uint8_t HllSketchImpl::makeFlagsByte(const bool compact) const {
   uint8_t flags(0);
   flags |= (isEmpty() ? HllUtil::EMPTY_FLAG_MASK : 0);
@@ -120,16 +275,4 @@ uint8_t HllSketchImpl::makeModeByte() const {
   return byte;
 }
 
-TgtHllType HllSketchImpl::getTgtHllType() const {
-  return tgtHllType;
-}
-
-int HllSketchImpl::getLgConfigK() const {
-  return lgConfigK;
-}
-
-CurMode HllSketchImpl::getCurMode() const {
-  return curMode;
-}
-
 }
@@ -0,0 +1,331 @@
+/*
+ * Copyright 2018, Yahoo! Inc. Licensed under the terms of the
+ * Apache License 2.0. See LICENSE file at the project root for terms.
+ */
+
+#include "HllSketchView.hpp"
+#include "HllArray.hpp"
+#include "CouponList.hpp"
+#include "IntArrayPairIterator.hpp"
+
+#include <cstdint>
+#include <cstring>
+#include <sstream>
+
+namespace datasketches {
+
+// a coupon count the header claims must fit the table it claims
+static void checkCount(const int count, const int maxCount) {
+  if ((count < 0) || (count > maxCount)) {
+    std::stringstream ss;
+    ss << "Corrupt HLL sketch count: " << count << " not in [0, " << maxCount << "]";
+    throw std::invalid_argument(ss.str());
+  }
+}
+
+static void checkLgArr(const int lgArr, const int minLgArr, const int maxLgArr) {
+  if ((lgArr < minLgArr) || (lgArr > maxLgArr)) {
+    std::stringstream ss;
+    ss << "Corrupt HLL sketch lgArr: " << lgArr << " not in [" << minLgArr << ", " << maxLgArr << "]";
+    throw std::invalid_argument(ss.str());
+  }
+}
+
+static void checkBytes(const size_t sizeBytes, const size_t minBytes) {
+  if (sizeBytes < minBytes) {
+    std::stringstream ss;
+    ss << "Input buffer too small for HLL sketch: " << sizeBytes << " < " << minBytes;
+    throw std::invalid_argument(ss.str());
+  }
+}
+
+HllSketchView::HllSketchView(const void* bytes, const size_t sizeBytes)
+  : HllSketchView(bytes, sizeBytes, true) {}
+
+HllSketchView::HllSketchView(const void* bytes, const size_t sizeBytes, const bool checkSize)
+  : bytes(static_cast<const uint8_t*>(bytes)),
+    couponCount(0), curMin(0), numAtCurMin(0),
+    hipAccum(0.0), kxq0(0.0), kxq1(0.0), auxCount(0),
+    data(nullptr), dataInts(0), codedBytes(0), auxInts(nullptr), auxLen(0), lgAuxArrInts(0),
+    seedHash(0) {
+  checkBytes(sizeBytes, 8);
+  if ((reinterpret_cast<uintptr_t>(bytes) % alignof(int)) != 0) {
+    throw std::invalid_argument("HLL sketch bytes must be 4-byte aligned");
+  }
+  const uint8_t* header = this->bytes;
+  const int preInts = header[0];
+  if (header[1] != HllUtil::SER_VER) {
+    throw std::invalid_argument("Wrong ser ver in input buffer");
+  }
+  if (header[2] != HllUtil::FAMILY_ID) {
+    throw std::invalid_argument("Input buffer is not an HLL sketch");
+  }
+
+  switch (header[7] & 0x3) {
+    case 0: curMode = LIST; break;
+    case 1: curMode = SET; break;
+    case 2: curMode = HLL; break;
+    default: throw std::invalid_argument("Invalid current sketch mode");
+  }
+  switch ((header[7] >> 2) & 0x3) {
+    case 0: tgtHllType = HLL_4; break;
+    case 1: tgtHllType = HLL_6; break;
+    case 2: tgtHllType = HLL_8; break;
+    default: throw std::invalid_argument("Invalid target HLL type");
+  }
+  hashTag = header[7] >> 4;
+
+  lgConfigK = HllUtil::checkLgK(header[3]);
+  const int lgArr = header[4];
+  compact = (header[5] & HllUtil::COMPACT_FLAG_MASK) ? true : false;
+  empty = (header[5] & HllUtil::EMPTY_FLAG_MASK) ? true : false;
+  oooFlag = (header[5] & HllUtil::OUT_OF_ORDER_FLAG_MASK) ? true : false;
+  compressed = (header[5] & HllUtil::COMPRESSED_FLAG_MASK) ? true : false;
+  if (compressed && ((curMode != HLL) || !compact)) {
+    throw std::invalid_argument("Only compact HLL images can be compressed");
+  }
+
+  if (curMode == LIST) {
+    if (preInts != HllUtil::LIST_PREINTS) {
+      throw std::invalid_argument("Incorrect number of preInts in input buffer");
+    }
+    checkLgArr(lgArr, HllUtil::LG_INIT_LIST_SIZE, HllUtil::LG_INIT_LIST_SIZE);
+    couponCount = header[6];
+    checkCount(couponCount, 1 << lgArr);
+    data = header + HllUtil::LIST_INT_ARR_START;
+    dataInts = (compact ? couponCount : (1 << lgArr));
+    serBytes = HllUtil::LIST_INT_ARR_START + ((size_t) dataInts << 2);
+  } else if (curMode == SET) {
+    if (preInts != HllUtil::HASH_SET_PREINTS) {
+      throw std::invalid_argument("Incorrect number of preInts in input buffer");
+    }
+    checkBytes(sizeBytes, HllUtil::HASH_SET_INT_ARR_START);
+    checkLgArr(lgArr, HllUtil::LG_INIT_SET_SIZE, lgConfigK);
+    std::memcpy(&couponCount, header + HllUtil::HASH_SET_COUNT_INT, sizeof(couponCount));
+    checkCount(couponCount, 1 << lgArr);
+    oooFlag = true; // SET is always out of order
+    data = header + HllUtil::HASH_SET_INT_ARR_START;
+    dataInts = (compact ? couponCount : (1 << lgArr));
+    serBytes = HllUtil::HASH_SET_INT_ARR_START + ((size_t) dataInts << 2);
+  } else {
+    if (preInts != HllUtil::HLL_PREINTS) {
+      throw std::invalid_argument("Incorrect number of preInts in input buffer");
+    }
+    checkBytes(sizeBytes, HllUtil::HLL_BYTE_ARR_START);
+    curMin = header[6];
+    std::memcpy(&hipAccum, header + 8, sizeof(hipAccum));
+    std::memcpy(&kxq0, header + 16, sizeof(kxq0));
+    std::memcpy(&kxq1, header + 24, sizeof(kxq1));
+    std::memcpy(&numAtCurMin, header + 32, sizeof(numAtCurMin));
+    std::memcpy(&auxCount, header + 36, sizeof(auxCount));
+    data = header + HllUtil::HLL_BYTE_ARR_START;
+
+    int arrBytes;
+    switch (tgtHllType) {
+      case HLL_4: arrBytes = HllArray::hll4ArrBytes(lgConfigK); break;
+      case HLL_6: arrBytes = HllArray::hll6ArrBytes(lgConfigK); break;
+      default:    arrBytes = HllArray::hll8ArrBytes(lgConfigK); break;
+    }
+    if (compressed) {
+      checkBytes(sizeBytes, HllCompression::CODED_START);
+      std::memcpy(&codedBytes, header + HllUtil::HLL_BYTE_ARR_START, sizeof(codedBytes));
+      // registers are only coded when that makes them smaller, and are
+      // padded to whole ints so that HLL_4 aux pairs stay aligned
+      if ((codedBytes <= 0) || (codedBytes > arrBytes) || ((codedBytes & 3) != 0)) {
+        throw std::invalid_argument("Corrupt compressed HLL registers");
+      }
+      data = header + HllCompression::CODED_START;
+      serBytes = HllCompression::CODED_START + codedBytes;
+    } else {
+      serBytes = HllUtil::HLL_BYTE_ARR_START + arrBytes;
+    }
+    if (tgtHllType == HLL_4) {
+      // updatable images always carry the aux table, even when unused
+      // and an lgArr of 0 when the sketch has no aux map yet
+      if (compact) {
+        checkCount(auxCount, 1 << lgConfigK);
+        auxLen = auxCount;
+      } else {
+        lgAuxArrInts = (lgArr > 0) ? lgArr : HllUtil::LG_AUX_ARR_INTS[lgConfigK];
+        checkLgArr(lgAuxArrInts, HllUtil::LG_AUX_ARR_INTS[lgConfigK], lgConfigK);
+        auxLen = 1 << lgAuxArrInts;
+        checkCount(auxCount, auxLen);
+      }
+      auxInts = reinterpret_cast<const int*>(header + serBytes);
+      serBytes += (size_t) auxLen << 2;
+    }
+    empty = (curMin == 0) && (numAtCurMin == (1 << lgConfigK));
+  }
+  // non-default hash policies end the image with their seed hash
+  const size_t seedHashStart = serBytes;
+  if (hashTag != 0) { serBytes += HashPolicy::SEED_HASH_BYTES; }
+  if (checkSize) {
+    checkBytes(sizeBytes, serBytes);
+    if (hashTag != 0) { std::memcpy(&seedHash, header + seedHashStart, sizeof(seedHash)); }
+  }
+}
+
+int HllSketchView::getPreambleBytes(const uint8_t* header) {
+  switch (header[0]) {
+    case HllUtil::LIST_PREINTS:
+    case HllUtil::HASH_SET_PREINTS:
+      return header[0] << 2;
+    case HllUtil::HLL_PREINTS:
+      return (header[5] & HllUtil::COMPRESSED_FLAG_MASK) ? HllCompression::CODED_START
+                                                         : HllUtil::HLL_BYTE_ARR_START;
+    default:
+      throw std::invalid_argument("Incorrect number of preInts in input stream");
+  }
+}
+
+int HllSketchView::read(std::istream& is, std::vector<uint8_t>& buffer) {
+  // the preamble tells how much more to read
+  buffer.resize(8);
+  is.read((char*) buffer.data(), 8);
+  if (!is) { throw std::invalid_argument("Input stream ended inside an HLL sketch"); }
+  const int preambleBytes = getPreambleBytes(buffer.data());
+  buffer.resize(preambleBytes);
+  is.read((char*) buffer.data() + 8, preambleBytes - 8);
+  if (!is) { throw std::invalid_argument("Input stream ended inside an HLL sketch"); }
+  const int sizeBytes = HllSketchView(buffer.data(), preambleBytes, false).getSerializationBytes();
+  buffer.resize(sizeBytes);
+  is.read((char*) buffer.data() + preambleBytes, sizeBytes - preambleBytes);
+  if (!is) { throw std::invalid_argument("Input stream ended inside an HLL sketch"); }
+  return sizeBytes;
+}
+
+const void* HllSketchView::aligned(const void* bytes, const size_t sizeBytes, std::vector<uint8_t>& buffer) {
+  if ((reinterpret_cast<uintptr_t>(bytes) % alignof(int)) == 0) { return bytes; }
+  const uint8_t* begin = static_cast<const uint8_t*>(bytes);
+  buffer.assign(begin, begin + sizeBytes);
+  return buffer.data();
+}
+
+double HllSketchView::getEstimate() const {
+  if (curMode != HLL) { return CouponList::getEstimate(couponCount); }
+  return oooFlag ? getCompositeEstimate() : hipAccum;
+}
+
+double HllSketchView::getCompositeEstimate() const {
+  if (curMode != HLL) { return CouponList::getEstimate(couponCount); }
+  return HllArray::getCompositeEstimate(lgConfigK, curMin, numAtCurMin, kxq0, kxq1);
+}
+
+double HllSketchView::getLowerBound(const int numStdDev) const {
+  if (curMode != HLL) { return CouponList::getLowerBound(couponCount, numStdDev); }
+  return HllArray::getLowerBound(lgConfigK, curMin, numAtCurMin, oooFlag, getEstimate(), numStdDev);
+}
+
+double HllSketchView::getUpperBound(const int numStdDev) const {
+  if (curMode != HLL) { return CouponList::getUpperBound(couponCount, numStdDev); }
+  return HllArray::getUpperBound(lgConfigK, oooFlag, getEstimate(), numStdDev);
+}
+
+int HllSketchView::getLgConfigK() const {
+  return lgConfigK;
+}
+
+TgtHllType HllSketchView::getTgtHllType() const {
+  return tgtHllType;
+}
+
+CurMode HllSketchView::getCurMode() const {
+  return curMode;
+}
+
+bool HllSketchView::isCompact() const {
+  return compact;
+}
+
+bool HllSketchView::isEmpty() const {
+  return (curMode == HLL) ? empty : (couponCount == 0);
+}
+
+bool HllSketchView::isOutOfOrderFlag() const {
+  return oooFlag;
+}
+
+bool HllSketchView::isCompressed() const {
+  return compressed;
+}
+
+uint8_t HllSketchView::getHashTag() const {
+  return hashTag;
+}
+
+uint16_t HllSketchView::getSeedHash() const {
+  return seedHash;
+}
+
+bool HllSketchView::hasHashPolicy(const HashPolicy& hashPolicy) const {
+  return (hashTag == hashPolicy.getSerialTag()) && (seedHash == hashPolicy.getSeedHash());
+}
+
+int HllSketchView::getSerializationBytes() const {
+  return (int) serBytes;
+}
+
+std::unique_ptr<PairIterator> HllSketchView::getIterator() const {
+  PairIterator* itr;
+  if (curMode == HLL) {
+    itr = new HllViewIterator(*this, 1 << lgConfigK);
+  } else {
+    itr = new IntArrayPairIterator(reinterpret_cast<const int*>(data), isEmpty() ? 0 : dataInts, lgConfigK);
+  }
+  return std::unique_ptr<PairIterator>(itr);
+}
+
+std::unique_ptr<PairIterator> HllSketchView::getAuxIterator() const {
+  if (auxInts == nullptr || auxCount == 0) { return nullptr; }
+  return std::unique_ptr<PairIterator>(new IntArrayPairIterator(auxInts, auxLen, lgConfigK));
+}
+
+HllViewIterator::HllViewIterator(const HllSketchView& view, const int lengthPairs)
+  : HllPairIterator(lengthPairs),
+    view(view),
+    decoder(view.compressed
+            ? new HllRegisterDecoder(view.data, view.codedBytes, HllCompression::getMaxSymbols(view.tgtHllType))
+            : nullptr)
+{}
+
+HllViewIterator::~HllViewIterator() { }
+
+int HllViewIterator::value() {
+  const uint8_t* arr = view.data;
+  switch (view.tgtHllType) {
+    case HLL_4: {
+      int nib;
+      if (decoder != nullptr) {
+        nib = decoder->next();
+      } else {
+        nib = arr[index >> 1];
+        if ((index & 1) > 0) { nib >>= 4; }
+        nib &= HllUtil::loNibbleMask;
+      }
+      return (nib != HllUtil::AUX_TOKEN) ? (nib + view.curMin) : auxValue();
+    }
+    case HLL_6: {
+      if (decoder != nullptr) { return decoder->next(); }
+      const int startBit = index * 6;
+      const uint16_t twoByteVal = (arr[(startBit >> 3) + 1] << 8) | arr[startBit >> 3];
+      return (twoByteVal >> (startBit & 0x7)) & 0x3F;
+    }
+    default:
+      if (decoder != nullptr) { return decoder->next(); }
+      return arr[index] & HllUtil::VAL_MASK_6;
+  }
+}
+
+int HllViewIterator::auxValue() const {
+  // exceptions are few, so a scan of the aux ints is cheap
+  const int slotMask = (1 << view.lgConfigK) - 1;
+  for (int i = 0; i < view.auxLen; ++i) {
+    const int pair = view.auxInts[i];
+    if ((pair != HllUtil::EMPTY) && ((HllUtil::getLow26(pair) & slotMask) == index)) {
+      return HllUtil::getValue(pair);
+    }
+  }
+  throw std::invalid_argument("Aux value not found for slot in input buffer");
+}
+
+}
@@ -0,0 +1,60 @@
+/*
+ * Copyright 2018, Yahoo! Inc. Licensed under the terms of the
+ * Apache License 2.0. See LICENSE file at the project root for terms.
+ */
+
+#include "HllSlab.hpp"
+#include "HllUtil.hpp"
+
+namespace datasketches {
+
+static int getLgBlocksPerChunk(const size_t blockBytes, const int lgChunkBytes) {
+  int lgBlockBytes = 0;
+  while (((size_t) 1 << lgBlockBytes) < blockBytes) { ++lgBlockBytes; }
+  return (lgBlockBytes < lgChunkBytes) ? (lgChunkBytes - lgBlockBytes) : 0;
+}
+
+HllSlab::HllSlab(const size_t blockBytes, std::pmr::memory_resource* resource)
+  : blockBytes(blockBytes),
+    lgBlocksPerChunk(getLgBlocksPerChunk(blockBytes, LG_CHUNK_BYTES)),
+    resource(HllUtil::resourceOrDefault(resource)),
+    chunks(this->resource),
+    freeBlocks(this->resource),
+    numBlocks(0) {}
+
+HllSlab::~HllSlab() {
+  for (uint8_t* chunk : chunks) {
+    HllUtil::deallocate(chunk);
+  }
+}
+
+uint32_t HllSlab::allocate() {
+  if (!freeBlocks.empty()) {
+    const uint32_t block = freeBlocks.back();
+    freeBlocks.pop_back();
+    return block;
+  }
+  if ((numBlocks >> lgBlocksPerChunk) == chunks.size()) {
+    chunks.push_back(HllUtil::newArray<uint8_t>(resource, blockBytes << lgBlocksPerChunk));
+  }
+  return numBlocks++;
+}
+
+void HllSlab::release(const uint32_t block) {
+  freeBlocks.push_back(block);
+}
+
+void HllSlab::clear() {
+  freeBlocks.clear();
+  numBlocks = 0;
+}
+
+size_t HllSlab::getBlockBytes() const {
+  return blockBytes;
+}
+
+size_t HllSlab::getMemoryBytes() const {
+  return chunks.size() * (blockBytes << lgBlocksPerChunk);
+}
+
+}
@@ -6,24 +6,47 @@
 #include "HllUnion.hpp"
 
 #include "HllSketchImpl.hpp"
+#include "CouponList.hpp"
 #include "HllArray.hpp"
+#include "HllDispatch.hpp"
+#include "HllKernels.hpp"
+#include "HllSketchView.hpp"
 #include "HllUtil.hpp"
+#include "IntArrayPairIterator.hpp"
+
+#include <algorithm>
+#include <cstring>
+#include <exception>
+#include <functional>
+#include <optional>
+#include <sstream>
+#include <thread>
+#include <vector>
 
 namespace datasketches {
 
-HllUnion* HllUnion::newInstance(const int lgMaxK) {
-  return new HllUnionPvt(lgMaxK);
+HllUnion* HllUnion::newInstance(const int lgMaxK, std::pmr::memory_resource* resource,
+                                const HashPolicy& hashPolicy) {
+  return new HllUnionPvt(lgMaxK, resource, hashPolicy);
+}
+
+HllUnion* HllUnion::deserialize(std::istream& is, std::pmr::memory_resource* resource,
+                                const HashPolicy& hashPolicy) {
+  return HllUnionPvt::deserialize(is, resource, hashPolicy);
 }
 
-HllUnion* HllUnion::deserialize(std::istream& is) {
-  return HllUnionPvt::deserialize(is);
+HllUnion* HllUnion::deserialize(const void* bytes, const size_t sizeBytes,
+                                std::pmr::memory_resource* resource,
+                                const HashPolicy& hashPolicy) {
+  return HllUnionPvt::deserialize(bytes, sizeBytes, resource, hashPolicy);
 }
 
 HllUnion::~HllUnion() {}
 
-HllUnionPvt::HllUnionPvt(const int lgMaxK)
+HllUnionPvt::HllUnionPvt(const int lgMaxK, std::pmr::memory_resource* resource,
+                         const HashPolicy& hashPolicy)
   : lgMaxK(HllUtil::checkLgK(lgMaxK)) {
-  gadget = new HllSketchPvt(lgMaxK, TgtHllType::HLL_8);
+  gadget = new HllSketchPvt(lgMaxK, TgtHllType::HLL_8, resource, hashPolicy);
 }
 
 HllUnionPvt::HllUnionPvt(HllSketch& sketch)
@@ -41,8 +64,9 @@ HllUnionPvt::~HllUnionPvt() {
   }
 }
 
-HllUnionPvt* HllUnionPvt::deserialize(std::istream& is) {
-  HllSketch* sk = HllSketch::deserialize(is);
+HllUnionPvt* HllUnionPvt::deserialize(std::istream& is, std::pmr::memory_resource* resource,
+                                      const HashPolicy& hashPolicy) {
+  HllSketch* sk = HllSketch::deserialize(is, resource, hashPolicy);
   if (sk == nullptr) { return nullptr; }
   // we're using the sketch's lgConfigK to initialize the union so
   // we can initialize the Union with it as long as it's HLL_8.
@@ -50,86 +74,323 @@ HllUnionPvt* HllUnionPvt::deserialize(std::istream& is) {
   if (sk->getTgtHllType() == HLL_8) {
     hllUnion = new HllUnionPvt(*sk);
   } else {
-    hllUnion = new HllUnionPvt(sk->getLgConfigK());
+    hllUnion = new HllUnionPvt(sk->getLgConfigK(), resource, hashPolicy);
     hllUnion->update(sk);
     delete sk;
   }
   return hllUnion;
 }
 
+HllUnionPvt* HllUnionPvt::deserialize(const void* bytes, const size_t sizeBytes,
+                                      std::pmr::memory_resource* resource,
+                                      const HashPolicy& hashPolicy) {
+  std::vector<uint8_t> buffer;
+  bytes = HllSketchView::aligned(bytes, sizeBytes, buffer);
+  const HllSketchView view(bytes, sizeBytes);
+  if (view.getTgtHllType() == HLL_8) {
+    return new HllUnionPvt(*HllSketch::deserialize(bytes, sizeBytes, resource, hashPolicy));
+  }
+  // other types are merged straight from the bytes
+  HllUnionPvt* hllUnion = new HllUnionPvt(view.getLgConfigK(), resource, hashPolicy);
+  hllUnion->update(view);
+  return hllUnion;
+}
+
 HllSketch* HllUnionPvt::getResult() const {
-  return gadget->copyAs(TgtHllType::HLL_4);
+  return getSharedResult(TgtHllType::HLL_4)->copy();
 }
 
 HllSketch* HllUnionPvt::getResult(TgtHllType tgtHllType) const {
-  return gadget->copyAs(tgtHllType);
+  return getSharedResult(tgtHllType)->copy();
+}
+
+std::shared_ptr<const HllSketch> HllUnionPvt::getSharedResult(TgtHllType tgtHllType) const {
+  std::shared_ptr<const HllSketch>& slot = results[tgtHllType];
+  std::shared_ptr<const HllSketch> result = std::atomic_load(&slot);
+  if (result == nullptr) {
+    // racing readers may both convert, the last store wins and both are equal
+    result = std::shared_ptr<const HllSketch>(gadget->copyAs(tgtHllType));
+    std::atomic_store(&slot, result);
+    hasResults.store(true, std::memory_order_release);
+  }
+  return result;
 }
 
 void HllUnionPvt::update(const HllSketch* sketch) {
-  unionImpl(static_cast<const HllSketchPvt*>(sketch)->hllSketchImpl, lgMaxK);
+  update(*sketch);
 }
 
+// coupons of different hash policies do not mix
 void HllUnionPvt::update(const HllSketch& sketch) {
+  if (sketch.getHashPolicy() != gadget->getHashPolicy()) {
+    throw std::invalid_argument("Cannot union sketches of different hash policies");
+  }
   unionImpl(static_cast<const HllSketchPvt&>(sketch).hllSketchImpl, lgMaxK);
 }
 
+// Follows the cases of unionImpl() with the view read in place, so the
+// gadget ends up as if the sketch had been deserialized and unioned
+void HllUnionPvt::update(const HllSketchView& sketch) {
+  if (!sketch.hasHashPolicy(gadget->getHashPolicy())) {
+    throw std::invalid_argument("Cannot union sketches of different hash policies");
+  }
+  if (sketch.isEmpty()) { return; }
+  invalidateResults();
+  HllSketchImpl* dstImpl = gadget->hllSketchImpl;
+  const bool dstEmpty = dstImpl->isEmpty();
+
+  if (sketch.getCurMode() != HLL) { // cases 0, 1, 4, 5, 8, 9, 12 and 13
+    dstImpl = unionCoupons(dstImpl, reinterpret_cast<const int*>(sketch.data), sketch.dataInts);
+    // as unionImpl() has it, the flag of the gadget is read after the union
+    bool ooo;
+    if (sketch.getCurMode() == SET) {
+      ooo = true;
+    } else if (dstEmpty) {
+      ooo = sketch.isOutOfOrderFlag();
+    } else {
+      ooo = dstImpl->isOutOfOrderFlag() || sketch.isOutOfOrderFlag();
+    }
+    dstImpl->putOutOfOrderFlag(ooo);
+    gadget->hllSketchImpl = dstImpl;
+    return;
+  }
+
+  if (dstEmpty || (dstImpl->getCurMode() != HLL)) { // cases 2, 6 and 14
+    // the gadget becomes the source, into which go the coupons it held
+    HllSketchImpl* hll = copyOrDownsampleHll(sketch, lgMaxK, dstImpl->getResource());
+    if (!dstEmpty) {
+      std::unique_ptr<PairIterator> itr = dstImpl->getIterator();
+      while (itr->nextValid()) { hll = leakFreeCouponUpdate(hll, itr->getPair()); }
+      hll->putOutOfOrderFlag((dstImpl->getCurMode() == SET) || dstImpl->isOutOfOrderFlag()
+                             || sketch.isOutOfOrderFlag());
+    }
+    delete dstImpl;
+    gadget->hllSketchImpl = hll;
+    return;
+  }
+
+  // case 10
+  const int srcLgK = sketch.getLgConfigK();
+  if ((srcLgK < dstImpl->getLgConfigK()) || (dstImpl->getTgtHllType() != HLL_8)) {
+    HllSketchImpl* downsampled = copyOrDownsampleHll(dstImpl, std::min(srcLgK, dstImpl->getLgConfigK()),
+                                                     dstImpl->getResource());
+    delete dstImpl;
+    gadget->hllSketchImpl = dstImpl = downsampled;
+  }
+  Hll8Array& dst = *static_cast<Hll8Array*>(dstImpl);
+  mergeHllRegisters(dst, sketch);
+  dst.putOutOfOrderFlag(true);
+}
+
+void HllUnionPvt::updateSerialized(const void* bytes, const size_t sizeBytes) {
+  update(HllSketchView(HllSketchView::aligned(bytes, sizeBytes, streamBuffer), sizeBytes));
+}
+
+void HllUnionPvt::updateSerialized(std::istream& is) {
+  const int sizeBytes = HllSketchView::read(is, streamBuffer);
+  update(HllSketchView(streamBuffer.data(), sizeBytes));
+}
+
+void HllUnionPvt::updateAll(const HllSketch* const* sketches, const size_t n, const int numThreads) {
+  parallelUpdate(sketches, n, numThreads);
+}
+
+void HllUnionPvt::updateAll(const HllSketchView* sketches, const size_t n, const int numThreads) {
+  parallelUpdate(sketches, n, numThreads);
+}
+
+// lgConfigK of a source in HLL mode, which bounds the lgK of the union;
+// sources in LIST or SET mode do not
+static int unionLgKBound(const HllSketch* sketch) {
+  const HllSketchImpl* impl = static_cast<const HllSketchPvt*>(sketch)->hllSketchImpl;
+  return (impl->getCurMode() == HLL) ? impl->getLgConfigK() : HllUtil::MAX_LOG_K;
+}
+
+static int unionLgKBound(const HllSketchView& sketch) {
+  return (sketch.getCurMode() == HLL) ? sketch.getLgConfigK() : HllUtil::MAX_LOG_K;
+}
+
+static const HllSketch* unionSource(const HllSketch* const& sketch) { return sketch; }
+static const HllSketchView& unionSource(const HllSketchView& sketch) { return sketch; }
+
+// Runs task(0) .. task(numTasks - 1) on their own threads, task(0) on the
+// caller's, and rethrows the first exception once all have finished.
+static void runTasks(const int numTasks, const std::function<void(int)>& task) {
+  std::vector<std::exception_ptr> errors(numTasks);
+  std::vector<std::thread> threads;
+  for (int t = 1; t < numTasks; ++t) {
+    threads.emplace_back([&task, &errors, t]() {
+      try { task(t); } catch (...) { errors[t] = std::current_exception(); }
+    });
+  }
+  try { task(0); } catch (...) { errors[0] = std::current_exception(); }
+  for (std::thread& thread : threads) { thread.join(); }
+  for (std::exception_ptr& error : errors) {
+    if (error) { std::rethrow_exception(error); }
+  }
+}
+
+template<typename Source>
+void HllUnionPvt::parallelUpdate(const Source* sources, const size_t n, int numThreads) {
+  if (sources == nullptr || n == 0) { return; }
+  invalidateResults();
+  if (numThreads <= 0) {
+    numThreads = std::max(1, (int) std::thread::hardware_concurrency());
+  }
+  const int numParts = (int) std::min<size_t>(numThreads, n);
+  if (numParts == 1) {
+    for (size_t i = 0; i < n; ++i) { update(unionSource(sources[i])); }
+    return;
+  }
+
+  // Settle the final lgK first: the gadget is downsampled at most once here,
+  // and the partial unions start at that lgK so they never need to be.
+  int tgtLgK = gadget->getLgConfigK();
+  for (size_t i = 0; i < n; ++i) {
+    tgtLgK = std::min(tgtLgK, unionLgKBound(sources[i]));
+  }
+  HllSketchImpl* gadgetImpl = gadget->hllSketchImpl;
+  if ((gadgetImpl->getCurMode() == HLL) && (gadgetImpl->getLgConfigK() > tgtLgK)) {
+    gadget->hllSketchImpl = copyOrDownsampleHll(gadgetImpl, tgtLgK, gadgetImpl->getResource());
+    gadget->hllSketchImpl->putOutOfOrderFlag(true);
+    delete gadgetImpl;
+  }
+
+  // the partial unions allocate from the default resource, which unlike the
+  // gadget's is safe to use from several threads at once
+  std::vector<HllUnionPvt*> parts(numParts);
+  for (int p = 0; p < numParts; ++p) {
+    parts[p] = new HllUnionPvt(tgtLgK, nullptr, gadget->getHashPolicy());
+  }
+  try {
+    runTasks(numParts, [&](const int p) {
+      const size_t begin = n * p / numParts;
+      const size_t end = n * (p + 1) / numParts;
+      for (size_t i = begin; i < end; ++i) { parts[p]->update(unionSource(sources[i])); }
+    });
+    for (int stride = 1; stride < numParts; stride <<= 1) {
+      const int numPairs = (numParts + 2 * stride - 1) / (2 * stride);
+      runTasks(numPairs, [&](const int pair) {
+        const int p = pair * 2 * stride;
+        if (p + stride < numParts) { parts[p]->update(*parts[p + stride]->gadget); }
+      });
+    }
+    update(*parts[0]->gadget);
+  } catch (...) {
+    for (HllUnionPvt* part : parts) { delete part; }
+    throw;
+  }
+  for (HllUnionPvt* part : parts) { delete part; }
+}
+
 void HllUnionPvt::update(const std::string datum) {
+  invalidateResults();
   gadget->update(datum);
 }
 
 void HllUnionPvt::update(const uint64_t datum) {
+  invalidateResults();
   gadget->update(datum);
 }
 
 void HllUnionPvt::update(const uint32_t datum) {
+  invalidateResults();
   gadget->update(datum);
 }
 
 void HllUnionPvt::update(const uint16_t datum) {
+  invalidateResults();
   gadget->update(datum);
 }
 
 void HllUnionPvt::update(const uint8_t datum) {
+  invalidateResults();
   gadget->update(datum);
 }
 
 void HllUnionPvt::update(const int64_t datum) {
+  invalidateResults();
   gadget->update(datum);
 }
 
 void HllUnionPvt::update(const int32_t datum) {
+  invalidateResults();
   gadget->update(datum);
 }
 
 void HllUnionPvt::update(const int16_t datum) {
+  invalidateResults();
   gadget->update(datum);
 }
 
 void HllUnionPvt::update(const int8_t datum) {
+  invalidateResults();
   gadget->update(datum);
 }
 
 void HllUnionPvt::update(const double datum) {
+  invalidateResults();
   gadget->update(datum);
 }
 
 void HllUnionPvt::update(const float datum) {
+  invalidateResults();
   gadget->update(datum);
 }
 
 void HllUnionPvt::update(const void* data, const size_t lengthBytes) {
+  invalidateResults();
   gadget->update(data, lengthBytes);
 }
 
+void HllUnionPvt::updateBatch(const uint64_t* data, const size_t n) {
+  invalidateResults();
+  gadget->updateBatch(data, n);
+}
+
+void HllUnionPvt::updateBatch(const int32_t* data, const size_t n) {
+  invalidateResults();
+  gadget->updateBatch(data, n);
+}
+
+void HllUnionPvt::updateBatch(const double* data, const size_t n) {
+  invalidateResults();
+  gadget->updateBatch(data, n);
+}
+
+void HllUnionPvt::updateBatch(const std::string_view* data, const size_t n) {
+  invalidateResults();
+  gadget->updateBatch(data, n);
+}
+
+void HllUnionPvt::update(const HashState& hash) {
+  invalidateResults();
+  gadget->update(hash);
+}
+
+void HllUnionPvt::updateBatch(const HashState* hashes, const size_t n) {
+  invalidateResults();
+  gadget->updateBatch(hashes, n);
+}
+
 void HllUnionPvt::couponUpdate(const int coupon) {
-  if (coupon == HllUtil::EMPTY) { return; }
-  HllSketchImpl* result = gadget->hllSketchImpl->couponUpdate(coupon);
+  if (HllUtil::getValue(coupon) == 0) {
+    if (coupon == HllUtil::EMPTY) { return; }
+    throw std::invalid_argument("Invalid coupon: zero value");
+  }
+  invalidateResults();
+  HllSketchImpl* result = HllDispatch::couponUpdate(gadget->hllSketchImpl, coupon);
   if (result != gadget->hllSketchImpl) {
     if (gadget->hllSketchImpl != nullptr) { delete gadget->hllSketchImpl; }
     gadget->hllSketchImpl = result;
   }
 }
 
+void HllUnionPvt::couponUpdate(const int* coupons, const size_t n) {
+  invalidateResults();
+  gadget->couponUpdate(coupons, n);
+}
+
 void HllUnionPvt::serializeCompact(std::ostream& os) const {
   return gadget->serializeCompact(os);
 }
@@ -138,6 +399,34 @@ void HllUnionPvt::serializeUpdatable(std::ostream& os) const {
   return gadget->serializeUpdatable(os);
 }
 
+std::pair<ptr_with_deleter, const size_t> HllUnionPvt::serializeCompact(unsigned header_size_bytes) const {
+  return gadget->serializeCompact(header_size_bytes);
+}
+
+std::pair<ptr_with_deleter, const size_t> HllUnionPvt::serializeUpdatable(unsigned header_size_bytes) const {
+  return gadget->serializeUpdatable(header_size_bytes);
+}
+
+size_t HllUnionPvt::serializeCompact(void* dst, const size_t capacityBytes) const {
+  return gadget->serializeCompact(dst, capacityBytes);
+}
+
+size_t HllUnionPvt::serializeUpdatable(void* dst, const size_t capacityBytes) const {
+  return gadget->serializeUpdatable(dst, capacityBytes);
+}
+
+void HllUnionPvt::serializeCompressed(std::ostream& os) const {
+  return gadget->serializeCompressed(os);
+}
+
+std::pair<ptr_with_deleter, const size_t> HllUnionPvt::serializeCompressed(unsigned header_size_bytes) const {
+  return gadget->serializeCompressed(header_size_bytes);
+}
+
+size_t HllUnionPvt::serializeCompressed(void* dst, const size_t capacityBytes) const {
+  return gadget->serializeCompressed(dst, capacityBytes);
+}
+
 std::ostream& HllUnionPvt::to_string(std::ostream& os, const bool summary,
                                   const bool detail, const bool auxDetail, const bool all) const {
   return gadget->to_string(os, summary, detail, auxDetail, all);
@@ -167,11 +456,16 @@ int HllUnionPvt::getUpdatableSerializationBytes() const {
   return gadget->getUpdatableSerializationBytes();
 }
 
+int HllUnionPvt::getCompressedSerializationBytes() const {
+  return gadget->getCompressedSerializationBytes();
+}
+
 int HllUnionPvt::getLgConfigK() const {
   return gadget->getLgConfigK();
 }
 
 void HllUnionPvt::reset() {
+  invalidateResults();
   gadget->reset();
 }
 
@@ -203,6 +497,10 @@ TgtHllType HllUnionPvt::getTgtHllType() const {
   return TgtHllType::HLL_8;
 }
 
+const HashPolicy& HllUnionPvt::getHashPolicy() const {
+  return gadget->getHashPolicy();
+}
+
 int HllUnion::getMaxSerializationBytes(const int lgK) {
   return HllSketch::getMaxUpdatableSerializationBytes(lgK, TgtHllType::HLL_8);
 }
@@ -212,19 +510,17 @@ double HllUnion::getRelErr(const bool upperBound, const bool unioned,
   return HllUtil::getRelErr(upperBound, unioned, lgConfigK, numStdDev);
 }
 
-HllSketchImpl* HllUnionPvt::copyOrDownsampleHll(HllSketchImpl* srcImpl, const int tgtLgK) {
+HllSketchImpl* HllUnionPvt::copyOrDownsampleHll(HllSketchImpl* srcImpl, const int tgtLgK,
+                                                std::pmr::memory_resource* resource) {
   assert(srcImpl->getCurMode() == CurMode::HLL);
   HllArray* src = (HllArray*) srcImpl;
   const int srcLgK = src->getLgConfigK();
   if ((srcLgK <= tgtLgK) && (src->getTgtHllType() == TgtHllType::HLL_8)) {
-    return src->copy();
+    return new (resource) Hll8Array(*static_cast<Hll8Array*>(src), resource);
   }
   const int minLgK = ((srcLgK < tgtLgK) ? srcLgK : tgtLgK);
-  HllArray* tgtHllArr = HllArray::newHll(minLgK, TgtHllType::HLL_8);
-  std::unique_ptr<PairIterator> srcItr = src->getIterator();
-  while (srcItr->nextValid()) {
-    tgtHllArr->couponUpdate(srcItr->getPair());
-  }
+  Hll8Array* tgtHllArr = new (resource) Hll8Array(minLgK, resource);
+  mergeHllRegisters(*tgtHllArr, *src);
   //both of these are required for isomorphism
   tgtHllArr->putHipAccum(src->getHipAccum());
   tgtHllArr->putOutOfOrderFlag(src->isOutOfOrderFlag());
@@ -232,15 +528,213 @@ HllSketchImpl* HllUnionPvt::copyOrDownsampleHll(HllSketchImpl* srcImpl, const in
   return tgtHllArr;
 }
 
+void HllUnionPvt::mergeHllRegisters(Hll8Array& dst, const TgtHllType srcType, const uint8_t* srcArr,
+                                    const int srcLgK, const int srcCurMin, PairIterator* auxItr) {
+  const int srcSlots = 1 << srcLgK;
+  const int dstSlots = 1 << dst.getLgConfigK();
+  dst.unshareArray();
+  uint8_t* dstArr = dst.hllByteArr;
+
+  switch (srcType) {
+    case HLL_8: {
+      // the estimators are counted as the registers are folded
+      int counts[64] = {0};
+      HllKernels::foldMax8(dstArr, dstSlots, srcArr, srcSlots, counts);
+      putEstimators(dst, counts);
+      return;
+    }
+    case HLL_6:
+    case HLL_4: {
+      // unpack a block of source slots to bytes, then fold as HLL_8
+      uint8_t block[HllKernels::BLOCK_SLOTS];
+      for (int i = 0; i < srcSlots; i += HllKernels::BLOCK_SLOTS) {
+        const int len = std::min(HllKernels::BLOCK_SLOTS, srcSlots - i);
+        if (srcType == HLL_6) {
+          HllKernels::unpack6(block, srcArr + ((i * 3) >> 2), len);
+        } else {
+          HllKernels::unpack4(block, srcArr + (i >> 1), len, srcCurMin);
+        }
+        foldBlock(dst, i, block, len);
+      }
+      // unpack4() leaves AUX_TOKEN slots at 0; apply their true values
+      mergeAuxPairs(dst, auxItr);
+      break;
+    }
+  }
+  refreshEstimators(dst);
+}
+
+// value of an HLL_4 exception, found by a scan as in HllViewIterator
+static int auxValue(const HllSketchView& src, const int* auxInts, const int auxLen, const int slotNo) {
+  const int slotMask = (1 << src.getLgConfigK()) - 1;
+  for (int i = 0; i < auxLen; ++i) {
+    const int pair = auxInts[i];
+    if ((pair != HllUtil::EMPTY) && ((HllUtil::getLow26(pair) & slotMask) == slotNo)) {
+      return HllUtil::getValue(pair);
+    }
+  }
+  throw std::invalid_argument("Aux value not found for slot in input buffer");
+}
+
+template<typename Fn>
+void HllUnionPvt::forEachRegisterBlock(const HllSketchView& src, Fn fn) {
+  const int numSlots = 1 << src.lgConfigK;
+  // on the stack, so a compressed source allocates nothing either
+  std::optional<HllRegisterDecoder> decoder;
+  if (src.compressed) {
+    decoder.emplace(src.data, src.codedBytes, HllCompression::getMaxSymbols(src.tgtHllType));
+  }
+  uint8_t block[HllKernels::BLOCK_SLOTS];
+  for (int i = 0; i < numSlots; i += HllKernels::BLOCK_SLOTS) {
+    const int len = std::min(HllKernels::BLOCK_SLOTS, numSlots - i);
+    if (decoder) {
+      decoder->next(block, len);
+    } else {
+      HllCompression::getStoredValues(src.tgtHllType, src.data, i, len, block);
+    }
+    if (src.tgtHllType == HLL_4) {
+      for (int j = 0; j < len; ++j) {
+        block[j] = (block[j] == HllUtil::AUX_TOKEN)
+            ? (uint8_t) auxValue(src, src.auxInts, src.auxLen, i + j) : (uint8_t) (block[j] + src.curMin);
+      }
+    }
+    fn(i, block, len);
+  }
+}
+
+Hll8Array* HllUnionPvt::copyOrDownsampleHll(const HllSketchView& src, const int tgtLgK,
+                                            std::pmr::memory_resource* resource) {
+  const int srcLgK = src.lgConfigK;
+  Hll8Array* tgtHllArr = new (resource) Hll8Array(std::min(srcLgK, tgtLgK), resource);
+  try {
+    if ((srcLgK <= tgtLgK) && (src.tgtHllType == HLL_8)) {
+      // what the copy constructor keeps of a deserialized source
+      if (src.compressed) {
+        HllCompression::decode(src.data, src.codedBytes, HLL_8, srcLgK, tgtHllArr->hllByteArr);
+      } else {
+        std::memcpy(tgtHllArr->hllByteArr, src.data, tgtHllArr->getHllByteArrBytes());
+      }
+      tgtHllArr->putCurMin(src.curMin);
+      tgtHllArr->putKxQ0(src.kxq0);
+      tgtHllArr->putKxQ1(src.kxq1);
+      tgtHllArr->putNumAtCurMin(src.numAtCurMin);
+    } else {
+      mergeHllRegisters(*tgtHllArr, src);
+    }
+  } catch (...) {
+    delete tgtHllArr;
+    throw;
+  }
+  //both of these are required for isomorphism
+  tgtHllArr->putHipAccum(src.hipAccum);
+  tgtHllArr->putOutOfOrderFlag(src.oooFlag);
+  return tgtHllArr;
+}
+
+void HllUnionPvt::mergeHllRegisters(Hll8Array& dst, const HllArray& src) {
+  const AuxHashMap* auxHashMap = src.getAuxHashMap();
+  if (auxHashMap != nullptr) {
+    IntArrayPairIterator auxItr = auxHashMap->getPairs();
+    mergeHllRegisters(dst, src.getTgtHllType(), src.hllByteArr, src.getLgConfigK(), src.getCurMin(),
+                      &auxItr);
+  } else {
+    mergeHllRegisters(dst, src.getTgtHllType(), src.hllByteArr, src.getLgConfigK(), src.getCurMin(),
+                      nullptr);
+  }
+}
+
+void HllUnionPvt::mergeHllRegisters(Hll8Array& dst, const HllSketchView& src) {
+  if (src.compressed) {
+    dst.unshareArray();
+    forEachRegisterBlock(src, [&dst](const int start, const uint8_t* values, const int len) {
+      foldBlock(dst, start, values, len);
+    });
+    refreshEstimators(dst);
+  } else if (src.auxCount > 0) {
+    IntArrayPairIterator auxItr(src.auxInts, src.auxLen, src.lgConfigK);
+    mergeHllRegisters(dst, src.tgtHllType, src.data, src.lgConfigK, src.curMin, &auxItr);
+  } else {
+    mergeHllRegisters(dst, src.tgtHllType, src.data, src.lgConfigK, src.curMin, nullptr);
+  }
+}
+
+void HllUnionPvt::foldBlock(Hll8Array& dst, const int start, const uint8_t* values, const int len) {
+  // a block lies within dst, or folds onto the whole of it
+  const int dstSlots = 1 << dst.getLgConfigK();
+  HllKernels::foldMax8(dst.hllByteArr + (start & (dstSlots - 1)), std::min(dstSlots, len), values, len);
+}
+
+void HllUnionPvt::mergeAuxPairs(Hll8Array& dst, PairIterator* auxItr) {
+  if (auxItr == nullptr) { return; }
+  const int slotMask = (1 << dst.getLgConfigK()) - 1;
+  uint8_t* dstArr = dst.hllByteArr;
+  while (auxItr->nextValid()) {
+    const int pair = auxItr->getPair();
+    const int slotNo = HllUtil::getLow26(pair) & slotMask;
+    const int value = HllUtil::getValue(pair);
+    if (value > dstArr[slotNo]) { dstArr[slotNo] = (uint8_t) value; }
+  }
+}
+
+void HllUnionPvt::refreshEstimators(Hll8Array& dst) {
+  int counts[64] = {0};
+  HllKernels::histogram8(dst.hllByteArr, 1 << dst.getLgConfigK(), counts);
+  putEstimators(dst, counts);
+}
+
+void HllUnionPvt::putEstimators(Hll8Array& dst, const int* counts) {
+  double kxq0;
+  double kxq1;
+  HllKernels::kxqFromHistogram(counts, kxq0, kxq1);
+  dst.putKxQ0(kxq0);
+  dst.putKxQ1(kxq1);
+  dst.putNumAtCurMin(counts[0]); // curMin is always 0 for HLL_8
+}
+
 inline HllSketchImpl* HllUnionPvt::leakFreeCouponUpdate(HllSketchImpl* impl, const int coupon) {
-  HllSketchImpl* result = impl->couponUpdate(coupon);
+  HllSketchImpl* result = HllDispatch::couponUpdate(impl, coupon);
   if (result != impl) {
     delete impl;
   }
   return result;
 }
 
+HllSketchImpl* HllUnionPvt::unionCoupons(HllSketchImpl* dstImpl, const HllSketchImpl* srcImpl) {
+  // an empty gadget may still be an HLL array, e.g. when deserialized
+  HllSketchImpl* result = (dstImpl->getCurMode() == CurMode::HLL) ? nullptr
+      : static_cast<CouponList*>(dstImpl)->unionCoupons(*static_cast<const CouponList*>(srcImpl));
+  if (result != nullptr) {
+    if (result != dstImpl) {
+      delete dstImpl;
+    }
+    return result;
+  }
+  // the result is or becomes an HLL, whose HIP estimate must see the coupons in order
+  std::unique_ptr<PairIterator> srcItr = srcImpl->getIterator();
+  while (srcItr->nextValid()) {
+    dstImpl = leakFreeCouponUpdate(dstImpl, srcItr->getPair()); //assignment required
+  }
+  return dstImpl;
+}
+
+HllSketchImpl* HllUnionPvt::unionCoupons(HllSketchImpl* dstImpl, const int* srcCoupons,
+                                         const int srcLen) {
+  HllSketchImpl* result = (dstImpl->getCurMode() == CurMode::HLL) ? nullptr
+      : static_cast<CouponList*>(dstImpl)->unionCoupons(srcCoupons, srcLen);
+  if (result != nullptr) {
+    if (result != dstImpl) {
+      delete dstImpl;
+    }
+    return result;
+  }
+  for (int i = 0; i < srcLen; ++i) {
+    if (srcCoupons[i] != HllUtil::EMPTY) { dstImpl = leakFreeCouponUpdate(dstImpl, srcCoupons[i]); }
+  }
+  return dstImpl;
+}
+
 void HllUnionPvt::unionImpl(HllSketchImpl* incomingImpl, const int lgMaxK) {
+  invalidateResults();
   assert(gadget->hllSketchImpl->getTgtHllType() == TgtHllType::HLL_8);
   HllSketchImpl* srcImpl = incomingImpl; //default
   HllSketchImpl* dstImpl = gadget->hllSketchImpl; //default
@@ -255,10 +749,7 @@ void HllUnionPvt::unionImpl(HllSketchImpl* incomingImpl, const int lgMaxK) {
   //System.out.println("SW: " + sw);
   switch (sw) {
     case 0: { //src: LIST, gadget: LIST
-      std::unique_ptr<PairIterator> srcItr = srcImpl->getIterator(); //LIST
-      while (srcItr->nextValid()) {
-        dstImpl = leakFreeCouponUpdate(dstImpl, srcItr->getPair()); //assignment required
-      }
+      dstImpl = unionCoupons(dstImpl, srcImpl); //LIST
       //whichever is True wins:
       dstImpl->putOutOfOrderFlag(dstImpl->isOutOfOrderFlag() | srcImpl->isOutOfOrderFlag());
       // gadget: cleanly updated as needed
@@ -266,10 +757,7 @@ void HllUnionPvt::unionImpl(HllSketchImpl* incomingImpl, const int lgMaxK) {
     }
     case 1: { //src: SET, gadget: LIST
       //consider a swap here
-      std::unique_ptr<PairIterator> srcItr = srcImpl->getIterator(); //SET
-      while (srcItr->nextValid()) {
-        dstImpl = leakFreeCouponUpdate(dstImpl, srcItr->getPair()); //assignment required
-      }
+      dstImpl = unionCoupons(dstImpl, srcImpl); //SET
       dstImpl->putOutOfOrderFlag(true); //SET oooFlag is always true
       // gadget: cleanly updated as needed
       break;
@@ -278,7 +766,7 @@ void HllUnionPvt::unionImpl(HllSketchImpl* incomingImpl, const int lgMaxK) {
       //swap so that src is gadget-LIST, tgt is HLL
       //use lgMaxK because LIST has effective K of 2^26
       srcImpl = gadget->hllSketchImpl;
-      dstImpl = copyOrDownsampleHll(incomingImpl, lgMaxK);
+      dstImpl = copyOrDownsampleHll(incomingImpl, lgMaxK, gadget->hllSketchImpl->getResource());
       std::unique_ptr<PairIterator> srcItr = srcImpl->getIterator();
       while (srcItr->nextValid()) {
         dstImpl = leakFreeCouponUpdate(dstImpl, srcItr->getPair()); //assignment required
@@ -290,19 +778,13 @@ void HllUnionPvt::unionImpl(HllSketchImpl* incomingImpl, const int lgMaxK) {
       break;
     }
     case 4: { //src: LIST, gadget: SET
-      std::unique_ptr<PairIterator> srcItr = srcImpl->getIterator(); //LIST
-      while (srcItr->nextValid()) {
-        dstImpl = leakFreeCouponUpdate(dstImpl, srcItr->getPair()); //assignment required
-      }
+      dstImpl = unionCoupons(dstImpl, srcImpl); //LIST
       dstImpl->putOutOfOrderFlag(true); //SET oooFlag is always true
       // gadget: cleanly updated as needed
       break;
     }
     case 5: { //src: SET, gadget: SET
-      std::unique_ptr<PairIterator> srcItr = srcImpl->getIterator(); //SET
-      while (srcItr->nextValid()) {
-        dstImpl = leakFreeCouponUpdate(dstImpl, srcItr->getPair()); //assignment required
-      }
+      dstImpl = unionCoupons(dstImpl, srcImpl); //SET
       dstImpl->putOutOfOrderFlag(true); //SET oooFlag is always true
       // gadget: cleanly updated as needed
       break;
@@ -311,7 +793,7 @@ void HllUnionPvt::unionImpl(HllSketchImpl* incomingImpl, const int lgMaxK) {
       //swap so that src is gadget-SET, tgt is HLL
       //use lgMaxK because LIST has effective K of 2^26
       srcImpl = gadget->hllSketchImpl;
-      dstImpl = copyOrDownsampleHll(incomingImpl, lgMaxK);
+      dstImpl = copyOrDownsampleHll(incomingImpl, lgMaxK, gadget->hllSketchImpl->getResource());
       std::unique_ptr<PairIterator> srcItr = srcImpl->getIterator(); //LIST
       assert(dstImpl->getCurMode() == HLL);
       while (srcItr->nextValid()) {
@@ -350,38 +832,30 @@ void HllUnionPvt::unionImpl(HllSketchImpl* incomingImpl, const int lgMaxK) {
       const int dstLgK = dstImpl->getLgConfigK();
       const int minLgK = ((srcLgK < dstLgK) ? srcLgK : dstLgK);
       if ((srcLgK < dstLgK) || (dstImpl->getTgtHllType() != HLL_8)) {
-        dstImpl = copyOrDownsampleHll(dstImpl, minLgK);
+        dstImpl = copyOrDownsampleHll(dstImpl, minLgK, dstImpl->getResource());
         // always replaces gadget
         delete gadget->hllSketchImpl;
       }
-      std::unique_ptr<PairIterator> srcItr = srcImpl->getIterator(); //HLL
-      while (srcItr->nextValid()) {
-        dstImpl = leakFreeCouponUpdate(dstImpl, srcItr->getPair()); //assignment required
-      }
+      const HllArray* src = static_cast<HllArray*>(srcImpl);
+      mergeHllRegisters(*static_cast<Hll8Array*>(dstImpl), *src);
       dstImpl->putOutOfOrderFlag(true); //union of two HLL modes is always true
       // gadget: replaced if copied/downampled, otherwise should be unchanged
       break;
     }
     case 12: { //src: LIST, gadget: empty
-      std::unique_ptr<PairIterator> srcItr = srcImpl->getIterator(); //LIST
-      while (srcItr->nextValid()) {
-        dstImpl = leakFreeCouponUpdate(dstImpl, srcItr->getPair()); //assignment required
-      }
+      dstImpl = unionCoupons(dstImpl, srcImpl); //LIST
       dstImpl->putOutOfOrderFlag(srcImpl->isOutOfOrderFlag()); //whatever source is
       // gadget: cleanly updated as needed
       break;
     }
     case 13: { //src: SET, gadget: empty
-      std::unique_ptr<PairIterator> srcItr = srcImpl->getIterator(); //SET
-      while (srcItr->nextValid()) {
-        dstImpl = leakFreeCouponUpdate(dstImpl, srcItr->getPair()); //assignment required
-      }
+      dstImpl = unionCoupons(dstImpl, srcImpl); //SET
       dstImpl->putOutOfOrderFlag(true); //SET oooFlag is always true
       // gadget: cleanly updated as needed
       break;
     }
     case 14: { //src: HLL, gadget: empty
-      dstImpl = copyOrDownsampleHll(srcImpl, lgMaxK);
+      dstImpl = copyOrDownsampleHll(srcImpl, lgMaxK, dstImpl->getResource());
       dstImpl->putOutOfOrderFlag(srcImpl->isOutOfOrderFlag()); //whatever source is.
       // gadget: always replaced with copied/downsampled sketch
       delete gadget->hllSketchImpl;
@@ -4,6 +4,13 @@
  */
 
 #include "HllUtil.hpp"
+#include "hll.hpp"
+
+#include <cstring>
+
+#if defined(__AVX512F__)
+#include <immintrin.h>
+#endif
 
 namespace datasketches {
 
@@ -18,4 +25,122 @@ const int HllUtil::LG_AUX_ARR_INTS[] = {
       12, 13, 14, 15, 16, 17, 18      // 20-26
       };
       
-}
\ No newline at end of file
+// MurmurHash3_x64_128 specialized for an 8-byte key: there are no full blocks,
+// so only the k1 tail mix and the finalization remain.
+static inline int longCoupon(const uint64_t key, const uint64_t seed) {
+  static const uint64_t c1 = BIG_CONSTANT(0x87c37b91114253d5);
+  static const uint64_t c2 = BIG_CONSTANT(0x4cf5ad432745937f);
+
+  uint64_t k1 = key;
+  k1 *= c1; k1 = ROTL64(k1, 31); k1 *= c2;
+  uint64_t h1 = (seed ^ k1) ^ sizeof(uint64_t);
+  uint64_t h2 = seed ^ sizeof(uint64_t);
+  h1 += h2;
+  h2 += h1;
+  h1 = fmix64(h1);
+  h2 = fmix64(h2);
+  h1 += h2;
+  h2 += h1;
+
+  HashState hashState;
+  hashState.h1 = h1;
+  hashState.h2 = h2;
+  return HllUtil::coupon(hashState);
+}
+
+#if defined(__AVX512F__) && defined(__AVX512DQ__) && defined(__AVX512CD__)
+// AVX2 lacks a 64-bit multiply and the emulated version is no faster than the
+// scalar code, so lanes are only used with AVX-512 (vpmullq and vplzcntq).
+static inline __m512i fmix64x8(__m512i k) {
+  k = _mm512_xor_si512(k, _mm512_srli_epi64(k, 33));
+  k = _mm512_mullo_epi64(k, _mm512_set1_epi64(BIG_CONSTANT(0xff51afd7ed558ccd)));
+  k = _mm512_xor_si512(k, _mm512_srli_epi64(k, 33));
+  k = _mm512_mullo_epi64(k, _mm512_set1_epi64(BIG_CONSTANT(0xc4ceb9fe1a85ec53)));
+  k = _mm512_xor_si512(k, _mm512_srli_epi64(k, 33));
+  return k;
+}
+
+// eight keys at a time, same arithmetic as longCoupon(); returns number of keys done
+static int longCouponsAvx512(const uint64_t* keys, const int numKeys, const uint64_t seed, int* coupons) {
+  const __m512i c1 = _mm512_set1_epi64(BIG_CONSTANT(0x87c37b91114253d5));
+  const __m512i c2 = _mm512_set1_epi64(BIG_CONSTANT(0x4cf5ad432745937f));
+  const __m512i seedLen = _mm512_set1_epi64(seed ^ sizeof(uint64_t));
+  const __m512i maxLz = _mm512_set1_epi64(62);
+  const __m512i one = _mm512_set1_epi64(1);
+  const __m512i keyMask = _mm512_set1_epi64(HllUtil::KEY_MASK_26);
+
+  int i = 0;
+  for (; i + 8 <= numKeys; i += 8) {
+    __m512i k1 = _mm512_loadu_si512(keys + i);
+    k1 = _mm512_mullo_epi64(k1, c1);
+    k1 = _mm512_rol_epi64(k1, 31);
+    k1 = _mm512_mullo_epi64(k1, c2);
+    __m512i h1 = _mm512_xor_si512(seedLen, k1);
+    __m512i h2 = seedLen;
+    h1 = _mm512_add_epi64(h1, h2);
+    h2 = _mm512_add_epi64(h2, h1);
+    h1 = fmix64x8(h1);
+    h2 = fmix64x8(h2);
+    h1 = _mm512_add_epi64(h1, h2);
+    h2 = _mm512_add_epi64(h2, h1);
+
+    // coupon(): value = min(lz, 62) + 1 in the top 6 bits, low 26 bits of h1 below
+    __m512i value = _mm512_add_epi64(_mm512_min_epu64(_mm512_lzcnt_epi64(h2), maxLz), one);
+    __m512i coupon = _mm512_or_si512(_mm512_slli_epi64(value, HllUtil::KEY_BITS_26),
+                                     _mm512_and_si512(h1, keyMask));
+    _mm256_storeu_si256((__m256i*) (coupons + i), _mm512_cvtepi64_epi32(coupon));
+  }
+  return i;
+}
+#endif
+
+void HllUtil::writeSeedHash(uint8_t* dst, const HashPolicy& hashPolicy) {
+  const uint16_t seedHash[2] = { hashPolicy.getSeedHash(), 0 };
+  std::memcpy(dst, seedHash, HashPolicy::SEED_HASH_BYTES);
+}
+
+// 16 bytes keeps the payload aligned for every array type used here
+static const size_t ALLOC_HEADER_BYTES = 16;
+
+void* HllUtil::allocate(std::pmr::memory_resource* resource, const size_t bytes) {
+  const size_t totalBytes = bytes + ALLOC_HEADER_BYTES;
+  uint8_t* block = static_cast<uint8_t*>(resource->allocate(totalBytes, ALLOC_HEADER_BYTES));
+  std::memcpy(block, &resource, sizeof(resource));
+  std::memcpy(block + sizeof(resource), &totalBytes, sizeof(totalBytes));
+  return block + ALLOC_HEADER_BYTES;
+}
+
+void HllUtil::deallocate(void* ptr) {
+  if (ptr == nullptr) { return; }
+  uint8_t* block = static_cast<uint8_t*>(ptr) - ALLOC_HEADER_BYTES;
+  std::pmr::memory_resource* resource;
+  size_t totalBytes;
+  std::memcpy(&resource, block, sizeof(resource));
+  std::memcpy(&totalBytes, block + sizeof(resource), sizeof(totalBytes));
+  resource->deallocate(block, totalBytes, ALLOC_HEADER_BYTES);
+}
+
+void HllUtil::couponsFromLongs(const uint64_t* keys, const int numKeys, const uint64_t seed, int* coupons) {
+  int i = 0;
+#if defined(__AVX512F__) && defined(__AVX512DQ__) && defined(__AVX512CD__)
+  i = longCouponsAvx512(keys, numKeys, seed, coupons);
+#endif
+  for (; i < numKeys; ++i) {
+    coupons[i] = longCoupon(keys[i], seed);
+  }
+}
+
+void HllUtil::couponsFromLongs(const uint64_t* keys, const int numKeys, const HashPolicy& hashPolicy,
+                               int* coupons) {
+  if (hashPolicy.getFunction() == HashPolicy::MURMUR3) {
+    couponsFromLongs(keys, numKeys, hashPolicy.getSeed(), coupons);
+    return;
+  }
+  HashState hashState;
+  for (int i = 0; i < numKeys; ++i) {
+    fastMix(keys[i], sizeof(uint64_t), hashPolicy.getSeed(), hashState);
+    coupons[i] = coupon(hashState);
+  }
+}
+
+}
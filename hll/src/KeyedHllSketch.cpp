@@ -0,0 +1,444 @@
+/*
+ * Copyright 2018, Yahoo! Inc. Licensed under the terms of the
+ * Apache License 2.0. See LICENSE file at the project root for terms.
+ */
+
+#include "KeyedHllSketch.hpp"
+#include "CouponHashSet.hpp"
+#include "CouponList.hpp"
+#include "Hll8Array.hpp"
+#include "HllArray.hpp"
+#include "HllSketchView.hpp"
+
+#include <algorithm>
+#include <stdexcept>
+
+namespace datasketches {
+
+KeyedHllSketch* KeyedHllSketch::newInstance(const int lgConfigK, std::pmr::memory_resource* resource,
+                                            const HashPolicy& hashPolicy) {
+  return new KeyedHllSketchPvt(lgConfigK, resource, hashPolicy);
+}
+
+KeyedHllSketch* KeyedHllSketch::deserialize(std::istream& is, std::pmr::memory_resource* resource,
+                                            const HashPolicy& hashPolicy) {
+  int32_t lgConfigK;
+  int32_t seedHash;
+  uint64_t numKeys;
+  is.read((char*) &lgConfigK, sizeof(lgConfigK));
+  is.read((char*) &seedHash, sizeof(seedHash));
+  is.read((char*) &numKeys, sizeof(numKeys));
+  if (!is) {
+    throw std::invalid_argument("Input stream ended inside a KeyedHllSketch");
+  }
+  if (seedHash != hashPolicy.getSeedHash()) {
+    throw std::invalid_argument("Cannot deserialize a sketch written under a different hash policy");
+  }
+
+  std::unique_ptr<KeyedHllSketchPvt> sketch(new KeyedHllSketchPvt(lgConfigK, resource, hashPolicy));
+  std::vector<uint8_t> buffer;
+  for (uint64_t i = 0; i < numKeys; ++i) {
+    uint64_t key;
+    is.read((char*) &key, sizeof(key));
+    if (!is) {
+      throw std::invalid_argument("Input stream ended inside a KeyedHllSketch");
+    }
+    const int sizeBytes = HllSketchView::read(is, buffer);
+    sketch->add(key, buffer.data(), sizeBytes);
+  }
+  return sketch.release();
+}
+
+KeyedHllSketch::~KeyedHllSketch() {}
+
+int KeyedHllSketchPvt::getListCapacity(const int lgConfigK) {
+  return (lgConfigK < 8) ? ((1 << HllUtil::LG_INIT_LIST_SIZE) - 1) : LIST_COUPONS;
+}
+
+KeyedHllSketchPvt::KeyedHllSketchPvt(const int lgConfigK, std::pmr::memory_resource* resource,
+                                     const HashPolicy& hashPolicy)
+  : lgConfigK(HllUtil::checkLgK(lgConfigK)),
+    listCapacity(getListCapacity(lgConfigK)),
+    resource(HllUtil::resourceOrDefault(resource)),
+    hashPolicy(hashPolicy),
+    entries(nullptr),
+    lgEntries(LG_INIT_ENTRIES),
+    numKeys(0),
+    couponSlab(LIST_COUPONS * sizeof(int), resource),
+    setSlabs(),
+    registerSlab(HllUtil::HLL_BYTE_ARR_START + HllArray::hll8ArrBytes(lgConfigK)
+                 + hashPolicy.getSeedHashBytes(), resource) {
+  // the preamble of a new array, hash tag and all, though never empty
+  Hll8Array hll(lgConfigK, this->resource);
+  hll.writeHeader(header, false);
+  header[5] &= ~HllUtil::EMPTY_FLAG_MASK;
+  header[7] |= hashPolicy.getSerialTag() << 4;
+  for (int lgArrInts = HllUtil::LG_INIT_SET_SIZE; lgArrInts <= lgConfigK - 3; ++lgArrInts) {
+    setSlabs.emplace_back(new HllSlab(sizeof(int) << lgArrInts, this->resource));
+  }
+
+  entries = HllUtil::newArray<Entry>(this->resource, (size_t) 1 << lgEntries);
+  std::fill(entries, entries + ((size_t) 1 << lgEntries), Entry{0, FREE_BLOCK, 0});
+}
+
+KeyedHllSketchPvt::~KeyedHllSketchPvt() {
+  HllUtil::deallocate(entries);
+}
+
+void KeyedHllSketchPvt::update(const uint64_t key, const uint64_t value) {
+  HashState hashResult;
+  hashPolicy.hash(&value, sizeof(value), hashResult);
+  couponUpdate(key, HllUtil::coupon(hashResult));
+}
+
+void KeyedHllSketchPvt::update(const uint64_t key, const std::string& value) {
+  if (value.empty()) { return; }
+  HashState hashResult;
+  hashPolicy.hash(value.c_str(), value.length(), hashResult);
+  couponUpdate(key, HllUtil::coupon(hashResult));
+}
+
+void KeyedHllSketchPvt::update(const uint64_t* keys, const uint64_t* values, const size_t n) {
+  if ((keys == nullptr) || (values == nullptr)) { return; }
+  int coupons[HllUtil::BATCH_SIZE];
+  Entry* batch[HllUtil::BATCH_SIZE];
+  for (size_t i = 0; i < n; i += HllUtil::BATCH_SIZE) {
+    const int len = (int) std::min<size_t>(HllUtil::BATCH_SIZE, n - i);
+    HllUtil::couponsFromLongs(values + i, len, hashPolicy, coupons);
+    // so the entries stay put while the batch holds them
+    reserve(len);
+
+    // index slots, then the blocks they name, then the updates in order, so
+    // each round of misses overlaps
+    const size_t mask = ((size_t) 1 << lgEntries) - 1;
+    for (int j = 0; j < len; ++j) {
+      __builtin_prefetch(entries + (splitmix64Finalize(keys[i + j]) & mask));
+    }
+    for (int j = 0; j < len; ++j) {
+      batch[j] = &getOrAddEntry(keys[i + j]);
+      prefetch(*batch[j], coupons[j]);
+    }
+    for (int j = 0; j < len; ++j) {
+      couponUpdate(*batch[j], coupons[j]);
+    }
+  }
+}
+
+void KeyedHllSketchPvt::couponUpdate(const uint64_t key, const int coupon) {
+  if (HllUtil::getValue(coupon) == 0) {
+    if (coupon == HllUtil::EMPTY) { return; }
+    throw std::invalid_argument("Invalid coupon: zero value");
+  }
+  reserve(1);
+  couponUpdate(getOrAddEntry(key), coupon);
+}
+
+void KeyedHllSketchPvt::couponUpdate(Entry& entry, const int coupon) {
+  if (entry.count == HLL_COUNT) {
+    registerUpdate(registerSlab.get(entry.block), coupon);
+    return;
+  }
+  if (isSet(entry)) {
+    setUpdate(entry, coupon);
+    return;
+  }
+  int* coupons = reinterpret_cast<int*>(couponSlab.get(entry.block));
+  for (uint32_t i = 0; i < entry.count; ++i) {
+    if (coupons[i] == coupon) { return; }
+  }
+  if (entry.count < listCapacity) {
+    coupons[entry.count++] = coupon;
+  } else if (setSlabs.empty()) {
+    promote(entry, coupon);
+  } else {
+    moveToSet(entry, HllUtil::LG_INIT_SET_SIZE, coupon);
+  }
+}
+
+void KeyedHllSketchPvt::setUpdate(Entry& entry, const int coupon) {
+  const int lgArrInts = getLgSetInts(entry.count);
+  int* coupons = reinterpret_cast<int*>(getSlab(entry).get(entry.block));
+  const int index = CouponHashSet::find(coupons, lgArrInts, coupon);
+  if (index >= 0) { return; } // duplicate
+  // as CouponHashSet::checkGrowOrPromote(), a table more than 3/4 full
+  // doubles, or at its largest goes to HLL
+  if ((HllUtil::RESIZE_DENOM * (entry.count + 1)) > ((uint32_t) HllUtil::RESIZE_NUMER << lgArrInts)) {
+    if (lgArrInts == lgConfigK - 3) {
+      promote(entry, coupon);
+    } else {
+      moveToSet(entry, lgArrInts + 1, coupon);
+    }
+    return;
+  }
+  coupons[~index] = coupon;
+  ++entry.count;
+}
+
+void KeyedHllSketchPvt::moveToSet(Entry& entry, const int lgArrInts, const int coupon) {
+  HllSlab& slab = *setSlabs[lgArrInts - HllUtil::LG_INIT_SET_SIZE];
+  const uint32_t block = slab.allocate();
+  int* table = reinterpret_cast<int*>(slab.get(block));
+  std::fill_n(table, 1 << lgArrInts, 0);
+  const int* coupons = getCoupons(entry);
+  const int len = getCouponsLength(entry);
+  for (int i = 0; i < len; ++i) {
+    if (coupons[i] != HllUtil::EMPTY) {
+      table[~CouponHashSet::find(table, lgArrInts, coupons[i])] = coupons[i];
+    }
+  }
+  table[~CouponHashSet::find(table, lgArrInts, coupon)] = coupon;
+
+  getSlab(entry).release(entry.block);
+  entry.block = block;
+  ++entry.count;
+}
+
+void KeyedHllSketchPvt::promote(Entry& entry, const int coupon) {
+  const uint32_t block = registerSlab.allocate();
+  uint8_t* mem = registerSlab.get(block);
+  std::memcpy(mem, header, sizeof(header));
+  std::fill_n(mem + HllUtil::HLL_BYTE_ARR_START, 1 << lgConfigK, 0);
+  if (hashPolicy.getSeedHashBytes() > 0) {
+    HllUtil::writeSeedHash(mem + HllUtil::HLL_BYTE_ARR_START + (1 << lgConfigK), hashPolicy);
+  }
+
+  // as CouponList::promoteHeapListOrSetToHll(), HIP picks up from the
+  // estimate of the coupons
+  const int* coupons = getCoupons(entry);
+  const int len = getCouponsLength(entry);
+  for (int i = 0; i < len; ++i) {
+    if (coupons[i] != HllUtil::EMPTY) { registerUpdate(mem, coupons[i]); }
+  }
+  registerUpdate(mem, coupon);
+  const double hipAccum = CouponList::getEstimate(entry.count + 1);
+  std::memcpy(mem + 8, &hipAccum, sizeof(hipAccum));
+
+  getSlab(entry).release(entry.block);
+  entry.block = block;
+  entry.count = HLL_COUNT;
+}
+
+void KeyedHllSketchPvt::prefetch(const Entry& entry, const int coupon) const {
+  if (entry.count == HLL_COUNT) {
+    const uint8_t* mem = registerSlab.get(entry.block);
+    const int slotNo = HllUtil::getLow26(coupon) & ((1 << lgConfigK) - 1);
+    __builtin_prefetch(mem);
+    __builtin_prefetch(mem + HllUtil::HLL_BYTE_ARR_START + slotNo);
+  } else if (isSet(entry)) {
+    const int slotNo = coupon & ((1 << getLgSetInts(entry.count)) - 1);
+    __builtin_prefetch(getCoupons(entry) + slotNo);
+  } else {
+    __builtin_prefetch(couponSlab.get(entry.block));
+  }
+}
+
+KeyedHllSketchPvt::Entry& KeyedHllSketchPvt::getOrAddEntry(const uint64_t key) {
+  Entry& entry = entries[findSlot(key)];
+  if (entry.block == FREE_BLOCK) {
+    entry.key = key;
+    entry.block = couponSlab.allocate();
+    entry.count = 0;
+    ++numKeys;
+  }
+  return entry;
+}
+
+const KeyedHllSketchPvt::Entry* KeyedHllSketchPvt::findEntry(const uint64_t key) const {
+  const Entry& entry = entries[findSlot(key)];
+  return (entry.block == FREE_BLOCK) ? nullptr : &entry;
+}
+
+void KeyedHllSketchPvt::reserve(const size_t n) {
+  int newLgEntries = lgEntries;
+  while (HllUtil::RESIZE_DENOM * (numKeys + n) > ((size_t) HllUtil::RESIZE_NUMER << newLgEntries)) {
+    ++newLgEntries;
+  }
+  if (newLgEntries > lgEntries) { resize(newLgEntries); }
+}
+
+void KeyedHllSketchPvt::resize(const int newLgEntries) {
+  Entry* oldEntries = entries;
+  const size_t oldLen = (size_t) 1 << lgEntries;
+  entries = HllUtil::newArray<Entry>(resource, (size_t) 1 << newLgEntries);
+  std::fill(entries, entries + ((size_t) 1 << newLgEntries), Entry{0, FREE_BLOCK, 0});
+  lgEntries = newLgEntries;
+  for (size_t i = 0; i < oldLen; ++i) {
+    if (oldEntries[i].block != FREE_BLOCK) {
+      entries[findSlot(oldEntries[i].key)] = oldEntries[i];
+    }
+  }
+  HllUtil::deallocate(oldEntries);
+}
+
+const int* KeyedHllSketchPvt::getCoupons(const Entry& entry) const {
+  if (isSet(entry)) {
+    const HllSlab& slab = *setSlabs[getLgSetInts(entry.count) - HllUtil::LG_INIT_SET_SIZE];
+    return reinterpret_cast<const int*>(slab.get(entry.block));
+  }
+  return reinterpret_cast<const int*>(couponSlab.get(entry.block));
+}
+
+int KeyedHllSketchPvt::getCouponsLength(const Entry& entry) const {
+  return isSet(entry) ? (1 << getLgSetInts(entry.count)) : entry.count;
+}
+
+HllSlab& KeyedHllSketchPvt::getSlab(const Entry& entry) {
+  if (entry.count == HLL_COUNT) { return registerSlab; }
+  if (isSet(entry)) { return *setSlabs[getLgSetInts(entry.count) - HllUtil::LG_INIT_SET_SIZE]; }
+  return couponSlab;
+}
+
+bool KeyedHllSketchPvt::isSet(const Entry& entry) const {
+  return (entry.count > listCapacity) && (entry.count != HLL_COUNT);
+}
+
+int KeyedHllSketchPvt::getLgSetInts(const uint32_t count) {
+  int lgArrInts = HllUtil::LG_INIT_SET_SIZE;
+  while ((HllUtil::RESIZE_DENOM * count) > ((uint32_t) HllUtil::RESIZE_NUMER << lgArrInts)) {
+    ++lgArrInts;
+  }
+  return lgArrInts;
+}
+
+const uint8_t* KeyedHllSketchPvt::getImage(const Entry& entry) const {
+  return registerSlab.get(entry.block);
+}
+
+double KeyedHllSketchPvt::getEstimate(const uint64_t key) const {
+  const Entry* entry = findEntry(key);
+  return (entry == nullptr) ? 0 : getEstimate(*entry);
+}
+
+double KeyedHllSketchPvt::getLowerBound(const uint64_t key, const int numStdDev) const {
+  const Entry* entry = findEntry(key);
+  return (entry == nullptr) ? 0 : getLowerBound(*entry, numStdDev);
+}
+
+double KeyedHllSketchPvt::getUpperBound(const uint64_t key, const int numStdDev) const {
+  const Entry* entry = findEntry(key);
+  return (entry == nullptr) ? 0 : getUpperBound(*entry, numStdDev);
+}
+
+double KeyedHllSketchPvt::getEstimate(const Entry& entry) const {
+  if (entry.count != HLL_COUNT) { return CouponList::getEstimate(entry.count); }
+  return HllSketchView(getImage(entry), registerSlab.getBlockBytes()).getEstimate();
+}
+
+double KeyedHllSketchPvt::getLowerBound(const Entry& entry, const int numStdDev) const {
+  if (entry.count != HLL_COUNT) { return CouponList::getLowerBound(entry.count, numStdDev); }
+  return HllSketchView(getImage(entry), registerSlab.getBlockBytes()).getLowerBound(numStdDev);
+}
+
+double KeyedHllSketchPvt::getUpperBound(const Entry& entry, const int numStdDev) const {
+  if (entry.count != HLL_COUNT) { return CouponList::getUpperBound(entry.count, numStdDev); }
+  return HllSketchView(getImage(entry), registerSlab.getBlockBytes()).getUpperBound(numStdDev);
+}
+
+HllSketch* KeyedHllSketchPvt::getResult(const uint64_t key, const TgtHllType tgtHllType) const {
+  const Entry* entry = findEntry(key);
+  if ((entry == nullptr) || (entry->count != HLL_COUNT)) {
+    HllSketch* sketch = HllSketch::newInstance(lgConfigK, tgtHllType, resource, hashPolicy);
+    if (entry != nullptr) { sketch->couponUpdate(getCoupons(*entry), getCouponsLength(*entry)); }
+    return sketch;
+  }
+  std::unique_ptr<HllSketch> sketch(HllSketch::deserialize(getImage(*entry), registerSlab.getBlockBytes(),
+                                                           resource, hashPolicy));
+  return (tgtHllType == HLL_8) ? sketch.release() : sketch->copyAs(tgtHllType);
+}
+
+void KeyedHllSketchPvt::forEach(const std::function<void(const uint64_t, const double)>& fn) const {
+  const size_t len = (size_t) 1 << lgEntries;
+  for (size_t i = 0; i < len; ++i) {
+    if (entries[i].block != FREE_BLOCK) { fn(entries[i].key, getEstimate(entries[i])); }
+  }
+}
+
+size_t KeyedHllSketchPvt::getNumKeys() const {
+  return numKeys;
+}
+
+int KeyedHllSketchPvt::getLgConfigK() const {
+  return lgConfigK;
+}
+
+const HashPolicy& KeyedHllSketchPvt::getHashPolicy() const {
+  return hashPolicy;
+}
+
+size_t KeyedHllSketchPvt::getMemoryBytes() const {
+  size_t bytes = (sizeof(Entry) << lgEntries) + couponSlab.getMemoryBytes() + registerSlab.getMemoryBytes();
+  for (const std::unique_ptr<HllSlab>& slab : setSlabs) { bytes += slab->getMemoryBytes(); }
+  return bytes;
+}
+
+void KeyedHllSketchPvt::serialize(std::ostream& os) const {
+  const int32_t lgK = lgConfigK;
+  const int32_t seedHash = hashPolicy.getSeedHash();
+  const uint64_t count = numKeys;
+  os.write((char*) &lgK, sizeof(lgK));
+  os.write((char*) &seedHash, sizeof(seedHash));
+  os.write((char*) &count, sizeof(count));
+
+  // coupon blocks become LIST or SET images through one sketch, reset for
+  // each; register blocks are images already
+  std::unique_ptr<HllSketch> list(HllSketch::newInstance(lgConfigK, HLL_8, resource, hashPolicy));
+  const size_t len = (size_t) 1 << lgEntries;
+  for (size_t i = 0; i < len; ++i) {
+    const Entry& entry = entries[i];
+    if (entry.block == FREE_BLOCK) { continue; }
+    os.write((char*) &entry.key, sizeof(entry.key));
+    if (entry.count == HLL_COUNT) {
+      os.write((char*) getImage(entry), registerSlab.getBlockBytes());
+    } else {
+      list->reset();
+      list->couponUpdate(getCoupons(entry), getCouponsLength(entry));
+      list->serializeCompact(os);
+    }
+  }
+}
+
+void KeyedHllSketchPvt::add(const uint64_t key, const uint8_t* bytes, const int sizeBytes) {
+  const HllSketchView view(bytes, sizeBytes);
+  if (!view.hasHashPolicy(hashPolicy)) {
+    throw std::invalid_argument("Cannot deserialize a sketch written under a different hash policy");
+  }
+  if (view.getLgConfigK() != lgConfigK) {
+    throw std::invalid_argument("Sketch lgConfigK does not match that of the KeyedHllSketch");
+  }
+  reserve(1);
+  Entry& entry = getOrAddEntry(key);
+  if (entry.count != 0) {
+    throw std::invalid_argument("Duplicate key in KeyedHllSketch image");
+  }
+
+  if (view.getCurMode() != HLL) {
+    std::unique_ptr<PairIterator> itr = view.getIterator();
+    while (itr->nextValid()) { couponUpdate(entry, itr->getPair()); }
+    return;
+  }
+
+  // an HLL_8 array is copied as it is, others are converted first
+  const uint32_t block = registerSlab.allocate();
+  uint8_t* mem = registerSlab.get(block);
+  couponSlab.release(entry.block);
+  entry.block = block;
+  entry.count = HLL_COUNT;
+  if ((view.getTgtHllType() == HLL_8) && !view.isCompressed()) {
+    std::memcpy(mem, bytes, registerSlab.getBlockBytes());
+    mem[5] &= ~HllUtil::COMPACT_FLAG_MASK;
+  } else {
+    std::unique_ptr<HllSketch> sketch(HllSketch::deserialize(bytes, sizeBytes, resource, hashPolicy));
+    std::unique_ptr<HllSketch> hll8(sketch->copyAs(HLL_8));
+    hll8->serializeUpdatable(mem, registerSlab.getBlockBytes());
+  }
+}
+
+void KeyedHllSketchPvt::reset() {
+  std::fill(entries, entries + ((size_t) 1 << lgEntries), Entry{0, FREE_BLOCK, 0});
+  numKeys = 0;
+  couponSlab.clear();
+  for (const std::unique_ptr<HllSlab>& slab : setSlabs) { slab->clear(); }
+  registerSlab.clear();
+}
+
+}
@@ -0,0 +1,78 @@
+/*
+ * Copyright 2018, Yahoo! Inc. Licensed under the terms of the
+ * Apache License 2.0. See LICENSE file at the project root for terms.
+ */
+
+#include "WrappedHllSketch.hpp"
+#include "HllSketchView.hpp"
+#include "HllUtil.hpp"
+
+#include <cstdint>
+
+namespace datasketches {
+
+static HllSketchImpl* checkAndDeserialize(const void* mem, const size_t capBytes) {
+  if ((reinterpret_cast<uintptr_t>(mem) & 0x3) != 0) {
+    throw std::invalid_argument("Memory to wrap must be 4-byte aligned");
+  }
+  const HllSketchView view(mem, capBytes);
+  if (view.isCompact()) {
+    throw std::invalid_argument("Cannot wrap a compact image");
+  }
+  if (view.getHashTag() != 0) {
+    throw std::invalid_argument("Only sketches of the default hash policy can be wrapped");
+  }
+  return HllSketchImpl::deserialize(mem, capBytes, std::pmr::get_default_resource());
+}
+
+WrappedHllSketch::WrappedHllSketch(void* mem, const size_t capBytes,
+                                   void* (*reallocate)(void* mem, size_t sizeBytes))
+  : HllSketchPvt(checkAndDeserialize(mem, capBytes)),
+    mem(static_cast<uint8_t*>(mem)),
+    capBytes(capBytes),
+    reallocate(reallocate) {
+  // the image may have been written with a different table size than the
+  // one we deserialized into, so lay it out afresh
+  bindMemory();
+}
+
+WrappedHllSketch::~WrappedHllSketch() {
+  // the implementation does not own arrays in mem, so the image stays behind
+}
+
+void WrappedHllSketch::bindMemory() {
+  const size_t sizeBytes = hllSketchImpl->getUpdatableSerializationBytes();
+  if (sizeBytes > capBytes) {
+    void* grown = (reallocate == nullptr) ? nullptr : reallocate(mem, sizeBytes);
+    if (grown == nullptr) {
+      HllUtil::checkMemSize(sizeBytes, capBytes);
+    }
+    if ((reinterpret_cast<uintptr_t>(grown) & 0x3) != 0) {
+      throw std::invalid_argument("Reallocated memory must be 4-byte aligned");
+    }
+    mem = static_cast<uint8_t*>(grown);
+    capBytes = sizeBytes;
+  }
+  hllSketchImpl->wrapMemory(mem);
+}
+
+void WrappedHllSketch::reset() {
+  HllSketchPvt::reset();
+  syncMemory();
+}
+
+void WrappedHllSketch::couponUpdate(const int coupon) {
+  HllSketchPvt::couponUpdate(coupon);
+  syncMemory();
+}
+
+void WrappedHllSketch::couponUpdate(const int* coupons, const size_t n) {
+  HllSketchPvt::couponUpdate(coupons, n);
+  syncMemory();
+}
+
+void* WrappedHllSketch::getMemory() const {
+  return mem;
+}
+
+}
@@ -7,6 +7,7 @@
 #include "CouponList.hpp"
 #include "CouponHashSet.hpp"
 #include "HllArray.hpp"
+#include "Hll4Array.hpp"
 
 #include "HllSketch.hpp"
 #include "HllUnion.hpp"
@@ -27,10 +28,12 @@ class AuxHashMapTest : public CppUnit::TestFixture {
   CPPUNIT_TEST(checkGrowSpace);
   CPPUNIT_TEST(checkExceptionMustFindValueFor);
   CPPUNIT_TEST(checkExceptionMustAdd);
+  CPPUNIT_TEST(checkFindAcrossTableSizes);
+  CPPUNIT_TEST(checkHll4IteratorExceptions);
   CPPUNIT_TEST_SUITE_END();
 
   void checkMustReplace() {
-    AuxHashMap* map = new AuxHashMap(3, 7);
+    AuxHashMap* map = new (std::pmr::get_default_resource()) AuxHashMap(3, 7);
     map->mustAdd(100, 5);
     int val = map->mustFindValueFor(100);
     CPPUNIT_ASSERT_EQUAL(val, 5);
@@ -50,7 +53,7 @@ class AuxHashMapTest : public CppUnit::TestFixture {
   }
 
   void checkGrowSpace() {
-    AuxHashMap* map = new AuxHashMap(3, 7);
+    AuxHashMap* map = new (std::pmr::get_default_resource()) AuxHashMap(3, 7);
     CPPUNIT_ASSERT_EQUAL(map->getLgAuxArrInts(), 3);
     for (int i = 1; i <= 7; ++i) {
       map->mustAdd(i, i);
@@ -71,7 +74,7 @@ class AuxHashMapTest : public CppUnit::TestFixture {
   }
 
   void checkExceptionMustFindValueFor() {
-    AuxHashMap* map = new AuxHashMap(3, 7);
+    AuxHashMap* map = new (std::pmr::get_default_resource()) AuxHashMap(3, 7);
     try {
       map->mustAdd(100, 5);
       map->mustFindValueFor(101);
@@ -83,7 +86,7 @@ class AuxHashMapTest : public CppUnit::TestFixture {
   }
 
   void checkExceptionMustAdd() {
-    AuxHashMap* map = new AuxHashMap(3, 7);
+    AuxHashMap* map = new (std::pmr::get_default_resource()) AuxHashMap(3, 7);
     try {
       map->mustAdd(100, 5);
       map->mustAdd(100, 6);
@@ -94,6 +97,56 @@ class AuxHashMapTest : public CppUnit::TestFixture {
     delete map;
   }
 
+  void checkFindAcrossTableSizes() {
+    // small tables are scanned, larger ones probed
+    AuxHashMap* map = new (std::pmr::get_default_resource()) AuxHashMap(2, 10);
+    try {
+      map->mustFindValueFor(0); // must not match an empty entry
+      CPPUNIT_FAIL("map->mustFindValueFor() should fail");
+    } catch (std::exception& e) {
+      // expected
+    }
+    for (int i = 0; i < 200; ++i) {
+      map->mustAdd(i * 5, 15 + (i % 40));
+      for (int j = 0; j <= i; ++j) {
+        CPPUNIT_ASSERT_EQUAL(15 + (j % 40), map->mustFindValueFor(j * 5));
+      }
+    }
+    map->mustReplace(0, 50);
+    CPPUNIT_ASSERT_EQUAL(50, map->mustFindValueFor(0));
+    delete map;
+  }
+
+  void checkHll4IteratorExceptions() {
+    // below and above the number of exceptions the iterator keeps inline
+    const int counts[] = {1, 10, 40};
+    for (const int count : counts) {
+      const int lgK = 8;
+      std::pmr::memory_resource* resource = std::pmr::get_default_resource();
+      Hll4Array* arr = new (resource) Hll4Array(lgK, resource);
+      for (int i = 0; i < count; ++i) {
+        arr->couponUpdate(HllUtil::pair((i * 37) & ((1 << lgK) - 1), 20 + (i % 7)));
+      }
+      CPPUNIT_ASSERT_EQUAL(count, arr->getAuxHashMap()->getAuxCount());
+      std::unique_ptr<PairIterator> itr = arr->getIterator();
+      int numValid = 0;
+      while (itr->nextValid()) {
+        CPPUNIT_ASSERT_EQUAL(arr->getAuxHashMap()->mustFindValueFor(itr->getSlot()), itr->getValue());
+        ++numValid;
+      }
+      CPPUNIT_ASSERT_EQUAL(count, numValid);
+      // and the in-place pairs are the map's
+      IntArrayPairIterator pairs = arr->getAuxHashMap()->getPairs();
+      numValid = 0;
+      while (pairs.nextValid()) {
+        CPPUNIT_ASSERT_EQUAL(arr->getAuxHashMap()->mustFindValueFor(pairs.getSlot()), pairs.getValue());
+        ++numValid;
+      }
+      CPPUNIT_ASSERT_EQUAL(count, numValid);
+      delete arr;
+    }
+  }
+
 };
 
 CPPUNIT_TEST_SUITE_REGISTRATION(AuxHashMapTest);
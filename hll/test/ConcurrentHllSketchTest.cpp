@@ -0,0 +1,135 @@
+/*
+ * Copyright 2018, Oath Inc. Licensed under the terms of the
+ * Apache License 2.0. See LICENSE file at the project root for terms.
+ */
+
+#include "hll.hpp"
+#include "HllSketch.hpp"
+#include "HllUtil.hpp"
+#include "HllTestUtil.hpp"
+
+#include <memory>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include <cppunit/TestFixture.h>
+#include <cppunit/extensions/HelperMacros.h>
+
+namespace datasketches {
+
+class ConcurrentHllSketchTest : public CppUnit::TestFixture {
+
+  CPPUNIT_TEST_SUITE(ConcurrentHllSketchTest);
+  CPPUNIT_TEST(checkMatchesSequential);
+  CPPUNIT_TEST(checkConcurrentUpdates);
+  CPPUNIT_TEST(checkResultTypes);
+  CPPUNIT_TEST(checkLargeBatchUpdate);
+  CPPUNIT_TEST_SUITE_END();
+
+  void checkMatchesSequential() {
+    const int nArr[] = {0, 1, 100, 10000, 100000};
+    for (int n : nArr) {
+      ConcurrentHllSketch* csk = ConcurrentHllSketch::newInstance(11);
+      HllSketch* sk = HllSketch::newInstance(11, HLL_8);
+      for (int i = 0; i < n; ++i) {
+        if (i & 1) {
+          csk->update((uint64_t) i);
+          sk->update((uint64_t) i);
+        } else {
+          csk->update(std::to_string(i));
+          sk->update(std::to_string(i));
+        }
+      }
+      CPPUNIT_ASSERT_EQUAL(n == 0, csk->isEmpty());
+
+      HllSketch* result = csk->getResult();
+      CPPUNIT_ASSERT_EQUAL(n == 0, result->isEmpty());
+      if (n > 0) {
+        // the concurrent sketch is always out of order, and in HLL mode even
+        // where the sequential sketch still counts coupons exactly
+        const double tol = (n >= 10000) ? 0.0 : n * 0.01;
+        CPPUNIT_ASSERT_DOUBLES_EQUAL(sk->getCompositeEstimate(), csk->getEstimate(), tol);
+        CPPUNIT_ASSERT_DOUBLES_EQUAL(result->getEstimate(), csk->getEstimate(), 0.0);
+        CPPUNIT_ASSERT_DOUBLES_EQUAL(result->getLowerBound(2), csk->getLowerBound(2), 0.0);
+        CPPUNIT_ASSERT_DOUBLES_EQUAL(result->getUpperBound(2), csk->getUpperBound(2), 0.0);
+        HllSketch* hll = sk->copyAs(HLL_8);
+        if (n >= 10000) { checkSameRegisters(hll, result); }
+        delete hll;
+      }
+      delete result;
+
+      csk->reset();
+      CPPUNIT_ASSERT(csk->isEmpty());
+      delete csk;
+      delete sk;
+    }
+  }
+
+  void checkLargeBatchUpdate() {
+    // big enough that batches prefetch the registers
+    const int lgK = 18;
+    const int n = 100000;
+    std::vector<uint64_t> keys(n);
+    for (int i = 0; i < n; ++i) { keys[i] = i; }
+    ConcurrentHllSketch* csk = ConcurrentHllSketch::newInstance(lgK);
+    csk->updateBatch(keys.data(), 1000);
+    csk->updateBatch(keys.data() + 1000, n - 1000);
+    HllSketch* sk = HllSketch::newInstance(lgK, HLL_8);
+    for (int i = 0; i < n; ++i) { sk->update(keys[i]); }
+    HllSketch* result = csk->getResult();
+    checkSameRegisters(sk, result);
+    delete result;
+    delete sk;
+    delete csk;
+  }
+
+  void checkConcurrentUpdates() {
+    const int numThreads = 8;
+    const int perThread = 50000;
+    ConcurrentHllSketch* csk = ConcurrentHllSketch::newInstance(12);
+    std::vector<std::thread> threads;
+    for (int t = 0; t < numThreads; ++t) {
+      threads.emplace_back([csk, t]() {
+        // overlapping ranges, so threads race on the same registers
+        const uint64_t start = (uint64_t) t * perThread / 2;
+        std::vector<uint64_t> keys(perThread / 2);
+        for (int i = 0; i < perThread / 2; ++i) { keys[i] = start + i; }
+        csk->updateBatch(keys.data(), keys.size());
+        for (int i = perThread / 2; i < perThread; ++i) { csk->update(start + i); }
+      });
+    }
+    for (std::thread& thread : threads) { thread.join(); }
+
+    HllSketch* sk = HllSketch::newInstance(12, HLL_8);
+    const uint64_t total = (uint64_t) (numThreads + 1) * perThread / 2;
+    for (uint64_t i = 0; i < total; ++i) { sk->update(i); }
+
+    HllSketch* result = csk->getResult();
+    checkSameRegisters(sk, result);
+    CPPUNIT_ASSERT_DOUBLES_EQUAL(sk->getCompositeEstimate(), csk->getEstimate(), 0.0);
+    delete result;
+    delete sk;
+    delete csk;
+  }
+
+  void checkResultTypes() {
+    ConcurrentHllSketch* csk = ConcurrentHllSketch::newInstance(10);
+    for (int i = 0; i < 20000; ++i) { csk->update(i); }
+    csk->couponUpdate(HllUtil::pair(5, 40));
+    TgtHllType types[] = { HLL_4, HLL_6, HLL_8 };
+    for (TgtHllType type : types) {
+      HllSketch* result = csk->getResult(type);
+      CPPUNIT_ASSERT_EQUAL(type, result->getTgtHllType());
+      CPPUNIT_ASSERT_DOUBLES_EQUAL(csk->getEstimate(), result->getEstimate(), 0.0);
+      delete result;
+    }
+    CPPUNIT_ASSERT_THROW(csk->couponUpdate(HllUtil::pair(5, 0) | 1), std::invalid_argument);
+    delete csk;
+  }
+
+};
+
+CPPUNIT_TEST_SUITE_REGISTRATION(ConcurrentHllSketchTest);
+
+} /* namespace datasketches */
@@ -0,0 +1,187 @@
+/*
+ * Copyright 2018, Yahoo! Inc. Licensed under the terms of the
+ * Apache License 2.0. See LICENSE file at the project root for terms.
+ */
+
+#include "hll.hpp"
+#include "HllSketch.hpp"
+#include "HllSketchImpl.hpp"
+#include "HllSketchView.hpp"
+#include "HllUtil.hpp"
+
+#include <cppunit/TestFixture.h>
+#include <cppunit/extensions/HelperMacros.h>
+#include <algorithm>
+#include <sstream>
+#include <vector>
+
+namespace datasketches {
+
+class CouponSparseTest : public CppUnit::TestFixture {
+
+  CPPUNIT_TEST_SUITE(CouponSparseTest);
+  CPPUNIT_TEST(checkMatchesCouponModes);
+  CPPUNIT_TEST(checkDuplicates);
+  CPPUNIT_TEST(checkSerialization);
+  CPPUNIT_TEST(checkCopyResetAndUnion);
+  CPPUNIT_TEST(checkLargeFill);
+  CPPUNIT_TEST_SUITE_END();
+
+  static std::vector<int> sortedCoupons(const HllSketch* sk) {
+    std::vector<int> coupons;
+    std::unique_ptr<PairIterator> itr = static_cast<const HllSketchPvt*>(sk)->getIterator();
+    while (itr->nextValid()) { coupons.push_back(itr->getPair()); }
+    std::sort(coupons.begin(), coupons.end());
+    return coupons;
+  }
+
+  static std::string image(const HllSketch* sk, const bool compact) {
+    std::stringstream ss(std::ios::in | std::ios::out | std::ios::binary);
+    if (compact) { sk->serializeCompact(ss); } else { sk->serializeUpdatable(ss); }
+    return ss.str();
+  }
+
+  void checkMatchesCouponModes() {
+    const int lgKs[] = {4, 7, 8, 12, 14};
+    const TgtHllType types[] = {HLL_4, HLL_6, HLL_8};
+    for (const int lgK : lgKs) {
+      for (const TgtHllType type : types) {
+        HllSketch* sparse = HllSketch::newSparseInstance(lgK, type);
+        HllSketch* ref = HllSketch::newInstance(lgK, type);
+        const int n = 4 << lgK;
+        for (int i = 0; i < n; ++i) {
+          sparse->update(i);
+          ref->update(i);
+          const bool refIsHll = static_cast<HllSketchPvt*>(ref)->getCurrentMode() == CurMode::HLL;
+          const bool sparseIsHll = static_cast<HllSketchPvt*>(sparse)->getCurrentMode() == CurMode::HLL;
+          // promoted at the same coupon count, after which both are the same HLL
+          CPPUNIT_ASSERT_EQUAL(refIsHll, sparseIsHll);
+          if (refIsHll) { continue; }
+          CPPUNIT_ASSERT_DOUBLES_EQUAL(ref->getEstimate(), sparse->getEstimate(), 0.0);
+          if ((i % 37) == 0) { CPPUNIT_ASSERT(sortedCoupons(ref) == sortedCoupons(sparse)); }
+        }
+        CPPUNIT_ASSERT(image(ref, false) == image(sparse, false));
+        CPPUNIT_ASSERT_DOUBLES_EQUAL(ref->getEstimate(), sparse->getEstimate(), 0.0);
+        delete sparse;
+        delete ref;
+      }
+    }
+  }
+
+  void checkDuplicates() {
+    const int lgK = 12;
+    HllSketch* sk = HllSketch::newSparseInstance(lgK);
+    HllSketchPvt* pvt = static_cast<HllSketchPvt*>(sk);
+    // the same slot with different values counts once for each value
+    for (int round = 0; round < 3; ++round) {
+      for (int value = 1; value < 64; value += 7) {
+        for (int slot = 0; slot < 30; ++slot) {
+          pvt->couponUpdate(HllUtil::pair(slot * 1000003, value));
+        }
+      }
+    }
+    CPPUNIT_ASSERT(pvt->hllSketchImpl->isSparse());
+    const std::vector<int> coupons = sortedCoupons(sk);
+    CPPUNIT_ASSERT_EQUAL((size_t) 270, coupons.size());
+    CPPUNIT_ASSERT(std::adjacent_find(coupons.begin(), coupons.end()) == coupons.end());
+    delete sk;
+  }
+
+  void checkSerialization() {
+    const int lgK = 13;
+    const int sizes[] = {0, 1, 7, 8, 15, 16, 17, 100, 500};
+    for (const int n : sizes) {
+      HllSketch* sparse = HllSketch::newSparseInstance(lgK, HLL_6);
+      HllSketch* ref = HllSketch::newInstance(lgK, HLL_6);
+      for (int i = 0; i < n; ++i) { sparse->update(i); ref->update(i); }
+      CPPUNIT_ASSERT_EQUAL(ref->getCompactSerializationBytes(), sparse->getCompactSerializationBytes());
+      CPPUNIT_ASSERT_EQUAL(ref->getUpdatableSerializationBytes(), sparse->getUpdatableSerializationBytes());
+      for (const bool compact : {true, false}) {
+        const std::string bytes = image(sparse, compact);
+        CPPUNIT_ASSERT_EQUAL(compact ? sparse->getCompactSerializationBytes()
+                                     : sparse->getUpdatableSerializationBytes(), (int) bytes.size());
+        const HllSketchView view(bytes.data(), bytes.size());
+        CPPUNIT_ASSERT_EQUAL(static_cast<HllSketchPvt*>(ref)->getCurrentMode(), view.getCurMode());
+        CPPUNIT_ASSERT_DOUBLES_EQUAL(ref->getEstimate(), view.getEstimate(), 0.0);
+
+        std::stringstream ss(bytes, std::ios::in | std::ios::binary);
+        HllSketch* restored = HllSketch::deserialize(ss);
+        CPPUNIT_ASSERT(sortedCoupons(ref) == sortedCoupons(restored));
+        CPPUNIT_ASSERT_DOUBLES_EQUAL(ref->getEstimate(), restored->getEstimate(), 0.0);
+        delete restored;
+      }
+      delete sparse;
+      delete ref;
+    }
+  }
+
+  void checkCopyResetAndUnion() {
+    const int lgK = 11;
+    HllSketch* sparse = HllSketch::newSparseInstance(lgK, HLL_4);
+    HllSketch* ref = HllSketch::newInstance(lgK, HLL_4);
+    for (int i = 0; i < 100; ++i) { sparse->update(i); ref->update(i); }
+
+    HllSketch* copy = sparse->copyAs(HLL_8);
+    CPPUNIT_ASSERT(static_cast<HllSketchPvt*>(copy)->hllSketchImpl->isSparse());
+    CPPUNIT_ASSERT_EQUAL(HLL_8, copy->getTgtHllType());
+    CPPUNIT_ASSERT(sortedCoupons(ref) == sortedCoupons(copy));
+
+    // a sparse source unions like any other
+    HllUnion* u1 = HllUnion::newInstance(lgK);
+    HllUnion* u2 = HllUnion::newInstance(lgK);
+    HllSketch* other = HllSketch::newInstance(lgK);
+    for (int i = 50; i < 150; ++i) { other->update(i); }
+    u1->update(sparse);
+    u1->update(other);
+    u2->update(ref);
+    u2->update(other);
+    CPPUNIT_ASSERT_DOUBLES_EQUAL(u2->getEstimate(), u1->getEstimate(), 0.0);
+
+    // resets stay sparse, also from HLL mode
+    for (int i = 0; i < 10000; ++i) { sparse->update(i); }
+    CPPUNIT_ASSERT_EQUAL(CurMode::HLL, static_cast<HllSketchPvt*>(sparse)->getCurrentMode());
+    sparse->reset();
+    CPPUNIT_ASSERT(sparse->isEmpty());
+    CPPUNIT_ASSERT(static_cast<HllSketchPvt*>(sparse)->hllSketchImpl->isSparse());
+    copy->reset();
+    CPPUNIT_ASSERT(copy->isEmpty());
+    for (int i = 0; i < 100; ++i) { sparse->update(i); }
+    CPPUNIT_ASSERT(sortedCoupons(ref) == sortedCoupons(sparse));
+
+    delete other;
+    delete u2;
+    delete u1;
+    delete copy;
+    delete ref;
+    delete sparse;
+  }
+
+  void checkLargeFill() {
+    // some 200k coupons before promotion, which takes minutes if every
+    // merge of a fixed size buffer re-encodes the stream
+    const int lgK = 21;
+    HllSketch* sparse = HllSketch::newSparseInstance(lgK, HLL_4);
+    HllSketch* ref = HllSketch::newInstance(lgK, HLL_4);
+    HllSketchPvt* pvt = static_cast<HllSketchPvt*>(sparse);
+    int n = 0;
+    while (pvt->getCurrentMode() != CurMode::HLL) {
+      sparse->update(n);
+      ref->update(n);
+      ++n;
+      if ((n % 50000) == 0) {
+        CPPUNIT_ASSERT(pvt->hllSketchImpl->isSparse());
+        CPPUNIT_ASSERT_DOUBLES_EQUAL(ref->getEstimate(), sparse->getEstimate(), 0.0);
+      }
+    }
+    CPPUNIT_ASSERT(n > 150000);
+    CPPUNIT_ASSERT_EQUAL(CurMode::HLL, static_cast<HllSketchPvt*>(ref)->getCurrentMode());
+    CPPUNIT_ASSERT(image(ref, true) == image(sparse, true));
+    delete ref;
+    delete sparse;
+  }
+
+};
+
+CPPUNIT_TEST_SUITE_REGISTRATION(CouponSparseTest);
+
+} /* namespace datasketches */
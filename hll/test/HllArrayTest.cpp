@@ -16,6 +16,8 @@ class HllArrayTest : public CppUnit::TestFixture {
   CPPUNIT_TEST_SUITE(HllArrayTest);
   CPPUNIT_TEST(checkCompositeEstimate);
   CPPUNIT_TEST(checkIsCompact);
+  CPPUNIT_TEST(checkShiftToBiggerCurMin);
+  CPPUNIT_TEST(checkHll6BulkPackUnpack);
   CPPUNIT_TEST_SUITE_END();
 
   void testComposite(const int lgK, const TgtHllType tgtHllType, const int n) {
@@ -101,6 +103,58 @@ class HllArrayTest : public CppUnit::TestFixture {
     delete sk;
   }
 
+  void checkShiftToBiggerCurMin() {
+    // enough updates that HLL_4 raises curMin several times and keeps exceptions
+    const int lgKs[] = {4, 7, 10};
+    for (const int lgK : lgKs) {
+      HllSketch* sk4 = HllSketch::newInstance(lgK, HLL_4);
+      HllSketch* sk8 = HllSketch::newInstance(lgK, HLL_8);
+      const int n = 200 << lgK;
+      for (int i = 0; i < n; ++i) {
+        sk4->update(i);
+        sk8->update(i);
+      }
+      std::unique_ptr<PairIterator> itr4 = static_cast<HllSketchPvt*>(sk4)->getIterator();
+      std::unique_ptr<PairIterator> itr8 = static_cast<HllSketchPvt*>(sk8)->getIterator();
+      while (itr8->nextAll()) {
+        CPPUNIT_ASSERT(itr4->nextAll());
+        CPPUNIT_ASSERT_EQUAL(itr8->getPair(), itr4->getPair());
+      }
+      CPPUNIT_ASSERT(!itr4->nextAll());
+      CPPUNIT_ASSERT_DOUBLES_EQUAL(sk8->getEstimate(), sk4->getEstimate(), 0.0);
+      delete sk4;
+      delete sk8;
+    }
+  }
+
+  void checkHll6BulkPackUnpack() {
+    // iterating HLL_6 unpacks whole blocks; converting from HLL_8 packs them
+    const int lgKs[] = {4, 5, 9, 12};
+    for (const int lgK : lgKs) {
+      HllSketch* sk6 = HllSketch::newInstance(lgK, HLL_6);
+      HllSketch* sk8 = HllSketch::newInstance(lgK, HLL_8);
+      const int n = 50 << lgK;
+      for (int i = 0; i < n; ++i) {
+        sk6->update(i);
+        sk8->update(i);
+      }
+      HllSketch* sk8to6 = sk8->copyAs(HLL_6);
+      std::unique_ptr<PairIterator> itr6 = static_cast<HllSketchPvt*>(sk6)->getIterator();
+      std::unique_ptr<PairIterator> itr8 = static_cast<HllSketchPvt*>(sk8)->getIterator();
+      std::unique_ptr<PairIterator> itr8to6 = static_cast<HllSketchPvt*>(sk8to6)->getIterator();
+      while (itr8->nextAll()) {
+        CPPUNIT_ASSERT(itr6->nextAll());
+        CPPUNIT_ASSERT(itr8to6->nextAll());
+        CPPUNIT_ASSERT_EQUAL(itr8->getPair(), itr6->getPair());
+        CPPUNIT_ASSERT_EQUAL(itr8->getPair(), itr8to6->getPair());
+      }
+      CPPUNIT_ASSERT(!itr6->nextAll());
+      delete sk6;
+      delete sk8;
+      delete sk8to6;
+    }
+  }
+
 };
 
 CPPUNIT_TEST_SUITE_REGISTRATION(HllArrayTest);
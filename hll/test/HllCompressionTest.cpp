@@ -0,0 +1,198 @@
+/*
+ * Copyright 2018, Yahoo! Inc. Licensed under the terms of the
+ * Apache License 2.0. See LICENSE file at the project root for terms.
+ */
+
+#include "hll.hpp"
+#include "HllCompression.hpp"
+#include "HllSketchView.hpp"
+#include "HllUtil.hpp"
+
+#include <cppunit/TestFixture.h>
+#include <cppunit/extensions/HelperMacros.h>
+#include <cstring>
+#include <sstream>
+#include <stdexcept>
+#include <string>
+#include <vector>
+
+namespace datasketches {
+
+class HllCompressionTest : public CppUnit::TestFixture {
+
+  CPPUNIT_TEST_SUITE(HllCompressionTest);
+  CPPUNIT_TEST(checkRoundTrip);
+  CPPUNIT_TEST(checkView);
+  CPPUNIT_TEST(checkUnion);
+  CPPUNIT_TEST(checkCouponModesAndSmallK);
+  CPPUNIT_TEST(checkCorruptInput);
+  CPPUNIT_TEST_SUITE_END();
+
+  static std::string compressed(const HllSketch* sk) {
+    std::stringstream ss(std::ios::in | std::ios::out | std::ios::binary);
+    sk->serializeCompressed(ss);
+    return ss.str();
+  }
+
+  static std::string compact(const HllSketch* sk) {
+    std::stringstream ss(std::ios::in | std::ios::out | std::ios::binary);
+    sk->serializeCompact(ss);
+    return ss.str();
+  }
+
+  static std::vector<int> registers(const HllSketchView& view) {
+    std::vector<int> values;
+    std::unique_ptr<PairIterator> itr = view.getIterator();
+    while (itr->nextAll()) { values.push_back(itr->getValue()); }
+    return values;
+  }
+
+  static HllSketch* newSketch(const int lgK, const TgtHllType type, const int n) {
+    HllSketch* sk = HllSketch::newInstance(lgK, type);
+    for (int i = 0; i < n; ++i) { sk->update(i); }
+    // forces an HLL_4 exception
+    sk->couponUpdate(HllUtil::pair(7, 45));
+    return sk;
+  }
+
+  void checkRoundTrip() {
+    const int lgKs[] = {8, 11, 14};
+    const TgtHllType types[] = {HLL_4, HLL_6, HLL_8};
+    for (const int lgK : lgKs) {
+      for (const TgtHllType type : types) {
+        for (const int n : {1 << lgK, 20 << lgK}) {
+          HllSketch* sk = newSketch(lgK, type, n);
+          const std::string bytes = compressed(sk);
+          CPPUNIT_ASSERT_EQUAL(sk->getCompressedSerializationBytes(), (int) bytes.size());
+          CPPUNIT_ASSERT(bytes.size() < compact(sk).size());
+          CPPUNIT_ASSERT(bytes[5] & HllUtil::COMPRESSED_FLAG_MASK);
+
+          std::pair<ptr_with_deleter, const size_t> withHeader = sk->serializeCompressed(3);
+          CPPUNIT_ASSERT_EQUAL(bytes.size() + 3, withHeader.second);
+          CPPUNIT_ASSERT(bytes == std::string(static_cast<char*>(withHeader.first.get()) + 3, bytes.size()));
+
+          // both deserialize paths give back the compact image, bit for bit
+          std::stringstream ss(bytes, std::ios::in | std::ios::binary);
+          HllSketch* fromStream = HllSketch::deserialize(ss);
+          HllSketch* fromBytes = HllSketch::deserialize(bytes.data(), bytes.size());
+          CPPUNIT_ASSERT(compact(sk) == compact(fromStream));
+          CPPUNIT_ASSERT(compact(sk) == compact(fromBytes));
+          CPPUNIT_ASSERT(bytes == compressed(fromBytes));
+          delete fromBytes;
+          delete fromStream;
+          delete sk;
+        }
+      }
+    }
+  }
+
+  void checkView() {
+    const TgtHllType types[] = {HLL_4, HLL_6, HLL_8};
+    for (const TgtHllType type : types) {
+      HllSketch* sk = newSketch(10, type, 50000);
+      const std::string bytes = compressed(sk);
+      const std::string plain = compact(sk);
+      const HllSketchView view(bytes.data(), bytes.size());
+      const HllSketchView plainView(plain.data(), plain.size());
+      CPPUNIT_ASSERT(view.isCompressed());
+      CPPUNIT_ASSERT(!plainView.isCompressed());
+      CPPUNIT_ASSERT_EQUAL((int) bytes.size(), view.getSerializationBytes());
+      CPPUNIT_ASSERT_DOUBLES_EQUAL(sk->getEstimate(), view.getEstimate(), 0.0);
+      CPPUNIT_ASSERT_DOUBLES_EQUAL(sk->getLowerBound(2), view.getLowerBound(2), 0.0);
+      CPPUNIT_ASSERT(registers(plainView) == registers(view));
+      delete sk;
+    }
+  }
+
+  void checkUnion() {
+    // the same lgK decodes into the gadget, a larger one goes through the
+    // iterator and a smaller one is deserialized to downsample the gadget
+    const int lgKs[] = {12, 12, 12, 13, 11};
+    HllUnion* fromSketches = HllUnion::newInstance(12);
+    HllUnion* fromViews = HllUnion::newInstance(12);
+    for (int i = 0; i < 5; ++i) {
+      HllSketch* sk = newSketch(lgKs[i], (TgtHllType) (i % 3), 30000 * (i + 1));
+      const std::string bytes = compressed(sk);
+      fromSketches->update(sk);
+      fromViews->update(HllSketchView(bytes.data(), bytes.size()));
+      CPPUNIT_ASSERT_DOUBLES_EQUAL(fromSketches->getEstimate(), fromViews->getEstimate(), 0.0);
+      delete sk;
+    }
+    CPPUNIT_ASSERT_EQUAL(11, fromViews->getLgConfigK());
+
+    // and the union's own image compresses
+    HllSketch* result = fromViews->getResult(HLL_8);
+    const std::string bytes = compressed(result);
+    delete result;
+    HllUnion* restored = HllUnion::deserialize(bytes.data(), bytes.size());
+    CPPUNIT_ASSERT_DOUBLES_EQUAL(fromViews->getCompositeEstimate(), restored->getCompositeEstimate(), 0.0);
+    CPPUNIT_ASSERT(fromViews->getCompressedSerializationBytes() < fromViews->getCompactSerializationBytes());
+    delete restored;
+    delete fromViews;
+    delete fromSketches;
+  }
+
+  void checkCouponModesAndSmallK() {
+    // LIST, SET and registers too few to code write the compact image
+    const int lgKs[] = {12, 12, 4};
+    const int nArr[] = {5, 200, 1000};
+    const TgtHllType types[] = {HLL_8, HLL_8, HLL_4};
+    for (int i = 0; i < 3; ++i) {
+      HllSketch* sk = HllSketch::newInstance(lgKs[i], types[i]);
+      for (int j = 0; j < nArr[i]; ++j) { sk->update(j); }
+      CPPUNIT_ASSERT(compact(sk) == compressed(sk));
+      CPPUNIT_ASSERT_EQUAL(sk->getCompactSerializationBytes(), sk->getCompressedSerializationBytes());
+      delete sk;
+    }
+  }
+
+  void checkCorruptInput() {
+    HllSketch* sk = newSketch(10, HLL_4, 20000);
+    const std::string bytes = compressed(sk);
+    delete sk;
+
+    // a truncated image
+    CPPUNIT_ASSERT_THROW(HllSketchView(bytes.data(), bytes.size() - 8), std::invalid_argument);
+
+    // a coded length beyond the register array
+    std::string badLength = bytes;
+    const int huge = 1 << 20;
+    badLength.replace(HllUtil::HLL_BYTE_ARR_START, sizeof(huge), (const char*) &huge, sizeof(huge));
+    CPPUNIT_ASSERT_THROW(HllSketch::deserialize(badLength.data(), badLength.size()), std::invalid_argument);
+    std::stringstream ss(badLength, std::ios::in | std::ios::binary);
+    CPPUNIT_ASSERT_THROW(HllSketch::deserialize(ss), std::invalid_argument);
+
+    // a coded length that would leave the aux pairs unaligned
+    std::string oddLength = bytes;
+    int codedBytes;
+    std::memcpy(&codedBytes, bytes.data() + HllUtil::HLL_BYTE_ARR_START, sizeof(codedBytes));
+    --codedBytes;
+    oddLength.replace(HllUtil::HLL_BYTE_ARR_START, sizeof(codedBytes), (const char*) &codedBytes, sizeof(codedBytes));
+    CPPUNIT_ASSERT_THROW(HllSketchView(oddLength.data(), oddLength.size()), std::invalid_argument);
+
+    // symbols beyond the 16 nibble values of HLL_4
+    std::string badTable = bytes;
+    badTable[HllCompression::CODED_START] = 15;
+    CPPUNIT_ASSERT_THROW(HllSketch::deserialize(badTable.data(), badTable.size()), std::invalid_argument);
+
+    // code lengths no prefix code can have
+    std::string badCodes = bytes;
+    for (int i = HllCompression::CODED_START + 2; i < HllCompression::CODED_START + 10; ++i) {
+      badCodes[i] = 0x11;
+    }
+    CPPUNIT_ASSERT_THROW(HllSketch::deserialize(badCodes.data(), badCodes.size()), std::invalid_argument);
+
+    // the flag on a coupon mode image
+    HllSketch* list = HllSketch::newInstance(10);
+    list->update(1);
+    std::string badMode = compact(list);
+    badMode[5] |= HllUtil::COMPRESSED_FLAG_MASK;
+    CPPUNIT_ASSERT_THROW(HllSketchView(badMode.data(), badMode.size()), std::invalid_argument);
+    delete list;
+  }
+
+};
+
+CPPUNIT_TEST_SUITE_REGISTRATION(HllCompressionTest);
+
+} /* namespace datasketches */
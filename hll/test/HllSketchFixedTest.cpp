@@ -0,0 +1,212 @@
+/*
+ * Copyright 2018, Yahoo! Inc. Licensed under the terms of the
+ * Apache License 2.0. See LICENSE file at the project root for terms.
+ */
+
+#include "hll.hpp"
+#include "HllSketch.hpp"
+#include "HllSketchFixed.hpp"
+#include "HllSketchView.hpp"
+#include "HllTestUtil.hpp"
+#include "HllUtil.hpp"
+
+#include <memory>
+#include <sstream>
+#include <string>
+#include <vector>
+
+#include <cppunit/TestFixture.h>
+#include <cppunit/extensions/HelperMacros.h>
+
+namespace datasketches {
+
+class HllSketchFixedTest : public CppUnit::TestFixture {
+
+  CPPUNIT_TEST_SUITE(HllSketchFixedTest);
+  CPPUNIT_TEST(checkMatchesSketch);
+  CPPUNIT_TEST(checkCompositeEstimate);
+  CPPUNIT_TEST(checkSerialization);
+  CPPUNIT_TEST(checkDeserialize);
+  CPPUNIT_TEST(checkUnion);
+  CPPUNIT_TEST_SUITE_END();
+
+  // the same values into a fixed sketch and an HllSketch of its configuration
+  template<int LgK, TgtHllType Type>
+  static void checkMatchesSketch(const int n) {
+    HllSketchFixed<LgK, Type> fixed;
+    std::unique_ptr<HllSketch> sk(HllSketch::newInstance(LgK, Type));
+    CPPUNIT_ASSERT(fixed.isEmpty());
+    for (int i = 0; i < n; ++i) {
+      fixed.update(i);
+      sk->update(i);
+    }
+    fixed.update(std::string("a"));
+    sk->update(std::string("a"));
+    fixed.update(-1.5);
+    sk->update(-1.5);
+    std::vector<uint64_t> batch(1000);
+    for (size_t i = 0; i < batch.size(); ++i) { batch[i] = n + i; }
+    fixed.updateBatch(batch.data(), batch.size());
+    sk->updateBatch(batch.data(), batch.size());
+    CPPUNIT_ASSERT(!fixed.isEmpty());
+
+    std::unique_ptr<HllSketch> result(fixed.getResult());
+    CPPUNIT_ASSERT_EQUAL(Type, result->getTgtHllType());
+    checkSameRegisters(sk.get(), result.get());
+    // the fixed sketch skips LIST and SET mode, so only the composite
+    // estimate, which depends on the registers alone, is the same
+    CPPUNIT_ASSERT_DOUBLES_EQUAL(sk->getCompositeEstimate(), fixed.getCompositeEstimate(), 0.0);
+    CPPUNIT_ASSERT_DOUBLES_EQUAL(sk->getEstimate(), fixed.getEstimate(), sk->getEstimate() * 0.01);
+    CPPUNIT_ASSERT_DOUBLES_EQUAL(fixed.getEstimate(), result->getEstimate(), 0.0);
+    CPPUNIT_ASSERT_DOUBLES_EQUAL(fixed.getLowerBound(2), result->getLowerBound(2), 0.0);
+    CPPUNIT_ASSERT_DOUBLES_EQUAL(fixed.getUpperBound(2), result->getUpperBound(2), 0.0);
+
+    fixed.reset();
+    CPPUNIT_ASSERT(fixed.isEmpty());
+    CPPUNIT_ASSERT_EQUAL(0.0, fixed.getEstimate());
+  }
+
+  void checkMatchesSketch() {
+    checkMatchesSketch<4, HLL_8>(1000);
+    checkMatchesSketch<5, HLL_6>(30);
+    checkMatchesSketch<8, HLL_4>(100000);
+    checkMatchesSketch<12, HLL_4>(100000);
+    checkMatchesSketch<12, HLL_6>(5000);
+    checkMatchesSketch<19, HLL_8>(300000);
+  }
+
+  // the composite estimate across the linear counting, interpolation and
+  // extrapolation ranges, against HllSketch's
+  template<int LgK>
+  static void checkCompositeEstimate() {
+    HllSketchFixed<LgK, HLL_8> fixed;
+    std::unique_ptr<HllSketch> sk(HllSketch::newInstance(LgK, HLL_8));
+    uint64_t value = 0;
+    for (int n = 100; n <= (100 << LgK); n *= 2) {
+      for (; value < (uint64_t) n; ++value) {
+        fixed.update(value);
+        sk->update(value);
+      }
+      if (static_cast<HllSketchPvt*>(sk.get())->getCurrentMode() != HLL) { continue; }
+      CPPUNIT_ASSERT_DOUBLES_EQUAL(sk->getCompositeEstimate(), fixed.getCompositeEstimate(), 0.0);
+    }
+  }
+
+  void checkCompositeEstimate() {
+    checkCompositeEstimate<4>();
+    checkCompositeEstimate<5>();
+    checkCompositeEstimate<6>();
+    checkCompositeEstimate<10>();
+  }
+
+  void checkSerialization() {
+    HllSketchFixed<10, HLL_8> fixed8;
+    HllSketchFixed<10, HLL_4> fixed4;
+    for (int i = 0; i < 10000; ++i) {
+      fixed8.update(i);
+      fixed4.update(i);
+    }
+
+    // HLL_8 images are written straight from the sketch
+    std::unique_ptr<HllSketch> result(fixed8.getResult());
+    std::stringstream expected(std::ios::in | std::ios::out | std::ios::binary);
+    std::stringstream actual(std::ios::in | std::ios::out | std::ios::binary);
+    result->serializeCompact(expected);
+    fixed8.serializeCompact(actual);
+    CPPUNIT_ASSERT(expected.str() == actual.str());
+    expected.str("");
+    actual.str("");
+    result->serializeUpdatable(expected);
+    fixed8.serializeUpdatable(actual);
+    CPPUNIT_ASSERT(expected.str() == actual.str());
+
+    std::stringstream ss(std::ios::in | std::ios::out | std::ios::binary);
+    fixed4.serializeCompact(ss);
+    const std::string bytes4 = ss.str();
+    const HllSketchView view(bytes4.data(), bytes4.size());
+    CPPUNIT_ASSERT_EQUAL(HLL_4, view.getTgtHllType());
+    CPPUNIT_ASSERT(view.isCompact());
+    std::unique_ptr<HllSketch> sk4(HllSketch::deserialize(ss));
+    CPPUNIT_ASSERT_DOUBLES_EQUAL(fixed4.getEstimate(), sk4->getEstimate(), 0.0);
+    checkSameRegisters(result.get(), sk4.get());
+  }
+
+  void checkDeserialize() {
+    const HashPolicy fast(HashPolicy::FAST_MIX, 5);
+    std::unique_ptr<HllSketch> sk(HllSketch::newInstance(11, HLL_4, nullptr, fast));
+    for (int i = 0; i < 50000; ++i) { sk->update(i); }
+    std::stringstream ss(std::ios::in | std::ios::out | std::ios::binary);
+    sk->serializeCompressed(ss);
+    const std::string bytes = ss.str();
+
+    std::unique_ptr<HllSketchFixed<11, HLL_6>> fixed(HllSketchFixed<11, HLL_6>::deserialize(ss, fast));
+    CPPUNIT_ASSERT_DOUBLES_EQUAL(sk->getEstimate(), fixed->getEstimate(), 0.0);
+    std::unique_ptr<HllSketch> result(fixed->getResult());
+    checkSameRegisters(sk.get(), result.get());
+    // and it carries on as the sketch would
+    for (int i = 50000; i < 60000; ++i) {
+      sk->update(i);
+      fixed->update(i);
+    }
+    CPPUNIT_ASSERT_DOUBLES_EQUAL(sk->getEstimate(), fixed->getEstimate(), sk->getEstimate() * 1e-12);
+
+    // coupons replay
+    std::unique_ptr<HllSketch> small(HllSketch::newInstance(11, HLL_8));
+    for (int i = 0; i < 100; ++i) { small->update(i); }
+    auto image = small->serializeCompact();
+    std::unique_ptr<HllSketchFixed<11, HLL_8>> fromSet(
+        HllSketchFixed<11, HLL_8>::deserialize(image.first.get(), image.second));
+    HllSketchFixed<11, HLL_8> direct;
+    for (int i = 0; i < 100; ++i) { direct.update(i); }
+    CPPUNIT_ASSERT_DOUBLES_EQUAL(direct.getCompositeEstimate(), fromSet->getCompositeEstimate(), 0.0);
+
+    // bytes at any offset, as when sliced out of a larger message
+    std::string shifted(" " + bytes);
+    std::unique_ptr<HllSketchFixed<11, HLL_6>> fromShifted(
+        HllSketchFixed<11, HLL_6>::deserialize(shifted.data() + 1, bytes.size(), fast));
+    std::unique_ptr<HllSketchFixed<11, HLL_6>> fromAligned(
+        HllSketchFixed<11, HLL_6>::deserialize(bytes.data(), bytes.size(), fast));
+    CPPUNIT_ASSERT_DOUBLES_EQUAL(fromAligned->getEstimate(), fromShifted->getEstimate(), 0.0);
+
+    CPPUNIT_ASSERT_THROW(HllSketchFixed<12>::deserialize(bytes.data(), bytes.size(), fast),
+                         std::invalid_argument);
+    CPPUNIT_ASSERT_THROW(HllSketchFixed<11>::deserialize(bytes.data(), bytes.size()),
+                         std::invalid_argument);
+  }
+
+  void checkUnion() {
+    std::unique_ptr<HllSketchFixed<12, HLL_4>> fixed1(new HllSketchFixed<12, HLL_4>());
+    std::unique_ptr<HllSketchFixed<12, HLL_4>> fixed2(new HllSketchFixed<12, HLL_4>());
+    std::unique_ptr<HllSketch> sk1(HllSketch::newInstance(12, HLL_8));
+    std::unique_ptr<HllSketch> sk2(HllSketch::newInstance(12, HLL_8));
+    for (int i = 0; i < 20000; ++i) {
+      fixed1->update(i);
+      sk1->update(i);
+      fixed2->update(i + 10000);
+      sk2->update(i + 10000);
+    }
+    std::unique_ptr<HllUnion> u1(HllUnion::newInstance(12));
+    std::unique_ptr<HllUnion> u2(HllUnion::newInstance(12));
+    u1->update(fixed1->getView());
+    u1->update(fixed2->getView());
+    u2->update(sk1.get());
+    u2->update(sk2.get());
+    std::unique_ptr<HllSketch> r1(u1->getResult(HLL_8));
+    std::unique_ptr<HllSketch> r2(u2->getResult(HLL_8));
+    checkSameRegisters(r1.get(), r2.get());
+    CPPUNIT_ASSERT_DOUBLES_EQUAL(r2->getEstimate(), r1->getEstimate(), 0.0);
+
+    // a union result reads back into a fixed sketch, out of order
+    auto image = r1->serializeUpdatable();
+    std::unique_ptr<HllSketchFixed<12, HLL_4>> merged(
+        HllSketchFixed<12, HLL_4>::deserialize(image.first.get(), image.second));
+    CPPUNIT_ASSERT(merged->isOutOfOrderFlag());
+    CPPUNIT_ASSERT_DOUBLES_EQUAL(r1->getEstimate(), merged->getEstimate(), 0.0);
+    CPPUNIT_ASSERT_DOUBLES_EQUAL(30000, merged->getEstimate(), 30000 * 0.05);
+  }
+
+};
+
+CPPUNIT_TEST_SUITE_REGISTRATION(HllSketchFixedTest);
+
+} /* namespace datasketches */
@@ -8,6 +8,13 @@
 #include "CouponList.hpp"
 #include "CouponHashSet.hpp"
 #include "HllArray.hpp"
+#include "HllSketchView.hpp"
+#include "HllTestUtil.hpp"
+
+#include <vector>
+#include <string>
+#include <sstream>
+#include <memory_resource>
 
 #include <cppunit/TestFixture.h>
 #include <cppunit/extensions/HelperMacros.h>
@@ -26,6 +33,13 @@ class hllSketchTest : public CppUnit::TestFixture {
   CPPUNIT_TEST(exerciseToString);
   CPPUNIT_TEST(checkEmptyCoupon);
   CPPUNIT_TEST(checkCompactFlag);
+  CPPUNIT_TEST(checkBatchUpdate);
+  CPPUNIT_TEST(checkPreHashedUpdate);
+  CPPUNIT_TEST(checkCopyOnWrite);
+  CPPUNIT_TEST(checkMemoryResource);
+  CPPUNIT_TEST(checkHashPolicy);
+  CPPUNIT_TEST(checkSeedHash);
+  CPPUNIT_TEST(checkSparseMemory);
   CPPUNIT_TEST_SUITE_END();
 
   void checkCopies() {
@@ -100,6 +114,7 @@ class hllSketchTest : public CppUnit::TestFixture {
     int n1 = 7;
     int n2 = 24;
     int n3 = 1000;
+    int n4 = 10000;
     int base = 0;
 
     HllSketch* src = HllSketch::newInstance(lgK, srcType);
@@ -124,6 +139,22 @@ class hllSketchTest : public CppUnit::TestFixture {
     CPPUNIT_ASSERT_DOUBLES_EQUAL(dst->getEstimate(), src->getEstimate(), 0.0);
     delete dst;
 
+    // raise a few registers far above the rest to force HLL_4 exceptions;
+    // registers must survive the conversion, so both sides look the same as HLL_8
+    for (int i = n3; i < n4; ++i) {
+      src->update(i + base);
+    }
+    src->couponUpdate(HllUtil::pair(3, 40));
+    src->couponUpdate(HllUtil::pair(200, 50));
+    dst = src->copyAs(dstType);
+    CPPUNIT_ASSERT_DOUBLES_EQUAL(dst->getCompositeEstimate(), src->getCompositeEstimate(), 0.0);
+    HllSketch* src8 = src->copyAs(HLL_8);
+    HllSketch* dst8 = dst->copyAs(HLL_8);
+    checkSameImage(src8, dst8);
+    delete dst8;
+    delete src8;
+    delete dst;
+
     delete src;
   }
 
@@ -320,6 +351,373 @@ class hllSketchTest : public CppUnit::TestFixture {
     return isCompact;
   }
 
+  void checkBatchUpdate() {
+    runCheckBatchUpdate(8, HLL_4);
+    runCheckBatchUpdate(8, HLL_6);
+    runCheckBatchUpdate(8, HLL_8);
+    runCheckBatchUpdate(12, HLL_4);
+    runCheckBatchUpdate(12, HLL_6);
+    runCheckBatchUpdate(12, HLL_8);
+    // register arrays big enough that batches prefetch them
+    runCheckBatchUpdate(20, HLL_4, 150000);
+    runCheckBatchUpdate(19, HLL_6, 80000);
+    runCheckBatchUpdate(18, HLL_8, 40000);
+  }
+
+  // batch updates must produce exactly the same image as single updates
+  void runCheckBatchUpdate(const int lgK, const TgtHllType type, const int n = 20000) {
+    std::vector<uint64_t> longs(n);
+    std::vector<int32_t> ints(n);
+    std::vector<double> doubles(n);
+    std::vector<std::string> strings(n);
+    for (int i = 0; i < n; ++i) {
+      longs[i] = (uint64_t) i * 2654435761ULL;
+      ints[i] = i - (n / 2);
+      doubles[i] = (i % 100 == 0) ? -0.0 : i * 0.5;
+      strings[i] = (i % 50 == 0) ? "" : std::to_string(i);
+    }
+    doubles[1] = std::nan("");
+    std::vector<std::string_view> views(strings.begin(), strings.end());
+
+    HllSketch* single = HllSketch::newInstance(lgK, type);
+    HllSketch* batch = HllSketch::newInstance(lgK, type);
+    // odd sizes so the blocks never line up with the input length
+    for (int i = 0; i < n; ++i) { single->update(longs[i]); }
+    batch->updateBatch(longs.data(), 7);
+    batch->updateBatch(longs.data() + 7, n - 7);
+    checkSameImage(single, batch);
+
+    for (int i = 0; i < n; ++i) { single->update(ints[i]); }
+    batch->updateBatch(ints.data(), n);
+    checkSameImage(single, batch);
+
+    for (int i = 0; i < n; ++i) { single->update(doubles[i]); }
+    batch->updateBatch(doubles.data(), n);
+    checkSameImage(single, batch);
+
+    for (int i = 0; i < n; ++i) { single->update(strings[i]); }
+    batch->updateBatch(views.data(), n);
+    checkSameImage(single, batch);
+
+    // a pointer and a byte count is still one datum of those bytes
+    const uint64_t x = 42;
+    const int32_t y = 43;
+    const double z = 44.5;
+    single->update((const void*) &x, sizeof(x));
+    single->update((const void*) &y, sizeof(y));
+    single->update((const void*) &z, sizeof(z));
+    batch->update(&x, sizeof(x));
+    batch->update(&y, sizeof(y));
+    batch->update(&z, sizeof(z));
+    checkSameImage(single, batch);
+
+    delete single;
+    delete batch;
+  }
+
+  void checkPreHashedUpdate() {
+    const int lgK = 10;
+    const int n = 5000;
+    HllSketch* byValue = HllSketch::newInstance(lgK, HLL_4);
+    HllSketch* byHash = HllSketch::newInstance(lgK, HLL_4);
+    HllSketch* byCoupon = HllSketch::newInstance(lgK, HLL_4);
+    std::vector<HashState> hashes(n);
+    std::vector<int> coupons(n);
+    for (int i = 0; i < n; ++i) {
+      const uint64_t key = i;
+      byValue->update(key);
+      HllSketch::hash(&key, sizeof(key), hashes[i]);
+      coupons[i] = HllSketch::coupon(hashes[i]);
+    }
+    for (int i = 0; i < n / 2; ++i) { byHash->update(hashes[i]); }
+    byHash->updateBatch(hashes.data() + (n / 2), n - (n / 2));
+    for (int i = 0; i < n / 2; ++i) { byCoupon->couponUpdate(coupons[i]); }
+    byCoupon->couponUpdate(coupons.data() + (n / 2), n - (n / 2));
+    checkSameImage(byValue, byHash);
+    checkSameImage(byValue, byCoupon);
+
+    // empty coupons are ignored, coupons with a zero value are rejected
+    byCoupon->couponUpdate(HllUtil::EMPTY);
+    CPPUNIT_ASSERT_THROW(byCoupon->couponUpdate(0x123), std::invalid_argument);
+    checkSameImage(byValue, byCoupon);
+
+    delete byValue;
+    delete byHash;
+    delete byCoupon;
+  }
+
+  void checkCopyOnWrite() {
+    runCheckCopyOnWrite(HLL_4);
+    runCheckCopyOnWrite(HLL_6);
+    runCheckCopyOnWrite(HLL_8);
+  }
+
+  void runCheckCopyOnWrite(const TgtHllType type) {
+    // lgK 8 with this many values gives HLL_4 some aux exceptions
+    const int n1 = 20000;
+    const int n2 = 40000;
+    HllSketch* sk = HllSketch::newInstance(8, type);
+    HllSketch* sk1 = HllSketch::newInstance(8, type);
+    HllSketch* sk2 = HllSketch::newInstance(8, type);
+    for (int i = 0; i < n1; ++i) { sk->update(i); sk1->update(i); sk2->update(i); }
+    for (int i = n1; i < n2; ++i) { sk2->update(i); }
+
+    // copies and copies of copies see no later writes from either side
+    HllSketch* copy = sk->copy();
+    HllSketch* copy2 = copy->copy();
+    for (int i = n1; i < n2; ++i) { sk->update(i); }
+    checkSameImage(sk2, sk);
+    checkSameImage(sk1, copy);
+    checkSameImage(sk1, copy2);
+
+    for (int i = n1; i < n2; ++i) { copy->update(i); }
+    checkSameImage(sk2, copy);
+    checkSameImage(sk1, copy2);
+
+    // the last owner may write in place after the others are gone
+    delete sk;
+    delete copy;
+    for (int i = n1; i < n2; ++i) { copy2->update(i); }
+    checkSameImage(sk2, copy2);
+
+    delete copy2;
+    delete sk1;
+    delete sk2;
+  }
+
+  void checkMemoryResource() {
+    const int lgK = 12;
+    TgtHllType types[] = { HLL_4, HLL_6, HLL_8 };
+    for (TgtHllType type : types) {
+      // only HLL_6 and HLL_8 register arrays are this big, HLL_4 ones are
+      // no bigger than the largest hash set
+      CountingResource resource(HllArray::hll6ArrBytes(lgK));
+      HllSketch* sk = HllSketch::newInstance(lgK, type, &resource);
+      for (int i = 0; i < 10000; ++i) { sk->update(i); }
+      CPPUNIT_ASSERT_EQUAL(CurMode::HLL, static_cast<HllSketchPvt*>(sk)->getCurrentMode());
+      const int numBig = (type == HLL_4) ? 0 : 1;
+      CPPUNIT_ASSERT_EQUAL(numBig, resource.numBig);
+      if (type == HLL_4) {
+        // as do the exception map and its table
+        HllArray* hllArr = (HllArray*) ((HllSketchPvt*) sk)->hllSketchImpl;
+        CPPUNIT_ASSERT(hllArr->getAuxHashMap() == nullptr);
+        const int numAllocs = resource.numAllocs;
+        sk->couponUpdate(HllUtil::pair(7, 63));
+        CPPUNIT_ASSERT(hllArr->getAuxHashMap() != nullptr);
+        CPPUNIT_ASSERT_EQUAL(numAllocs + 2, resource.numAllocs);
+      }
+
+      // the copies use it too, and reset() keeps the registers for the refill
+      HllSketch* copy = sk->copy();
+      HllSketch* other = sk->copyAs(type == HLL_4 ? HLL_8 : HLL_4);
+      CPPUNIT_ASSERT_EQUAL(numBig + ((type == HLL_4) ? 1 : 0), resource.numBig);
+      const int numBigAfterCopies = resource.numBig;
+      delete copy;
+      for (int round = 0; round < 3; ++round) {
+        sk->reset();
+        CPPUNIT_ASSERT(sk->isEmpty());
+        for (int i = 0; i < 10000; ++i) { sk->update(i + round * 10000); }
+      }
+      CPPUNIT_ASSERT_EQUAL(numBigAfterCopies, resource.numBig);
+      HllSketch* fresh = HllSketch::newInstance(lgK, type);
+      for (int i = 0; i < 10000; ++i) { fresh->update(i + 20000); }
+      checkSameImage(fresh, sk);
+
+      // a LIST is reset in place
+      sk->reset();
+      sk->update(1);
+      const int numAllocs = resource.numAllocs;
+      sk->reset();
+      CPPUNIT_ASSERT(sk->isEmpty());
+      CPPUNIT_ASSERT_EQUAL(numAllocs, resource.numAllocs);
+
+      HllSketch* restored = HllSketch::deserialize(sk->serializeUpdatable().first.get(),
+                                                   sk->getUpdatableSerializationBytes(), &resource);
+      delete restored;
+      delete fresh;
+      delete other;
+      delete sk;
+      CPPUNIT_ASSERT_EQUAL((size_t) 0, resource.bytesInUse);
+    }
+
+    // a union allocates its gadget and results from its resource as well
+    CountingResource resource(HllArray::hll8ArrBytes(lgK));
+    HllUnion* u = HllUnion::newInstance(lgK, &resource);
+    HllSketch* sk = HllSketch::newInstance(lgK);
+    for (int i = 0; i < 10000; ++i) { sk->update(i); }
+    u->update(*sk);
+    HllSketch* result = u->getResult(HLL_8);
+    CPPUNIT_ASSERT(resource.numBig >= 1);
+    delete sk;
+    delete u;
+    CPPUNIT_ASSERT(resource.bytesInUse > 0);
+    delete result;
+    CPPUNIT_ASSERT_EQUAL((size_t) 0, resource.bytesInUse);
+  }
+
+  void checkHashPolicy() {
+    const int lgK = 11;
+    const int n = 10000;
+    const HashPolicy seeded(HashPolicy::MURMUR3, 12345);
+    const HashPolicy fast(HashPolicy::FAST_MIX);
+
+    // the default policy is the Java compatible hash, and its image is untouched
+    HllSketch* dflt = HllSketch::newInstance(lgK, HLL_4);
+    HllSketch* explicitDflt = HllSketch::newInstance(lgK, HLL_4, nullptr,
+                                                     HashPolicy(HashPolicy::MURMUR3, HashPolicy::DEFAULT_SEED));
+    HllSketch* sk1 = HllSketch::newInstance(lgK, HLL_4, nullptr, seeded);
+    HllSketch* sk2 = HllSketch::newInstance(lgK, HLL_6, nullptr, fast);
+    for (int i = 0; i < n; ++i) {
+      dflt->update(i);
+      explicitDflt->update(i);
+      sk1->update(i);
+      sk2->update(i);
+    }
+    checkSameImage(dflt, explicitDflt);
+    CPPUNIT_ASSERT_EQUAL(0, static_cast<const uint8_t*>(dflt->serializeCompact().first.get())[7] >> 4);
+    CPPUNIT_ASSERT(dflt->getEstimate() != sk1->getEstimate());
+    CPPUNIT_ASSERT_DOUBLES_EQUAL(n, sk1->getEstimate(), n * 0.05);
+    CPPUNIT_ASSERT_DOUBLES_EQUAL(n, sk2->getEstimate(), n * 0.05);
+
+    // the seed and the function both change the coupons
+    HashState h1, h2, h3;
+    const uint64_t key = 42;
+    HashPolicy().hash(&key, sizeof(key), h1);
+    seeded.hash(&key, sizeof(key), h2);
+    fast.hash(&key, sizeof(key), h3);
+    CPPUNIT_ASSERT(h1.h1 != h2.h1);
+    CPPUNIT_ASSERT(h1.h1 != h3.h1);
+    CPPUNIT_ASSERT(HashPolicy(HashPolicy::FAST_MIX, 1) != fast);
+
+    // batch updates hash the same way as single ones
+    HllSketch* batch = HllSketch::newInstance(lgK, HLL_6, nullptr, fast);
+    std::vector<uint64_t> keys(n);
+    for (int i = 0; i < n; ++i) { keys[i] = i; }
+    batch->updateBatch(keys.data(), n);
+    checkSameImage(sk2, batch);
+
+    // round trips keep the policy, and other policies are refused
+    std::stringstream ss(std::ios::in | std::ios::out | std::ios::binary);
+    sk1->serializeCompact(ss);
+    CPPUNIT_ASSERT_THROW(HllSketch::deserialize(ss), std::invalid_argument);
+    ss.seekg(0);
+    HllSketch* restored1 = HllSketch::deserialize(ss, nullptr, seeded);
+    CPPUNIT_ASSERT(restored1->getHashPolicy() == seeded);
+    checkSameImage(sk1, restored1);
+
+    std::pair<ptr_with_deleter, const size_t> bytes = sk2->serializeUpdatable();
+    CPPUNIT_ASSERT_THROW(HllSketch::deserialize(bytes.first.get(), bytes.second), std::invalid_argument);
+    CPPUNIT_ASSERT_THROW(HllSketch::deserialize(bytes.first.get(), bytes.second, nullptr, seeded),
+                         std::invalid_argument);
+    CPPUNIT_ASSERT_THROW(HllSketch::writableWrap(bytes.first.get(), bytes.second), std::invalid_argument);
+    HllSketch* restored2 = HllSketch::deserialize(bytes.first.get(), bytes.second, nullptr, fast);
+    HllSketch* copy = restored2->copyAs(HLL_8);
+    CPPUNIT_ASSERT(copy->getHashPolicy() == fast);
+    restored2->update(n);
+    sk2->update(n);
+    checkSameImage(sk2, restored2);
+
+    delete copy;
+    delete restored2;
+    delete restored1;
+    delete batch;
+    delete sk2;
+    delete sk1;
+    delete explicitDflt;
+    delete dflt;
+  }
+
+  void checkSeedHash() {
+    const HashPolicy seeded(HashPolicy::MURMUR3, 12345);
+    // another seed whose tag is the same, only the seed hash tells them apart
+    uint64_t seed = 1;
+    while ((HashPolicy(HashPolicy::MURMUR3, seed).getSerialTag() != seeded.getSerialTag())
+           || (HashPolicy(HashPolicy::MURMUR3, seed).getSeedHash() == seeded.getSeedHash())) {
+      ++seed;
+    }
+    const HashPolicy collider(HashPolicy::MURMUR3, seed);
+    CPPUNIT_ASSERT_EQUAL(0, HashPolicy().getSeedHashBytes());
+    CPPUNIT_ASSERT_EQUAL((int) HashPolicy::SEED_HASH_BYTES, seeded.getSeedHashBytes());
+
+    const int counts[] = {5, 100, 2000};
+    for (const int n : counts) {
+      HllSketch* sk = HllSketch::newInstance(10, HLL_4, nullptr, seeded);
+      HllSketch* dflt = HllSketch::newInstance(10, HLL_4);
+      for (int i = 0; i < n; ++i) {
+        sk->update(i);
+        dflt->update(i);
+      }
+      CPPUNIT_ASSERT_EQUAL(dflt->getCompactSerializationBytes() + HashPolicy::SEED_HASH_BYTES,
+                           sk->getCompactSerializationBytes());
+      CPPUNIT_ASSERT_EQUAL(dflt->getUpdatableSerializationBytes() + HashPolicy::SEED_HASH_BYTES,
+                           sk->getUpdatableSerializationBytes());
+
+      std::pair<ptr_with_deleter, const size_t> bytes = sk->serializeCompact();
+      CPPUNIT_ASSERT_EQUAL((size_t) sk->getCompactSerializationBytes(), bytes.second);
+      const HllSketchView view(bytes.first.get(), bytes.second);
+      CPPUNIT_ASSERT_EQUAL((int) bytes.second, view.getSerializationBytes());
+      CPPUNIT_ASSERT(view.hasHashPolicy(seeded));
+      CPPUNIT_ASSERT(!view.hasHashPolicy(collider));
+      CPPUNIT_ASSERT_THROW(HllSketchView(bytes.first.get(), bytes.second - 1), std::invalid_argument);
+      CPPUNIT_ASSERT_THROW(HllSketch::deserialize(bytes.first.get(), bytes.second, nullptr, collider),
+                           std::invalid_argument);
+      HllUnion* u = HllUnion::newInstance(10, nullptr, collider);
+      CPPUNIT_ASSERT_THROW(u->update(view), std::invalid_argument);
+      delete u;
+
+      // the stream reader consumes the seed hash, leaving what follows
+      std::stringstream ss(std::ios::in | std::ios::out | std::ios::binary);
+      sk->serializeUpdatable(ss);
+      sk->serializeCompact(ss);
+      CPPUNIT_ASSERT_THROW(HllSketch::deserialize(ss, nullptr, collider), std::invalid_argument);
+      ss.seekg(0);
+      HllSketch* restored1 = HllSketch::deserialize(ss, nullptr, seeded);
+      HllSketch* restored2 = HllSketch::deserialize(ss, nullptr, seeded);
+      CPPUNIT_ASSERT_EQUAL((int) EOF, ss.peek());
+      checkSameImage(sk, restored1);
+      checkSameImage(sk, restored2);
+
+      delete restored2;
+      delete restored1;
+      delete dflt;
+      delete sk;
+    }
+  }
+
+  void checkSparseMemory() {
+    // below a few dozen coupons the fixed overhead outweighs the savings
+    const int numSketches = 100;
+    const int counts[] = {100, 200, 300};
+    for (const int n : counts) {
+      CountingResource regular(1 << 30);
+      CountingResource sparse(1 << 30);
+      std::vector<HllSketch*> sketches;
+      for (int s = 0; s < numSketches; ++s) {
+        HllSketch* sk1 = HllSketch::newInstance(12, HLL_4, &regular);
+        HllSketch* sk2 = HllSketch::newSparseInstance(12, HLL_4, &sparse);
+        for (int i = 0; i < n; ++i) {
+          sk1->update(s * n + i);
+          sk2->update(s * n + i);
+        }
+        CPPUNIT_ASSERT_DOUBLES_EQUAL(sk1->getEstimate(), sk2->getEstimate(), 0.0);
+        sketches.push_back(sk1);
+        sketches.push_back(sk2);
+      }
+      CPPUNIT_ASSERT(sparse.bytesInUse * 3 < regular.bytesInUse * 2);
+      for (HllSketch* sk : sketches) { delete sk; }
+      CPPUNIT_ASSERT_EQUAL((size_t) 0, sparse.bytesInUse);
+    }
+  }
+
+  void checkSameImage(const HllSketch* sk1, const HllSketch* sk2) {
+    std::stringstream ss1(std::ios::in | std::ios::out | std::ios::binary);
+    std::stringstream ss2(std::ios::in | std::ios::out | std::ios::binary);
+    sk1->serializeUpdatable(ss1);
+    sk2->serializeUpdatable(ss2);
+    CPPUNIT_ASSERT(ss1.str() == ss2.str());
+    CPPUNIT_ASSERT_DOUBLES_EQUAL(sk1->getEstimate(), sk2->getEstimate(), 0.0);
+  }
+
 };
 
 CPPUNIT_TEST_SUITE_REGISTRATION(hllSketchTest);
@@ -0,0 +1,184 @@
+/*
+ * Copyright 2018, Oath Inc. Licensed under the terms of the
+ * Apache License 2.0. See LICENSE file at the project root for terms.
+ */
+
+#include "hll.hpp"
+#include "HllSketchView.hpp"
+#include "HllUtil.hpp"
+
+#include <algorithm>
+#include <cstring>
+#include <sstream>
+#include <string>
+#include <vector>
+
+#include <cppunit/TestFixture.h>
+#include <cppunit/extensions/HelperMacros.h>
+
+namespace datasketches {
+
+class HllSketchViewTest : public CppUnit::TestFixture {
+
+  CPPUNIT_TEST_SUITE(HllSketchViewTest);
+  CPPUNIT_TEST(checkEstimates);
+  CPPUNIT_TEST(checkUnion);
+  CPPUNIT_TEST(checkInvalidInput);
+  CPPUNIT_TEST_SUITE_END();
+
+  static std::string serialize(const HllSketch* sk, const bool compact) {
+    std::stringstream ss(std::ios::in | std::ios::out | std::ios::binary);
+    if (compact) {
+      sk->serializeCompact(ss);
+    } else {
+      sk->serializeUpdatable(ss);
+    }
+    return ss.str();
+  }
+
+  void checkEstimates() {
+    // n spans LIST, SET and HLL modes at lgK = 8
+    const int nArr[] = {0, 3, 30, 300, 30000};
+    TgtHllType types[] = { HLL_4, HLL_6, HLL_8 };
+    for (TgtHllType type : types) {
+      for (int n : nArr) {
+        HllSketch* sk = HllSketch::newInstance(8, type);
+        for (int i = 0; i < n; ++i) { sk->update(i); }
+        for (int compact = 0; compact < 2; ++compact) {
+          const std::string bytes = serialize(sk, compact == 1);
+          HllSketchView view(bytes.data(), bytes.size());
+          CPPUNIT_ASSERT_EQUAL((int) bytes.size(), view.getSerializationBytes());
+          CPPUNIT_ASSERT_EQUAL(8, view.getLgConfigK());
+          CPPUNIT_ASSERT_EQUAL(type, view.getTgtHllType());
+          CPPUNIT_ASSERT_EQUAL(compact == 1, view.isCompact());
+          CPPUNIT_ASSERT_EQUAL(sk->isEmpty(), view.isEmpty());
+          CPPUNIT_ASSERT_DOUBLES_EQUAL(sk->getEstimate(), view.getEstimate(), 0.0);
+          CPPUNIT_ASSERT_DOUBLES_EQUAL(sk->getCompositeEstimate(), view.getCompositeEstimate(), 0.0);
+          CPPUNIT_ASSERT_DOUBLES_EQUAL(sk->getLowerBound(2), view.getLowerBound(2), 0.0);
+          CPPUNIT_ASSERT_DOUBLES_EQUAL(sk->getUpperBound(2), view.getUpperBound(2), 0.0);
+
+          int numValid = 0;
+          std::unique_ptr<PairIterator> itr = view.getIterator();
+          while (itr->nextValid()) { ++numValid; }
+          CPPUNIT_ASSERT((n == 0) == (numValid == 0));
+        }
+        delete sk;
+      }
+    }
+  }
+
+  void checkUnion() {
+    // a mix of modes, types and lgKs, unioned from views and from sketches
+    const int lgKs[] = {10, 12, 10, 11, 10, 10, 12};
+    const int nArr[] = {20, 100000, 5000, 300, 200000, 5, 40};
+    HllUnion* fromSketches = HllUnion::newInstance(12);
+    HllUnion* fromViews = HllUnion::newInstance(12);
+    for (int i = 0; i < 7; ++i) {
+      HllSketch* sk = HllSketch::newInstance(lgKs[i], (TgtHllType) (i % 3));
+      for (int j = 0; j < nArr[i]; ++j) { sk->update(i * 1000000 + j); }
+      // forces an HLL_4 exception
+      sk->couponUpdate(HllUtil::pair(7, 45));
+      const std::string bytes = serialize(sk, (i & 1) == 0);
+      fromSketches->update(sk);
+      fromViews->update(HllSketchView(bytes.data(), bytes.size()));
+      delete sk;
+
+      HllSketch* r1 = fromSketches->getResult(HLL_8);
+      HllSketch* r2 = fromViews->getResult(HLL_8);
+      CPPUNIT_ASSERT_DOUBLES_EQUAL(r1->getEstimate(), r2->getEstimate(), 0.0);
+      CPPUNIT_ASSERT_DOUBLES_EQUAL(r1->getLowerBound(1), r2->getLowerBound(1), 0.0);
+      // coupon order in a SET depends on insertion order, so registers only
+      const std::string image1 = serialize(r1, true);
+      if (image1[0] == HllUtil::HLL_PREINTS) {
+        CPPUNIT_ASSERT(image1 == serialize(r2, true));
+      }
+      delete r2;
+      delete r1;
+    }
+    delete fromViews;
+    delete fromSketches;
+  }
+
+  void checkInvalidInput() {
+    HllSketch* sk = HllSketch::newInstance(10, HLL_4);
+    for (int i = 0; i < 1000; ++i) { sk->update(i); }
+    std::string bytes = serialize(sk, false);
+
+    // views need aligned bytes, the byte entry points copy them if they are not
+    std::vector<uint8_t> shifted(bytes.size() + 1);
+    std::memcpy(shifted.data() + 1, bytes.data(), bytes.size());
+    CPPUNIT_ASSERT_THROW(HllSketchView(shifted.data() + 1, bytes.size()), std::invalid_argument);
+    HllSketch* fromShifted = HllSketch::deserialize(shifted.data() + 1, bytes.size());
+    CPPUNIT_ASSERT_DOUBLES_EQUAL(sk->getEstimate(), fromShifted->getEstimate(), 0.0);
+    HllUnion* u = HllUnion::newInstance(10);
+    HllUnion* expected = HllUnion::newInstance(10);
+    u->updateSerialized(shifted.data() + 1, bytes.size());
+    expected->updateSerialized(bytes.data(), bytes.size());
+    CPPUNIT_ASSERT_DOUBLES_EQUAL(expected->getEstimate(), u->getEstimate(), 0.0);
+    delete expected;
+    delete u;
+    delete fromShifted;
+    delete sk;
+
+    CPPUNIT_ASSERT_THROW(HllSketchView(bytes.data(), 7), std::invalid_argument);
+    CPPUNIT_ASSERT_THROW(HllSketchView(bytes.data(), bytes.size() - 1), std::invalid_argument);
+    checkCorruptHeader(bytes, 4, 11); // aux lgArr above lgConfigK
+    checkCorruptHeader(bytes, 4, 3);  // aux lgArr below LG_AUX_ARR_INTS[lgConfigK]
+    checkCorruptHeader(bytes, 36, -1); // aux count
+    checkCorruptHeader(bytes, 36, 1 << 30);
+    bytes[2] = 0; // family
+    CPPUNIT_ASSERT_THROW(HllSketchView(bytes.data(), bytes.size()), std::invalid_argument);
+
+    sk = HllSketch::newInstance(10, HLL_4);
+    sk->couponUpdate(HllUtil::pair(7, 45)); // an exception
+    for (int i = 0; i < 1000; ++i) { sk->update(i); }
+    checkCorruptHeader(serialize(sk, true), 36, -1);
+    checkCorruptHeader(serialize(sk, true), 36, (1 << 10) + 1);
+    delete sk;
+
+    // the header's table sizes and counts are checked before they size anything
+    sk = HllSketch::newInstance(10, HLL_8);
+    for (int i = 0; i < 3; ++i) { sk->update(i); }
+    for (int compact = 0; compact < 2; ++compact) {
+      const std::string list = serialize(sk, compact == 1);
+      checkCorruptHeader(list, 4, 30, 16); // a huge lgArr must not wrap the size
+      checkCorruptHeader(list, 4, 4);
+      checkCorruptHeader(list, 6, 9);      // more coupons than the LIST holds
+    }
+    for (int i = 3; i < 50; ++i) { sk->update(i); }
+    for (int compact = 0; compact < 2; ++compact) {
+      const std::string set = serialize(sk, compact == 1);
+      checkCorruptHeader(set, 4, 4);
+      checkCorruptHeader(set, 4, 11);
+      checkCorruptHeader(set, 8, -1);
+      checkCorruptHeader(set, 8, 1 << 30);
+    }
+    delete sk;
+  }
+
+  // value written as the byte at offset, or as the int there if it is not
+  // a byte, must be rejected by the view and everything reading through it,
+  // given the whole image or its first sizeBytes
+  static void checkCorruptHeader(const std::string& image, const int offset, const int value,
+                                 const size_t sizeBytes = 0) {
+    std::vector<int> aligned((image.size() + 3) / 4);
+    uint8_t* bytes = reinterpret_cast<uint8_t*>(aligned.data());
+    std::memcpy(bytes, image.data(), image.size());
+    if ((value >= 0) && (value < 256)) {
+      bytes[offset] = (uint8_t) value;
+    } else {
+      std::memcpy(bytes + offset, &value, sizeof(value));
+    }
+    const size_t len = (sizeBytes > 0) ? std::min(image.size(), sizeBytes) : image.size();
+    CPPUNIT_ASSERT_THROW(HllSketchView(bytes, len), std::invalid_argument);
+    CPPUNIT_ASSERT_THROW(HllSketch::deserialize(bytes, len), std::invalid_argument);
+    HllUnion* u = HllUnion::newInstance(10);
+    CPPUNIT_ASSERT_THROW(u->updateSerialized(bytes, len), std::invalid_argument);
+    delete u;
+  }
+
+};
+
+CPPUNIT_TEST_SUITE_REGISTRATION(HllSketchViewTest);
+
+} /* namespace datasketches */
@@ -0,0 +1,59 @@
+/*
+ * Copyright 2018, Yahoo! Inc. Licensed under the terms of the
+ * Apache License 2.0. See LICENSE file at the project root for terms.
+ */
+
+#ifndef _HLLTESTUTIL_H_
+#define _HLLTESTUTIL_H_
+
+#include "hll.hpp"
+#include "HllSketch.hpp"
+
+#include <memory>
+#include <memory_resource>
+
+#include <cppunit/extensions/HelperMacros.h>
+
+namespace datasketches {
+
+// counts what passes through, and how many blocks were at least bigBytes
+class CountingResource : public std::pmr::memory_resource {
+  public:
+    explicit CountingResource(const size_t bigBytes) : bigBytes(bigBytes) {}
+
+    int numAllocs = 0;
+    int numBig = 0;
+    size_t bytesInUse = 0;
+
+  private:
+    void* do_allocate(size_t bytes, size_t alignment) override {
+      ++numAllocs;
+      if (bytes >= bigBytes) { ++numBig; }
+      bytesInUse += bytes;
+      return std::pmr::new_delete_resource()->allocate(bytes, alignment);
+    }
+    void do_deallocate(void* p, size_t bytes, size_t alignment) override {
+      bytesInUse -= bytes;
+      std::pmr::new_delete_resource()->deallocate(p, bytes, alignment);
+    }
+    bool do_is_equal(const std::pmr::memory_resource& other) const noexcept override {
+      return this == &other;
+    }
+
+    const size_t bigBytes;
+};
+
+// asserts that both sketches hold the same value in every register
+inline void checkSameRegisters(const HllSketch* sk1, const HllSketch* sk2) {
+  std::unique_ptr<PairIterator> itr1 = static_cast<const HllSketchPvt*>(sk1)->getIterator();
+  std::unique_ptr<PairIterator> itr2 = static_cast<const HllSketchPvt*>(sk2)->getIterator();
+  while (itr1->nextAll()) {
+    CPPUNIT_ASSERT(itr2->nextAll());
+    CPPUNIT_ASSERT_EQUAL(itr1->getValue(), itr2->getValue());
+  }
+  CPPUNIT_ASSERT(!itr2->nextAll());
+}
+
+}
+
+#endif // _HLLTESTUTIL_H_
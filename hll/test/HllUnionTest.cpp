@@ -6,6 +6,13 @@
 #include "hll.hpp"
 #include "HllUnion.hpp"
 #include "HllUtil.hpp"
+#include "HllSketchView.hpp"
+
+#include <algorithm>
+#include <cstring>
+#include <sstream>
+#include <string>
+#include <vector>
 
 #include <cppunit/TestFixture.h>
 #include <cppunit/extensions/HelperMacros.h>
@@ -26,6 +33,14 @@ class HllUnionTest : public CppUnit::TestFixture {
   CPPUNIT_TEST(checkEmptyCoupon);
   CPPUNIT_TEST(checkConversions);
   CPPUNIT_TEST(checkMisc);
+  CPPUNIT_TEST(checkPreHashedUpdate);
+  CPPUNIT_TEST(checkHllRegisterMerge);
+  CPPUNIT_TEST(checkDownsampledMerge);
+  CPPUNIT_TEST(checkUpdateAll);
+  CPPUNIT_TEST(checkSharedResult);
+  CPPUNIT_TEST(checkCouponModeUnions);
+  CPPUNIT_TEST(checkHashPolicy);
+  CPPUNIT_TEST(checkUpdateSerialized);
   CPPUNIT_TEST_SUITE_END();
 
   int min(int a, int b) {
@@ -343,6 +358,341 @@ class HllUnionTest : public CppUnit::TestFixture {
     delete u;
   }
 
+  void checkPreHashedUpdate() {
+    const int lgK = 11;
+    const int n = 10000;
+    HllUnion* byValue = HllUnion::newInstance(lgK);
+    HllUnion* byHash = HllUnion::newInstance(lgK);
+    HllUnion* byCoupon = HllUnion::newInstance(lgK);
+    std::vector<HashState> hashes(n);
+    std::vector<int> coupons(n);
+    for (int i = 0; i < n; ++i) {
+      const std::string key = std::to_string(i);
+      byValue->update(key);
+      HllSketch::hash(key.c_str(), key.length(), hashes[i]);
+      coupons[i] = HllSketch::coupon(hashes[i]);
+    }
+    byHash->update(hashes[0]);
+    byHash->updateBatch(hashes.data() + 1, n - 1);
+    byCoupon->couponUpdate(coupons[0]);
+    byCoupon->couponUpdate(coupons.data() + 1, n - 1);
+    CPPUNIT_ASSERT_DOUBLES_EQUAL(byValue->getEstimate(), byHash->getEstimate(), 0.0);
+    CPPUNIT_ASSERT_DOUBLES_EQUAL(byValue->getEstimate(), byCoupon->getEstimate(), 0.0);
+    CPPUNIT_ASSERT_THROW(byCoupon->couponUpdate(0x123), std::invalid_argument);
+
+    delete byValue;
+    delete byHash;
+    delete byCoupon;
+  }
+
+  void checkHllRegisterMerge() {
+    // same-lgK HLL sources merge register-wise; the result must match a single
+    // sketch that saw every key
+    const int lgK = 10;
+    const int n = 200000;
+    TgtHllType types[] = { HLL_4, HLL_6, HLL_8 };
+    for (TgtHllType type : types) {
+      HllSketch* sk1 = HllSketch::newInstance(lgK, HLL_8);
+      HllSketch* sk2 = HllSketch::newInstance(lgK, type);
+      HllSketch* all = HllSketch::newInstance(lgK, HLL_8);
+      for (int i = 0; i < n; ++i) {
+        sk1->update(i);
+        sk2->update(i + n / 2);
+        all->update(i);
+        all->update(i + n / 2);
+      }
+      HllUnion* u = HllUnion::newInstance(lgK);
+      u->update(*sk1);
+      u->update(*sk2);
+      HllSketch* result = u->getResult(HLL_8);
+      CPPUNIT_ASSERT_DOUBLES_EQUAL(all->getCompositeEstimate(), result->getCompositeEstimate(), 0.0);
+      CPPUNIT_ASSERT_DOUBLES_EQUAL(result->getCompositeEstimate(), result->getEstimate(), 0.0);
+
+      delete result;
+      delete u;
+      delete all;
+      delete sk2;
+      delete sk1;
+    }
+  }
+
+  void checkDownsampledMerge() {
+    // sources of larger lgK fold onto the smallest, in either order, which
+    // must leave the registers of a single sketch of that lgK seeing every key
+    const int lgKsArr[][3] = { {16, 14, 12}, {12, 16, 14}, {10, 5, 7} };
+    TgtHllType types[] = { HLL_4, HLL_6, HLL_8 };
+    for (const int* lgKs : lgKsArr) {
+      const int minLgK = std::min(lgKs[0], std::min(lgKs[1], lgKs[2]));
+      for (int t = 0; t < 3; ++t) {
+        HllUnion* u = HllUnion::newInstance(16);
+        HllUnion* fromViews = HllUnion::newInstance(16);
+        HllSketch* all = HllSketch::newInstance(minLgK, HLL_8);
+        for (int s = 0; s < 3; ++s) {
+          HllSketch* sk = HllSketch::newInstance(lgKs[s], types[(s + t) % 3]);
+          for (int i = s * 50000; i < (s + 2) * 50000; ++i) {
+            sk->update(i);
+            all->update(i);
+          }
+          std::pair<ptr_with_deleter, const size_t> bytes
+            = (s == t) ? sk->serializeCompressed() : sk->serializeCompact();
+          u->update(sk);
+          fromViews->updateSerialized(bytes.first.get(), bytes.second);
+          delete sk;
+        }
+        CPPUNIT_ASSERT_EQUAL(minLgK, u->getLgConfigK());
+        CPPUNIT_ASSERT(sameImage(u, fromViews));
+        HllSketch* result = u->getResult(HLL_8);
+        std::unique_ptr<PairIterator> expected = static_cast<HllSketchPvt*>(all)->getIterator();
+        std::unique_ptr<PairIterator> actual = static_cast<HllSketchPvt*>(result)->getIterator();
+        while (expected->nextAll()) {
+          CPPUNIT_ASSERT(actual->nextAll());
+          CPPUNIT_ASSERT_EQUAL(expected->getValue(), actual->getValue());
+        }
+        CPPUNIT_ASSERT_DOUBLES_EQUAL(all->getCompositeEstimate(), result->getCompositeEstimate(), 0.0);
+
+        delete result;
+        delete all;
+        delete fromViews;
+        delete u;
+      }
+    }
+  }
+
+  void checkUpdateAll() {
+    // mixed types, sizes (all three modes) and lgKs, some below the union's
+    TgtHllType types[] = { HLL_4, HLL_6, HLL_8 };
+    std::vector<HllSketch*> sketches;
+    std::vector<std::string> images;
+    for (int i = 0; i < 40; ++i) {
+      const int lgK = (i == 17) ? 9 : 11 + (i % 3);
+      HllSketch* sk = HllSketch::newInstance(lgK, types[i % 3]);
+      const int n = nArr[i % 10] * (1 + i / 10);
+      for (int j = 0; j < n; ++j) { sk->update(i * 1000 + j); }
+      sketches.push_back(sk);
+      std::stringstream ss(std::ios::in | std::ios::out | std::ios::binary);
+      sk->serializeCompact(ss);
+      images.push_back(ss.str());
+    }
+    std::vector<HllSketchView> views;
+    for (const std::string& image : images) { views.emplace_back(image.data(), image.size()); }
+
+    // the sequential result, from a union that already holds some data
+    HllUnion* expected = HllUnion::newInstance(12);
+    for (int j = 0; j < 5000; ++j) { expected->update(-j); }
+    for (const HllSketch* sk : sketches) { expected->update(*sk); }
+
+    const int threadArr[] = {1, 3, 8, 64};
+    for (int numThreads : threadArr) {
+      HllUnion* u = HllUnion::newInstance(12);
+      for (int j = 0; j < 5000; ++j) { u->update(-j); }
+      u->updateAll(sketches.data(), sketches.size(), numThreads);
+      CPPUNIT_ASSERT_EQUAL(expected->getLgConfigK(), u->getLgConfigK());
+      CPPUNIT_ASSERT_DOUBLES_EQUAL(expected->getEstimate(), u->getEstimate(), 0.0);
+      delete u;
+
+      u = HllUnion::newInstance(12);
+      for (int j = 0; j < 5000; ++j) { u->update(-j); }
+      u->updateAll(views.data(), views.size(), numThreads);
+      CPPUNIT_ASSERT_EQUAL(expected->getLgConfigK(), u->getLgConfigK());
+      CPPUNIT_ASSERT_DOUBLES_EQUAL(expected->getEstimate(), u->getEstimate(), 0.0);
+      delete u;
+    }
+    CPPUNIT_ASSERT_EQUAL(9, expected->getLgConfigK());
+
+    // only small sketches: the result stays in SET mode
+    HllUnion* u = HllUnion::newInstance(12);
+    u->updateAll(sketches.data(), 4, 2);
+    HllUnion* u1 = HllUnion::newInstance(12);
+    for (int i = 0; i < 4; ++i) { u1->update(*sketches[i]); }
+    CPPUNIT_ASSERT_DOUBLES_EQUAL(u1->getEstimate(), u->getEstimate(), 0.0);
+    delete u1;
+    delete u;
+
+    delete expected;
+    for (HllSketch* sk : sketches) { delete sk; }
+  }
+
+  void checkSharedResult() {
+    HllUnion* u = HllUnion::newInstance(11);
+    for (int i = 0; i < 5000; ++i) { u->update(i); }
+
+    std::shared_ptr<const HllSketch> r4 = u->getSharedResult();
+    std::shared_ptr<const HllSketch> r6 = u->getSharedResult(HLL_6);
+    CPPUNIT_ASSERT_EQUAL(HLL_4, r4->getTgtHllType());
+    CPPUNIT_ASSERT_EQUAL(HLL_6, r6->getTgtHllType());
+    CPPUNIT_ASSERT(r4 == u->getSharedResult(HLL_4));
+    CPPUNIT_ASSERT(r6 == u->getSharedResult(HLL_6));
+    CPPUNIT_ASSERT_DOUBLES_EQUAL(u->getEstimate(), r4->getEstimate(), 0.0);
+
+    // getResult() copies from the cache and gives the same sketch as before
+    HllSketch* res = u->getResult(HLL_4);
+    CPPUNIT_ASSERT(res != r4.get());
+    CPPUNIT_ASSERT_DOUBLES_EQUAL(r4->getEstimate(), res->getEstimate(), 0.0);
+    CPPUNIT_ASSERT_EQUAL(r4->getCompactSerializationBytes(), res->getCompactSerializationBytes());
+    delete res;
+
+    // each kind of change drops the cache, old handles keep their value
+    const double before = r4->getEstimate();
+    u->update(1000000);
+    std::shared_ptr<const HllSketch> r4b = u->getSharedResult();
+    CPPUNIT_ASSERT(r4 != r4b);
+    CPPUNIT_ASSERT_DOUBLES_EQUAL(before, r4->getEstimate(), 0.0);
+    CPPUNIT_ASSERT_DOUBLES_EQUAL(u->getEstimate(), r4b->getEstimate(), 0.0);
+
+    HllSketch* sk = HllSketch::newInstance(11);
+    for (int i = 0; i < 3000; ++i) { sk->update(i + 2000000); }
+    u->update(*sk);
+    std::shared_ptr<const HllSketch> r4c = u->getSharedResult();
+    CPPUNIT_ASSERT(r4b != r4c);
+    CPPUNIT_ASSERT_DOUBLES_EQUAL(u->getEstimate(), r4c->getEstimate(), 0.0);
+
+    const HllSketch* skArr[] = { sk };
+    u->updateAll(skArr, 1, 1);
+    CPPUNIT_ASSERT(r4c != u->getSharedResult());
+
+    std::shared_ptr<const HllSketch> r8 = u->getSharedResult(HLL_8);
+    u->couponUpdate(HllUtil::pair(7, 30));
+    CPPUNIT_ASSERT(r8 != u->getSharedResult(HLL_8));
+
+    u->reset();
+    CPPUNIT_ASSERT(u->getSharedResult()->isEmpty());
+    CPPUNIT_ASSERT(!r4c->isEmpty());
+
+    delete sk;
+    delete u;
+  }
+
+  void checkCouponModeUnions() {
+    // LIST and SET unions are done in bulk; compare with direct updates
+    const int lgKs[] = {6, 12};
+    const int sizes[] = {1, 5, 7, 8, 20, 100, 300};
+    for (const int lgK : lgKs) {
+      for (const int n1 : sizes) {
+        for (const int n2 : sizes) {
+          HllUnion* u = HllUnion::newInstance(lgK);
+          HllUnionPvt* uPvt = static_cast<HllUnionPvt*>(u);
+          HllSketch* sk1 = HllSketch::newInstance(lgK);
+          HllSketch* sk2 = HllSketch::newInstance(lgK);
+          HllSketch* ref = HllSketch::newInstance(lgK, HLL_8);
+          // the second range overlaps half of the first
+          for (int i = 0; i < n1; ++i) { sk1->update(i); ref->update(i); }
+          for (int i = n1 / 2; i < (n1 / 2) + n2; ++i) { sk2->update(i); ref->update(i); }
+          u->update(sk1);
+          u->update(sk2);
+          const CurMode refMode = static_cast<HllSketchPvt*>(ref)->getCurrentMode();
+          CPPUNIT_ASSERT_EQUAL(refMode, uPvt->getCurrentMode());
+          if (refMode != CurMode::HLL) {
+            CPPUNIT_ASSERT_DOUBLES_EQUAL(ref->getEstimate(), u->getEstimate(), 0.0);
+          }
+          delete u;
+          delete sk1;
+          delete sk2;
+          delete ref;
+        }
+      }
+    }
+  }
+
+  void checkHashPolicy() {
+    const int lgK = 10;
+    const HashPolicy fast(HashPolicy::FAST_MIX, 7);
+    HllUnion* u = HllUnion::newInstance(lgK, nullptr, fast);
+    HllSketch* sk1 = HllSketch::newInstance(lgK, HLL_4, nullptr, fast);
+    HllSketch* sk2 = HllSketch::newInstance(lgK, HLL_4, nullptr, fast);
+    HllSketch* other = HllSketch::newInstance(lgK);
+    for (int i = 0; i < 3000; ++i) { sk1->update(i); other->update(i); }
+    for (int i = 2000; i < 5000; ++i) { sk2->update(i); }
+    std::pair<ptr_with_deleter, const size_t> bytes2 = sk2->serializeCompact();
+    std::pair<ptr_with_deleter, const size_t> otherBytes = other->serializeCompact();
+
+    u->update(sk1);
+    u->update(HllSketchView(bytes2.first.get(), bytes2.second));
+    CPPUNIT_ASSERT_THROW(u->update(other), std::invalid_argument);
+    CPPUNIT_ASSERT_THROW(u->update(HllSketchView(otherBytes.first.get(), otherBytes.second)),
+                         std::invalid_argument);
+    const HllSketch* sketches[] = { sk1, sk2, sk1, sk2 };
+    u->updateAll(sketches, 4, 2);
+    CPPUNIT_ASSERT_DOUBLES_EQUAL(5000, u->getEstimate(), 5000 * 0.1);
+
+    // the results and a round trip keep the policy
+    HllSketch* result = u->getResult(HLL_6);
+    CPPUNIT_ASSERT(result->getHashPolicy() == fast);
+    std::pair<ptr_with_deleter, const size_t> unionBytes = u->serializeUpdatable();
+    CPPUNIT_ASSERT_THROW(HllUnion::deserialize(unionBytes.first.get(), unionBytes.second),
+                         std::invalid_argument);
+    HllUnion* restored = HllUnion::deserialize(unionBytes.first.get(), unionBytes.second, nullptr, fast);
+    CPPUNIT_ASSERT_DOUBLES_EQUAL(u->getEstimate(), restored->getEstimate(), 0.0);
+
+    delete restored;
+    delete result;
+    delete other;
+    delete sk2;
+    delete sk1;
+    delete u;
+  }
+
+
+  static bool sameImage(const HllUnion* u1, const HllUnion* u2) {
+    std::pair<ptr_with_deleter, const size_t> bytes1 = u1->serializeUpdatable();
+    std::pair<ptr_with_deleter, const size_t> bytes2 = u2->serializeUpdatable();
+    return (bytes1.second == bytes2.second)
+        && (std::memcmp(bytes1.first.get(), bytes2.first.get(), bytes1.second) == 0);
+  }
+
+  void checkUpdateSerialized() {
+    // the gadget ends up as deserializing and updating would leave it, for
+    // every mode and type, lgKs around the union's, in each image format
+    const int lgKs[] = {11, 12, 10, 12};
+    const int counts[] = {0, 7, 300, 5000, 100000};
+    const TgtHllType types[] = {HLL_4, HLL_6, HLL_8};
+    HllUnion* reference = HllUnion::newInstance(12);
+    HllUnion* fromBytes = HllUnion::newInstance(12);
+    HllUnion* fromStream = HllUnion::newInstance(12);
+    std::stringstream images(std::ios::in | std::ios::out | std::ios::binary);
+    int i = 0;
+    for (const int lgK : lgKs) {
+      for (const int n : counts) {
+        for (const TgtHllType type : types) {
+          HllSketch* sk = HllSketch::newInstance(lgK, type);
+          for (int j = 0; j < n; ++j) { sk->update((i << 20) + j); }
+          std::pair<ptr_with_deleter, const size_t> bytes
+            = (i % 3 == 0) ? sk->serializeCompact()
+            : (i % 3 == 1) ? sk->serializeUpdatable() : sk->serializeCompressed();
+          images.write(static_cast<const char*>(bytes.first.get()), bytes.second);
+
+          HllSketch* copy = HllSketch::deserialize(bytes.first.get(), bytes.second);
+          reference->update(copy);
+          fromBytes->updateSerialized(bytes.first.get(), bytes.second);
+          CPPUNIT_ASSERT(sameImage(reference, fromBytes));
+          delete copy;
+          delete sk;
+          ++i;
+        }
+      }
+    }
+    while (images.peek() != EOF) { fromStream->updateSerialized(images); }
+    CPPUNIT_ASSERT_EQUAL(10, fromStream->getLgConfigK());
+    CPPUNIT_ASSERT(sameImage(reference, fromStream));
+
+    // truncated images
+    HllSketch* sk = HllSketch::newInstance(10);
+    for (int j = 0; j < 20000; ++j) { sk->update(j); }
+    std::stringstream ss(std::ios::in | std::ios::out | std::ios::binary);
+    sk->serializeCompressed(ss);
+    const std::string image = ss.str();
+    CPPUNIT_ASSERT_THROW(fromBytes->updateSerialized(image.data(), image.size() - 1),
+                         std::invalid_argument);
+    for (const size_t len : {(size_t) 5, (size_t) 42, image.size() - 1}) {
+      std::stringstream truncated(image.substr(0, len), std::ios::in | std::ios::binary);
+      CPPUNIT_ASSERT_THROW(fromStream->updateSerialized(truncated), std::invalid_argument);
+    }
+    delete sk;
+
+    delete fromStream;
+    delete fromBytes;
+    delete reference;
+  }
+
 };
 
 CPPUNIT_TEST_SUITE_REGISTRATION(HllUnionTest);
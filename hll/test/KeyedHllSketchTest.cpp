@@ -0,0 +1,246 @@
+/*
+ * Copyright 2018, Yahoo! Inc. Licensed under the terms of the
+ * Apache License 2.0. See LICENSE file at the project root for terms.
+ */
+
+#include "hll.hpp"
+#include "HllSketch.hpp"
+#include "HllSketchView.hpp"
+#include "HllTestUtil.hpp"
+#include "HllUtil.hpp"
+
+#include <map>
+#include <memory>
+#include <sstream>
+#include <string>
+#include <vector>
+
+#include <cppunit/TestFixture.h>
+#include <cppunit/extensions/HelperMacros.h>
+
+namespace datasketches {
+
+class KeyedHllSketchTest : public CppUnit::TestFixture {
+
+  CPPUNIT_TEST_SUITE(KeyedHllSketchTest);
+  CPPUNIT_TEST(checkMatchesSketches);
+  CPPUNIT_TEST(checkBatchUpdate);
+  CPPUNIT_TEST(checkResults);
+  CPPUNIT_TEST(checkSerialization);
+  CPPUNIT_TEST(checkResetAndMemory);
+  CPPUNIT_TEST(checkMidSizeMemory);
+  CPPUNIT_TEST_SUITE_END();
+
+  // key k counts the values below n(k), so the keys cover every mode
+  static int numValues(const uint64_t key) {
+    const int nArr[] = {1, 7, 8, 16, 17, 100, 1000, 20000};
+    return nArr[key % 8];
+  }
+
+  void checkMatchesSketches() {
+    const int lgKs[] = {6, 11};
+    for (const int lgK : lgKs) {
+      KeyedHllSketch* keyed = KeyedHllSketch::newInstance(lgK);
+      std::map<uint64_t, HllSketch*> sketches;
+      for (uint64_t key = 0; key < 40; ++key) {
+        sketches[key] = HllSketch::newInstance(lgK, HLL_8);
+      }
+      // interleaved, as a group-by sees them
+      for (int i = 0; i < 20000; ++i) {
+        for (uint64_t key = 0; key < 40; ++key) {
+          if (i >= numValues(key)) { continue; }
+          keyed->update(key, (uint64_t) i);
+          sketches[key]->update((uint64_t) i);
+        }
+      }
+      CPPUNIT_ASSERT_EQUAL((size_t) 40, keyed->getNumKeys());
+      for (auto& keyAndSketch : sketches) {
+        const uint64_t key = keyAndSketch.first;
+        HllSketch* sk = keyAndSketch.second;
+        const double estimate = keyed->getEstimate(key);
+        if ((lgK < 8) || (numValues(key) <= 16)) {
+          CPPUNIT_ASSERT_DOUBLES_EQUAL(sk->getEstimate(), estimate, 0.0);
+          CPPUNIT_ASSERT_DOUBLES_EQUAL(sk->getLowerBound(2), keyed->getLowerBound(key, 2), 0.0);
+          CPPUNIT_ASSERT_DOUBLES_EQUAL(sk->getUpperBound(2), keyed->getUpperBound(key, 2), 0.0);
+        } else {
+          // past 16 values HllSketch may still be in SET mode, with its
+          // near-exact estimate, where the keyed sketch uses HLL registers
+          CPPUNIT_ASSERT_DOUBLES_EQUAL(sk->getEstimate(), estimate, sk->getEstimate() * 0.03);
+          CPPUNIT_ASSERT(keyed->getLowerBound(key, 2) <= estimate);
+          CPPUNIT_ASSERT(keyed->getUpperBound(key, 2) >= estimate);
+        }
+        delete sk;
+      }
+      CPPUNIT_ASSERT_EQUAL(0.0, keyed->getEstimate(12345));
+      delete keyed;
+    }
+  }
+
+  void checkBatchUpdate() {
+    // keys repeat within and across batches, as do values
+    const size_t n = 100000;
+    std::vector<uint64_t> keys(n);
+    std::vector<uint64_t> values(n);
+    for (size_t i = 0; i < n; ++i) {
+      keys[i] = (i * 7919) % 1000;
+      values[i] = i % 30000;
+    }
+    KeyedHllSketch* batched = KeyedHllSketch::newInstance(10);
+    KeyedHllSketch* single = KeyedHllSketch::newInstance(10);
+    batched->update(keys.data(), values.data(), n);
+    for (size_t i = 0; i < n; ++i) { single->update(keys[i], values[i]); }
+    CPPUNIT_ASSERT_EQUAL((size_t) 1000, batched->getNumKeys());
+    size_t numKeys = 0;
+    batched->forEach([single, &numKeys](const uint64_t key, const double estimate) {
+      CPPUNIT_ASSERT_DOUBLES_EQUAL(single->getEstimate(key), estimate, 0.0);
+      ++numKeys;
+    });
+    CPPUNIT_ASSERT_EQUAL((size_t) 1000, numKeys);
+    delete single;
+    delete batched;
+  }
+
+  void checkResults() {
+    KeyedHllSketch* keyed = KeyedHllSketch::newInstance(12);
+    for (int i = 0; i < 10000; ++i) {
+      keyed->update(1, (uint64_t) i);
+      keyed->update(2, std::to_string(i));
+      if (i < 5) { keyed->update(3, (uint64_t) i); }
+    }
+    HllSketch* sk = HllSketch::newInstance(12, HLL_8);
+    for (int i = 0; i < 10000; ++i) { sk->update((uint64_t) i); }
+
+    const TgtHllType types[] = {HLL_4, HLL_6, HLL_8};
+    for (const TgtHllType type : types) {
+      HllSketch* result = keyed->getResult(1, type);
+      CPPUNIT_ASSERT_EQUAL(type, result->getTgtHllType());
+      CPPUNIT_ASSERT_DOUBLES_EQUAL(keyed->getEstimate(1), result->getEstimate(), 0.0);
+      checkSameRegisters(sk, result);
+      delete result;
+    }
+    HllSketch* small = keyed->getResult(3);
+    CPPUNIT_ASSERT_DOUBLES_EQUAL(keyed->getEstimate(3), small->getEstimate(), 0.0);
+    CPPUNIT_ASSERT_DOUBLES_EQUAL(5.0, small->getEstimate(), 0.001);
+    HllSketch* none = keyed->getResult(4, HLL_4);
+    CPPUNIT_ASSERT(none->isEmpty());
+
+    // results union like any sketch
+    HllUnion* u = HllUnion::newInstance(12);
+    HllSketch* r1 = keyed->getResult(1);
+    HllSketch* r2 = keyed->getResult(2);
+    u->update(r1);
+    u->update(r2);
+    CPPUNIT_ASSERT_DOUBLES_EQUAL(20000, u->getEstimate(), 20000 * 0.05);
+
+    delete r2;
+    delete r1;
+    delete u;
+    delete none;
+    delete small;
+    delete sk;
+    delete keyed;
+  }
+
+  void checkSerialization() {
+    const HashPolicy fast(HashPolicy::FAST_MIX, 3);
+    KeyedHllSketch* keyed = KeyedHllSketch::newInstance(8, nullptr, fast);
+    for (uint64_t key = 0; key < 64; ++key) {
+      for (int i = 0; i < numValues(key); ++i) { keyed->update(key * 1000003, (uint64_t) i); }
+    }
+    std::stringstream ss(std::ios::in | std::ios::out | std::ios::binary);
+    keyed->serialize(ss);
+    const std::string bytes = ss.str();
+
+    KeyedHllSketch* restored = KeyedHllSketch::deserialize(ss, nullptr, fast);
+    CPPUNIT_ASSERT_EQUAL(keyed->getNumKeys(), restored->getNumKeys());
+    restored->forEach([keyed](const uint64_t key, const double estimate) {
+      CPPUNIT_ASSERT_DOUBLES_EQUAL(keyed->getEstimate(key), estimate, 0.0);
+    });
+    std::stringstream again(std::ios::in | std::ios::out | std::ios::binary);
+    restored->serialize(again);
+    CPPUNIT_ASSERT_EQUAL(bytes.size(), again.str().size());
+
+    // the images after each key are ordinary sketches
+    std::stringstream in(bytes, std::ios::in | std::ios::binary);
+    in.seekg(16);
+    std::vector<uint8_t> buffer;
+    HllUnion* u = HllUnion::newInstance(8, nullptr, fast);
+    for (size_t i = 0; i < keyed->getNumKeys(); ++i) {
+      uint64_t key;
+      in.read((char*) &key, sizeof(key));
+      const int sizeBytes = HllSketchView::read(in, buffer);
+      const HllSketchView view(buffer.data(), sizeBytes);
+      CPPUNIT_ASSERT_DOUBLES_EQUAL(keyed->getEstimate(key), view.getEstimate(), 0.0);
+      u->update(view);
+    }
+    CPPUNIT_ASSERT_DOUBLES_EQUAL(20000, u->getEstimate(), 20000 * 0.1);
+
+    std::stringstream otherPolicy(bytes, std::ios::in | std::ios::binary);
+    CPPUNIT_ASSERT_THROW(KeyedHllSketch::deserialize(otherPolicy), std::invalid_argument);
+    std::stringstream truncated(bytes.substr(0, bytes.size() - 100), std::ios::in | std::ios::binary);
+    CPPUNIT_ASSERT_THROW(KeyedHllSketch::deserialize(truncated, nullptr, fast), std::invalid_argument);
+
+    delete u;
+    delete restored;
+    delete keyed;
+  }
+
+  void checkResetAndMemory() {
+    KeyedHllSketch* keyed = KeyedHllSketch::newInstance(10);
+    for (uint64_t key = 0; key < 100000; ++key) { keyed->update(key, key); }
+    // a 16-byte index slot and a 64-byte coupon block per key, not a sketch
+    const size_t smallBytes = keyed->getMemoryBytes();
+    CPPUNIT_ASSERT(smallBytes < 100000 * 128);
+    for (int i = 0; i < 1000; ++i) { keyed->update(7, (uint64_t) i); }
+    CPPUNIT_ASSERT(keyed->getMemoryBytes() > smallBytes);
+
+    const size_t bytes = keyed->getMemoryBytes();
+    keyed->reset();
+    CPPUNIT_ASSERT_EQUAL((size_t) 0, keyed->getNumKeys());
+    CPPUNIT_ASSERT_EQUAL(0.0, keyed->getEstimate(7));
+    for (uint64_t key = 0; key < 100000; ++key) { keyed->update(key, key); }
+    CPPUNIT_ASSERT_EQUAL(bytes, keyed->getMemoryBytes());
+    CPPUNIT_ASSERT_DOUBLES_EQUAL(1.0, keyed->getEstimate(99999), 0.0);
+    delete keyed;
+  }
+
+  void checkMidSizeMemory() {
+    // keys past a coupon block but far from HLL mode take no more than the
+    // heap sketches of an HllSketch each, where a register block is 4KB
+    const int lgK = 12;
+    const int numKeys = 100000;
+    const int numValues = 20;
+    CountingResource resource(1 << 30);
+    std::vector<HllSketch*> sketches;
+    for (int key = 0; key < 1000; ++key) {
+      sketches.push_back(HllSketch::newInstance(lgK, HLL_4, &resource));
+      for (int i = 0; i < numValues; ++i) { sketches.back()->update((uint64_t) key * numValues + i); }
+    }
+    const size_t sketchBytes = resource.bytesInUse / sketches.size();
+    for (HllSketch* sketch : sketches) { delete sketch; }
+
+    KeyedHllSketch* keyed = KeyedHllSketch::newInstance(lgK);
+    for (int key = 0; key < numKeys; ++key) {
+      for (int i = 0; i < numValues; ++i) { keyed->update(key, (uint64_t) key * numValues + i); }
+    }
+    CPPUNIT_ASSERT(keyed->getMemoryBytes() < numKeys * sketchBytes);
+    std::unique_ptr<HllSketch> result(keyed->getResult(numKeys - 1));
+    CPPUNIT_ASSERT_EQUAL(numValues, (int) result->getEstimate());
+
+    // past the largest table a key goes to HLL mode with the sketch
+    std::unique_ptr<HllSketch> ref(HllSketch::newInstance(lgK, HLL_8));
+    for (int i = 0; i < 2000; ++i) {
+      keyed->update(numKeys, (uint64_t) i);
+      ref->update((uint64_t) i);
+      CPPUNIT_ASSERT_DOUBLES_EQUAL(ref->getEstimate(), keyed->getEstimate(numKeys), 0.0);
+    }
+    result.reset(keyed->getResult(numKeys));
+    checkSameRegisters(ref.get(), result.get());
+    delete keyed;
+  }
+
+};
+
+CPPUNIT_TEST_SUITE_REGISTRATION(KeyedHllSketchTest);
+
+} /* namespace datasketches */
@@ -7,6 +7,11 @@
 #include "CouponList.hpp"
 #include "CouponHashSet.hpp"
 #include "HllArray.hpp"
+#include "HllUtil.hpp"
+
+#include <algorithm>
+#include <sstream>
+#include <vector>
 
 #include <cppunit/TestFixture.h>
 #include <cppunit/extensions/HelperMacros.h>
@@ -21,6 +26,9 @@ class ToFromByteArray : public CppUnit::TestFixture {
   CPPUNIT_TEST_SUITE(ToFromByteArray);
   CPPUNIT_TEST(deserializeFromJava);
   CPPUNIT_TEST(toFromSketch);
+  CPPUNIT_TEST(toFromBytes);
+  CPPUNIT_TEST(toFromUnionBytes);
+  CPPUNIT_TEST(checkBufferTooSmall);
   CPPUNIT_TEST_SUITE_END();
 
   void deserializeFromJava() {
@@ -158,6 +166,110 @@ class ToFromByteArray : public CppUnit::TestFixture {
       }
     }
   }
+
+  void toFromBytes(const int lgConfigK, const TgtHllType tgtHllType, const int n) {
+    HllSketch* src = HllSketch::newInstance(lgConfigK, tgtHllType);
+    for (int i = 0; i < n; ++i) {
+      src->update(i);
+    }
+    if (tgtHllType == HLL_4 && n > 1000) {
+      src->couponUpdate(HllUtil::pair(3, 40)); // force an exception into the aux map
+    }
+
+    for (int compact = 0; compact < 2; ++compact) {
+      std::stringstream ss(std::ios::in | std::ios::out | std::ios::binary);
+      if (compact) { src->serializeCompact(ss); } else { src->serializeUpdatable(ss); }
+      const std::string streamImage = ss.str();
+
+      // leading header space is left untouched for the caller
+      const unsigned header = 5;
+      auto bytes = compact ? src->serializeCompact(header) : src->serializeUpdatable(header);
+      CPPUNIT_ASSERT_EQUAL(streamImage.size() + header, bytes.second);
+      const uint8_t* image = static_cast<const uint8_t*>(bytes.first.get()) + header;
+      CPPUNIT_ASSERT(std::equal(streamImage.begin(), streamImage.end(), (const char*)image));
+
+      std::vector<uint8_t> buffer(bytes.second + 16);
+      const size_t written = compact ? src->serializeCompact(buffer.data(), buffer.size())
+                                     : src->serializeUpdatable(buffer.data(), buffer.size());
+      CPPUNIT_ASSERT_EQUAL(streamImage.size(), written);
+      CPPUNIT_ASSERT(std::equal(streamImage.begin(), streamImage.end(), (const char*)buffer.data()));
+
+      HllSketch* dst = HllSketch::deserialize(image, bytes.second - header);
+      CPPUNIT_ASSERT_DOUBLES_EQUAL(src->getEstimate(), dst->getEstimate(), 0.0);
+      CPPUNIT_ASSERT_DOUBLES_EQUAL(src->getLowerBound(1), dst->getLowerBound(1), 0.0);
+      CPPUNIT_ASSERT_EQUAL(src->getTgtHllType(), dst->getTgtHllType());
+      CPPUNIT_ASSERT_EQUAL(src->isEmpty(), dst->isEmpty());
+
+      // same result as the stream path, down to the bytes
+      HllSketch* fromStream = HllSketch::deserialize(ss);
+      std::stringstream ss1(std::ios::in | std::ios::out | std::ios::binary);
+      std::stringstream ss2(std::ios::in | std::ios::out | std::ios::binary);
+      dst->serializeUpdatable(ss1);
+      fromStream->serializeUpdatable(ss2);
+      CPPUNIT_ASSERT(ss1.str() == ss2.str());
+      delete fromStream;
+      delete dst;
+    }
+
+    delete src;
+  }
+
+  void toFromBytes() {
+    for (int i = 0; i < 10; ++i) {
+      int n = nArr[i];
+      for (int lgK = 4; lgK <= 13; ++lgK) {
+        toFromBytes(lgK, HLL_4, n);
+        toFromBytes(lgK, HLL_6, n);
+        toFromBytes(lgK, HLL_8, n);
+      }
+    }
+
+    HllSketch* empty = HllSketch::newInstance(8);
+    auto bytes = empty->serializeCompact();
+    HllSketch* dst = HllSketch::deserialize(bytes.first.get(), bytes.second);
+    CPPUNIT_ASSERT(dst->isEmpty());
+    delete dst;
+    delete empty;
+  }
+
+  void toFromUnionBytes() {
+    const int ns[] = {0, 5, 100, 10000};
+    for (int n : ns) {
+      HllUnion* u = HllUnion::newInstance(10);
+      for (int i = 0; i < n; ++i) {
+        u->update(i);
+      }
+      auto bytes = u->serializeUpdatable();
+      HllUnion* u2 = HllUnion::deserialize(bytes.first.get(), bytes.second);
+      CPPUNIT_ASSERT_DOUBLES_EQUAL(u->getEstimate(), u2->getEstimate(), 0.0);
+      CPPUNIT_ASSERT_EQUAL(u->getLgConfigK(), u2->getLgConfigK());
+      delete u2;
+
+      // a non-HLL_8 image is merged into a fresh union
+      HllSketch* sk = u->getResult(HLL_4);
+      auto skBytes = sk->serializeCompact();
+      u2 = HllUnion::deserialize(skBytes.first.get(), skBytes.second);
+      CPPUNIT_ASSERT_DOUBLES_EQUAL(u->getEstimate(), u2->getEstimate(), u->getEstimate() * 1e-12);
+      CPPUNIT_ASSERT_EQUAL(HLL_8, u2->getTgtHllType());
+      delete u2;
+      delete sk;
+      delete u;
+    }
+  }
+
+  void checkBufferTooSmall() {
+    HllSketch* sk = HllSketch::newInstance(8, HLL_6);
+    for (int i = 0; i < 1000; ++i) {
+      sk->update(i);
+    }
+    std::vector<uint8_t> buffer(sk->getCompactSerializationBytes() - 1);
+    CPPUNIT_ASSERT_THROW(sk->serializeCompact(buffer.data(), buffer.size()), std::invalid_argument);
+
+    buffer.resize(sk->getCompactSerializationBytes());
+    sk->serializeCompact(buffer.data(), buffer.size());
+    CPPUNIT_ASSERT_THROW(HllSketch::deserialize(buffer.data(), buffer.size() - 1), std::invalid_argument);
+    delete sk;
+  }
 };
 
 CPPUNIT_TEST_SUITE_REGISTRATION(ToFromByteArray);
@@ -0,0 +1,152 @@
+/*
+ * Copyright 2018, Oath Inc. Licensed under the terms of the
+ * Apache License 2.0. See LICENSE file at the project root for terms.
+ */
+
+#include "hll.hpp"
+#include "HllUtil.hpp"
+
+#include <cstdlib>
+#include <cstring>
+#include <sstream>
+#include <string>
+
+#include <cppunit/TestFixture.h>
+#include <cppunit/extensions/HelperMacros.h>
+
+namespace datasketches {
+
+class WrappedHllSketchTest : public CppUnit::TestFixture {
+
+  CPPUNIT_TEST_SUITE(WrappedHllSketchTest);
+  CPPUNIT_TEST(checkInPlaceUpdates);
+  CPPUNIT_TEST(checkRewrap);
+  CPPUNIT_TEST(checkNoReallocate);
+  CPPUNIT_TEST(checkInvalidWrap);
+  CPPUNIT_TEST_SUITE_END();
+
+  // a malloc'd updatable image of an empty sketch, sized for LIST mode only
+  static void* newImage(const int lgK, const TgtHllType type, size_t& capBytes) {
+    HllSketch* sk = HllSketch::newInstance(lgK, type);
+    capBytes = sk->getUpdatableSerializationBytes();
+    void* mem = std::malloc(capBytes);
+    sk->serializeUpdatable(mem, capBytes);
+    delete sk;
+    return mem;
+  }
+
+  static void checkImage(const HllSketch* heap, const HllSketch* wrapped) {
+    std::stringstream ss(std::ios::in | std::ios::out | std::ios::binary);
+    heap->serializeUpdatable(ss);
+    const std::string image = ss.str();
+    CPPUNIT_ASSERT_EQUAL((int) image.size(), wrapped->getUpdatableSerializationBytes());
+    CPPUNIT_ASSERT(std::memcmp(image.data(), wrapped->getMemory(), image.size()) == 0);
+  }
+
+  void checkInPlaceUpdates() {
+    const int nArr[] = {0, 5, 100, 1000, 20000};
+    TgtHllType types[] = { HLL_4, HLL_6, HLL_8 };
+    for (TgtHllType type : types) {
+      for (int n : nArr) {
+        size_t capBytes;
+        void* mem = newImage(10, type, capBytes);
+        HllSketch* wrapped = HllSketch::writableWrap(mem, capBytes, &std::realloc);
+        HllSketch* heap = HllSketch::newInstance(10, type);
+        for (int i = 0; i < n; ++i) {
+          wrapped->update(i);
+          heap->update(i);
+        }
+        if (n > 1000) {
+          // enough HLL_4 exceptions to grow the aux table past its default size
+          for (int slot = 0; slot < 40; ++slot) {
+            wrapped->couponUpdate(HllUtil::pair(slot, 30));
+            heap->couponUpdate(HllUtil::pair(slot, 30));
+          }
+        }
+        CPPUNIT_ASSERT_DOUBLES_EQUAL(heap->getEstimate(), wrapped->getEstimate(), 0.0);
+        checkImage(heap, wrapped);
+
+        // the memory alone is a valid image
+        HllSketch* sk = HllSketch::deserialize(wrapped->getMemory(), wrapped->getUpdatableSerializationBytes());
+        CPPUNIT_ASSERT_DOUBLES_EQUAL(heap->getEstimate(), sk->getEstimate(), 0.0);
+        delete sk;
+
+        wrapped->reset();
+        CPPUNIT_ASSERT(wrapped->isEmpty());
+        heap->reset();
+        checkImage(heap, wrapped);
+
+        std::free(wrapped->getMemory());
+        delete wrapped;
+        delete heap;
+      }
+    }
+  }
+
+  void checkRewrap() {
+    size_t capBytes;
+    void* mem = newImage(12, HLL_4, capBytes);
+    HllSketch* wrapped = HllSketch::writableWrap(mem, capBytes, &std::realloc);
+    HllSketch* heap = HllSketch::newInstance(12, HLL_4);
+    for (int i = 0; i < 5000; ++i) {
+      wrapped->update(i);
+      heap->update(i);
+    }
+    mem = wrapped->getMemory();
+    capBytes = wrapped->getUpdatableSerializationBytes();
+    delete wrapped;
+
+    // pick up where the previous sketch left off
+    wrapped = HllSketch::writableWrap(mem, capBytes, &std::realloc);
+    CPPUNIT_ASSERT_DOUBLES_EQUAL(heap->getEstimate(), wrapped->getEstimate(), 0.0);
+    for (int i = 5000; i < 10000; ++i) {
+      wrapped->update(i);
+      heap->update(i);
+    }
+    CPPUNIT_ASSERT_DOUBLES_EQUAL(heap->getEstimate(), wrapped->getEstimate(), 0.0);
+    checkImage(heap, wrapped);
+
+    // copies live on the heap
+    HllSketch* copy = wrapped->copy();
+    CPPUNIT_ASSERT(copy->getMemory() == nullptr);
+    copy->update(-1);
+    CPPUNIT_ASSERT_DOUBLES_EQUAL(heap->getEstimate(), wrapped->getEstimate(), 0.0);
+    delete copy;
+
+    std::free(wrapped->getMemory());
+    delete wrapped;
+    delete heap;
+  }
+
+  void checkNoReallocate() {
+    size_t capBytes;
+    void* mem = newImage(8, HLL_8, capBytes);
+    HllSketch* wrapped = HllSketch::writableWrap(mem, capBytes);
+    for (int i = 0; i < 7; ++i) {
+      wrapped->update(i); // stays in LIST mode
+    }
+    CPPUNIT_ASSERT(wrapped->getMemory() == mem);
+    CPPUNIT_ASSERT_THROW(
+      for (int i = 7; i < 100; ++i) { wrapped->update(i); },
+      std::invalid_argument);
+    delete wrapped;
+    std::free(mem);
+  }
+
+  void checkInvalidWrap() {
+    HllSketch* sk = HllSketch::newInstance(8, HLL_6);
+    for (int i = 0; i < 1000; ++i) { sk->update(i); }
+    auto compact = sk->serializeCompact();
+    CPPUNIT_ASSERT_THROW(HllSketch::writableWrap(compact.first.get(), compact.second), std::invalid_argument);
+
+    auto updatable = sk->serializeUpdatable(1);
+    CPPUNIT_ASSERT_THROW(HllSketch::writableWrap(static_cast<uint8_t*>(updatable.first.get()) + 1, updatable.second - 1),
+                         std::invalid_argument);
+    delete sk;
+  }
+
+};
+
+CPPUNIT_TEST_SUITE_REGISTRATION(WrappedHllSketchTest);
+
+} /* namespace datasketches */